@@ -147,6 +147,26 @@ ASMCALL uint32_t rcr4() {
     return cr4;
 }
 
+ASMCALL void ltr(uint16_t selector) {
+    asm volatile("ltr %0"
+                 :
+                 : "r"(selector));
+}
+
+ASMCALL uint16_t rtr() {
+    uint16_t selector;
+    asm volatile("str %0"
+                 : "=r"(selector));
+    return selector;
+}
+
+ASMCALL void invlpg(uint32_t laddr) {
+    asm volatile("invlpg (%0)"
+                 :
+                 : "r"(laddr)
+                 : "memory");
+}
+
 ASMCALL void tlbflush() {
     asm volatile("mov %cr3, %eax\n"
                  "mov %eax, %cr3\n");
@@ -214,4 +234,8 @@ ASMCALL void halt() {
     asm volatile("hlt");
 }
 
+ASMCALL void cpu_relax() {
+    asm volatile("pause" ::: "memory");
+}
+
 #undef ASMCALL
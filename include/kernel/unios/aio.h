@@ -0,0 +1,15 @@
+#pragma once
+
+#include <sys/aio.h>
+
+#define NR_AIO 64 //<! async io in flight in the whole system
+
+void init_aio();
+
+/*!
+ * \brief forget the async io of the gone pid, their slots are reclaimed once
+ * the io is done
+ *
+ * \attention called with interrupts disabled
+ */
+void aio_orphan(int pid);
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <unios/layout.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+//! NOTE: ref Intel SDM Vol.3A Chapter 10 Advanced Programmable Interrupt
+//! Controller (APIC)
+
+#define LAPIC_DEFAULT_PHY 0xfee00000u
+//! where the local apic registers are mapped in every page table
+#define LAPIC_LIN_BASE 0xfee00000u
+
+//! local apic registers, offset from the base
+#define LAPIC_ID    0x020 //<! local apic id
+#define LAPIC_VER   0x030 //<! version
+#define LAPIC_TPR   0x080 //<! task priority
+#define LAPIC_EOI   0x0b0 //<! end of interrupt
+#define LAPIC_SVR   0x0f0 //<! spurious interrupt vector
+#define LAPIC_ESR   0x280 //<! error status
+#define LAPIC_ICRLO 0x300 //<! interrupt command, bits 0-31
+#define LAPIC_ICRHI 0x310 //<! interrupt command, bits 32-63
+#define LAPIC_TIMER 0x320 //<! lvt timer
+#define LAPIC_LINT0 0x350 //<! lvt local interrupt 0
+#define LAPIC_LINT1 0x360 //<! lvt local interrupt 1
+#define LAPIC_ERROR 0x370 //<! lvt error
+#define LAPIC_TICR  0x380 //<! timer initial count
+#define LAPIC_TCCR  0x390 //<! timer current count
+#define LAPIC_TDCR  0x3e0 //<! timer divide configuration
+
+#define LAPIC_SVR_ENABLE      0x00000100 //<! apic software enable
+#define LAPIC_SPURIOUS_VECTOR 0xff
+#define LAPIC_LVT_MASKED      0x00010000
+#define LAPIC_LVT_NMI         0x00000400 //<! delivery mode
+#define LAPIC_LVT_EXTINT      0x00000700 //<! delivery mode
+#define LAPIC_TIMER_PERIODIC  0x00020000
+#define LAPIC_TDCR_X16        0x00000003 //<! divide the bus clock by 16
+
+//! fields of interrupt command
+#define ICR_FIXED    0x00000000 //<! delivery mode
+#define ICR_INIT     0x00000500 //<! delivery mode
+#define ICR_STARTUP  0x00000600 //<! delivery mode
+#define ICR_DELIVS   0x00001000 //<! delivery status, 1 if pending
+#define ICR_ASSERT   0x00004000 //<! level
+#define ICR_DEASSERT 0x00000000 //<! level
+#define ICR_LEVEL    0x00008000 //<! trigger mode
+
+/*!
+ * \brief record the phy base of the local apic and map it into the current
+ * page table
+ */
+void lapic_setup(phyaddr_t phy_base);
+
+/*!
+ * \brief whether the local apic is available, i.e. lapic_setup is done
+ */
+bool lapic_ready();
+
+/*!
+ * \brief map the local apic registers into the page table at LAPIC_LIN_BASE
+ *
+ * \note do nothing if the local apic is not set up
+ */
+void lapic_map(uint32_t cr3);
+
+/*!
+ * \brief software enable the local apic of the calling cpu with all the local
+ * interrupts masked
+ *
+ * \attention never call it on the bsp, whose lint0 carries the 8259A
+ */
+void lapic_init();
+
+/*!
+ * \brief software enable the local apic of the bsp in the virtual wire mode,
+ * i.e. lint0 carries the 8259A and lint1 the nmi
+ *
+ * \note the bsp must be enabled to receive ipis
+ */
+void lapic_enable_bsp();
+
+/*!
+ * \brief measure the rate of the local apic timer against the system clock,
+ * called once on the bsp, the timers of all the cpus run at the same rate
+ */
+void lapic_calibrate_timer();
+
+/*!
+ * \brief start the periodic local apic timer of the calling cpu
+ */
+void lapic_start_timer(uint8_t vector, uint32_t hz);
+
+/*!
+ * \brief local apic id of the calling cpu, 0 if the local apic is unavailable
+ */
+uint8_t lapic_id();
+
+void lapic_eoi();
+
+/*!
+ * \brief send a fixed ipi of the vector to the cpu of the apic id
+ */
+void lapic_send_ipi(uint8_t apic_id, uint8_t vector);
+
+/*!
+ * \brief wake up an ap through the INIT-SIPI-SIPI sequence
+ *
+ * \param entry phy addr of the real mode entry, 4K aligned and below 1M
+ */
+void lapic_start_ap(uint8_t apic_id, phyaddr_t entry);
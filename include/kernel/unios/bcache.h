@@ -0,0 +1,90 @@
+#pragma once
+
+#include <sys/bcache.h>
+#include <sys/defs.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <list.h>
+
+#define NR_BCACHE_BUFS 128 //<! sectors held by the cache
+
+//! buffers hash to buckets by (dev, sector), see `bcache_bucket`
+#define BCACHE_HASH_BITS  6
+#define NR_BCACHE_BUCKETS (1 << BCACHE_HASH_BITS)
+
+//! transfers of at least so many sectors bypass the cache for the sectors that
+//! are not cached, see `bcache_rdwt_sects`
+#define BCACHE_DIRECT_SECTS 8
+
+//! interval of the flusher to write the dirty buffers back
+#define BCACHE_FLUSH_TICKS (5 * SYSCLK_FREQ_HZ)
+
+typedef struct buf_head_s {
+    int              dev;       //<! device nr, NO_DEV if unused
+    uint32_t         sector;    //<! sector nr relative to the device
+    int              refcnt;    //<! holders, never evicted if non-zero
+    bool             valid;     //<! data has been read in
+    bool             dirty;     //<! data is newer than the disk
+    uint32_t         lock;      //<! held by the holder accessing the data
+    struct list_head hash_node; //<! link in the hash bucket
+    struct list_head lru_node;  //<! link in the lru list, coldest first
+    uint8_t         *data;      //<! SECTOR_SIZE bytes
+} buf_head_t;
+
+void init_bcache();
+
+/*!
+ * \brief get the locked buffer of the sector with its data read in
+ *
+ * \note release it by `brelse` as soon as possible
+ */
+buf_head_t *bread(int dev, uint32_t sector);
+
+/*!
+ * \brief mark the locked buffer dirty, written back later by the flusher
+ */
+void bdirty(buf_head_t *bh);
+
+/*!
+ * \brief unlock the buffer and drop the reference
+ */
+void brelse(buf_head_t *bh);
+
+/*!
+ * \brief copy the whole sector out of the cache
+ */
+void bcache_read(int dev, uint32_t sector, void *buf);
+
+/*!
+ * \brief overwrite the whole sector in the cache, without reading it in
+ */
+void bcache_write(int dev, uint32_t sector, const void *buf);
+
+/*!
+ * \brief transfer nr_sects consecutive sectors between buf and the device
+ *
+ * \note a large transfer moves the sectors that are not cached between the disk
+ * and buf in place by multi-sector commands, and the cached ones through the
+ * cache to stay coherent with it
+ */
+void bcache_rdwt_sects(
+    int io_type, int dev, uint32_t sector, int nr_sects, void *buf);
+
+/*!
+ * \brief drop the clean buffers of the sectors that might be read in by others
+ * while the disk is written in place
+ *
+ * \note the buffers in use or dirty are left alone
+ */
+void bcache_forget(int dev, uint32_t sector, int nr_sects);
+
+/*!
+ * \brief write the dirty buffers of the device back, or of all the devices if
+ * dev is NO_DEV
+ */
+void bcache_sync(int dev);
+
+/*!
+ * \brief task entry that writes the dirty buffers back periodically
+ */
+void bcache_flusher();
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <unios/waitqueue.h>
+#include <sys/types.h>
+#include <sys/defs.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define BIO_MAX_VECS 32 //<! physical segments of one bio
+
+//! sectors of a request, a request is served by exactly one drive command
+#define BLK_MAX_SECTS 256
+//! physical segments of a request, merged bios included
+#define BLK_REQ_MAX_VECS 64
+
+//! pending requests of a queue that kick the dispatch off without a waiter
+#define BLK_PLUG_DEPTH 16
+
+//! the oldest request is served first once it waits longer than so many ticks,
+//! reads are more urgent since someone usually blocks on them
+#define BLK_READ_EXPIRE  (SYSCLK_FREQ_HZ / 2)
+#define BLK_WRITE_EXPIRE (5 * SYSCLK_FREQ_HZ)
+
+//! physically contiguous segment of the data
+typedef struct bio_vec_s {
+    phyaddr_t phyaddr;
+    int       size; //<! in bytes, an even number
+} bio_vec_t;
+
+struct bio_s;
+typedef void (*bio_end_io_t)(struct bio_s *bio);
+
+/*!
+ * \brief block io descriptor, a transfer of consecutive sectors between the
+ * device and the page frames
+ */
+typedef struct bio_s {
+    int           io_type; //<! DEV_READ or DEV_WRITE
+    int           device;  //<! minor device nr
+    uint32_t      sector;  //<! relative to the device
+    int           nr_sects;
+    int           nr_vecs;
+    bio_vec_t     vecs[BIO_MAX_VECS];
+    bool          pinned;  //<! user frames, referenced while in flight
+    volatile bool done;    //<! set last, the bio is free to reuse then
+    int           error;   //<! 0 on success
+    bio_end_io_t  end_io;  //<! called on completion before done is set
+    void         *private; //<! owned by the submitter
+    struct bio_s *next;    //<! link in the request
+} bio_t;
+
+void init_blkdev();
+
+void bio_init(bio_t *bio, int io_type, int device, uint32_t sector);
+
+/*!
+ * \brief append the data at buf to the bio, the frames of a user buffer are
+ * faulted in here, and pinned from the submission till the completion
+ *
+ * \param size in bytes, a multiple of SECTOR_SIZE
+ *
+ * \return false if the bio is left untouched since it is full, buf is not even
+ * aligned or some page of it is not accessible
+ */
+bool bio_add_buf(bio_t *bio, void *buf, int size);
+
+/*!
+ * \brief queue the bio, it is merged into a pending request if adjacent
+ *
+ * \note the bio is only served once someone waits on the queue or the queue
+ * gets deep enough, see BLK_PLUG_DEPTH
+ */
+void blk_submit(bio_t *bio);
+
+/*!
+ * \brief wait for the completion of the bio, the caller dispatches the
+ * requests of the queue by itself if nobody else is doing so
+ *
+ * \return error of the bio
+ */
+int blk_wait(bio_t *bio);
+
+/*!
+ * \brief dispatch the pending requests of all the queues
+ */
+void blk_run_queues();
+
+/*!
+ * \brief synchronous transfer of nr_sects consecutive sectors between buf and
+ * the device through the request queue
+ *
+ * \return 0 on success, -1 if buf can not be reached by the device
+ */
+int blk_rdwt(
+    int io_type, int device, uint32_t sector, int nr_sects, void *buf);
+
+/*!
+ * \brief the same as `blk_rdwt` but the data of the i-th sector is at sects[i]
+ */
+int blk_rdwt_sects(
+    int io_type, int device, uint32_t sector, int nr_sects, void *const *sects);
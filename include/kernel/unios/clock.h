@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdint.h>
+
 //! NOTE: ref http://www.osdever.net/bkerndev/Docs/pit.htm
 
 //! 8253/8254 PIT
@@ -8,7 +10,40 @@
 #define TIMER_FREQ 1193182 //<! PIT frequency
 //! 00-11-010-0 : Counter0 - LSB then MSB - rate generator - binary
 #define RATE_GENERATOR 0x34
+//! 00-11-000-0 : Counter0 - LSB then MSB - interrupt on terminal count - binary
+#define ONE_SHOT 0x30
+//! 00-00-000-0 : Counter0 - latch the current count
+#define LATCH_COUNT 0x00
+
+//! counter 2 is gated by the system control port, and polled for busy waiting
+#define TIMER2    0x42 //<! timer channel 2
+#define PIT_GATE2 0x61 //<! system control port b, gate & output of counter 2
+//! 10-11-000-0 : Counter2 - LSB then MSB - interrupt on terminal count - binary
+#define TIMER2_ONE_SHOT 0xb0
 
 void init_sysclk();
 
+/*!
+ * \brief stop the periodic tick and arm a one-shot count of the given ticks
+ * before the idle cpu halts, called with interrupts disabled
+ *
+ * \note the count is clamped to what the 16-bit counter can hold, and the
+ * periodic tick is kept if ticks is no more than 1
+ */
+void sysclk_enter_idle(uint32_t ticks);
+
+/*!
+ * \brief account the ticks slept through and restore the periodic tick, called
+ * with interrupts disabled once the halted cpu is waken up
+ */
+void sysclk_leave_idle();
+
+/*!
+ * \brief busy wait for the given microseconds without any irq
+ *
+ * \note used on the early boot path only, e.g. ap startup, where the system
+ * clock is not yet running or not allowed to be taken
+ */
+void sysclk_delay_us(uint32_t us);
+
 extern int system_ticks;
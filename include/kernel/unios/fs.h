@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdint.h>
+
 /* APIs of file operation */
 #define O_CREAT 1
 #define O_RDWR  2
@@ -17,6 +19,20 @@ int real_write(int fd, const void *buf, int count);
 int real_unlink(const char *pathname);
 int real_lseek(int fd, int offset, int whence);
 
+/*!
+ * \brief map the byte range of the regular file opened as fd to the sectors
+ * it is laid out on, for a transfer that goes to the disk directly
+ *
+ * \note sectors are allocated to the file to cover a range to write, while a
+ * range to read stops at the end of the file, the sectors to transfer are
+ * those covering the bytes returned
+ *
+ * \return bytes of the file covered by the range, or -1 if the range is not
+ * sector aligned, beyond the end of the file or not contiguous on the disk
+ */
+int real_map_range(
+    int fd, int io_type, int pos, int size, int *dev, uint32_t *sector);
+
 void                read_orange_superblock(int dev);
 struct super_block *get_unique_superblock(int dev);
 int                 get_fs_dev(int drive, int fs_type);
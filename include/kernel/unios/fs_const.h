@@ -182,6 +182,4 @@ enum msgtype {
     ((((m) & I_TYPE_MASK) == I_BLOCK_SPECIAL) \
      || (((m) & I_TYPE_MASK) == I_CHAR_SPECIAL))
 
-#define NR_DEFAULT_FILE_SECTS 2048 /* 2048 * 512 = 1MB */
-
 #define FSBUF_SIZE 0x100000 // added by mingxuan 2019-5-17
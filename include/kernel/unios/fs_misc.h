@@ -110,6 +110,12 @@ struct dev_drv_map {
  */
 #define MAGIC_V1 0x111
 
+/**
+ * @def   MAGIC_V2
+ * @brief Magic number of FS v2.0, files are laid out on extents
+ */
+#define MAGIC_V2 0x112
+
 /**
  * @struct super_block fs.h "include/fs.h"
  * @brief  The 2nd sector of the FS
@@ -127,7 +133,7 @@ typedef struct super_block {
     uint32_t root_inode;        /**< Inode nr of root directory */
     uint32_t inode_size;        /**< INODE_SIZE */
     uint32_t inode_isize_off;   /**< Offset of `struct inode::i_size' */
-    uint32_t inode_start_off;   /**< Offset of `struct inode::i_start_sect' */
+    uint32_t inode_start_off;   /**< Offset of `struct inode::i_extents' */
     uint32_t dir_ent_size;      /**< DIR_ENTRY_SIZE */
     uint32_t dir_ent_inode_off; /**< Offset of `struct dir_entry::inode_nr' */
     uint32_t dir_ent_fname_off; /**< Offset of `struct dir_entry::name' */
@@ -149,28 +155,60 @@ typedef struct super_block {
 // #define	SUPER_BLOCK_SIZE	56
 #define SUPER_BLOCK_SIZE 64 // modified by mingxuan 2020-10-30
 
+/**
+ * @struct extent
+ * @brief  A run of contiguous sectors of a file
+ */
+struct extent {
+    uint32_t e_start_sect; /**< The first sector of the run */
+    uint32_t e_nr_sects;   /**< How many sectors the run covers */
+};
+
+/**
+ * @def   NR_INODE_EXTENTS
+ * @brief How many extents are kept in the i-node itself.
+ */
+#define NR_INODE_EXTENTS 2
+
+/**
+ * @def   NR_BLOCK_EXTENTS
+ * @brief How many extents are kept in the extent block of a file.
+ */
+#define NR_BLOCK_EXTENTS (SECTOR_SIZE / sizeof(struct extent))
+
+/**
+ * @def   NR_FILE_EXTENTS
+ * @brief How many extents a file is laid out on at most.
+ */
+#define NR_FILE_EXTENTS (NR_INODE_EXTENTS + NR_BLOCK_EXTENTS)
+
 /**
  * @struct inode
  * @brief  i-node
  *
- * The \c start_sect and\c nr_sects locate the file in the device,
- * and the size show how many bytes is used.
- * If <tt> size < (nr_sects * SECTOR_SIZE) </tt>, the rest bytes
- * are wasted and reserved for later writing.
+ * The data of the file is laid out on the extents in order, the leading
+ * NR_INODE_EXTENTS ones are kept in the i-node and the rest in the extent
+ * block. Sectors are allocated on demand as the file grows, so
+ * \c nr_sects is the sum of the extents and the size show how many bytes of
+ * them are used.
  *
  * \b NOTE: Remember to change INODE_SIZE if the members are changed
  */
 struct inode {
-    uint32_t i_mode;       /**< Accsess mode */
-    uint32_t i_size;       /**< File size */
-    uint32_t i_start_sect; /**< The first sector of the data */
-    uint32_t i_nr_sects;   /**< How many sectors the file occupies */
-    uint8_t  _unused[16];  /**< Stuff for alignment */
+    uint32_t i_mode;     /**< Accsess mode */
+    uint32_t i_size;     /**< File size */
+    uint32_t i_nr_sects; /**< How many sectors the file occupies */
+    uint32_t i_ext_sect; /**< The extent block, 0 if not allocated */
+    union {
+        struct extent i_extents[NR_INODE_EXTENTS]; /**< The leading runs */
+        uint32_t      i_rdev; /**< Device nr of a special file */
+    };
 
     /* the following items are only present in memory */
-    int i_dev;
-    int i_cnt; /**< How many procs share this inode  */
-    int i_num; /**< inode nr.  */
+    int      i_dev;
+    int      i_cnt;  /**< How many procs share this inode  */
+    int      i_num;  /**< inode nr.  */
+    uint32_t i_lock; /**< Serializes the changes to the extents */
 };
 
 /**
@@ -0,0 +1,7 @@
+#pragma once
+
+//! waiters hash to buckets by the key of the futex, see `futex_bucket`
+#define FUTEX_HASH_BITS  6
+#define NR_FUTEX_BUCKETS (1 << FUTEX_HASH_BITS)
+
+void init_futex();
@@ -2,7 +2,9 @@
 
 #include <unios/proc.h>
 #include <unios/fs_const.h>
+#include <unios/blkdev.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 /**
  * @struct part_ent
@@ -263,6 +265,8 @@ typedef struct part_info {
 /* main drive struct, one entry per drive */
 typedef struct hd_info_s {
     int              open_cnt;
+    int              multi_sects; //<! sectors per drq block, 0 if unset
+    bool             dma;         //<! transfer by bus master dma
     struct part_info primary[NR_PRIM_PER_DRIVE]; // NR_PRIM_PER_DRIVE = 5
     struct part_info logical[NR_SUB_PER_DRIVE];  // NR_SUB_PER_DRIVE = 16 *4 =64
 } hd_info_t;
@@ -275,29 +279,63 @@ typedef struct hd_info_s {
 #define ATA_IDENTIFY           0xEC
 #define ATA_READ               0x20
 #define ATA_WRITE              0x30
+#define ATA_READ_MULTIPLE      0xC4
+#define ATA_WRITE_MULTIPLE     0xC5
+#define ATA_SET_MULTIPLE       0xC6
+#define ATA_READ_DMA           0xC8
+#define ATA_WRITE_DMA          0xCA
+#define HD_MAX_SECTS_PER_CMD   256 //<! the sector count 0 stands for 256
+
+/* bus master ide, ref SFF-8038i & the PIIX3 datasheet */
+#define BM_REG_CMD       0x0 /* offsets to BAR4, primary channel */
+#define BM_REG_STATUS    0x2
+#define BM_REG_PRDT      0x4 /* phyaddr of the prd table */
+#define BM_CMD_START     0x01
+#define BM_CMD_READ      0x08 /* the bus master writes to the memory */
+#define BM_STATUS_ACTIVE 0x01
+#define BM_STATUS_ERR    0x02 /* write 1 to clear */
+#define BM_STATUS_INTR   0x04 /* write 1 to clear */
+#define PRD_EOT          0x8000
+
+/* physical region descriptor, a region never crosses a 64K boundary */
+typedef struct prd_s {
+    uint32_t phyaddr;
+    uint16_t size; /* 0 stands for 64K */
+    uint16_t flags;
+} __attribute__((packed)) prd_t;
 /* for DEVICE register. */
 #define MAKE_DEVICE_REG(lba, drv, lba_highest) \
     (((lba) << 6) | ((drv) << 4) | (lba_highest & 0xF) | 0xA0)
 
-typedef struct rdwt_info {
-    MESSAGE          *msg;
-    void             *kbuf;
-    process_t        *proc;
-    struct rdwt_info *next;
-} RWInfo;
-
-typedef struct {
-    RWInfo *front;
-    RWInfo *rear;
-} HDQueue;
-
 void init_hd();
 void hd_open(int device);
 void hd_close(int device);
-void hd_service();
 
 void hd_rdwt(MESSAGE *p);
-void hd_rdwt_sched(MESSAGE *p);
+
+/*!
+ * \brief drive nr of the minor device
+ */
+int hd_drive_of(int device);
+
+/*!
+ * \brief sector nr on the whole drive of the sector relative to the device
+ */
+uint32_t hd_abs_sector(int device, uint32_t sector);
+
+/*!
+ * \brief transfer at most HD_MAX_SECTS_PER_CMD consecutive sectors starting at
+ * the sector of the device by one command, the data is at the physical segments
+ *
+ * \note served by the block request layer, see `blk_submit`
+ */
+void hd_rdwt_vecs(
+    int              io_type,
+    int              device,
+    uint32_t         sector,
+    int              nr_sects,
+    const bio_vec_t *vecs,
+    int              nr_vecs);
 void hd_ioctl(MESSAGE *p);
 
 extern hd_info_t hd_info[1];
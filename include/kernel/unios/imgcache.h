@@ -0,0 +1,45 @@
+#pragma once
+
+#include <sys/elf.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+//! max read-only segments kept by the exec image cache
+#define IMGCACHE_MAX_ENTRIES 16
+
+typedef struct imgcache_stat_s {
+    size_t nr_entries; //<! segments currently cached
+    size_t nr_pages;   //<! frames held by the cache
+    size_t nr_hits;    //<! accumulated map hits
+    size_t nr_misses;  //<! accumulated map misses
+} imgcache_stat_t;
+
+/*!
+ * \brief map a cached read-only segment of the image (dev, ino) into cr3
+ *
+ * \return true if hit and mapped, otherwise nothing is changed
+ *
+ * \note each mapped frame takes a reference, so it is released by the common
+ * unmap path with free=true
+ */
+bool imgcache_map(int dev, int ino, const elf_proghdr_t *progh, uint32_t cr3);
+
+/*!
+ * \brief cache the frames of a read-only segment that has been loaded into cr3
+ *
+ * \param gen generation taken by imgcache_generation before the segment was
+ * read, the segment is not cached if any invalidation happened in between
+ */
+void imgcache_insert(
+    int dev, int ino, const elf_proghdr_t *progh, uint32_t cr3, uint32_t gen);
+
+/*!
+ * \brief drop all cached segments of the image, must be called once the
+ * content of the file is going to change
+ */
+void     imgcache_invalidate(int dev, int ino);
+uint32_t imgcache_generation();
+void     imgcache_get_stat(imgcache_stat_t *stat);
+
+void init_imgcache();
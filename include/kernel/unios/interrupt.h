@@ -55,6 +55,11 @@ void init_interrupt_controller();
 #define INT_VECTOR_PAGE_FAULT   0x0e
 #define INV_VECTOR_FP_EXCEPTION 0x10
 
+//! local interrupts, sent by the local apics, see smp.h
+#define INT_VECTOR_LOCAL_TIMER 0x40
+#define INT_VECTOR_RESCHED     0x41
+#define INT_VECTOR_TLB_FLUSH   0x42
+
 #define INT_VECTOR_SYSCALL 0x80
 
 #define disable_int_begin()                                      \
@@ -91,6 +96,11 @@ void hwint13();
 void hwint14();
 void hwint15();
 
+void hwint_local_timer();
+void hwint_resched();
+void hwint_tlb_flush();
+void hwint_spurious();
+
 void division_error();
 void debug_exception();
 void nmi();
@@ -157,3 +157,8 @@ typedef struct mouse_inbuf {
 
 void init_keyboard();
 void keyboard_read(tty_t* p_tty);
+
+/*!
+ * \brief block until the keyboard buffer is not empty, for kernel tasks
+ */
+void keyboard_wait_input();
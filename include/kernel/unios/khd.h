@@ -21,4 +21,6 @@ void wait_disk(void);
 
 void read_sector_pio(uint32_t lba, void *buf);
 
+void read_sectors_pio(uint32_t lba, int nr_sects, void *buf);
+
 void raw_read_font(uint32_t start_lba, uint32_t bytes, uint8_t *buffer);
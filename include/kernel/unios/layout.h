@@ -19,7 +19,11 @@
 #define HeapLinBase     ((uintptr_t)(512u * NUM_1M))
 #define HeapLinLimitMAX (HeapLinBase + NUM_1G)
 
-//! shared memory space, used by fork
+//! program break, the upper half of user heap, grows by sbrk only
+#define BrkLinBase     ((uintptr_t)(HeapLinBase + NUM_1G / 2))
+#define BrkLinLimitMAX HeapLinLimitMAX
+
+//! shared memory space, window to copy pages out of the kernel space
 #define SharePageBase  ((uintptr_t)(HeapLinBase - NUM_4K))
 #define SharePageLimit HeapLinBase
 
@@ -35,5 +39,11 @@
 #define StackLinBase     ((uintptr_t)ArgLinBase)
 #define StackLinLimitMAX HeapLinLimitMAX
 
+//! stacks of child threads are carved below the main stack, one fixed slot
+//! per pcb, see `thread_stack_base`
+#define StackMainSizeMAX   ((uintptr_t)(64u * NUM_1M))
+#define StackThreadSizeMAX ((uintptr_t)NUM_1M)
+#define StackChildLinBase  ((uintptr_t)(StackLinBase - StackMainSizeMAX))
+
 #define K_PHY2LIN(x) ((void *)((phyaddr_t)(x) + (KernelLinBase)))
 #define K_LIN2PHY(x) ((phyaddr_t)((void *)(x) - (KernelLinBase)))
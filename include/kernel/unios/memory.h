@@ -3,8 +3,7 @@
 #include <sys/types.h>
 #include <stddef.h>
 #include <stdbool.h>
-
-typedef void *(*fn_malloc_t)(size_t);
+#include <stdint.h>
 
 typedef struct memblk_s {
     void  *addr;
@@ -14,11 +13,50 @@ typedef struct memblk_s {
 typedef struct memblk_allocator_s {
     void    *memblk_base;
     void    *memblk_limit;
-    size_t   total_free_slots;
-    size_t   nr_frees;
-    memblk_t free_slots[0];
+    size_t    total_free_slots;
+    size_t    nr_frees;
+    memblk_t *free_slots; //<! kmalloc-ed, grows on demand
 } memblk_allocator_t;
 
+typedef struct kmem_stat_s {
+    size_t total;          //<! total bytes of kmem
+    size_t free;           //<! free bytes, including block tags
+    size_t nr_free_blocks; //<! number of free blocks
+    size_t largest_free;   //<! size of the largest free block
+    int    fragmentation;  //<! external fragmentation in permille
+} kmem_stat_t;
+
+//! max order of a physical page block, i.e. 2^10 pages ~ 4 MB
+#define PHYPAGE_MAX_ORDER 10
+
+#define PHYPAGE_DIRTY  0x01 //<! content differs from its backing store
+#define PHYPAGE_PINNED 0x02 //<! must stay resident at the same frame
+#define PHYPAGE_COW    0x04 //<! shared by copy-on-write
+
+enum phypage_type {
+    PHYPAGE_FREE,
+    PHYPAGE_KERNEL,  //<! generic kpage
+    PHYPAGE_USER,    //<! generic upage, usually mapped into user space
+    PHYPAGE_PGTABLE, //<! page directory or page table
+    PHYPAGE_SLAB,    //<! owned by a slab cache
+    NR_PHYPAGE_TYPES,
+};
+
+//! descriptor of a single phy page frame in kpage or upage
+typedef struct phypage_s {
+    uint16_t refcount; //<! only counted on the head frame of a block
+    uint8_t  type;     //<! see enum phypage_type
+    uint8_t  flags;    //<! PHYPAGE_*
+} phypage_t;
+
+typedef struct phypage_stat_s {
+    size_t nr_pages[NR_PHYPAGE_TYPES]; //<! frames of each type
+    size_t nr_shared;                  //<! frames referenced more than once
+    size_t nr_cow;                     //<! frames shared by copy-on-write
+    size_t nr_pinned;                  //<! frames marked as pinned
+    size_t nr_dirty;                   //<! frames marked as dirty
+} phypage_stat_t;
+
 enum mballoc_free_state {
     MBALLOC_OK,
     MBALLOC_NOSLOTS,
@@ -36,19 +74,47 @@ void mballoc_reset_unsafe(memblk_allocator_t *allocator);
 
 void *mballoc_alloc(memblk_allocator_t *allocator, size_t size);
 int   mballoc_free(memblk_allocator_t *allocator, void *addr, size_t size);
-memblk_allocator_t *mballoc_create(
-    fn_malloc_t malloc, size_t total_free_slots, void *base, void *limit);
-memblk_allocator_t *mballoc_create_by(
-    memblk_allocator_t *allocator,
-    size_t              total_free_slots,
-    void               *base,
-    void               *limit);
+memblk_allocator_t *
+    mballoc_create(size_t total_free_slots, void *base, void *limit);
+memblk_allocator_t *mballoc_clone(memblk_allocator_t *allocator);
+void                mballoc_destroy(memblk_allocator_t *allocator);
 
 void     *kmalloc(size_t size);
 void      kfree(void *ptr);
+void      get_kmem_stat(kmem_stat_t *stat);
 phyaddr_t kmalloc_phypage();
 phyaddr_t malloc_phypage();
 void      free_phypage(phyaddr_t phyaddr);
 
+/*!
+ * \brief allocate 2^order physically contiguous pages from kpage or upage
+ *
+ * \return physical address aligned to 2^order pages, or 0 on failure
+ */
+phyaddr_t kmalloc_phypages(int order);
+phyaddr_t malloc_phypages(int order);
+void      free_phypages(phyaddr_t phyaddr, int order);
+
+/*!
+ * \brief take one more reference of an allocated phy page
+ *
+ * \note phy pages are born with one reference, and free_phypage drops one,
+ * the page is only given back to the allocator when the last one is dropped
+ */
+void ref_phypage(phyaddr_t phyaddr);
+int  phypage_refcount(phyaddr_t phyaddr);
+
+/*!
+ * \brief retag an allocated phy page, descriptors are reset on free
+ *
+ * \param type one of enum phypage_type except PHYPAGE_FREE
+ */
+void set_phypage_type(phyaddr_t phyaddr, int type);
+void set_phypage_flags(phyaddr_t phyaddr, int flags, bool on);
+bool get_phypage_info(phyaddr_t phyaddr, phypage_t *info);
+void get_phypage_usage(phypage_stat_t *stat);
+
+bool get_phypage_stat(int type, size_t *total, size_t *nr_free);
+
 bool get_phymem_bound(int type, phyaddr_t *base, phyaddr_t *limit);
 void init_memory();
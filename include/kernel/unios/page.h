@@ -11,12 +11,14 @@
 #define PG_MASK_US 0x4             //<! U/S
 #define PG_MASK_PWT 0x8            //<! page write-through
 #define PG_MASK_PCD 0x10           //<! page cache disable
+#define PG_MASK_COW 0x200          //<! available bit, copy-on-write
 #define PG_NP      0               //<! not present
 #define PG_P       PG_MASK_P       //<! present
 #define PG_RX      0               //<! read & executable
 #define PG_RWX     PG_MASK_RW      //<! read & write & executable
 #define PG_S       0               //<! supervisor
 #define PG_U       PG_MASK_US      //<! user
+#define PG_COW     PG_MASK_COW     //<! read-only shared, copy on write
 
 /*!
  * \brief free pde table according to the given cr3
@@ -113,6 +115,56 @@ bool pg_map_laddr_range(
  */
 void pg_refresh();
 
+//! max pages invalidated one by one in a batch, beyond which reloading cr3 is
+//! cheaper than a series of invlpg
+#define PG_BATCH_MAX 32
+
+/*!
+ * \brief pending tlb invalidations of a series of page table updates on cr3
+ *
+ * \note updates through a batch take effect in the page table immediately,
+ * but stale tlb entries are only invalidated at pg_batch_commit, and nothing
+ * is done at all if cr3 is not the current one
+ */
+typedef struct pg_batch_s {
+    uint32_t cr3;
+    int      nr_pending; //<! overflowed if greater than PG_BATCH_MAX
+    uint32_t pending[PG_BATCH_MAX];
+} pg_batch_t;
+
+void pg_batch_begin(pg_batch_t *batch, uint32_t cr3);
+
+/*!
+ * \brief record a laddr whose pte has been changed by the caller directly
+ */
+void pg_batch_invalidate(pg_batch_t *batch, uint32_t laddr);
+
+/*!
+ * \brief the same as pg_map_laddr, but the tlb entry is invalidated at commit
+ * if an old present pte is overwritten
+ */
+bool pg_batch_map(
+    pg_batch_t *batch,
+    uint32_t    laddr,
+    uint32_t    phyaddr,
+    uint32_t    pde_attr,
+    uint32_t    pte_attr);
+bool pg_batch_unmap(pg_batch_t *batch, uint32_t laddr, bool free);
+bool pg_batch_map_range(
+    pg_batch_t *batch,
+    uint32_t    laddr_base,
+    uint32_t    laddr_limit,
+    uint32_t    pde_attr,
+    uint32_t    pte_attr);
+bool pg_batch_unmap_range(
+    pg_batch_t *batch, uint32_t laddr_base, uint32_t laddr_limit, bool free);
+
+/*!
+ * \brief invalidate the pending tlb entries, either one by one via invlpg or
+ * by a whole flush if overflowed
+ */
+void pg_batch_commit(pg_batch_t *batch);
+
 /*!
  * \brief create page table and map the kernel space
  *
@@ -122,6 +174,12 @@ void pg_refresh();
  */
 bool pg_create_and_init(uint32_t *p_cr3);
 
+/*!
+ * \brief build the pte tables of the kernel space once, they are then shared by
+ * all the page tables created by pg_create_and_init
+ */
+void init_kernel_page_table();
+
 //! NOTE: address of cr3 pde pte always located in kernel memory space, since we
 //! always mapping it for the program in the initilization stage, access to
 //! these should never cause a page fault, otherwise maybe something wrong in
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <arch/x86.h>
+#include <stdint.h>
+
+//! NOTE: ref PCI Local Bus Specification 3.0, configuration mechanism #1
+
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+#define PCI_REG_ID      0x00 //<! vendor id & device id
+#define PCI_REG_COMMAND 0x04 //<! command & status
+#define PCI_REG_CLASS   0x08 //<! revision, prog if, subclass & class
+#define PCI_REG_BAR0    0x10
+#define PCI_REG_BAR1    0x14
+#define PCI_REG_BAR4    0x20
+
+#define PCI_CMD_IO     0x1 //<! respond to the io space
+#define PCI_CMD_MASTER 0x4 //<! enable bus mastering
+
+#define PCI_CLASS_IDE    0x0101 //<! mass storage & ide
+#define PCI_PROGIF_BMIDE 0x80   //<! ide supports bus mastering
+#define PCI_INVALID_VDID 0xffffffffu
+#define PCI_NR_DEVS      32
+#define PCI_NR_FUNCS     8
+
+static inline uint32_t
+    pci_cfg_addr(uint8_t bus, uint8_t dev, uint8_t func, uint8_t offset) {
+    return 0x80000000u | (bus << 16) | (dev << 11) | (func << 8)
+         | (offset & 0xfc);
+}
+
+static inline uint32_t
+    pci_cfg_read32(uint8_t bus, uint8_t dev, uint8_t func, uint8_t offset) {
+    outl(PCI_CONFIG_ADDR, pci_cfg_addr(bus, dev, func, offset));
+    return inl(PCI_CONFIG_DATA);
+}
+
+static inline void pci_cfg_write32(
+    uint8_t bus, uint8_t dev, uint8_t func, uint8_t offset, uint32_t value) {
+    outl(PCI_CONFIG_ADDR, pci_cfg_addr(bus, dev, func, offset));
+    outl(PCI_CONFIG_DATA, value);
+}
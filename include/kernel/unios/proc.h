@@ -6,8 +6,12 @@
 #include <unios/memory.h>
 #include <unios/regs.h>
 #include <unios/sync.h>
+#include <unios/waitqueue.h>
+#include <unios/timer.h>
+#include <unios/smp.h>
 #include <sys/types.h>
 #include <stdint.h>
+#include <list.h>
 
 #define DEFAULT_STACK_SIZE (8 * NUM_1K)
 
@@ -51,10 +55,14 @@
 #define SSREG        (NR_SSREG * 4)
 #define P_STACKTOP   (SSREG + 4)
 
-#define NR_PCBS      64 //<! total pcbs
-#define NR_TASKS     3  //<! predefined task k-pcbs
-#define NR_K_PCBS    3  //<! reserved k-pcbs, only predefined tasks currently
-#define NR_RECY_PROC 1  //<! no. of recycler proc `scanvenger`
+#define NR_PCBS      64   //<! initial size of the pcb table, multiple of 32
+#define NR_PCBS_MAX  1024 //<! the pcb table grows by doubling up to it
+#define NR_TASKS     4    //<! predefined task k-pcbs
+#define NR_K_PCBS    4    //<! reserved k-pcbs, only predefined tasks currently
+#define NR_RECY_PROC 2    //<! pid of recycler proc `scanvenger`
+
+#define PID_HASH_BITS  6
+#define NR_PID_BUCKETS (1 << PID_HASH_BITS)
 
 #define NR_FILES 64
 
@@ -68,7 +76,6 @@ enum process_stat {
     PREINITED, //<! already inited and wait to be a ready one
 };
 
-#define NR_CHILD_MAX (NR_PCBS - NR_K_PCBS - 1)
 #define TYPE_PROCESS 0
 #define TYPE_THREAD  1
 
@@ -94,19 +101,25 @@ typedef struct stack_frame_s {
 } stack_frame_t;
 
 typedef struct tree_info_s {
-    int      type;                        //<! type of task
-    uint32_t real_ppid;                   //<! pid of creator task
-    uint32_t ppid;                        //<! pid of current parent task
-    uint32_t child_p_num;                 //<! total child proc
-    uint32_t child_process[NR_CHILD_MAX]; //<! child proc list
-    uint32_t child_t_num;                 //<! total child thread
-    uint32_t child_thread[NR_CHILD_MAX];  //<! child thread list
-    uint32_t child_k_num;                 //<! total killed child proc/thread
-    uint32_t child_killed[NR_CHILD_MAX];  //<! child killed list
-    int      text_hold;                   //<! owner of text or not
-    int      data_hold;                   //<! owner of data or not
+    int              type;      //<! type of task
+    uint32_t         real_ppid; //<! pid of creator task
+    uint32_t         ppid;      //<! pid of current parent task
+    struct list_head children;  //<! child procs, linked by `sibling`
+    struct list_head threads;   //<! child threads, linked by `sibling`
+    struct list_head zombies;   //<! ZOMBIE child procs, linked by `zombie`
+    struct list_head killed;    //<! killed_child_t not waited for yet
+    struct list_head sibling;   //<! link in children or threads of the parent
+    struct list_head zombie;    //<! link in zombies of the parent
+    int              text_hold; //<! owner of text or not
+    int              data_hold; //<! owner of data or not
 } tree_info_t;
 
+//! pid of a killed child kept for `wait`, since its pcb is recycled at once
+typedef struct killed_child_s {
+    int              pid;
+    struct list_head node;
+} killed_child_t;
+
 typedef struct ph_info_s {
     uint32_t          base;
     uint32_t          limit;
@@ -119,6 +132,9 @@ typedef struct lin_memmap_s {
     //! heap
     uint32_t heap_lin_base;
     uint32_t heap_lin_limit;
+    //! program break
+    uint32_t brk_lin_base;
+    uint32_t brk_lin_limit;
     //! kernel space
     uint32_t kernel_lin_base;
     uint32_t kernel_lin_limit;
@@ -143,30 +159,39 @@ typedef struct pcb_s {
     char* esp_save_syscall;
     char* esp_save_context;
 
-    //! if non-zero, sleeping on channel, which is a pointer of the target field
-    //! for example, as for syscall sleep(int n), the target field is
-    //! 'system_ticks', and the channel is a pointer of 'system_ticks'.
-    void*        channel;
-    lin_memmap_t memmap;
+    //! if non-null, sleeping on the wait queue, linked by `wait_node`
+    wait_queue_head_t* wait_queue;
+    struct list_head   wait_node;
+    ktimer_t           sleep_timer; //<! wakes the proc up from sleep(n)
+    uint64_t           futex_key;   //<! key of the futex waited on, if any
+    lin_memmap_t       memmap;
 
-    tree_info_t tree_info;
-    int         live_ticks;
-    int         priority;
+    tree_info_t       tree_info;
+    wait_queue_head_t wait_child;   //<! where the proc waits for its children
+    int               live_ticks;   //<! ticks left before sinking a level
+    int               priority;     //<! base time slice in ticks
+    int               sched_level;  //<! level in the feedback queue
+    struct list_head  rq_node;      //<! link in the run queue of its level
+    int               cpu;          //<! cpu whose run queue holds the proc
+    int               cpu_affinity; //<! pinned cpu or SCHED_CPU_ANY
 
-    uint32_t pid;
-    char     name[16];
+    uint32_t         pid;
+    int              slot;     //<! index in proc_table, kept across reuse
+    struct list_head pid_node; //<! link in the pid hash
+    char             name[16];
 
     int                 stat;
     uint32_t            cr3;
     memblk_allocator_t* allocator;
     uint32_t            heap_lock;
 
-    file_desc_t* filp[NR_FILES];
-    uint32_t     lock;
-    uint32_t     exit_code;
+    file_desc_t** filp;            //<! table in use, the leader's for threads
+    file_desc_t*  files[NR_FILES]; //<! own file table
+    uint32_t      lock;
+    uint32_t      exit_code;
 } pcb_t;
 
-typedef union {
+typedef union process_u {
     pcb_t   pcb;
     uint8_t stack[DEFAULT_STACK_SIZE];
     //! NOTE: only for convenient access
@@ -181,19 +206,58 @@ typedef struct task_s {
 
 bool init_locked_pcb(
     process_t* proc, const char* name, void* entry_point, uint32_t rpl);
+void       init_proc_cache();
 process_t* try_lock_free_pcb();
+ph_info_t* alloc_ph_info();
+void       free_ph_info(ph_info_t* ph_info);
 ph_info_t* clone_ph_info(ph_info_t* src);
+void       init_tree_lists(tree_info_t* info);
+void       add_killed_child(tree_info_t* info, int pid);
+int        pop_killed_child(tree_info_t* info);
+void       free_killed_children(tree_info_t* info);
 int        ldt_seg_linear(process_t* p, int idx);
 void*      va2la(int pid, void* va);
 process_t* pid2proc(int pid);
 int        proc2pid(process_t* proc);
 
-//! ATTENTION: only called in a restart restore routine
-void wakeup_exclusive(void* channel);
+/*!
+ * \brief bind a new pid to the locked pcb and make it visible to `pid2proc`
+ *
+ * \return the new pid
+ */
+int pid_alloc(pcb_t* pcb);
+
+/*!
+ * \brief unbind the pid from the pcb and mark its slot free
+ *
+ * \note called by `set_proc_stat` once the pcb turns IDLE
+ */
+void pid_detach(pcb_t* pcb);
+
+/*!
+ * \brief turn the locked pcb into a clean IDLE one ready for reuse
+ *
+ * \note the lock is still held on return
+ */
+void recycle_locked_pcb(pcb_t* pcb);
+
+/*!
+ * \brief point the shared ldt descriptor in the gdt to the ldt of the pcb
+ */
+void load_ldt_desc(pcb_t* pcb);
+
+/*!
+ * \brief get the pcb owning the address space, heap & file table shared by the
+ * given pcb, i.e. the pcb itself for processes and the creator process of the
+ * whole thread group for threads
+ */
+pcb_t* thread_leader(pcb_t* pcb);
+
+//! NOTE: every cpu runs its own proc, see `cpu_t`
+#define p_proc_current (this_cpu()->proc)
 
-extern tss_t      tss;
-extern process_t* p_proc_current;
-extern process_t* p_proc_next;
-extern process_t* proc_table[];
-extern task_t     task_table[];
-extern rwlock_t   proc_table_rwlock;
+extern process_t*  p_proc_next;
+extern process_t** proc_table;
+extern int         nr_pcbs;
+extern task_t      task_table[];
+extern rwlock_t    proc_table_rwlock;
@@ -95,6 +95,8 @@ typedef struct tss_s {
 #define INDEX_VIDEO     3 // ┛
 #define INDEX_TSS       4
 #define INDEX_LDT_FIRST 5
+//! tss of the aps, one for each, the bsp takes INDEX_TSS
+#define INDEX_TSS_AP_FIRST (INDEX_LDT_FIRST + 1)
 
 //! selector, defined in loader
 #define SELECTOR_DUMMY     0          // ┓
@@ -162,3 +164,8 @@ void init_protect_mode();
 void init_descriptor(
     descriptor_t* desc, uint32_t base, uint32_t limit, uint16_t attr);
 uint32_t seg2phys(uint16_t seg);
+
+/*!
+ * \brief clear the tss and point the gdt descriptor at the index to it
+ */
+void init_tss(tss_t* tss, int index);
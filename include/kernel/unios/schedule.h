@@ -1,9 +1,58 @@
 #pragma once
 
 #include <sys/types.h>
+#include <sys/sched.h>
+
+#define NR_SCHED_LEVELS      4    //<! levels of the multi-level feedback queue
+#define SCHED_BOOST_TICKS    1000 //<! period to lift all procs to the top level
+#define SCHED_MAX_IDLE_TICKS 1000 //<! max ticks for the idle cpu to halt
+#define SCHED_IMBALANCE      2    //<! extra ready procs to place elsewhere
+
+struct pcb_s;
 
 void restart_initial();
 void restart_restore();
 void sched();
 
+/*!
+ * \brief update the stat of the pcb and keep the run queues in sync with it
+ *
+ * \note every write to `pcb.stat` of a live pcb should go through it, a pcb is
+ * in the run queue iff its stat is READY
+ */
+void set_proc_stat(struct pcb_s *pcb, int stat);
+
+/*!
+ * \brief account one tick to the current proc, demote it if it has run out of
+ * the allotment of its level, called from the clock handler
+ */
+void sched_tick();
+
+/*!
+ * \brief choose the cpu of a new proc before it is made READY, the affinity
+ * is inherited from the parent
+ *
+ * \param parent creator of the proc, NULL for kernel tasks
+ *
+ * \note the child stays on the cpu of its parent for the warm cache, unless
+ * that cpu has more than SCHED_IMBALANCE ready procs over the idlest one
+ */
+void sched_fork(struct pcb_s *child, struct pcb_s *parent);
+
+/*!
+ * \brief wait till the pcb is off all the cpus, called with the kernel lock
+ * held before the pcb is torn down
+ *
+ * \note the pcb must have left READY, or it may be picked again at any time
+ */
+void sched_wait_off_cpu(struct pcb_s *pcb);
+
+/*!
+ * \brief join the scheduler on the calling ap, called with the kernel lock
+ * held and never return
+ */
+void sched_start_ap();
+
+void init_sched();
+
 extern phyaddr_t cr3_ready;
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+//! max order of a slab, i.e. 2^4 pages ~ 64 KB
+#define SLAB_MAX_ORDER 4
+
+typedef struct kmem_cache_s kmem_cache_t;
+
+typedef void (*fn_ctor_t)(void *);
+
+typedef struct kmem_cache_stat_s {
+    size_t obj_size;  //<! size of each object slot
+    size_t slab_size; //<! size of each slab in bytes
+    size_t nr_slabs;  //<! slabs currently owned by the cache
+    size_t nr_objs;   //<! total object slots of all slabs
+    size_t nr_active; //<! objects currently allocated
+    size_t nr_allocs; //<! accumulated alloc count
+    size_t nr_frees;  //<! accumulated free count
+} kmem_cache_stat_t;
+
+/*!
+ * \brief create a cache of fixed-size objects backed by slabs of kpage
+ *
+ * \param name name of the cache, must outlive the cache
+ * \param size size of each object
+ * \param align alignment of each object, 0 for the natural word alignment
+ * \param ctor called once per object when a new slab is carved, the object
+ * should be returned to its constructed state before freed if provided
+ *
+ * \return cache object or NULL on failure
+ */
+kmem_cache_t *kmem_cache_create(
+    const char *name, size_t size, size_t align, fn_ctor_t ctor);
+void  kmem_cache_destroy(kmem_cache_t *cache);
+void *kmem_cache_alloc(kmem_cache_t *cache);
+void  kmem_cache_free(kmem_cache_t *cache, void *obj);
+bool  kmem_cache_get_stat(kmem_cache_t *cache, kmem_cache_stat_t *stat);
+void  kmem_cache_report();
+
+void init_slab();
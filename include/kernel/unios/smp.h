@@ -0,0 +1,123 @@
+#pragma once
+
+#include <unios/layout.h>
+#include <unios/protect.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define NR_CPUS 8
+
+//! phy addr where the ap trampoline is copied to, the sipi vector is its page
+//! number, so it must be 4K aligned and below 1M
+//! NOTE: keep in sync with smpboot.asm
+#define AP_TRAMPOLINE_BASE 0x7000
+
+//! stack of a cpu, used by the irqs, the scheduler and the idle loop, and also
+//! as the boot stack of an ap
+#define CPU_STACK_SIZE (8 * NUM_1K)
+
+//! index of the bsp in cpus, the only cpu that takes the irqs of the 8259A
+#define CPU_BSP 0
+
+union process_u;
+
+typedef struct cpu_s {
+    //! NOTE: the leading fields are accessed in kernel.asm & trap.asm, keep
+    //! them in sync with CPU_* in sconst.inc
+    union process_u *proc;      //<! proc running on the cpu, NULL if none
+    int              reenter;   //<! reenter times in kernel
+    void            *stack_top; //<! top of the kmalloc-ed cpu stack
+
+    uint8_t       apic_id;   //<! local apic id
+    volatile bool online;    //<! set by the cpu itself once it is up
+    volatile bool tlb_flush; //<! set by the cpu asking for a tlb flush
+    uint32_t      cr3;       //<! page table loaded on the cpu
+    void         *stack;     //<! kmalloc-ed cpu stack
+    tss_t         tss;       //<! tss of the cpu, see this_cpu
+} cpu_t;
+
+extern cpu_t cpus[NR_CPUS];
+extern int   nr_cpus;
+
+/*!
+ * \brief discover the cpus through the MP tables and start up all the aps
+ *
+ * \note the kernel falls back to uniprocessor if no MP table is found
+ *
+ * \attention called with interrupts disabled before any pcb is created
+ */
+void init_smp();
+
+/*!
+ * \brief cpu descriptor of the calling cpu
+ *
+ * \note a cpu is told by the tss it has loaded, and the bsp is the only one
+ * that may run the kernel before its tss is loaded
+ */
+cpu_t *this_cpu();
+
+/*!
+ * \brief index of the calling cpu in cpus
+ */
+int smp_cpu_id();
+
+/*!
+ * \brief number of cpus that are up
+ */
+int smp_nr_online();
+
+/*!
+ * \brief c entry of the aps, called from smpboot.asm, join the scheduler and
+ * never return once the ap is up
+ */
+void smp_ap_main();
+
+/*!
+ * \brief take the kernel lock, spin till it is given out
+ *
+ * \note a cpu holds the kernel lock whenever it runs in the kernel, the lock
+ * is taken on the way in from the user space or the idle halt, and dropped on
+ * the way back, see kernel.asm
+ *
+ * \attention called with interrupts disabled
+ */
+void smp_lock_kernel();
+
+/*!
+ * \brief drop the kernel lock, called with interrupts disabled
+ */
+void smp_unlock_kernel();
+
+/*!
+ * \brief whether any other cpu is waiting for the kernel lock
+ */
+bool smp_kernel_contended();
+
+/*!
+ * \brief give the kernel lock to the waiting cpus for a while
+ *
+ * \note busy waits for what is done by the other cpus, e.g. the irqs taken by
+ * the bsp, must relax in the loop, otherwise the others never get in
+ */
+void smp_kernel_relax();
+
+/*!
+ * \brief flush the tlb of the other cpus that have the page table loaded, and
+ * wait till all of them are done, called with the kernel lock held
+ */
+void smp_tlb_shootdown(uint32_t cr3);
+
+/*!
+ * \brief ask the cpu to schedule again, e.g. to wake it up from the idle halt
+ */
+void smp_send_resched(int cpu);
+
+void smp_local_timer_handler();
+void smp_resched_handler();
+void smp_tlb_flush_handler();
+
+/*!
+ * \brief halt till an interrupt is taken, called with interrupts disabled and
+ * the kernel lock dropped, and return with interrupts disabled
+ */
+void cpu_halt();
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <sys/sched.h>
+#include <sys/bcache.h>
+#include <sys/aio.h>
 #include <stdbool.h>
 
 enum {
@@ -27,6 +30,16 @@ enum {
     NR_killerabbit,
     NR_environ,
     NR_krnlobj_request,
+    NR_sbrk,
+    NR_thread_create,
+    NR_thread_join,
+    NR_sched_setaffinity,
+    NR_sched_getstat,
+    NR_futex,
+    NR_sync,
+    NR_bcache_getstat,
+    NR_aio_submit,
+    NR_aio_wait,
     NR_exit,
 
     //! total syscalls
@@ -48,9 +61,29 @@ void do_exit(int exit_code);
 //! from wait.c
 int do_wait(int *wstatus);
 
+//! from thread.c
+int do_thread_create(void *entry, void *func, void *arg);
+int do_thread_join(int tid, int *retval);
+
+//! from schedule.c
+int do_sched_setaffinity(int pid, int cpu);
+int do_sched_getstat(int cpu, sched_stat_t *stat);
+
+//! from futex.c
+int do_futex(int *uaddr, int op, int val);
+
+//! from bcache.c
+int do_sync();
+int do_bcache_getstat(bcache_stat_t *stat);
+
+//! from aio.c
+int do_aio_submit(int op, int fd, void *buf, int size, int pos);
+int do_aio_wait(int id);
+
 //! from malloc.c
 void *do_malloc(int size);
 void  do_free(void *ptr);
+void *do_sbrk(int increment);
 
 //! from proc.c
 int  do_get_pid();
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <list.h>
+
+//! hierarchical timer wheel, the first level holds timers due in the next
+//! 2^TIMER_ROOT_BITS ticks one slot per tick, each of the upper levels covers
+//! 2^TIMER_LEVEL_BITS times the range of the level below, and its timers are
+//! cascaded down once the lower level wraps
+#define TIMER_ROOT_BITS  8
+#define TIMER_LEVEL_BITS 6
+#define TIMER_ROOT_SIZE  (1 << TIMER_ROOT_BITS)
+#define TIMER_LEVEL_SIZE (1 << TIMER_LEVEL_BITS)
+#define NR_TIMER_LEVELS  3 //<! upper levels besides the root one
+#define TIMER_MAX_TICKS \
+    ((1u << (TIMER_ROOT_BITS + NR_TIMER_LEVELS * TIMER_LEVEL_BITS)) - 1)
+
+typedef void (*fn_timer_t)(void *arg);
+
+typedef struct ktimer_s {
+    struct list_head node;
+    uint32_t         expires; //<! tick to fire at
+    uint32_t         period;  //<! re-armed with the period if non-zero
+    fn_timer_t       func;
+    void            *arg;
+    bool             pending;
+} ktimer_t;
+
+/*!
+ * \brief init a disarmed timer, must not be called on a pending timer
+ */
+void ktimer_init(ktimer_t *timer, fn_timer_t func, void *arg);
+
+/*!
+ * \brief arm a one-shot timer to fire after the given ticks, an already
+ * pending timer is re-armed
+ *
+ * \note ticks longer than TIMER_MAX_TICKS are clamped
+ */
+void ktimer_arm(ktimer_t *timer, uint32_t ticks);
+
+/*!
+ * \brief arm a timer to fire every period ticks, starting period ticks later
+ */
+void ktimer_arm_periodic(ktimer_t *timer, uint32_t period);
+
+/*!
+ * \brief disarm the timer
+ *
+ * \return whether the timer was pending
+ */
+bool ktimer_cancel(ktimer_t *timer);
+
+bool ktimer_pending(const ktimer_t *timer);
+
+/*!
+ * \brief run the expired timers, called from the clock handler
+ *
+ * \note the wheel is walked and the callbacks are run with interrupts
+ * disabled, so callbacks must be short and never sleep
+ */
+void timer_tick();
+
+/*!
+ * \brief ticks from now to the next tick that has work for the wheel, with
+ * interrupts disabled
+ *
+ * \return 0 if some timers are already due, or no more than limit
+ */
+uint32_t timer_ticks_until_next(uint32_t limit);
+
+void init_timer();
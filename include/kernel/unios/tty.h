@@ -1,6 +1,7 @@
 #pragma once
 
 #include <unios/console.h>
+#include <unios/waitqueue.h>
 #include <stdint.h>
 
 #define TTY_BUFSZ 256 //<! tty buffer size
@@ -36,9 +37,17 @@ typedef struct tty_s {
     } mouse;
 
     console_t* console;
+
+    wait_queue_head_t rd_wait; //<! readers waiting for an enter
 } tty_t;
 
 void tty_wait_shell(int index);
+
+/*!
+ * \brief block until some tty waits for its shell and the request has not yet
+ * been taken by `tty_wait_for`
+ */
+void tty_wait_request();
 int  tty_wait_for();
 void tty_notify_shell();
 bool tty_select(int index);
@@ -47,5 +56,6 @@ int  tty_read(tty_t* tty, char* buf, int len);
 void tty_keyboard_proc(tty_t* tty, uint32_t key);
 
 void tty_handler();
+void init_tty();
 
 extern tty_t* tty_table[];
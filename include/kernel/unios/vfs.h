@@ -2,6 +2,7 @@
 
 #include <unios/fs_misc.h>
 #include <unios/fs_const.h>
+#include <stdint.h>
 
 #define NR_FS    10 //<! 最大 fs 数
 #define NR_FS_OP 3  //<! 最大 fs 操作表数
@@ -42,3 +43,13 @@ typedef struct vfs {
 } vfs_t;
 
 void vfs_setup_and_init();
+
+/*!
+ * \brief map the byte range of the file opened as fd to the sectors of the
+ * device, see `real_map_range`
+ *
+ * \return bytes of the file covered by the range, or -1 if the file can not be
+ * accessed by sectors
+ */
+int vfs_map_range(
+    int fd, int io_type, int pos, int size, int *dev, uint32_t *sector);
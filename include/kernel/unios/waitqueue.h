@@ -0,0 +1,59 @@
+#pragma once
+
+#include <list.h>
+#include <stdbool.h>
+
+struct pcb_s;
+
+//! NOTE: a sleeping proc hangs off the wait queue of the object it waits on
+//! through the link embedded in its pcb, so a proc waits on at most one queue
+//! at a time, and a wakeup only touches the procs actually waiting
+
+typedef struct wait_queue_head_s {
+    struct list_head head;
+} wait_queue_head_t;
+
+void init_wait_queue_head(wait_queue_head_t *wq);
+
+/*!
+ * \brief put the current proc on the wait queue and mark it SLEEPING, the
+ * caller should then check its condition and sched if still unsatisfied
+ *
+ * \note typical usage:
+ *
+ *     while (true) {
+ *         prepare_to_wait(wq);
+ *         if (condition) { break; }
+ *         sched();
+ *     }
+ *     finish_wait(wq);
+ */
+void prepare_to_wait(wait_queue_head_t *wq);
+
+/*!
+ * \brief mark the current proc READY and take it off the wait queue if it is
+ * still there
+ */
+void finish_wait(wait_queue_head_t *wq);
+
+/*!
+ * \brief wake up the earliest waiter
+ *
+ * \return whether any proc is waken up
+ */
+bool wake_up_one(wait_queue_head_t *wq);
+
+/*!
+ * \brief wake up all the waiters
+ *
+ * \return number of procs waken up
+ */
+int wake_up_all(wait_queue_head_t *wq);
+
+/*!
+ * \brief take the pcb off the wait queue it hangs on, no-op if none
+ *
+ * \note called by set_proc_stat once a pcb leaves SLEEPING, so that a pcb is
+ * on a wait queue only if it is SLEEPING
+ */
+void wait_queue_detach(struct pcb_s *pcb);
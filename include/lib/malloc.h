@@ -1,4 +1,24 @@
 #pragma once
 
+/*!
+ * \brief allocate from the user space heap, small requests are served from
+ * size-class free lists and never enter the kernel
+ */
 void *malloc(int size);
 void  free(void *ptr);
+
+/*!
+ * \brief move the program break by increment bytes
+ *
+ * \return the old break, or (void *)-1 on failure
+ */
+void *sbrk(int increment);
+
+/*!
+ * \brief allocate from the kernel managed heap, one syscall per call
+ *
+ * \note memory returned by kernel, e.g. getenv, also lives there, and free
+ * recognizes and routes it back automatically
+ */
+void *malloc_syscall(int size);
+void  free_syscall(void *ptr);
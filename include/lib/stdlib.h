@@ -14,6 +14,25 @@ int  killerabbit(int pid);
 void yield();
 void sleep(int n);
 
+/*!
+ * \brief create a thread running func(arg) in the address space of the caller,
+ * the heap & file table are shared as well, and the return value of func is
+ * taken as the exit code of the thread
+ *
+ * \return tid of the new thread or -1 on failure
+ *
+ * \note exit in a thread only terminates the thread itself, and all threads
+ * are torn down once the creator process exits
+ */
+int thread_create(int (*func)(void *arg), void *arg);
+
+/*!
+ * \brief wait for the thread of the same process to exit and release it
+ *
+ * \return tid of the joined thread or -1 if no such thread
+ */
+int thread_join(int tid, int *retval);
+
 bool         putenv(char *const *envp);
 char *const *getenv();
 
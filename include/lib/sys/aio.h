@@ -0,0 +1,27 @@
+#pragma once
+
+#define AIO_READ  0
+#define AIO_WRITE 1
+
+#define AIO_MAX_SIZE (64 * 1024) //<! bytes of one async io
+
+/*!
+ * \brief start an async transfer between buf and the file at pos, the data is
+ * moved between the disk and buf in place, bypassing the block cache
+ *
+ * \param op AIO_READ or AIO_WRITE
+ *
+ * \note only regular files of orange fs are supported, pos & size must be
+ * multiples of the sector size, size must not exceed AIO_MAX_SIZE, buf must
+ * be even aligned and the range must fit in the sectors reserved for the file
+ *
+ * \return id to wait on, or -1 on failure
+ */
+int aio_submit(int op, int fd, void *buf, int size, int pos);
+
+/*!
+ * \brief wait for the async io submitted by the caller itself
+ *
+ * \return bytes of the file transferred, or -1 on failure
+ */
+int aio_wait(int id);
@@ -0,0 +1,24 @@
+#pragma once
+
+typedef struct bcache_stat_s {
+    int nr_bufs;    //<! buffers held by the cache
+    int nr_dirty;   //<! buffers not written back yet
+    int hits;       //<! accumulated lookups served from the cache
+    int misses;     //<! accumulated lookups that went to the disk
+    int evictions;  //<! accumulated buffers reused for another sector
+    int writebacks; //<! accumulated dirty buffers written to the disk
+} bcache_stat_t;
+
+/*!
+ * \brief write all the dirty buffers of the block cache back to the disk
+ *
+ * \return 0 on success
+ */
+int sync();
+
+/*!
+ * \brief get a snapshot of the block cache stat
+ *
+ * \return 0 on success, -1 if stat is NULL
+ */
+int bcache_getstat(bcache_stat_t *stat);
@@ -0,0 +1,19 @@
+#pragma once
+
+enum futex_op {
+    FUTEX_WAIT, //<! sleep if *uaddr == val
+    FUTEX_WAKE, //<! wake up at most val waiters
+};
+
+/*!
+ * \brief fast user-space locking primitive, a futex is keyed by the address
+ * of the word within the address space, so it is private to the threads of
+ * a process
+ *
+ * \return for FUTEX_WAIT, 0 if woken up, -EAGAIN if *uaddr != val; for
+ * FUTEX_WAKE, number of waiters woken up; -EFAULT if uaddr is not a valid
+ * aligned user word, -EINVAL for unknown op
+ *
+ * \note a waiter may be woken up spuriously, callers should recheck the word
+ */
+int futex(int *uaddr, int op, int val);
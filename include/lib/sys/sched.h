@@ -0,0 +1,25 @@
+#pragma once
+
+#define SCHED_CPU_ANY (-1) //<! affinity of a proc free to migrate
+
+typedef struct sched_stat_s {
+    int active;        //<! 1 if the cpu runs the scheduler
+    int nr_ready;      //<! procs in the run queue, the running one included
+    int nr_switches;   //<! accumulated switches to a different proc
+    int nr_migrations; //<! accumulated procs moved in from other cpus
+    int nr_steals;     //<! accumulated balance rounds that stole procs
+} sched_stat_t;
+
+/*!
+ * \brief pin the proc to the cpu, or unpin it if cpu is SCHED_CPU_ANY
+ *
+ * \return 0 on success, -1 if no such proc or the cpu does not schedule
+ */
+int sched_setaffinity(int pid, int cpu);
+
+/*!
+ * \brief get a snapshot of the scheduler stat of the cpu
+ *
+ * \return 0 on success, -1 if no such cpu
+ */
+int sched_getstat(int cpu, sched_stat_t *stat);
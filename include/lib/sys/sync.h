@@ -1,6 +1,7 @@
 #pragma once
 
 #include <sys/types.h>
+#include <stdbool.h>
 
 #define INVALID_HANDLE ((handle_t)-1)
 
@@ -9,3 +10,45 @@ handle_t krnlobj_create(int user_id);
 void     krnlobj_destroy(handle_t handle);
 void     krnlobj_lock(int user_id);
 void     krnlobj_unlock(int user_id);
+
+//! NOTE: the primitives below are built on futex, an uncontended op is a single
+//! atomic op in user space and a contended one sleeps in the kernel, they are
+//! shared by the threads of a process, see `thread_create`
+
+typedef struct mutex_s {
+    int state; //<! 0: unlocked, 1: locked, 2: locked and maybe contended
+} mutex_t;
+
+typedef struct cond_s {
+    int seq; //<! bumped on every signal & broadcast
+} cond_t;
+
+typedef struct sem_s {
+    int count;
+    int nr_waiters;
+} sem_t;
+
+#define MUTEX_INITIALIZER {0}
+#define COND_INITIALIZER  {0}
+
+void mutex_init(mutex_t *mutex);
+void mutex_lock(mutex_t *mutex);
+bool mutex_trylock(mutex_t *mutex);
+void mutex_unlock(mutex_t *mutex);
+
+void cond_init(cond_t *cond);
+
+/*!
+ * \brief atomically unlock the mutex and wait for a signal, the mutex is locked
+ * again before it returns
+ *
+ * \note spurious wakeups are possible, always wait in a loop on the predicate
+ */
+void cond_wait(cond_t *cond, mutex_t *mutex);
+void cond_signal(cond_t *cond);
+void cond_broadcast(cond_t *cond);
+
+void sem_init(sem_t *sem, int value);
+void sem_wait(sem_t *sem);
+bool sem_trywait(sem_t *sem);
+void sem_post(sem_t *sem);
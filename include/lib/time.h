@@ -3,4 +3,5 @@
 #include <sys/types.h>
 
 clock_t clock_from_sysclk(int ticks);
+int     sysclk_from_clock(clock_t ms);
 clock_t clock();
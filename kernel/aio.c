@@ -0,0 +1,113 @@
+#include <unios/aio.h>
+#include <unios/blkdev.h>
+#include <unios/bcache.h>
+#include <unios/vfs.h>
+#include <unios/proc.h>
+#include <unios/interrupt.h>
+#include <unios/fs_const.h>
+#include <unios/syscall.h>
+#include <sys/aio.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <math.h>
+
+//! NOTE: the slots are protected by disabling interrupts since they are also
+//! touched by `aio_orphan` on the way a pid is detached
+typedef struct aio_s {
+    bool  used;
+    bool  orphan; //<! the owner is gone, reclaimed once the bio is done
+    int   owner;  //<! pid of the submitter
+    int   bytes;  //<! bytes of the file covered by the io
+    int   result; //<! set on completion
+    bio_t bio;
+} aio_t;
+
+static aio_t aio_table[NR_AIO];
+
+void init_aio() {
+    for (int i = 0; i < NR_AIO; ++i) {
+        aio_table[i].used   = false;
+        aio_table[i].orphan = false;
+    }
+}
+
+static aio_t *aio_alloc() {
+    aio_t *aio = NULL;
+    disable_int_begin();
+    for (int i = 0; i < NR_AIO; ++i) {
+        aio_t *p = &aio_table[i];
+        if (p->used && !(p->orphan && p->bio.done)) { continue; }
+        p->used   = true;
+        p->orphan = false;
+        p->owner  = p_proc_current->pcb.pid;
+        aio       = p;
+        break;
+    }
+    disable_int_end();
+    return aio;
+}
+
+static void aio_free(aio_t *aio) {
+    disable_int_begin();
+    aio->used = false;
+    disable_int_end();
+}
+
+void aio_orphan(int pid) {
+    for (int i = 0; i < NR_AIO; ++i) {
+        aio_t *aio = &aio_table[i];
+        if (aio->used && aio->owner == pid) { aio->orphan = true; }
+    }
+}
+
+static void aio_end_io(bio_t *bio) {
+    aio_t *aio  = bio->private;
+    aio->result = bio->error == 0 ? aio->bytes : -1;
+}
+
+int do_aio_submit(int op, int fd, void *buf, int size, int pos) {
+    if (op != AIO_READ && op != AIO_WRITE) { return -1; }
+    if (size > AIO_MAX_SIZE) { return -1; }
+
+    int      io_type = op == AIO_READ ? DEV_READ : DEV_WRITE;
+    int      dev     = NO_DEV;
+    uint32_t sector  = 0;
+    int      bytes   = vfs_map_range(fd, io_type, pos, size, &dev, &sector);
+    if (bytes < 0) { return -1; }
+
+    //! NOTE: a read stops at the sector holding the end of the file
+    if (io_type == DEV_READ) { size = round_up(bytes, SECTOR_SIZE); }
+
+    aio_t *aio = aio_alloc();
+    if (aio == NULL) { return -1; }
+    aio->bytes  = bytes;
+    aio->result = -1;
+    bio_init(&aio->bio, io_type, MINOR(dev), sector);
+    aio->bio.end_io  = aio_end_io;
+    aio->bio.private = aio;
+    if (!bio_add_buf(&aio->bio, buf, size)) {
+        aio_free(aio);
+        return -1;
+    }
+
+    //! NOTE: the disk is accessed in place, so the dirty buffers must reach it
+    //! first, and the clean ones of the sectors to write go stale
+    bcache_sync(dev);
+    if (io_type == DEV_WRITE) {
+        bcache_forget(dev, sector, aio->bio.nr_sects);
+    }
+    blk_submit(&aio->bio);
+    return aio - aio_table;
+}
+
+int do_aio_wait(int id) {
+    if (id < 0 || id >= NR_AIO) { return -1; }
+    aio_t *aio = &aio_table[id];
+    if (!aio->used || aio->orphan) { return -1; }
+    if (aio->owner != p_proc_current->pcb.pid) { return -1; }
+
+    blk_wait(&aio->bio);
+    int result = aio->result;
+    aio_free(aio);
+    return result;
+}
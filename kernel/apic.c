@@ -0,0 +1,110 @@
+#include <unios/apic.h>
+#include <unios/clock.h>
+#include <unios/page.h>
+#include <arch/x86.h>
+#include <stdint.h>
+#include <math.h>
+
+#define LAPIC_CALIBRATE_US 10000
+
+static phyaddr_t          lapic_phy        = 0;
+static volatile uint32_t *lapic            = NULL;
+static uint32_t           lapic_timer_rate = 0; //<! timer counts per second
+
+static uint32_t lapic_read(int reg) {
+    return lapic[reg / sizeof(uint32_t)];
+}
+
+static void lapic_write(int reg, uint32_t value) {
+    lapic[reg / sizeof(uint32_t)] = value;
+    //! NOTE: read back to wait for the write to finish
+    (void)lapic[LAPIC_ID / sizeof(uint32_t)];
+}
+
+static void lapic_send(uint8_t apic_id, uint32_t cmd) {
+    lapic_write(LAPIC_ICRHI, (uint32_t)apic_id << 24);
+    lapic_write(LAPIC_ICRLO, cmd);
+    while ((lapic_read(LAPIC_ICRLO) & ICR_DELIVS) != 0) {}
+}
+
+void lapic_setup(phyaddr_t phy_base) {
+    lapic_phy = phy_base;
+    lapic_map(rcr3());
+    invlpg(LAPIC_LIN_BASE);
+    lapic = (volatile uint32_t *)LAPIC_LIN_BASE;
+}
+
+bool lapic_ready() {
+    return lapic != NULL;
+}
+
+void lapic_map(uint32_t cr3) {
+    if (lapic_phy == 0) { return; }
+    //! NOTE: registers are memory mapped io, so never cache them
+    uint32_t attr = PG_P | PG_S | PG_RWX | PG_MASK_PWT | PG_MASK_PCD;
+    pg_map_laddr(cr3, LAPIC_LIN_BASE, lapic_phy, attr, attr);
+}
+
+void lapic_init() {
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+    lapic_write(LAPIC_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LINT0, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LINT1, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_ERROR, LAPIC_LVT_MASKED);
+    //! NOTE: esr is cleared by back-to-back writes
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_ESR, 0);
+    lapic_eoi();
+    lapic_write(LAPIC_TPR, 0);
+}
+
+void lapic_enable_bsp() {
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+    //! NOTE: the lvts are masked while the local apic is software disabled, so
+    //! the virtual wire is set up again rather than kept as the bios left it
+    lapic_write(LAPIC_LINT0, LAPIC_LVT_EXTINT);
+    lapic_write(LAPIC_LINT1, LAPIC_LVT_NMI);
+    lapic_write(LAPIC_TPR, 0);
+}
+
+void lapic_calibrate_timer() {
+    lapic_write(LAPIC_TDCR, LAPIC_TDCR_X16);
+    lapic_write(LAPIC_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_TICR, 0xffffffff);
+    sysclk_delay_us(LAPIC_CALIBRATE_US);
+    uint32_t elapsed = 0xffffffff - lapic_read(LAPIC_TCCR);
+    lapic_write(LAPIC_TICR, 0);
+    lapic_timer_rate = elapsed * (1000000 / LAPIC_CALIBRATE_US);
+}
+
+void lapic_start_timer(uint8_t vector, uint32_t hz) {
+    lapic_write(LAPIC_TDCR, LAPIC_TDCR_X16);
+    lapic_write(LAPIC_TIMER, LAPIC_TIMER_PERIODIC | vector);
+    lapic_write(LAPIC_TICR, max(lapic_timer_rate / hz, 1));
+}
+
+uint8_t lapic_id() {
+    if (!lapic_ready()) { return 0; }
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+void lapic_eoi() {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+void lapic_send_ipi(uint8_t apic_id, uint8_t vector) {
+    lapic_send(apic_id, ICR_FIXED | ICR_ASSERT | vector);
+}
+
+void lapic_start_ap(uint8_t apic_id, phyaddr_t entry) {
+    //! NOTE: the universal startup algorithm, ref MP spec v1.4 B.4
+    lapic_write(LAPIC_ESR, 0);
+    lapic_send(apic_id, ICR_INIT | ICR_LEVEL | ICR_ASSERT);
+    lapic_send(apic_id, ICR_INIT | ICR_LEVEL | ICR_DEASSERT);
+    sysclk_delay_us(10000);
+    //! the second sipi is ignored if the first one has taken effect
+    for (int i = 0; i < 2; ++i) {
+        lapic_send(apic_id, ICR_STARTUP | (entry >> 12));
+        sysclk_delay_us(200);
+    }
+}
@@ -0,0 +1,324 @@
+#include <unios/bcache.h>
+#include <unios/proc.h>
+#include <unios/syscall.h>
+#include <unios/hd.h>
+#include <unios/blkdev.h>
+#include <unios/fs_const.h>
+#include <unios/schedule.h>
+#include <unios/memory.h>
+#include <unios/assert.h>
+#include <sys/bcache.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic.h>
+#include <list.h>
+
+//! NOTE: bcache_lock protects the hash, the lru list, the refcnt & the identity
+//! of the buffers and the stat, while the data & the dirty flag of a buffer are
+//! protected by its own lock
+static uint32_t         bcache_lock;
+static buf_head_t      *bufs;
+static struct list_head bcache_buckets[NR_BCACHE_BUCKETS];
+static struct list_head lru_list;
+static bcache_stat_t    bcache_stat;
+
+static struct list_head *bcache_bucket(int dev, uint32_t sector) {
+    uint32_t hash = (sector ^ ((uint32_t)dev << 24)) * 2654435761u;
+    return &bcache_buckets[hash >> (32 - BCACHE_HASH_BITS)];
+}
+
+static void bcache_rdwt(int io_type, buf_head_t *bh) {
+    int error = blk_rdwt(io_type, MINOR(bh->dev), bh->sector, 1, bh->data);
+    assert(error == 0);
+}
+
+void init_bcache() {
+    bufs       = kmalloc(NR_BCACHE_BUFS * sizeof(buf_head_t));
+    void *data = kmalloc(NR_BCACHE_BUFS * SECTOR_SIZE);
+    assert(bufs != NULL && data != NULL);
+
+    for (int i = 0; i < NR_BCACHE_BUCKETS; ++i) {
+        INIT_LIST_HEAD(&bcache_buckets[i]);
+    }
+    INIT_LIST_HEAD(&lru_list);
+    for (int i = 0; i < NR_BCACHE_BUFS; ++i) {
+        buf_head_t *bh = &bufs[i];
+        bh->dev        = NO_DEV;
+        bh->sector     = 0;
+        bh->refcnt     = 0;
+        bh->valid      = false;
+        bh->dirty      = false;
+        bh->lock       = 0;
+        bh->data       = data + i * SECTOR_SIZE;
+        INIT_LIST_HEAD(&bh->hash_node);
+        list_add_tail(&bh->lru_node, &lru_list);
+    }
+
+    memset(&bcache_stat, 0, sizeof(bcache_stat));
+    bcache_stat.nr_bufs = NR_BCACHE_BUFS;
+    bcache_lock         = 0;
+}
+
+static buf_head_t *bcache_lookup(int dev, uint32_t sector) {
+    struct list_head *head = bcache_bucket(dev, sector);
+    buf_head_t       *bh   = NULL;
+    list_for_each_entry(bh, head, hash_node) {
+        if (bh->dev == dev && bh->sector == sector) { return bh; }
+    }
+    return NULL;
+}
+
+static buf_head_t *bcache_evict() {
+    buf_head_t *bh = NULL;
+    //! NOTE: the lru list is ordered from the coldest to the hottest
+    list_for_each_entry(bh, &lru_list, lru_node) {
+        if (bh->refcnt == 0) { break; }
+    }
+    assert(&bh->lru_node != &lru_list && "all the buffers are pinned");
+
+    if (bh->dev != NO_DEV) { ++bcache_stat.evictions; }
+    if (bh->dirty) {
+        //! NOTE: nobody else can reach the unreferenced buffer while the cache
+        //! is locked, so write it back in place without its own lock
+        bcache_rdwt(DEV_WRITE, bh);
+        bh->dirty = false;
+        ++bcache_stat.writebacks;
+    }
+    return bh;
+}
+
+/*!
+ * \brief get the locked buffer of the sector whose data might be not read in
+ */
+static buf_head_t *bget(int dev, uint32_t sector) {
+    lock_or(&bcache_lock, sched);
+    buf_head_t *bh = bcache_lookup(dev, sector);
+    if (bh != NULL) {
+        ++bcache_stat.hits;
+    } else {
+        ++bcache_stat.misses;
+        bh         = bcache_evict();
+        bh->dev    = dev;
+        bh->sector = sector;
+        bh->valid  = false;
+        list_move(&bh->hash_node, bcache_bucket(dev, sector));
+    }
+    ++bh->refcnt;
+    list_move_tail(&bh->lru_node, &lru_list);
+    release(&bcache_lock);
+
+    lock_or(&bh->lock, sched);
+    return bh;
+}
+
+buf_head_t *bread(int dev, uint32_t sector) {
+    buf_head_t *bh = bget(dev, sector);
+    if (!bh->valid) {
+        bcache_rdwt(DEV_READ, bh);
+        bh->valid = true;
+    }
+    return bh;
+}
+
+void bdirty(buf_head_t *bh) {
+    bh->dirty = true;
+}
+
+void brelse(buf_head_t *bh) {
+    release(&bh->lock);
+    lock_or(&bcache_lock, sched);
+    assert(bh->refcnt > 0);
+    --bh->refcnt;
+    release(&bcache_lock);
+}
+
+void bcache_read(int dev, uint32_t sector, void *buf) {
+    buf_head_t *bh = bread(dev, sector);
+    memcpy(buf, bh->data, SECTOR_SIZE);
+    brelse(bh);
+}
+
+void bcache_write(int dev, uint32_t sector, const void *buf) {
+    buf_head_t *bh = bget(dev, sector);
+    memcpy(bh->data, buf, SECTOR_SIZE);
+    bh->valid = true;
+    bdirty(bh);
+    brelse(bh);
+}
+
+/*!
+ * \brief pin the cached buffer of the sector if any, without locking it
+ */
+static buf_head_t *bcache_pin(int dev, uint32_t sector) {
+    lock_or(&bcache_lock, sched);
+    buf_head_t *bh = bcache_lookup(dev, sector);
+    if (bh != NULL) {
+        ++bcache_stat.hits;
+        ++bh->refcnt;
+        list_move_tail(&bh->lru_node, &lru_list);
+    }
+    release(&bcache_lock);
+    return bh;
+}
+
+void bcache_forget(int dev, uint32_t sector, int nr_sects) {
+    lock_or(&bcache_lock, sched);
+    for (int i = 0; i < nr_sects; ++i) {
+        buf_head_t *bh = bcache_lookup(dev, sector + i);
+        if (bh == NULL || bh->refcnt != 0 || bh->dirty) { continue; }
+        list_del_init(&bh->hash_node);
+        list_move(&bh->lru_node, &lru_list);
+        bh->dev   = NO_DEV;
+        bh->valid = false;
+    }
+    release(&bcache_lock);
+}
+
+static void bcache_rdwt_cached(
+    int io_type, int dev, uint32_t sector, int nr_sects, void *buf) {
+    for (int i = 0; i < nr_sects; ++i) {
+        void *data = buf + i * SECTOR_SIZE;
+        if (io_type == DEV_READ) {
+            bcache_read(dev, sector + i, data);
+        } else {
+            bcache_write(dev, sector + i, data);
+        }
+    }
+}
+
+void bcache_rdwt_sects(
+    int io_type, int dev, uint32_t sector, int nr_sects, void *buf) {
+    //! NOTE: the device moves words, an odd buffer goes through the cache
+    if (nr_sects < BCACHE_DIRECT_SECTS || ((uint32_t)buf & 0x1) != 0) {
+        bcache_rdwt_cached(io_type, dev, sector, nr_sects, buf);
+        return;
+    }
+
+    int start = 0; //<! first sector of the pending direct run
+    for (int i = 0; i <= nr_sects; ++i) {
+        buf_head_t *bh = i < nr_sects ? bcache_pin(dev, sector + i) : NULL;
+        if (bh == NULL && i < nr_sects) { continue; }
+        if (i > start) {
+            void *data = buf + start * SECTOR_SIZE;
+            int   n    = i - start;
+            //! NOTE: a buffer the device can not reach faults through the cache
+            if (blk_rdwt(io_type, MINOR(dev), sector + start, n, data) != 0) {
+                bcache_rdwt_cached(io_type, dev, sector + start, n, data);
+            }
+        }
+        start = i + 1;
+        if (bh == NULL) { break; }
+
+        lock_or(&bh->lock, sched);
+        void *data = buf + i * SECTOR_SIZE;
+        if (io_type == DEV_READ) {
+            if (!bh->valid) {
+                bcache_rdwt(DEV_READ, bh);
+                bh->valid = true;
+            }
+            memcpy(data, bh->data, SECTOR_SIZE);
+        } else {
+            memcpy(bh->data, data, SECTOR_SIZE);
+            bh->valid = true;
+            bdirty(bh);
+        }
+        brelse(bh);
+    }
+
+    if (io_type == DEV_WRITE) { bcache_forget(dev, sector, nr_sects); }
+}
+
+static void bcache_sort(buf_head_t **bhs, int total) {
+    for (int i = 1; i < total; ++i) {
+        buf_head_t *bh = bhs[i];
+        int         j  = i;
+        for (; j > 0; --j) {
+            buf_head_t *prev = bhs[j - 1];
+            if (prev->dev < bh->dev) { break; }
+            if (prev->dev == bh->dev && prev->sector < bh->sector) { break; }
+            bhs[j] = prev;
+        }
+        bhs[j] = bh;
+    }
+}
+
+void bcache_sync(int dev) {
+    buf_head_t *bhs[NR_BCACHE_BUFS];
+    void       *sects[NR_BCACHE_BUFS];
+    int         total = 0;
+
+    //! NOTE: a racy peek at the dirty flag is enough to skip the clean ones,
+    //! it is checked again under the lock of the buffer
+    lock_or(&bcache_lock, sched);
+    for (int i = 0; i < NR_BCACHE_BUFS; ++i) {
+        buf_head_t *bh = &bufs[i];
+        if (!bh->dirty || bh->dev == NO_DEV) { continue; }
+        if (dev != NO_DEV && bh->dev != dev) { continue; }
+        ++bh->refcnt;
+        bhs[total++] = bh;
+    }
+    release(&bcache_lock);
+
+    //! NOTE: others never hold more than one buffer at a time, so it is safe to
+    //! lock them all here as long as they are locked in order
+    bcache_sort(bhs, total);
+    for (int i = 0; i < total; ++i) { lock_or(&bhs[i]->lock, sched); }
+
+    //! coalesce the adjacent dirty sectors into one write
+    int written = 0;
+    for (int i = 0; i < total;) {
+        if (!bhs[i]->dirty) {
+            ++i;
+            continue;
+        }
+        int end = i + 1;
+        while (end < total && end - i < HD_MAX_SECTS_PER_CMD) {
+            buf_head_t *bh = bhs[end];
+            if (!bh->dirty || bh->dev != bhs[i]->dev) { break; }
+            if (bh->sector != bhs[end - 1]->sector + 1) { break; }
+            ++end;
+        }
+        for (int j = i; j < end; ++j) {
+            sects[j]      = bhs[j]->data;
+            bhs[j]->dirty = false;
+        }
+        int error = blk_rdwt_sects(
+            DEV_WRITE, MINOR(bhs[i]->dev), bhs[i]->sector, end - i, sects + i);
+        assert(error == 0);
+        written += end - i;
+        i        = end;
+    }
+
+    for (int i = 0; i < total; ++i) { brelse(bhs[i]); }
+    lock_or(&bcache_lock, sched);
+    bcache_stat.writebacks += written;
+    release(&bcache_lock);
+}
+
+int do_sync() {
+    bcache_sync(NO_DEV);
+    //! NOTE: also kick off the plugged async io that nobody waits on yet
+    blk_run_queues();
+    return 0;
+}
+
+int do_bcache_getstat(bcache_stat_t *stat) {
+    if (stat == NULL) { return -1; }
+    lock_or(&bcache_lock, sched);
+    *stat          = bcache_stat;
+    stat->nr_dirty = 0;
+    for (int i = 0; i < NR_BCACHE_BUFS; ++i) {
+        if (bufs[i].dirty) { ++stat->nr_dirty; }
+    }
+    release(&bcache_lock);
+    return 0;
+}
+
+void bcache_flusher() {
+    //! NOTE: the flusher runs in ring 1, the sync must be issued as a syscall
+    while (true) {
+        sleep(BCACHE_FLUSH_TICKS);
+        sync();
+    }
+}
@@ -0,0 +1,437 @@
+#include <unios/blkdev.h>
+#include <unios/hd.h>
+#include <unios/fs_const.h>
+#include <unios/slab.h>
+#include <unios/page.h>
+#include <unios/memory.h>
+#include <unios/layout.h>
+#include <unios/clock.h>
+#include <unios/kstate.h>
+#include <unios/schedule.h>
+#include <unios/assert.h>
+#include <arch/x86.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic.h>
+#include <list.h>
+#include <math.h>
+
+//! bios in flight of a synchronous transfer
+#define BLK_SYNC_BIOS 8
+
+//! NOTE: a request gathers the adjacent bios of the same direction, and is
+//! served by exactly one drive command
+typedef struct blk_request_s {
+    int              io_type;
+    int              device;
+    uint32_t         sector;    //<! relative to the device
+    uint32_t         lba;       //<! on the whole drive, key of the elevator
+    int              nr_sects;
+    int              nr_vecs;
+    bio_vec_t        vecs[BLK_REQ_MAX_VECS];
+    int              deadline;  //<! in system ticks
+    bio_t           *bios;      //<! in the order of the sectors
+    bio_t           *last_bio;
+    struct list_head sort_node; //<! link in the queue, in the order of lba
+    struct list_head fifo_node; //<! link in the fifo of its direction
+} blk_request_t;
+
+typedef struct blk_queue_s {
+    uint32_t          lock;
+    bool              running;  //<! someone is dispatching the requests
+    int               nr_pending;
+    uint32_t          head_lba; //<! where the last dispatched request ends
+    struct list_head  sorted;   //<! pending requests in the order of lba
+    struct list_head  fifo[2];  //<! pending reads & writes, oldest first
+    wait_queue_head_t wait;     //<! waiters of the bios of the queue
+} blk_queue_t;
+
+//! one queue per drive
+#define NR_BLK_QUEUES (sizeof(hd_info) / sizeof(hd_info_t))
+
+static blk_queue_t   blk_queues[NR_BLK_QUEUES];
+static kmem_cache_t *request_cache;
+static kmem_cache_t *bio_cache;
+
+static blk_queue_t *blk_queue_of(int device) {
+    return &blk_queues[hd_drive_of(device)];
+}
+
+static struct list_head *blk_fifo_of(blk_queue_t *q, int io_type) {
+    return &q->fifo[io_type == DEV_READ ? 0 : 1];
+}
+
+void init_blkdev() {
+    for (int i = 0; i < NR_BLK_QUEUES; ++i) {
+        blk_queue_t *q = &blk_queues[i];
+        q->lock        = 0;
+        q->running     = false;
+        q->nr_pending  = 0;
+        q->head_lba    = 0;
+        INIT_LIST_HEAD(&q->sorted);
+        INIT_LIST_HEAD(&q->fifo[0]);
+        INIT_LIST_HEAD(&q->fifo[1]);
+        init_wait_queue_head(&q->wait);
+    }
+    request_cache =
+        kmem_cache_create("blk_request", sizeof(blk_request_t), 0, NULL);
+    bio_cache = kmem_cache_create("bio", sizeof(bio_t), 0, NULL);
+    assert(request_cache != NULL && bio_cache != NULL);
+}
+
+void bio_init(bio_t *bio, int io_type, int device, uint32_t sector) {
+    bio->io_type  = io_type;
+    bio->device   = device;
+    bio->sector   = sector;
+    bio->nr_sects = 0;
+    bio->nr_vecs  = 0;
+    bio->pinned   = false;
+    bio->done     = false;
+    bio->error    = 0;
+    bio->end_io   = NULL;
+    bio->private  = NULL;
+    bio->next     = NULL;
+}
+
+/*!
+ * \brief append the segment to the vecs, merged into the last one if adjacent
+ */
+static bool vec_append(
+    bio_vec_t *vecs, int *nr_vecs, int max_vecs, phyaddr_t phy, int size) {
+    if (*nr_vecs > 0) {
+        bio_vec_t *last = &vecs[*nr_vecs - 1];
+        if (last->phyaddr + last->size == phy) {
+            last->size += size;
+            return true;
+        }
+    }
+    if (*nr_vecs == max_vecs) { return false; }
+    vecs[*nr_vecs].phyaddr = phy;
+    vecs[*nr_vecs].size    = size;
+    ++*nr_vecs;
+    return true;
+}
+
+bool bio_add_buf(bio_t *bio, void *buf, int size) {
+    assert(size > 0 && size % SECTOR_SIZE == 0);
+    uint32_t laddr = (uint32_t)buf;
+    bool     user  = laddr < KernelLinBase;
+    if ((laddr & 0x1) != 0) { return false; }
+    if (bio->nr_sects + size / SECTOR_SIZE > BLK_MAX_SECTS) { return false; }
+    //! NOTE: the frames of a bio are either all pinned or none of them
+    if (bio->nr_sects > 0 && user != bio->pinned) { return false; }
+
+    uint32_t cr3       = rcr3();
+    int      nr_vecs   = bio->nr_vecs;
+    int      last_size = nr_vecs > 0 ? bio->vecs[nr_vecs - 1].size : 0;
+    for (int off = 0; off < size;) {
+        uint32_t la = laddr + off;
+        //! NOTE: fault the user page in and break its cow in advance, the
+        //! device never triggers a page fault
+        if (user) {
+            volatile uint8_t *p = (void *)la;
+            if (bio->io_type == DEV_READ) {
+                *p = *p;
+            } else {
+                (void)*p;
+            }
+        }
+        int  n  = min(size - off, NUM_4K - pg_offset(la));
+        bool ok = pg_addr_pte_exist(cr3, la);
+        if (ok && bio->io_type == DEV_READ) {
+            ok = pg_pte_attr(pg_pde(cr3, la), la, PG_MASK_RW);
+        }
+        if (ok) {
+            ok = vec_append(
+                bio->vecs,
+                &bio->nr_vecs,
+                BIO_MAX_VECS,
+                pg_laddr_phyaddr(cr3, la),
+                n);
+        }
+        if (!ok) {
+            bio->nr_vecs = nr_vecs;
+            if (nr_vecs > 0) { bio->vecs[nr_vecs - 1].size = last_size; }
+            return false;
+        }
+        off += n;
+    }
+    bio->pinned    = user;
+    bio->nr_sects += size / SECTOR_SIZE;
+    return true;
+}
+
+/*!
+ * \brief take or drop one reference of each frame of the bio
+ */
+static void bio_pin(bio_t *bio, bool pin) {
+    for (int i = 0; i < bio->nr_vecs; ++i) {
+        phyaddr_t phy   = pg_frame_phyaddr(bio->vecs[i].phyaddr);
+        phyaddr_t limit = bio->vecs[i].phyaddr + bio->vecs[i].size;
+        for (; phy < limit; phy += NUM_4K) {
+            if (pin) {
+                ref_phypage(phy);
+            } else {
+                free_phypage(phy);
+            }
+        }
+    }
+}
+
+static void blk_sort_insert(blk_queue_t *q, blk_request_t *req) {
+    blk_request_t *pos = NULL;
+    list_for_each_entry(pos, &q->sorted, sort_node) {
+        if (pos->lba > req->lba) { break; }
+    }
+    list_add_tail(&req->sort_node, &pos->sort_node);
+}
+
+/*!
+ * \brief merge the bio into a pending request that it is adjacent to
+ *
+ * \return false if no request can take it
+ */
+static bool blk_merge(blk_queue_t *q, bio_t *bio) {
+    blk_request_t *req = NULL;
+    list_for_each_entry(req, &q->sorted, sort_node) {
+        if (req->io_type != bio->io_type || req->device != bio->device) {
+            continue;
+        }
+        if (req->nr_sects + bio->nr_sects > BLK_MAX_SECTS) { continue; }
+        if (req->nr_vecs + bio->nr_vecs > BLK_REQ_MAX_VECS) { continue; }
+
+        if (req->sector + req->nr_sects == bio->sector) {
+            //! back merge, the bio goes after the request
+            for (int i = 0; i < bio->nr_vecs; ++i) {
+                bio_vec_t *vec = &bio->vecs[i];
+                vec_append(
+                    req->vecs,
+                    &req->nr_vecs,
+                    BLK_REQ_MAX_VECS,
+                    vec->phyaddr,
+                    vec->size);
+            }
+            req->nr_sects       += bio->nr_sects;
+            req->last_bio->next  = bio;
+            req->last_bio        = bio;
+            return true;
+        }
+
+        if (bio->sector + bio->nr_sects == req->sector) {
+            //! front merge, the bio goes before the request
+            bio_vec_t vecs[BLK_REQ_MAX_VECS];
+            int       nr_vecs = bio->nr_vecs;
+            memcpy(vecs, bio->vecs, nr_vecs * sizeof(bio_vec_t));
+            for (int i = 0; i < req->nr_vecs; ++i) {
+                bio_vec_t *vec = &req->vecs[i];
+                vec_append(
+                    vecs, &nr_vecs, BLK_REQ_MAX_VECS, vec->phyaddr, vec->size);
+            }
+            memcpy(req->vecs, vecs, nr_vecs * sizeof(bio_vec_t));
+            req->nr_vecs   = nr_vecs;
+            req->sector    = bio->sector;
+            req->lba      -= bio->nr_sects;
+            req->nr_sects += bio->nr_sects;
+            bio->next      = req->bios;
+            req->bios      = bio;
+            list_del(&req->sort_node);
+            blk_sort_insert(q, req);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void blk_enqueue(blk_queue_t *q, blk_request_t *req, bio_t *bio) {
+    bool read     = bio->io_type == DEV_READ;
+    req->io_type  = bio->io_type;
+    req->device   = bio->device;
+    req->sector   = bio->sector;
+    req->lba      = hd_abs_sector(bio->device, bio->sector);
+    req->nr_sects = bio->nr_sects;
+    req->nr_vecs  = bio->nr_vecs;
+    req->deadline = system_ticks + (read ? BLK_READ_EXPIRE : BLK_WRITE_EXPIRE);
+    req->bios     = bio;
+    req->last_bio = bio;
+    memcpy(req->vecs, bio->vecs, bio->nr_vecs * sizeof(bio_vec_t));
+    blk_sort_insert(q, req);
+    list_add_tail(&req->fifo_node, blk_fifo_of(q, req->io_type));
+    ++q->nr_pending;
+}
+
+void blk_submit(bio_t *bio) {
+    assert(bio->nr_sects > 0 && bio->nr_sects <= BLK_MAX_SECTS);
+    blk_queue_t   *q   = blk_queue_of(bio->device);
+    blk_request_t *req = kmem_cache_alloc(request_cache);
+    assert(req != NULL);
+    bio->next = NULL;
+    bio->done = false;
+    //! NOTE: the owner of user frames may be gone before the completion, keep
+    //! them from being reused till then
+    if (bio->pinned) { bio_pin(bio, true); }
+
+    lock_or(&q->lock, sched);
+    if (blk_merge(q, bio)) {
+        kmem_cache_free(request_cache, req);
+    } else {
+        blk_enqueue(q, req, bio);
+    }
+    bool kick = !q->running && q->nr_pending >= BLK_PLUG_DEPTH;
+    release(&q->lock);
+
+    if (kick) { blk_run_queues(); }
+}
+
+/*!
+ * \brief pick the next request to serve and take it off the queue
+ *
+ * \note an expired request is served first to bound the latency, otherwise the
+ * requests are swept in the ascending order of lba from the head and wrap
+ * around at the end, aka c-scan
+ */
+static blk_request_t *blk_elv_next(blk_queue_t *q) {
+    if (q->nr_pending == 0) { return NULL; }
+
+    blk_request_t *req = NULL;
+    for (int i = 0; i < 2 && req == NULL; ++i) {
+        if (list_empty(&q->fifo[i])) { continue; }
+        blk_request_t *oldest =
+            list_first_entry(&q->fifo[i], blk_request_t, fifo_node);
+        if (system_ticks - oldest->deadline >= 0) { req = oldest; }
+    }
+    if (req == NULL) {
+        blk_request_t *pos = NULL;
+        list_for_each_entry(pos, &q->sorted, sort_node) {
+            if (pos->lba >= q->head_lba) {
+                req = pos;
+                break;
+            }
+        }
+    }
+    if (req == NULL) {
+        req = list_first_entry(&q->sorted, blk_request_t, sort_node);
+    }
+
+    list_del(&req->sort_node);
+    list_del(&req->fifo_node);
+    --q->nr_pending;
+    q->head_lba = req->lba + req->nr_sects;
+    return req;
+}
+
+static void blk_complete(blk_request_t *req, int error) {
+    bio_t *bio = req->bios;
+    while (bio != NULL) {
+        //! NOTE: the bio may be reused as soon as it is done
+        bio_t *next = bio->next;
+        if (bio->pinned) { bio_pin(bio, false); }
+        bio->error = error;
+        if (bio->end_io != NULL) { bio->end_io(bio); }
+        bio->done = true;
+        bio       = next;
+    }
+    kmem_cache_free(request_cache, req);
+}
+
+/*!
+ * \brief serve the requests of the queue till it is drained, or return at once
+ * if someone else is serving it
+ */
+static void blk_run(blk_queue_t *q) {
+    lock_or(&q->lock, sched);
+    if (q->running) {
+        release(&q->lock);
+        return;
+    }
+    q->running = true;
+    while (true) {
+        blk_request_t *req = blk_elv_next(q);
+        if (req == NULL) { break; }
+        release(&q->lock);
+
+        hd_rdwt_vecs(
+            req->io_type,
+            req->device,
+            req->sector,
+            req->nr_sects,
+            req->vecs,
+            req->nr_vecs);
+        blk_complete(req, 0);
+        wake_up_all(&q->wait);
+
+        lock_or(&q->lock, sched);
+    }
+    q->running = false;
+    release(&q->lock);
+    wake_up_all(&q->wait);
+}
+
+void blk_run_queues() {
+    for (int i = 0; i < NR_BLK_QUEUES; ++i) { blk_run(&blk_queues[i]); }
+}
+
+int blk_wait(bio_t *bio) {
+    blk_queue_t *q = blk_queue_of(bio->device);
+    while (!bio->done) {
+        blk_run(q);
+        //! NOTE: nothing else can be scheduled during the initialization
+        if (bio->done || kstate_on_init) { continue; }
+        //! NOTE: the bio is being served by the runner if not done yet, wake up
+        //! on each completion of it
+        prepare_to_wait(&q->wait);
+        if (!bio->done && q->running) { sched(); }
+        finish_wait(&q->wait);
+    }
+    return bio->error;
+}
+
+static int blk_transfer(
+    int          io_type,
+    int          device,
+    uint32_t     sector,
+    int          nr_sects,
+    void        *buf,
+    void *const *sects) {
+    int error = 0;
+    int i     = 0;
+    while (i < nr_sects && error == 0) {
+        bio_t *bios[BLK_SYNC_BIOS];
+        int    nr_bios = 0;
+        while (i < nr_sects && nr_bios < BLK_SYNC_BIOS) {
+            bio_t *bio = kmem_cache_alloc(bio_cache);
+            assert(bio != NULL);
+            bio_init(bio, io_type, device, sector + i);
+            for (; i < nr_sects; ++i) {
+                void *data = sects != NULL ? sects[i] : buf + i * SECTOR_SIZE;
+                if (!bio_add_buf(bio, data, SECTOR_SIZE)) { break; }
+            }
+            if (bio->nr_sects == 0) {
+                //! NOTE: the sector can not be reached by the device at all
+                kmem_cache_free(bio_cache, bio);
+                error = -1;
+                break;
+            }
+            blk_submit(bio);
+            bios[nr_bios++] = bio;
+        }
+        for (int j = 0; j < nr_bios; ++j) {
+            if (blk_wait(bios[j]) != 0) { error = -1; }
+            kmem_cache_free(bio_cache, bios[j]);
+        }
+    }
+    return error;
+}
+
+int blk_rdwt(
+    int io_type, int device, uint32_t sector, int nr_sects, void *buf) {
+    return blk_transfer(io_type, device, sector, nr_sects, buf, NULL);
+}
+
+int blk_rdwt_sects(
+    int          io_type,
+    int          device,
+    uint32_t     sector,
+    int          nr_sects,
+    void *const *sects) {
+    return blk_transfer(io_type, device, sector, nr_sects, NULL, sects);
+}
@@ -1,20 +1,40 @@
 #include <unios/clock.h>
 #include <unios/syscall.h>
 #include <unios/proc.h>
+#include <unios/schedule.h>
+#include <unios/timer.h>
 #include <unios/graphics.h>
 #include <unios/interrupt.h>
 #include <unios/kstate.h>
 #include <arch/x86.h>
 #include <sys/defs.h>
+#include <math.h>
 
 #define RENDER_INTERVAL_TICKS (SYSCLK_FREQ_HZ / 60)
+#define SYSCLK_LATCH          (TIMER_FREQ / SYSCLK_FREQ_HZ)
+#define SYSCLK_MAX_IDLE_TICKS (0xffff / SYSCLK_LATCH)
+#define SYSCLK_DELAY_CHUNK_US 50000 //<! keep the count in 16 bits
 
 int system_ticks;
 
-static int render_timer = 0;
+static int          render_timer = 0;
+static volatile int idle_ticks   = 0; //<! ticks of the armed one-shot count
+
+static void sysclk_set_periodic() {
+    outb(TIMER_MODE, RATE_GENERATOR);
+    outb(TIMER0, (uint8_t)(SYSCLK_LATCH >> 0));
+    outb(TIMER0, (uint8_t)(SYSCLK_LATCH >> 8));
+}
 
 void clock_handler(int irq) {
-    ++system_ticks;
+    if (idle_ticks > 0) {
+        //! the one-shot count of the idle cpu has run out
+        system_ticks += idle_ticks;
+        idle_ticks    = 0;
+        sysclk_set_periodic();
+    } else {
+        ++system_ticks;
+    }
     if (kstate_on_init) { return; }
 
     if (++render_timer >= RENDER_INTERVAL_TICKS) {
@@ -22,22 +42,67 @@ void clock_handler(int irq) {
         render_timer = 0;
     }
 
-    --p_proc_current->pcb.live_ticks;
-    wakeup_exclusive(&system_ticks);
+    timer_tick();
+    sched_tick();
 }
 
 void init_sysclk() {
     //! use 8253 PIT timer0 as system clock
-    outb(TIMER_MODE, RATE_GENERATOR);
-    outb(TIMER0, (uint8_t)((TIMER_FREQ / SYSCLK_FREQ_HZ) >> 0));
-    outb(TIMER0, (uint8_t)((TIMER_FREQ / SYSCLK_FREQ_HZ) >> 8));
+    sysclk_set_periodic();
     system_ticks = 0;
+    idle_ticks   = 0;
+    init_timer();
 
     //! enable clock irq for 8259A
     put_irq_handler(CLOCK_IRQ, clock_handler);
     enable_irq(CLOCK_IRQ);
 }
 
+void sysclk_enter_idle(uint32_t ticks) {
+    if (ticks > SYSCLK_MAX_IDLE_TICKS) { ticks = SYSCLK_MAX_IDLE_TICKS; }
+    //! not worth to stop the periodic tick for the very next one
+    if (ticks <= 1) { return; }
+    uint16_t count = ticks * SYSCLK_LATCH;
+    outb(TIMER_MODE, ONE_SHOT);
+    outb(TIMER0, (uint8_t)(count >> 0));
+    outb(TIMER0, (uint8_t)(count >> 8));
+    idle_ticks = ticks;
+}
+
+void sysclk_leave_idle() {
+    if (idle_ticks == 0) { return; }
+    uint16_t programmed = idle_ticks * SYSCLK_LATCH;
+    outb(TIMER_MODE, LATCH_COUNT);
+    uint16_t left  = inb(TIMER0);
+    left          |= inb(TIMER0) << 8;
+    //! NOTE: the count keeps going down across zero in mode 0, a wrapped count
+    //! means the irq has been raised but not yet taken, and it will account one
+    //! more tick after the periodic mode is restored
+    int elapsed = left > programmed ? idle_ticks - 1
+                                    : (programmed - left) / SYSCLK_LATCH;
+    system_ticks += elapsed;
+    idle_ticks    = 0;
+    sysclk_set_periodic();
+}
+
+void sysclk_delay_us(uint32_t us) {
+    while (us > 0) {
+        uint32_t chunk = min(us, SYSCLK_DELAY_CHUNK_US);
+        uint16_t count = max(chunk * (TIMER_FREQ / 1000) / 1000, 1);
+        //! NOTE: bit 0 of port b gates counter 2 and bit 1 drives the speaker,
+        //! the out pin of counter 2 is then read back from bit 5
+        uint8_t ctrl = inb(PIT_GATE2) & ~0x03;
+        outb(PIT_GATE2, ctrl);
+        outb(TIMER_MODE, TIMER2_ONE_SHOT);
+        outb(TIMER2, (uint8_t)(count >> 0));
+        outb(TIMER2, (uint8_t)(count >> 8));
+        outb(PIT_GATE2, ctrl | 0x01);
+        while ((inb(PIT_GATE2) & 0x20) == 0) {}
+        outb(PIT_GATE2, ctrl);
+        us -= chunk;
+    }
+}
+
 int do_get_ticks() {
     return system_ticks;
 }
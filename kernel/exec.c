@@ -7,6 +7,7 @@
 #include <unios/schedule.h>
 #include <unios/environ.h>
 #include <unios/tracing.h>
+#include <unios/imgcache.h>
 #include <sys/errno.h>
 #include <sys/elf.h>
 #include <stdio.h>
@@ -22,8 +23,12 @@ static uint32_t
     uint32_t llimit  = elf_progh.va + elf_progh.memsz;
     uint32_t foffset = elf_progh.offset;
     uint32_t flimit  = elf_progh.offset + elf_progh.filesz;
-    bool     ok      = pg_map_laddr_range(
-        p_proc_current->pcb.cr3, laddr, llimit, PG_P | PG_U | PG_RWX, pte_attr);
+    uint32_t cr3     = p_proc_current->pcb.cr3;
+    uint32_t attr    = PG_P | PG_U | PG_RWX;
+
+    //! NOTE: write protect is also enforced in the kernel, so fill the segment
+    //! through a writable mapping first and downgrade it later if required
+    bool ok = pg_map_laddr_range(cr3, laddr, llimit, attr, attr);
     assert(ok);
     pg_refresh();
 
@@ -33,17 +38,46 @@ static uint32_t
     laddr += size;
     memset((void*)laddr, 0, llimit - laddr);
 
+    if (pte_attr != attr) {
+        ok = pg_map_laddr_range(cr3, elf_progh.va, llimit, attr, pte_attr);
+        assert(ok);
+        pg_refresh();
+    }
+
     return 0;
 }
 
+static bool exec_segment_shareable(
+    const elf_header_t*  elf_header,
+    const elf_proghdr_t* elf_proghs,
+    int                  index) {
+    if (elf_proghs[index].flags & ELF_PF_W) { return false; }
+    //! NOTE: pages shared with another segment would be written while loading
+    //! that one, so only segments owning all of their pages are shareable
+    uint32_t base  = pg_frame_phyaddr(elf_proghs[index].va);
+    uint32_t limit = elf_proghs[index].va + elf_proghs[index].memsz;
+    limit          = round_up(limit, NUM_4K);
+    for (int i = 0; i < elf_header->phnum; ++i) {
+        if (i == index || elf_proghs[i].type != ELF_PT_LOAD) { continue; }
+        uint32_t other_base  = pg_frame_phyaddr(elf_proghs[i].va);
+        uint32_t other_limit = elf_proghs[i].va + elf_proghs[i].memsz;
+        other_limit          = round_up(other_limit, NUM_4K);
+        if (base < other_limit && other_base < limit) { return false; }
+    }
+    return true;
+}
+
 static uint32_t exec_load(
     uint32_t             fd,
+    const struct inode*  pin,
     const elf_header_t*  elf_header,
     const elf_proghdr_t* elf_proghs) {
     assert(elf_header->phnum > 0);
 
     lin_memmap_t* memmap = &p_proc_current->pcb.memmap;
     uint32_t      cr3    = p_proc_current->pcb.cr3;
+    int           dev    = pin->i_dev;
+    int           ino    = pin->i_num;
 
     ph_info_t* ph_info = memmap->ph_info;
     while (ph_info != NULL) {
@@ -51,7 +85,7 @@ static uint32_t exec_load(
         bool       ok =
             pg_unmap_laddr_range(cr3, ph_info->base, ph_info->limit, true);
         assert(ok);
-        kfree(ph_info);
+        free_ph_info(ph_info);
         ph_info = next;
     }
     memmap->ph_info = NULL;
@@ -77,11 +111,20 @@ static uint32_t exec_load(
             pte_attr |= PG_RX;
         }
 
-        exec_elfcpy(fd, elf_proghs[ph_num], pte_attr);
+        const elf_proghdr_t* progh = &elf_proghs[ph_num];
+
+        //! read-only segments are shared through the image cache
+        bool shareable = exec_segment_shareable(elf_header, elf_proghs, ph_num);
+        bool cached    = shareable && imgcache_map(dev, ino, progh, cr3);
+        if (!cached) {
+            uint32_t gen = imgcache_generation();
+            exec_elfcpy(fd, *progh, pte_attr);
+            if (shareable) { imgcache_insert(dev, ino, progh, cr3, gen); }
+        }
 
         //! maintenance ph info list
         //! TODO: integrate linked-list ops
-        ph_info_t* new_ph_info = kmalloc(sizeof(ph_info_t));
+        ph_info_t* new_ph_info = alloc_ph_info();
         new_ph_info->base      = elf_proghs[ph_num].va;
         new_ph_info->limit = elf_proghs[ph_num].va + elf_proghs[ph_num].memsz;
         if (memmap->ph_info == NULL) {
@@ -126,6 +169,16 @@ static int exec_pcb_init(const char* path) {
     //! memory footprint
     mballoc_reset_unsafe(pcb->allocator);
 
+    //! NOTE: the program break belongs to the user space allocator of the old
+    //! image, drop it entirely
+    bool ok = pg_unmap_laddr_range(
+        pcb->cr3,
+        memmap->brk_lin_base,
+        round_up(memmap->brk_lin_limit, NUM_4K),
+        true);
+    assert(ok);
+    memmap->brk_lin_limit = memmap->brk_lin_base;
+
     pcb->tree_info.text_hold = true;
     pcb->tree_info.data_hold = true;
 
@@ -221,8 +274,11 @@ static void* exec_read_and_load(int fd) {
         do_read(fd, &elf_proghs[i], sizeof(elf_proghdr_t));
     }
 
+    //! NOTE: exec files are always from the orange fs currently
+    const struct inode* pin = p_proc_current->pcb.filp[fd]->fd_node.fd_inode;
+
     void* entry_point = (void*)elf_header->entry;
-    int   resp        = exec_load(fd, elf_header, elf_proghs);
+    int   resp        = exec_load(fd, pin, elf_header, elf_proghs);
 
     kfree(elf_header);
     kfree(elf_proghs);
@@ -424,6 +480,13 @@ int do_execve(const char* path, char* const* argv, char* const* envp) {
             break;
         }
 
+        //! TODO: exec in a thread group, other threads should be torn down
+        if (pcb->tree_info.type == TYPE_THREAD
+            || !list_empty(&pcb->tree_info.threads)) {
+            errno = EBUSY;
+            break;
+        }
+
         uint32_t fd = try_open_executable(path);
         if (fd == -1) {
             errno = ENOENT;
@@ -460,18 +523,8 @@ int do_execve(const char* path, char* const* argv, char* const* envp) {
 
         exec_pcb_init(path);
 
-        //! FIXME: may be there's no need to remap stack?
-        //! FIXME: potential phy page leak
-        bool ok = pg_map_laddr_range(
-            pcb->cr3,
-            memmap->stack_lin_limit,
-            memmap->stack_lin_base,
-            PG_P | PG_U | PG_RWX,
-            PG_P | PG_U | PG_RWX);
-        if (!ok) {
-            errno = ENOMEM;
-            break;
-        }
+        //! NOTE: stack pages kept from the old image are reused as is, and
+        //! the missing ones are faulted in on demand
         pg_refresh();
 
         uint32_t* frame        = (void*)(p_proc_current + 1) - P_STACKTOP;
@@ -510,7 +563,7 @@ int do_execve(const char* path, char* const* argv, char* const* envp) {
     }
     if (have_old_ptes) { kfree(old_ptes); }
 
-    p_proc_current->pcb.stat = READY;
+    set_proc_stat(&p_proc_current->pcb, READY);
     release(&p_proc_current->pcb.lock);
     if (errno != 0) { kerror("exec: caught %s", strerrno(errno)); }
     return -errno;
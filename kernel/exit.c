@@ -9,8 +9,8 @@
 #include <stdio.h>
 
 static void exit_handle_child_killed_proc(uint32_t pid) {
-    pcb_t* pcb                 = (pcb_t*)pid2proc(pid);
-    pcb->tree_info.child_k_num = 0;
+    pcb_t* pcb = (pcb_t*)pid2proc(pid);
+    free_killed_children(&pcb->tree_info);
 }
 
 static int transfer_child_proc(uint32_t src_pid, uint32_t dst_pid) {
@@ -18,41 +18,40 @@ static int transfer_child_proc(uint32_t src_pid, uint32_t dst_pid) {
     assert(src_pid != dst_pid);
     pcb_t* src_pcb = (pcb_t*)pid2proc(src_pid);
     pcb_t* dst_pcb = (pcb_t*)pid2proc(dst_pid);
-    for (int i = 0, j = dst_pcb->tree_info.child_p_num;
-         i < src_pcb->tree_info.child_p_num;
-         ++i, ++j) {
-        dst_pcb->tree_info.child_process[j] =
-            src_pcb->tree_info.child_process[i];
-        pcb_t* son_pcb = (pcb_t*)pid2proc(src_pcb->tree_info.child_process[i]);
+    pcb_t* son_pcb = NULL;
+    list_for_each_entry(
+        son_pcb, &src_pcb->tree_info.children, tree_info.sibling) {
         lock_or(&son_pcb->lock, sched);
         son_pcb->tree_info.ppid = dst_pid;
-        son_pcb->stat           = ZOMBIE;
-        ++dst_pcb->tree_info.child_p_num;
+        set_proc_stat(son_pcb, ZOMBIE);
+        list_move_tail(
+            &son_pcb->tree_info.zombie, &dst_pcb->tree_info.zombies);
         release(&son_pcb->lock);
+        ++number;
     }
-    number                         = src_pcb->tree_info.child_p_num;
-    src_pcb->tree_info.child_p_num = 0;
+    list_splice_tail_init(
+        &src_pcb->tree_info.children, &dst_pcb->tree_info.children);
     return number;
 }
 
 static void exit_handle_child_thread_proc(uint32_t pid, bool lock_recy) {
     //! NOTE:fixed, now recursive delete
-    pcb_t* pcb      = (pcb_t*)pid2proc(pid);
-    pcb_t* recy_pcb = (pcb_t*)pid2proc(NR_RECY_PROC);
-    for (int i = 0; i < pcb->tree_info.child_t_num; ++i) {
-        pcb_t*   child_pcb = (pcb_t*)pid2proc(pcb->tree_info.child_thread[i]);
-        uint32_t cr3       = ((pcb_t*)pid2proc(pid))->cr3;
-        uint32_t laddr     = child_pcb->memmap.stack_lin_limit;
-        uint32_t limit     = child_pcb->memmap.stack_lin_base;
-        while (laddr < limit) {
-            bool ok = pg_unmap_laddr(cr3, laddr, true);
-            assert(ok);
-            laddr = pg_frame_phyaddr(laddr) + NUM_4K;
-        }
-        for (int i = 0; i < child_pcb->tree_info.child_t_num; ++i) {
-            exit_handle_child_thread_proc(
-                child_pcb->tree_info.child_thread[i], lock_recy);
-        }
+    pcb_t* pcb       = (pcb_t*)pid2proc(pid);
+    pcb_t* recy_pcb  = (pcb_t*)pid2proc(NR_RECY_PROC);
+    pcb_t* child_pcb = NULL;
+    pcb_t* next_pcb  = NULL;
+    list_for_each_entry_safe(
+        child_pcb, next_pcb, &pcb->tree_info.threads, tree_info.sibling) {
+        //! NOTE: the thread may be running on another cpu, keep it from being
+        //! picked again and wait till it leaves before its stack goes away
+        set_proc_stat(child_pcb, KILLING);
+        sched_wait_off_cpu(child_pcb);
+        uint32_t cr3   = pcb->cr3;
+        uint32_t laddr = child_pcb->memmap.stack_lin_limit;
+        uint32_t limit = child_pcb->memmap.stack_lin_base;
+        bool     ok    = pg_unmap_laddr_range(cr3, laddr, limit, true);
+        assert(ok);
+        exit_handle_child_thread_proc(child_pcb->pid, lock_recy);
         if (lock_recy) {
             lock_or(&recy_pcb->lock, sched);
             transfer_child_proc(child_pcb->pid, NR_RECY_PROC);
@@ -61,12 +60,22 @@ static void exit_handle_child_thread_proc(uint32_t pid, bool lock_recy) {
             transfer_child_proc(child_pcb->pid, NR_RECY_PROC);
         }
 
-        child_pcb->stat = IDLE;
+        list_del_init(&child_pcb->tree_info.sibling);
+        set_proc_stat(child_pcb, IDLE);
     }
-    pcb->tree_info.child_t_num = 0;
     return;
 } // 8049143
 
+static void exit_release_thread_stack(pcb_t* exit_pcb) {
+    //! NOTE: the address space belongs to the leader, only the stack goes away
+    //! with the thread, and the pcb is left to `do_thread_join`
+    lin_memmap_t* memmap = &exit_pcb->memmap;
+    bool          ok     = pg_unmap_laddr_range(
+        exit_pcb->cr3, memmap->stack_lin_limit, memmap->stack_lin_base, true);
+    assert(ok);
+    memmap->stack_lin_limit = memmap->stack_lin_base;
+}
+
 void do_exit(int exit_code) {
     pcb_t* exit_pcb = NULL;
     pcb_t* fa_pcb   = NULL;
@@ -80,11 +89,14 @@ void do_exit(int exit_code) {
         sched();
     }
 
-    assert(exit_pcb->tree_info.ppid >= 0 && exit_pcb->tree_info.ppid < NR_PCBS);
+    assert(pid2proc(exit_pcb->tree_info.ppid) != NULL);
     assert(fa_pcb->stat == READY || fa_pcb->stat == SLEEPING);
     exit_handle_child_killed_proc(exit_pcb->pid);
     //! NOTE: disable int to reduce op complexity
-    if (fa_pcb->pid == NR_RECY_PROC) {
+    if (exit_pcb->tree_info.type == TYPE_THREAD) {
+        //! NOTE: a thread never owns children, see `do_fork`
+        exit_release_thread_stack(exit_pcb);
+    } else if (fa_pcb->pid == NR_RECY_PROC) {
         //! case 0: father is recy and already locked
         exit_handle_child_thread_proc(exit_pcb->pid, false);
         transfer_child_proc(exit_pcb->pid, NR_RECY_PROC);
@@ -93,14 +105,19 @@ void do_exit(int exit_code) {
         exit_handle_child_thread_proc(exit_pcb->pid, true);
         lock_or(&recy_pcb->lock, sched);
         if (transfer_child_proc(exit_pcb->pid, NR_RECY_PROC) != 0) {
-            recy_pcb->stat = READY;
+            wake_up_all(&recy_pcb->wait_child);
         }
         release(&recy_pcb->lock);
     }
     disable_int_begin();
-    fa_pcb->stat        = READY;
-    exit_pcb->stat      = ZOMBIE;
+    wake_up_all(&fa_pcb->wait_child);
+    set_proc_stat(exit_pcb, ZOMBIE);
     exit_pcb->exit_code = exit_code;
+    //! NOTE: threads are reaped by `do_thread_join` instead of `do_wait`
+    if (exit_pcb->tree_info.type != TYPE_THREAD) {
+        list_add_tail(
+            &exit_pcb->tree_info.zombie, &fa_pcb->tree_info.zombies);
+    }
     disable_int_end();
     assert(exit_pcb->lock);
     assert(fa_pcb->lock);
@@ -6,39 +6,49 @@
 #include <unios/schedule.h>
 #include <unios/protect.h>
 #include <unios/graphics.h>
+#include <unios/apic.h>
 #include <unios/tracing.h>
 #include <unios/interrupt.h>
 #include <arch/x86.h>
 #include <stdint.h>
 #include <string.h>
 #include <atomic.h>
+#include <math.h>
 
-static bool fork_clone_part_rwx(
-    uint32_t ppid, uint32_t pid, uint32_t base, uint32_t limit) {
-    //! FIXME: risky action, this is relevant to current cr3, but ppid may be
-    //! not the expected one
+static bool fork_clone_part_cow(
+    pg_batch_t* batch, uint32_t pid, uint32_t base, uint32_t limit) {
     //! FIXME: pid allocation method may changes
-    uint32_t cr3_ppid = ((pcb_t*)pid2proc(ppid))->cr3;
+    uint32_t cr3_ppid = batch->cr3;
     uint32_t cr3_pid  = ((pcb_t*)pid2proc(pid))->cr3;
 
-    uint32_t attr        = PG_P | PG_U | PG_RWX;
-    uint32_t laddr_share = SharePageBase;
-    assert(laddr_share == pg_frame_phyaddr(laddr_share));
-
-    uint32_t laddr = base;
-    bool     ok    = false;
+    //! NOTE: writable pages are shared read-only by both sides and copied on
+    //! the first write, read-only pages are simply shared, and pages never
+    //! touched by the parent are left to demand paging
+    uint32_t laddr = pg_frame_phyaddr(base);
     while (laddr < limit) {
-        assert(!pg_addr_pte_exist(cr3_ppid, laddr_share));
-        bool ok = pg_map_laddr(cr3_ppid, laddr_share, PG_INVALID, attr, attr);
-        if (!ok) { return false; }
-        pg_refresh();
-        memcpy((void*)laddr_share, (void*)pg_frame_phyaddr(laddr), NUM_4K);
-        uint32_t phyaddr = pg_laddr_phyaddr(cr3_ppid, laddr_share);
-        ok               = pg_map_laddr(cr3_pid, laddr, phyaddr, attr, attr);
-        if (!ok) { return false; }
-        laddr = pg_frame_phyaddr(laddr) + NUM_4K;
-        ok    = pg_unmap_laddr(cr3_ppid, laddr_share, false);
-        if (!ok) { return false; }
+        if (!pg_pde_exist(cr3_ppid, laddr)) {
+            laddr = round_down(laddr, NUM_4M) + NUM_4M;
+            continue;
+        }
+        uint32_t* pte_ptr = pg_pte_ptr(pg_pde(cr3_ppid, laddr), laddr);
+        uint32_t  pte     = *pte_ptr;
+        //! parts may overlap at the page boundary, share only once
+        bool skip = (pte & PG_MASK_P) != PG_P
+                 || pg_addr_pte_exist(cr3_pid, laddr);
+        if (!skip) {
+            uint32_t phyaddr = pg_frame_phyaddr(pte);
+            if ((pte & PG_MASK_RW) == PG_RWX) {
+                pte      = (pte & ~PG_MASK_RW) | PG_COW;
+                *pte_ptr = pte;
+                pg_batch_invalidate(batch, laddr);
+                set_phypage_flags(phyaddr, PHYPAGE_COW, true);
+            }
+            bool     ok      = pg_map_laddr(
+                cr3_pid, laddr, phyaddr, PG_P | PG_U | PG_RWX, pte & 0xfff);
+            if (!ok) { return false; }
+            ref_phypage(phyaddr);
+        }
+        laddr += NUM_4K;
     }
     return true;
 }
@@ -47,28 +57,25 @@ static int fork_update_proc_info(process_t* p_child) {
     pcb_t* fa = &p_proc_current->pcb;
     pcb_t* ch = &p_child->pcb;
 
-    assert(fa->tree_info.child_p_num < NR_CHILD_MAX);
-    fa->tree_info.child_process[fa->tree_info.child_p_num++] = ch->pid;
+    init_tree_lists(&ch->tree_info);
+    list_add_tail(&ch->tree_info.sibling, &fa->tree_info.children);
 
-    ch->tree_info.type        = fa->tree_info.type;
-    ch->tree_info.real_ppid   = fa->pid;
-    ch->tree_info.ppid        = fa->pid;
-    ch->tree_info.child_p_num = 0;
-    ch->tree_info.child_t_num = 0;
-    ch->tree_info.child_k_num = 0;
-    ch->tree_info.text_hold   = false;
-    ch->tree_info.data_hold   = true;
+    ch->tree_info.type      = fa->tree_info.type;
+    ch->tree_info.real_ppid = fa->pid;
+    ch->tree_info.ppid      = fa->pid;
+    ch->tree_info.text_hold = false;
+    ch->tree_info.data_hold = true;
 
     return 0;
 }
 
-static bool fork_memory_clone(uint32_t ppid, uint32_t pid) {
-    lin_memmap_t* memmap = &p_proc_current->pcb.memmap;
-    ph_info_t*    ph_ptr = memmap->ph_info;
+static bool fork_memory_clone_parts(
+    pg_batch_t* batch, uint32_t pid, lin_memmap_t* memmap) {
     //! clone elf part
-    bool ok = false;
+    bool       ok     = false;
+    ph_info_t* ph_ptr = memmap->ph_info;
     while (ph_ptr != NULL) {
-        ok = fork_clone_part_rwx(ppid, pid, ph_ptr->base, ph_ptr->limit);
+        ok = fork_clone_part_cow(batch, pid, ph_ptr->base, ph_ptr->limit);
         if (!ok) { return false; }
         ph_ptr = ph_ptr->next;
     }
@@ -78,24 +85,40 @@ static bool fork_memory_clone(uint32_t ppid, uint32_t pid) {
     //! cases are like that, e.g. heap limit reduction, thread clone, etc.
 
     //! clone heap
-    ok = fork_clone_part_rwx(
-        ppid, pid, memmap->heap_lin_base, memmap->heap_lin_limit);
+    ok = fork_clone_part_cow(
+        batch, pid, memmap->heap_lin_base, memmap->heap_lin_limit);
+    if (!ok) { return false; }
+
+    //! clone program break
+    ok = fork_clone_part_cow(
+        batch, pid, memmap->brk_lin_base, memmap->brk_lin_limit);
     if (!ok) { return false; }
 
     //! clone stack
     //! NOTE: inverse grow
-    ok = fork_clone_part_rwx(
-        ppid, pid, memmap->stack_lin_limit, memmap->stack_lin_base);
+    ok = fork_clone_part_cow(
+        batch, pid, memmap->stack_lin_limit, memmap->stack_lin_base);
     if (!ok) { return false; }
 
     //! clone args
-    ok = fork_clone_part_rwx(
-        ppid, pid, memmap->arg_lin_base, memmap->arg_lin_limit);
+    ok = fork_clone_part_cow(
+        batch, pid, memmap->arg_lin_base, memmap->arg_lin_limit);
     if (!ok) { return false; }
 
     return true;
 }
 
+static bool fork_memory_clone(uint32_t ppid, uint32_t pid) {
+    //! NOTE: writable pages of the parent are downgraded to cow, whose tlb
+    //! entries are invalidated together at the end
+    pcb_t*     fa = (pcb_t*)pid2proc(ppid);
+    pg_batch_t batch;
+    pg_batch_begin(&batch, fa->cr3);
+    bool ok = fork_memory_clone_parts(&batch, pid, &fa->memmap);
+    pg_batch_commit(&batch);
+    return ok;
+}
+
 static int fork_pcb_clone(process_t* p_child) {
     pcb_t* fa = &p_proc_current->pcb;
     pcb_t* ch = &p_child->pcb;
@@ -106,44 +129,32 @@ static int fork_pcb_clone(process_t* p_child) {
     //! shared part
     ch->regs             = fa->regs;
     ch->esp_save_syscall = fa->esp_save_syscall;
-    ch->channel          = fa->channel;
     //! FIXME: see `fork_memory_clone`
     ch->memmap     = fa->memmap;
-    ch->live_ticks = fa->live_ticks;
-    ch->priority   = fa->priority;
-    ch->exit_code  = fa->exit_code;
+    ch->live_ticks  = fa->live_ticks;
+    ch->priority    = fa->priority;
+    ch->sched_level = fa->sched_level;
+    ch->exit_code   = fa->exit_code;
     assert(ch->exit_code == 0);
     strcpy(ch->name, fa->name);
     memcpy(ch->ldts, fa->ldts, sizeof(fa->ldts));
-    memcpy(ch->filp, fa->filp, sizeof(fa->filp));
+    memcpy(ch->files, fa->filp, sizeof(ch->files));
     memcpy(ch_frame, fa_frame, P_STACKTOP);
+    sched_fork(ch, fa);
 
     //! unique part
     assert(ch->cr3 != 0 && ch->cr3 != fa->cr3);
+    ch->filp       = ch->files;
+    ch->wait_queue = NULL;
+    init_wait_queue_head(&ch->wait_child);
     ch->memmap.ph_info = clone_ph_info(fa->memmap.ph_info);
 
-    //! TODO: better pid assignment method
-    ch->pid = proc2pid(p_child);
-
-    //! TODO: better ldt selector assignment method
-    ch->ldt_sel = SELECTOR_LDT_FIRST + (ch->pid << 3);
-    init_descriptor(
-        &gdt[ch->ldt_sel >> 3],
-        vir2phys(seg2phys(SELECTOR_KERNEL_DS), ch->ldts),
-        LDT_SIZE * sizeof(descriptor_t) - 1,
-        DA_LDT);
-
-    ch->allocator = mballoc_create(
-        kmalloc,
-        NUM_4K,
-        (void*)ch->memmap.heap_lin_base,
-        (void*)HeapLinLimitMAX);
+    pid_alloc(ch);
+    //! NOTE: the descriptor is bound on switch, see `load_ldt_desc`
+    ch->ldt_sel = SELECTOR_LDT_FIRST;
+
+    ch->allocator = mballoc_clone(fa->allocator);
     assert(ch->allocator != NULL);
-    memcpy(
-        ch->allocator,
-        fa->allocator,
-        sizeof(memblk_allocator_t)
-            + fa->allocator->total_free_slots * sizeof(memblk_t));
     ch->heap_lock = 0;
 
     //! NOTE: forked child proc should start at user space, see
@@ -161,6 +172,11 @@ static int fork_pcb_clone(process_t* p_child) {
 
 int do_fork() {
     process_t* fa = p_proc_current;
+    //! TODO: fork from a thread, only the calling thread should be cloned
+    if (fa->pcb.tree_info.type == TYPE_THREAD) {
+        kwarn("fork %d: not supported in a thread", fa->pcb.pid);
+        return -1;
+    }
     lock_or(&fa->pcb.lock, sched);
     process_t* ch = try_lock_free_pcb();
     if (ch == NULL) {
@@ -182,6 +198,7 @@ int do_fork() {
     }
 
     graphics_map_lfb(ch->pcb.cr3);
+    lapic_map(ch->pcb.cr3);
 
     fork_pcb_clone(ch);
     disable_int_begin();
@@ -199,7 +216,7 @@ int do_fork() {
     frame[NR_EAXREG] = ch->pcb.regs.eax;
 
     disable_int_begin();
-    ch->pcb.stat = READY;
+    set_proc_stat(&ch->pcb, READY);
     disable_int_end();
 
     release(&ch->pcb.lock);
@@ -3,20 +3,24 @@
 #include <unios/assert.h>
 #include <unios/fs_const.h>
 #include <unios/hd.h>
+#include <unios/bcache.h>
 #include <unios/fs.h>
 #include <unios/fs_misc.h>
 #include <unios/tty.h>
 #include <unios/schedule.h>
 #include <unios/sync.h>
 #include <unios/tracing.h>
+#include <unios/imgcache.h>
 #include <sys/defs.h>
 #include <config.h>
 #include <stdio.h>
 #include <string.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include <math.h>
 
 static rwlock_t inode_table_rwlock;
+static uint32_t smap_lock;
 
 extern struct file_desc   file_desc_table[NR_FILE_DESC];
 extern struct super_block superblock_table[NR_SUPER_BLOCK];
@@ -37,13 +41,17 @@ static int           search_file(char *path);
 static struct inode *create_file(char *path, int flags);
 static struct inode *get_inode(int dev, int num);
 static struct inode *get_inode_sched(int dev, int num);
-static struct inode *new_inode(int dev, int inode_nr, int start_sect);
+static struct inode *new_inode(int dev, int inode_nr);
 static void          put_inode(struct inode *pinode);
 static void          sync_inode(struct inode *p);
 static void
            new_dir_entry(struct inode *dir_inode, int inode_nr, char *filename);
 static int alloc_imap_bit(int dev);
-static int alloc_smap_bit(int dev, int nr_sects_to_alloc);
+static void
+    set_smap_bits(superblock_t *sb, uint32_t start_sect, int nr, bool used);
+static uint32_t bmap(struct inode *pin, int blk, int *run);
+static bool     grow_inode(struct inode *pin, int nr_sects);
+static void     free_extents(struct inode *pin);
 
 int get_fs_dev(int drive, int fs_type) {
     int i = 0;
@@ -62,6 +70,7 @@ int get_fs_dev(int drive, int fs_type) {
 
 void init_fs() {
     memset(inode_table, 0, sizeof(inode_table));
+    smap_lock = 0;
     superblock_t *sb = superblock_table;
 
     int orange_dev = get_fs_dev(PRIMARY_MASTER, ORANGE_TYPE);
@@ -72,7 +81,7 @@ void init_fs() {
 
     kinfo("Superblock Address: 0x%x", sb_root);
 
-    if (sb_root->magic != MAGIC_V1) {
+    if (sb_root->magic != MAGIC_V2) {
         mkfs();
         kdebug("mkfs done");
         read_orange_superblock(orange_dev);
@@ -106,7 +115,7 @@ static void mkfs() {
     //! not ready for multiple imap sectors
 
     superblock_t sb   = {};
-    sb.magic          = MAGIC_V1;
+    sb.magic          = MAGIC_V2;
     sb.nr_inodes      = ORANGE_FS_IMAP_SECTORS * bits_per_sect;
     sb.nr_inode_sects = sb.nr_inodes * INODE_SIZE / SECTOR_SIZE;
     sb.nr_sects       = geo.size; /* partition size in sector */
@@ -119,7 +128,7 @@ static void mkfs() {
 
     struct inode x     = {};
     sb.inode_isize_off = (int)&x.i_size - (int)&x;
-    sb.inode_start_off = (int)&x.i_start_sect - (int)&x;
+    sb.inode_start_off = (int)&x.i_extents - (int)&x;
     sb.dir_ent_size    = DIR_ENTRY_SIZE;
 
     struct dir_entry de  = {};
@@ -153,41 +162,19 @@ static void mkfs() {
     WR_SECT(orange_dev, 2, fsbuf);
 
     //! resolve sector map
-    //! FIXME: why assume 1 sector is enough for nr_sects in sector map
-    int nr_sects = NR_DEFAULT_FILE_SECTS + 1;
-    memset(fsbuf, 0, SECTOR_SIZE);
-    //! NOTE: the following 2 lines fills nr_sects bits
-    memset(fsbuf, 0xff, nr_sects / 8);
-    fsbuf[nr_sects / 8] |= (1 << (nr_sects % 8 + 1)) - 1;
-    //! write first sector map
-    WR_SECT(orange_dev, 2 + sb.nr_imap_sects, fsbuf);
-    //! zero the rest sector map
     memset(fsbuf, 0, SECTOR_SIZE);
-    for (int i = 1; i < sb.nr_smap_sects; ++i) {
+    for (int i = 0; i < sb.nr_smap_sects; ++i) {
         WR_SECT(orange_dev, 2 + sb.nr_imap_sects + i, fsbuf);
     }
 
+    //! NOTE: the root dir is the only dir and it is laid out on one extent
+    //! large enough to hold an entry for every inode, it never grows then
+    int nr_root_sects = sb.nr_inodes * DIR_ENTRY_SIZE / SECTOR_SIZE;
+    //! NOTE: bit 0 is reserved and the sectors of the root dir follow it
+    set_smap_bits(&sb, sb.n_1st_sect - 1, nr_root_sects + 1, true);
+
     //! resolve app.tar
-    //! sect M <-> bit (M - sb.n_1stsect + 1)
-    int bit_offset      = INSTALL_START_SECTOR - sb.n_1st_sect + 1;
-    int bit_off_in_sect = bit_offset % (SECTOR_SIZE * 8);
-    int bit_left        = INSTALL_NR_SECTORS;
-    int cur_sect        = bit_offset / (SECTOR_SIZE * 8);
-    RD_SECT(orange_dev, 2 + sb.nr_imap_sects + cur_sect, fsbuf);
-    while (bit_left) {
-        int byte_off = bit_off_in_sect / 8;
-        /* this line is ineffecient in a loop, but I don't care */
-        fsbuf[byte_off] |= 1 << (bit_off_in_sect % 8);
-        --bit_left;
-        ++bit_off_in_sect;
-        if (bit_off_in_sect == (SECTOR_SIZE * 8)) {
-            WR_SECT(orange_dev, 2 + sb.nr_imap_sects + cur_sect, fsbuf);
-            ++cur_sect;
-            RD_SECT(orange_dev, 2 + sb.nr_imap_sects + cur_sect, fsbuf);
-            bit_off_in_sect = 0;
-        }
-    }
-    WR_SECT(orange_dev, 2 + sb.nr_imap_sects + cur_sect, fsbuf);
+    set_smap_bits(&sb, INSTALL_START_SECTOR, INSTALL_NR_SECTORS, true);
 
     /************************/
     /*       inodes         */
@@ -203,23 +190,25 @@ static void mkfs() {
     //! 3~. tty
     pi->i_size = DIR_ENTRY_SIZE * (2 + NR_CONSOLES);
 
-    pi->i_start_sect = sb.n_1st_sect;
-    pi->i_nr_sects   = NR_DEFAULT_FILE_SECTS;
+    pi->i_nr_sects                = nr_root_sects;
+    pi->i_extents[0].e_start_sect = sb.n_1st_sect;
+    pi->i_extents[0].e_nr_sects   = nr_root_sects;
 
     for (int i = 0; i < NR_CONSOLES; ++i) {
-        pi               = (struct inode *)(fsbuf + (INODE_SIZE * (i + 1)));
-        pi->i_mode       = I_CHAR_SPECIAL;
-        pi->i_size       = 0;
-        pi->i_start_sect = MAKE_DEV(DEV_CHAR_TTY, i);
-        pi->i_nr_sects   = 0;
+        pi             = (struct inode *)(fsbuf + (INODE_SIZE * (i + 1)));
+        pi->i_mode     = I_CHAR_SPECIAL;
+        pi->i_size     = 0;
+        pi->i_nr_sects = 0;
+        pi->i_rdev     = MAKE_DEV(DEV_CHAR_TTY, i);
     }
 
     /* inode of /app.tar */
     pi         = (struct inode *)(fsbuf + (INODE_SIZE * (NR_CONSOLES + 1)));
     pi->i_mode = I_REGULAR;
     pi->i_size = INSTALL_NR_SECTORS * SECTOR_SIZE;
-    pi->i_start_sect = INSTALL_START_SECTOR;
-    pi->i_nr_sects   = INSTALL_NR_SECTORS;
+    pi->i_nr_sects                = INSTALL_NR_SECTORS;
+    pi->i_extents[0].e_start_sect = INSTALL_START_SECTOR;
+    pi->i_extents[0].e_nr_sects   = INSTALL_NR_SECTORS;
 
     WR_SECT(orange_dev, 2 + sb.nr_imap_sects + sb.nr_smap_sects, fsbuf);
 
@@ -244,6 +233,9 @@ static void mkfs() {
     strcpy(pde->name, INSTALL_FILENAME);
     WR_SECT(orange_dev, sb.n_1st_sect, fsbuf);
 
+    //! NOTE: make the fresh fs durable at once rather than on the next flush
+    bcache_sync(orange_dev);
+
     kdebug("mkfs orange done");
 }
 
@@ -251,7 +243,8 @@ static void mkfs() {
  *                                rw_sector
  *****************************************************************************/
 /**
- * <Ring 1> R/W a sector via messaging with the corresponding driver.
+ * <Ring 1> R/W sectors through the block cache, the driver is only reached by
+ * the cache on a miss or a write back.
  *
  * @param io_type  DEV_READ or DEV_WRITE
  * @param dev      device nr
@@ -265,41 +258,38 @@ static void mkfs() {
 /// zcr: change the "uint64_t pos" to "int pos"
 static int rw_sector(
     int io_type, int dev, uint64_t pos, int bytes, int proc_nr, void *buf) {
-    MESSAGE driver_msg;
-
-    driver_msg.type     = io_type;
-    driver_msg.DEVICE   = MINOR(dev);
-    driver_msg.POSITION = pos;
-    driver_msg.CNT      = bytes; /// hu is: 512
-    driver_msg.PROC_NR  = proc_nr;
-    driver_msg.BUF      = buf;
-
-    hd_rdwt(&driver_msg);
-
+    uint32_t sector   = (uint32_t)(pos >> SECTOR_SIZE_SHIFT);
+    uint8_t *la       = va2la(proc_nr, buf);
+    int      nr_sects = bytes / SECTOR_SIZE;
+    int      tail     = bytes % SECTOR_SIZE;
+    if (nr_sects > 0) { bcache_rdwt_sects(io_type, dev, sector, nr_sects, la); }
+    if (tail == 0) { return 0; }
+
+    la             += nr_sects * SECTOR_SIZE;
+    buf_head_t *bh  = bread(dev, sector + nr_sects);
+    if (io_type == DEV_READ) {
+        memcpy(la, bh->data, tail);
+    } else {
+        memcpy(bh->data, la, tail);
+        bdirty(bh);
+    }
+    brelse(bh);
     return 0;
 }
 
 static int rw_sector_sched(
     int io_type, int dev, int pos, int bytes, int proc_nr, void *buf) {
-    MESSAGE driver_msg;
-
-    driver_msg.type   = io_type;
-    driver_msg.DEVICE = MINOR(dev);
-
-    driver_msg.POSITION = pos;
-    driver_msg.CNT      = bytes; /// hu is: 512
-    driver_msg.PROC_NR  = proc_nr;
-    driver_msg.BUF      = buf;
-
-    hd_rdwt_sched(&driver_msg);
-    return 0;
+    //! NOTE: the cache serves both paths, and the queued driver service is
+    //! bypassed so that both paths see the same data
+    return rw_sector(io_type, dev, pos, bytes, proc_nr, buf);
 }
 
 /*****************************************************************************
  *                                create_file
  *****************************************************************************/
 /**
- * Create a file and return it's inode ptr.
+ * Create a file and return it's inode ptr. No sector is allocated to the file
+ * till it is written.
  *
  * @param[in] path   The full path of the new file
  * @param[in] flags  Attribiutes of the new file
@@ -313,9 +303,8 @@ static struct inode *create_file(char *path, int flags) {
     char          filename[PATH_MAX];
     struct inode *dir_inode;
     if (strip_path(filename, path, &dir_inode) != 0) return 0;
-    int inode_nr     = alloc_imap_bit(dir_inode->i_dev);
-    int free_sect_nr = alloc_smap_bit(dir_inode->i_dev, NR_DEFAULT_FILE_SECTS);
-    struct inode *newino = new_inode(dir_inode->i_dev, inode_nr, free_sect_nr);
+    int           inode_nr = alloc_imap_bit(dir_inode->i_dev);
+    struct inode *newino   = new_inode(dir_inode->i_dev, inode_nr);
     new_dir_entry(dir_inode, newino->i_num, filename);
     return newino;
 }
@@ -344,7 +333,6 @@ static int search_file(char *path) {
     if (filename[0] == 0) { return dir_inode->i_num; }
 
     //! Search the dir for the file.
-    int dir_blk0_nr = dir_inode->i_start_sect;
     int nr_dir_blks = (dir_inode->i_size + SECTOR_SIZE - 1) / SECTOR_SIZE;
     int nr_dir_entries =
         dir_inode->i_size / DIR_ENTRY_SIZE; /**
@@ -359,7 +347,7 @@ static int search_file(char *path) {
     for (i = 0; i < nr_dir_blks; i++) {
         // RD_SECT_SCHED(dir_inode->i_dev, dir_blk0_nr + i, fsbuf);
         // //modified by xw, 18/12/27
-        RD_SECT(dir_inode->i_dev, dir_blk0_nr + i, fsbuf);
+        RD_SECT(dir_inode->i_dev, bmap(dir_inode, i, NULL), fsbuf);
         pde = (struct dir_entry *)fsbuf;
         for (j = 0; j < SECTOR_SIZE / DIR_ENTRY_SIZE; j++, pde++) {
             if (memcmp(filename, pde->name, FILENAME_MAX) == 0)
@@ -422,15 +410,7 @@ static int strip_path(char *file, const char *path, struct inode **ppinode) {
 
 void read_orange_superblock(int dev) {
     char fsbuf[SECTOR_SIZE] = {};
-
-    MESSAGE driver_msg  = {};
-    driver_msg.type     = DEV_READ;
-    driver_msg.DEVICE   = MINOR(dev);
-    driver_msg.POSITION = SECTOR_SIZE * 1;
-    driver_msg.BUF      = fsbuf;
-    driver_msg.CNT      = SECTOR_SIZE;
-    driver_msg.PROC_NR  = proc2pid(p_proc_current); /// TASK_A
-    hd_rdwt(&driver_msg);
+    bcache_read(dev, 1, fsbuf);
 
     int index = 0;
     while (index < NR_SUPER_BLOCK) {
@@ -490,9 +470,10 @@ static struct inode *get_inode(int dev, int num) {
 
     if (!q) { panic("the inode table is full"); }
 
-    q->i_dev = dev;
-    q->i_num = num;
-    q->i_cnt = 1;
+    q->i_dev  = dev;
+    q->i_num  = num;
+    q->i_cnt  = 1;
+    q->i_lock = 0;
 
     superblock_t *sb = get_unique_superblock(dev);
 
@@ -504,10 +485,11 @@ static struct inode *get_inode(int dev, int num) {
         (struct inode *)((uint8_t *)fsbuf
                          + ((num - 1) % (SECTOR_SIZE / INODE_SIZE))
                                * INODE_SIZE);
-    q->i_mode       = pinode->i_mode;
-    q->i_size       = pinode->i_size;
-    q->i_start_sect = pinode->i_start_sect;
-    q->i_nr_sects   = pinode->i_nr_sects;
+    q->i_mode     = pinode->i_mode;
+    q->i_size     = pinode->i_size;
+    q->i_nr_sects = pinode->i_nr_sects;
+    q->i_ext_sect = pinode->i_ext_sect;
+    memcpy(q->i_extents, pinode->i_extents, sizeof(q->i_extents));
     rwlock_leave(&inode_table_rwlock);
     return q;
 }
@@ -534,9 +516,10 @@ static struct inode *get_inode_sched(int dev, int num) {
 
     if (!q) panic("the inode table is full");
 
-    q->i_dev = dev;
-    q->i_num = num;
-    q->i_cnt = 1;
+    q->i_dev  = dev;
+    q->i_num  = num;
+    q->i_cnt  = 1;
+    q->i_lock = 0;
 
     superblock_t *sb     = get_unique_superblock(dev);
     int           blk_nr = 1 + 1 + sb->nr_imap_sects + sb->nr_smap_sects
@@ -548,10 +531,11 @@ static struct inode *get_inode_sched(int dev, int num) {
         (struct inode *)((uint8_t *)fsbuf
                          + ((num - 1) % (SECTOR_SIZE / INODE_SIZE))
                                * INODE_SIZE);
-    q->i_mode       = pinode->i_mode;
-    q->i_size       = pinode->i_size;
-    q->i_start_sect = pinode->i_start_sect;
-    q->i_nr_sects   = pinode->i_nr_sects;
+    q->i_mode     = pinode->i_mode;
+    q->i_size     = pinode->i_size;
+    q->i_nr_sects = pinode->i_nr_sects;
+    q->i_ext_sect = pinode->i_ext_sect;
+    memcpy(q->i_extents, pinode->i_extents, sizeof(q->i_extents));
     rwlock_leave(&inode_table_rwlock);
     return q;
 }
@@ -588,13 +572,14 @@ static void sync_inode(struct inode *p) {
     char fsbuf[SECTOR_SIZE]; // local array, to substitute global fsbuf.
                              // added by xw, 18/12/27
     RD_SECT(p->i_dev, blk_nr, fsbuf);
-    pinode               = (struct inode *)((uint8_t *)fsbuf
-                              + (((p->i_num - 1) % (SECTOR_SIZE / INODE_SIZE))
-                                 * INODE_SIZE));
-    pinode->i_mode       = p->i_mode;
-    pinode->i_size       = p->i_size;
-    pinode->i_start_sect = p->i_start_sect;
-    pinode->i_nr_sects   = p->i_nr_sects;
+    pinode             = (struct inode *)((uint8_t *)fsbuf
+                            + (((p->i_num - 1) % (SECTOR_SIZE / INODE_SIZE))
+                               * INODE_SIZE));
+    pinode->i_mode     = p->i_mode;
+    pinode->i_size     = p->i_size;
+    pinode->i_nr_sects = p->i_nr_sects;
+    pinode->i_ext_sect = p->i_ext_sect;
+    memcpy(pinode->i_extents, p->i_extents, sizeof(p->i_extents));
     WR_SECT(p->i_dev, blk_nr, fsbuf);
 }
 
@@ -602,23 +587,23 @@ static void sync_inode(struct inode *p) {
  *                                new_inode
  *****************************************************************************/
 /**
- * Generate a new i-node and write it to disk.
+ * Generate a new i-node of an empty file and write it to disk.
  *
  * @param dev  Home device of the i-node.
  * @param inode_nr  I-node nr.
- * @param start_sect  Start sector of the file pointed by the new i-node.
  *
  * @return  Ptr of the new i-node.
  *****************************************************************************/
-static struct inode *new_inode(int dev, int inode_nr, int start_sect) {
+static struct inode *new_inode(int dev, int inode_nr) {
     // struct inode * new_inode = get_inode_sched(dev, inode_nr);
     // //modified by xw, 18/8/28
     struct inode *new_inode = get_inode(dev, inode_nr);
 
-    new_inode->i_mode       = I_REGULAR;
-    new_inode->i_size       = 0;
-    new_inode->i_start_sect = start_sect;
-    new_inode->i_nr_sects   = NR_DEFAULT_FILE_SECTS;
+    new_inode->i_mode     = I_REGULAR;
+    new_inode->i_size     = 0;
+    new_inode->i_nr_sects = 0;
+    new_inode->i_ext_sect = 0;
+    memset(new_inode->i_extents, 0, sizeof(new_inode->i_extents));
 
     new_inode->i_dev = dev;
     new_inode->i_cnt = 1;
@@ -643,7 +628,6 @@ static struct inode *new_inode(int dev, int inode_nr, int start_sect) {
 static void
     new_dir_entry(struct inode *dir_inode, int inode_nr, char *filename) {
     /* write the dir_entry */
-    int dir_blk0_nr = dir_inode->i_start_sect;
     int nr_dir_blks = (dir_inode->i_size + SECTOR_SIZE) / SECTOR_SIZE;
     int nr_dir_entries =
         dir_inode->i_size / DIR_ENTRY_SIZE; /**
@@ -656,10 +640,13 @@ static void
     struct dir_entry *pde;
     struct dir_entry *new_de = 0;
 
+    //! NOTE: the entry may go to the sector next to the last one in use
+    if (!grow_inode(dir_inode, nr_dir_blks)) { panic("the dir is full"); }
+
     int  i, j;
     char fsbuf[SECTOR_SIZE];
     for (i = 0; i < nr_dir_blks; i++) {
-        RD_SECT(dir_inode->i_dev, dir_blk0_nr + i, fsbuf);
+        RD_SECT(dir_inode->i_dev, bmap(dir_inode, i, NULL), fsbuf);
 
         pde = (struct dir_entry *)fsbuf;
         for (j = 0; j < SECTOR_SIZE / DIR_ENTRY_SIZE; j++, pde++) {
@@ -682,7 +669,7 @@ static void
     strcpy(new_de->name, filename);
 
     /* write dir block -- ROOT dir block */
-    WR_SECT(dir_inode->i_dev, dir_blk0_nr + i, fsbuf);
+    WR_SECT(dir_inode->i_dev, bmap(dir_inode, i, NULL), fsbuf);
 
     /* update dir inode */
     sync_inode(dir_inode);
@@ -726,51 +713,218 @@ static int alloc_imap_bit(int dev) {
     return 0;
 }
 
-//! \return 1st sector nr allocated.
-static int alloc_smap_bit(int dev, int nr_sects_to_alloc) {
-    /* int nr_sects_to_alloc = NR_DEFAULT_FILE_SECTS; */
+//! sect M <-> bit (M - sb->n_1st_sect + 1) of the sector map
+#define SMAP_BITS_PER_SECT (SECTOR_SIZE * 8)
 
-    int i; /* sector index */
-    int j; /* byte index */
-    int k; /* bit index */
+static bool smap_test(superblock_t *sb, int bit, char *fsbuf, int *cur_sect) {
+    int s = bit / SMAP_BITS_PER_SECT;
+    if (s != *cur_sect) {
+        RD_SECT(sb->sb_dev, 2 + sb->nr_imap_sects + s, fsbuf);
+        *cur_sect = s;
+    }
+    int off = bit % SMAP_BITS_PER_SECT;
+    return (fsbuf[off / 8] >> (off % 8)) & 1;
+}
 
-    superblock_t *sb = get_unique_superblock(dev);
+static void
+    set_smap_bits(superblock_t *sb, uint32_t start_sect, int nr, bool used) {
+    int  bit      = start_sect - sb->n_1st_sect + 1;
+    int  cur_sect = -1;
+    char fsbuf[SECTOR_SIZE];
+    for (int i = 0; i < nr; ++i, ++bit) {
+        int s = bit / SMAP_BITS_PER_SECT;
+        if (s != cur_sect) {
+            if (cur_sect != -1) {
+                WR_SECT(sb->sb_dev, 2 + sb->nr_imap_sects + cur_sect, fsbuf);
+            }
+            RD_SECT(sb->sb_dev, 2 + sb->nr_imap_sects + s, fsbuf);
+            cur_sect = s;
+        }
+        int off = bit % SMAP_BITS_PER_SECT;
+        if (used) {
+            fsbuf[off / 8] |= 1 << (off % 8);
+        } else {
+            fsbuf[off / 8] &= ~(1 << (off % 8));
+        }
+    }
+    if (cur_sect != -1) {
+        WR_SECT(sb->sb_dev, 2 + sb->nr_imap_sects + cur_sect, fsbuf);
+    }
+}
 
-    int  smap_blk0_nr = 1 + 1 + sb->nr_imap_sects;
-    int  free_sect_nr = 0;
-    char fsbuf[SECTOR_SIZE]; // local array, to substitute global fsbuf.
-                             // added by xw, 18/12/27
+/*!
+ * \brief allocate a run of at most nr free sectors
+ *
+ * The run right at goal is always taken so that a file grows in place,
+ * otherwise the first run from goal on that has room for min_run sectors is
+ * taken, and the longest one if there is no such run.
+ *
+ * \param goal the sector expected to start the run, 0 if none
+ * \param[out] nr_alloc how many sectors are allocated, 0 if the disk is full
+ *
+ * \return the first sector of the run
+ */
+static uint32_t
+    alloc_smap_run(int dev, uint32_t goal, int nr, int min_run, int *nr_alloc) {
+    superblock_t *sb       = get_unique_superblock(dev);
+    int           max_bit  = sb->nr_sects - sb->n_1st_sect;
+    bool          in_place = goal >= sb->n_1st_sect && goal < sb->nr_sects;
+    int           first    = in_place ? goal - sb->n_1st_sect + 1 : 1;
+
+    int  cur_sect  = -1;
+    int  run_start = 0;
+    int  run_len   = 0;
+    int  best      = 0;
+    int  best_len  = 0;
+    char fsbuf[SECTOR_SIZE];
 
-    for (i = 0; i < sb->nr_smap_sects; i++) { /* smap_blk0_nr + i :
-                             current sect nr. */
-        // RD_SECT_SCHED(dev, smap_blk0_nr + i, fsbuf);	//modified by xw,
-        // 18/12/27
-        RD_SECT(dev, smap_blk0_nr + i, fsbuf);
-
-        /* byte offset in current sect */
-        for (j = 0; j < SECTOR_SIZE && nr_sects_to_alloc > 0; j++) {
-            k = 0;
-            if (!free_sect_nr) {
-                //! loop until a free bit is found
-                // if (fsbuf[j] == 0xFF) continue;
-                if (fsbuf[j] == '\xFF') continue;
-                for (; ((fsbuf[j] >> k) & 1) != 0; k++) {}
-                free_sect_nr =
-                    (i * SECTOR_SIZE + j) * 8 + k - 1 + sb->n_1st_sect;
-            }
+    lock_or(&smap_lock, sched);
+    //! NOTE: scan from goal to the end and then wrap around, a run never
+    //! crosses the wrap point
+    for (int i = 0, bit = first; i < max_bit; ++i, bit = bit % max_bit + 1) {
+        bool used    = smap_test(sb, bit, fsbuf, &cur_sect);
+        bool at_goal = in_place && run_len > 0 && run_start == first;
+        if (used || bit == 1) {
+            //! the run at goal is taken however short it is
+            if (at_goal) { break; }
+            run_len = 0;
+        }
+        if (used) { continue; }
+        if (run_len++ == 0) { run_start = bit; }
+        if (run_len > best_len) {
+            best     = run_start;
+            best_len = run_len;
+        }
+        at_goal = in_place && run_start == first;
+        if (run_len >= (at_goal ? nr : min_run)) { break; }
+    }
 
-            //! repeat till enough bits are set
-            for (; k < 8; k++) {
-                fsbuf[j] |= (1 << k);
-                if (--nr_sects_to_alloc == 0) break;
-            }
+    int n = min(best_len, nr);
+    if (n > 0) { set_smap_bits(sb, best - 1 + sb->n_1st_sect, n, true); }
+    release(&smap_lock);
+
+    *nr_alloc = n;
+    return n > 0 ? best - 1 + sb->n_1st_sect : 0;
+}
+
+static void free_smap_run(int dev, uint32_t start_sect, int nr) {
+    lock_or(&smap_lock, sched);
+    set_smap_bits(get_unique_superblock(dev), start_sect, nr, false);
+    release(&smap_lock);
+}
+
+//! \return the nr of extents of the file, which are read into exts
+static int get_extents(struct inode *pin, struct extent *exts) {
+    memcpy(exts, pin->i_extents, sizeof(pin->i_extents));
+    if (pin->i_ext_sect != 0) {
+        RD_SECT(pin->i_dev, pin->i_ext_sect, &exts[NR_INODE_EXTENTS]);
+    }
+    int      nr    = 0;
+    uint32_t total = 0;
+    while (nr < NR_FILE_EXTENTS && total < pin->i_nr_sects) {
+        total += exts[nr++].e_nr_sects;
+    }
+    return nr;
+}
+
+static void put_extents(struct inode *pin, struct extent *exts, int nr) {
+    memset(&exts[nr], 0, (NR_FILE_EXTENTS - nr) * sizeof(struct extent));
+    memcpy(pin->i_extents, exts, sizeof(pin->i_extents));
+    if (pin->i_ext_sect != 0) {
+        WR_SECT(pin->i_dev, pin->i_ext_sect, &exts[NR_INODE_EXTENTS]);
+    }
+}
+
+/*!
+ * \brief map the blk-th sector of the file to the sector of the device
+ *
+ * \param[out] run how many sectors of the file from blk on are contiguous on
+ * the device, optional
+ *
+ * \return 0 if the sector is not allocated to the file yet
+ */
+static uint32_t bmap(struct inode *pin, int blk, int *run) {
+    struct extent exts[NR_FILE_EXTENTS];
+    int           nr = get_extents(pin, exts);
+    for (int i = 0; i < nr; ++i) {
+        if (blk < exts[i].e_nr_sects) {
+            if (run != NULL) { *run = exts[i].e_nr_sects - blk; }
+            return exts[i].e_start_sect + blk;
         }
+        blk -= exts[i].e_nr_sects;
+    }
+    return 0;
+}
 
-        //! free bit found, write the bits to smap
-        if (free_sect_nr) { WR_SECT(dev, smap_blk0_nr + i, fsbuf); }
-        if (nr_sects_to_alloc == 0) { break; }
+/*!
+ * \brief allocate sectors to the file on demand till it occupies nr_sects
+ * sectors, the new ones extend the last extent in place whenever possible
+ *
+ * \return false if it falls short since the disk or the extents are used up
+ */
+static bool grow_inode(struct inode *pin, int nr_sects) {
+    if (nr_sects <= pin->i_nr_sects) { return true; }
+
+    //! NOTE: the extents are read, modified and written back as a whole, so
+    //! concurrent appends to the file must not interleave
+    lock_or(&pin->i_lock, sched);
+    if (nr_sects <= pin->i_nr_sects) {
+        release(&pin->i_lock);
+        return true;
     }
-    return free_sect_nr;
+
+    struct extent exts[NR_FILE_EXTENTS];
+    int           nr = get_extents(pin, exts);
+    bool          ok = true;
+    while (pin->i_nr_sects < nr_sects) {
+        struct extent *last = nr > 0 ? &exts[nr - 1] : NULL;
+        uint32_t       goal = last ? last->e_start_sect + last->e_nr_sects : 0;
+        int            want = nr_sects - pin->i_nr_sects;
+        //! NOTE: prefer a run with room for the file to double, so that the
+        //! later appends still go on in place
+        int      got   = 0;
+        uint32_t start = alloc_smap_run(
+            pin->i_dev, goal, want, want + pin->i_nr_sects, &got);
+        if (got == 0) {
+            ok = false;
+            break;
+        }
+        if (last != NULL && start == goal) {
+            last->e_nr_sects += got;
+            pin->i_nr_sects  += got;
+            continue;
+        }
+        if (nr == NR_INODE_EXTENTS && pin->i_ext_sect == 0) {
+            int n           = 0;
+            pin->i_ext_sect = alloc_smap_run(pin->i_dev, 0, 1, 1, &n);
+        }
+        if (nr == NR_FILE_EXTENTS
+            || (nr >= NR_INODE_EXTENTS && pin->i_ext_sect == 0)) {
+            free_smap_run(pin->i_dev, start, got);
+            ok = false;
+            break;
+        }
+        exts[nr].e_start_sect = start;
+        exts[nr].e_nr_sects   = got;
+        pin->i_nr_sects      += got;
+        ++nr;
+    }
+    put_extents(pin, exts, nr);
+    sync_inode(pin);
+    release(&pin->i_lock);
+    return ok;
+}
+
+static void free_extents(struct inode *pin) {
+    struct extent exts[NR_FILE_EXTENTS];
+    int           nr = get_extents(pin, exts);
+    for (int i = 0; i < nr; ++i) {
+        free_smap_run(pin->i_dev, exts[i].e_start_sect, exts[i].e_nr_sects);
+    }
+    if (pin->i_ext_sect != 0) { free_smap_run(pin->i_dev, pin->i_ext_sect, 1); }
+    pin->i_nr_sects = 0;
+    pin->i_ext_sect = 0;
+    memset(pin->i_extents, 0, sizeof(pin->i_extents));
 }
 
 static int do_open(MESSAGE *fs_msg) {
@@ -842,7 +996,7 @@ static int do_open(MESSAGE *fs_msg) {
         int imode = pin->i_mode & I_TYPE_MASK;
         if (imode == I_CHAR_SPECIAL) {
             // MESSAGE driver_msg;
-            // int dev = pin->i_start_sect;
+            // int dev = pin->i_rdev;
         } else if (imode == I_DIRECTORY) {
             if (pin->i_num != ROOT_INODE) { panic("pin->i_num != ROOT_INODE"); }
         } else if (pin->i_mode != I_REGULAR) {
@@ -865,8 +1019,8 @@ static int do_close(int fd) {
     return 0;
 }
 
-//! NOTE: Sector map is not needed to update, since the sectors for the file
-//! have been allocated and the bits are set when the file was created.
+//! NOTE: Sectors are allocated to the file on demand as it is written, see
+//! grow_inode.
 static int do_rdwt(MESSAGE *fs_msg) {
     int   fd  = fs_msg->FD;  /**< file descriptor. */
     void *buf = fs_msg->BUF; /**< r/w buffer */
@@ -887,7 +1041,7 @@ static int do_rdwt(MESSAGE *fs_msg) {
         int t        = fs_msg->type == READ ? DEV_READ : DEV_WRITE;
         fs_msg->type = t;
 
-        int dev    = pin->i_start_sect;
+        int dev    = pin->i_rdev;
         int nr_tty = MINOR(dev);
         if (MAJOR(dev) != 4) { panic("Error: MAJOR(dev) == 4\n"); }
 
@@ -900,33 +1054,58 @@ static int do_rdwt(MESSAGE *fs_msg) {
         return fs_msg->CNT;
     }
 
+    //! NOTE: cached image of the file goes stale once written
+    if (fs_msg->type == WRITE) { imgcache_invalidate(pin->i_dev, pin->i_num); }
+
     int pos_end;
-    if (fs_msg->type == READ)
+    if (fs_msg->type == READ) {
         pos_end = min(pos + len, pin->i_size);
-    else /* WRITE */
+    } else { /* WRITE */
+        //! NOTE: the write falls short only if the disk or the extents of the
+        //! file are used up
+        grow_inode(pin, (pos + len + SECTOR_SIZE - 1) >> SECTOR_SIZE_SHIFT);
         pos_end = min(pos + len, pin->i_nr_sects * SECTOR_SIZE);
+    }
 
-    int off         = pos % SECTOR_SIZE;
-    int rw_sect_min = pin->i_start_sect + (pos >> SECTOR_SIZE_SHIFT);
-    int rw_sect_max = pin->i_start_sect + (pos_end >> SECTOR_SIZE_SHIFT);
-
-    int chunk =
-        min(rw_sect_max - rw_sect_min + 1, SECTOR_SIZE >> SECTOR_SIZE_SHIFT);
-
+    int off        = pos % SECTOR_SIZE;
+    int blk        = pos >> SECTOR_SIZE_SHIFT;
     int bytes_rw   = 0;
-    int bytes_left = len;
-    int i;
+    int bytes_left = max(pos_end - pos, 0);
 
     char fsbuf[SECTOR_SIZE]; // local array, to substitute global fsbuf.
 
-    for (i = rw_sect_min; i <= rw_sect_max; i += chunk) {
+    while (bytes_left > 0) {
+        int      run  = 0;
+        uint32_t sect = bmap(pin, blk, &run);
+        assert(sect != 0);
+
+        //! NOTE: whole sectors are transferred between the disk and the
+        //! caller in place by one request per extent, only the partial ones
+        //! go through fsbuf
+        if (off == 0 && bytes_left >= SECTOR_SIZE) {
+            int chunk = min(bytes_left / SECTOR_SIZE, run);
+            int bytes = chunk * SECTOR_SIZE;
+            rw_sector(
+                fs_msg->type == READ ? DEV_READ : DEV_WRITE,
+                pin->i_dev,
+                sect * SECTOR_SIZE,
+                bytes,
+                caller,
+                buf + bytes_rw);
+            blk                                  += chunk;
+            bytes_rw                             += bytes;
+            p_proc_current->pcb.filp[fd]->fd_pos += bytes;
+            bytes_left                           -= bytes;
+            continue;
+        }
+
         /* read/write this amount of bytes every time */
-        int bytes = min(bytes_left, chunk * SECTOR_SIZE - off);
+        int bytes = min(bytes_left, SECTOR_SIZE - off);
         rw_sector(
             DEV_READ,
             pin->i_dev,
-            i * SECTOR_SIZE,
-            chunk * SECTOR_SIZE,
+            sect * SECTOR_SIZE,
+            SECTOR_SIZE,
             proc2pid(p_proc_current), /// TASK_FS
             fsbuf);
 
@@ -944,8 +1123,8 @@ static int do_rdwt(MESSAGE *fs_msg) {
             rw_sector(
                 DEV_WRITE,
                 pin->i_dev,
-                i * SECTOR_SIZE,
-                chunk * SECTOR_SIZE,
+                sect * SECTOR_SIZE,
+                SECTOR_SIZE,
                 proc2pid(p_proc_current),
                 fsbuf);
         }
@@ -953,6 +1132,7 @@ static int do_rdwt(MESSAGE *fs_msg) {
         bytes_rw                             += bytes;
         p_proc_current->pcb.filp[fd]->fd_pos += bytes;
         bytes_left                           -= bytes;
+        ++blk;
     }
 
     if (p_proc_current->pcb.filp[fd]->fd_pos > pin->i_size) {
@@ -1005,7 +1185,7 @@ static int do_unlink(MESSAGE *fs_msg) {
         return -1;
     }
 
-    superblock_t *sb = get_unique_superblock(pin->i_dev);
+    imgcache_invalidate(pin->i_dev, pin->i_num);
 
     /*************************/
     /* free the bit in i-map */
@@ -1024,66 +1204,13 @@ static int do_unlink(MESSAGE *fs_msg) {
     /**************************/
     /* free the bits in s-map */
     /**************************/
-    /*
-     *           bit_idx: bit idx in the entire i-map
-     *     ... ____|____
-     *                  \        .-- byte_cnt: how many bytes between
-     *                   \      |              the first and last byte
-     *        +-+-+-+-+-+-+-+-+ V +-+-+-+-+-+-+-+-+
-     *    ... | | | | | |*|*|*|...|*|*|*|*| | | | |
-     *        +-+-+-+-+-+-+-+-+   +-+-+-+-+-+-+-+-+
-     *         0 1 2 3 4 5 6 7     0 1 2 3 4 5 6 7
-     *  ...__/
-     *      byte_idx: byte idx in the entire i-map
-     */
-    bit_idx       = pin->i_start_sect - sb->n_1st_sect + 1;
-    byte_idx      = bit_idx / 8;
-    int bits_left = pin->i_nr_sects;
-    int byte_cnt  = (bits_left - (8 - (bit_idx % 8))) / 8;
-
-    /* current sector nr. */
-    int s = 2 /* 2: bootsect + superblk */
-          + sb->nr_imap_sects + byte_idx / SECTOR_SIZE;
-
-    RD_SECT_SCHED(pin->i_dev, s, fsbuf);
-
-    int i;
-    /* clear the first byte */
-    for (i = bit_idx % 8; (i < 8) && bits_left; i++, bits_left--) {
-        // assert((fsbuf[byte_idx % SECTOR_SIZE] >> i & 1) == 1);
-        fsbuf[byte_idx % SECTOR_SIZE] &= ~(1 << i);
-    }
-
-    /* clear bytes from the second byte to the second to last */
-    int k;
-    i = (byte_idx % SECTOR_SIZE) + 1; /* the second byte */
-    for (k = 0; k < byte_cnt; k++, i++, bits_left -= 8) {
-        if (i == SECTOR_SIZE) {
-            i = 0;
-            WR_SECT_SCHED(pin->i_dev, s, fsbuf);
-            RD_SECT_SCHED(pin->i_dev, ++s, fsbuf);
-        }
-        // assert(fsbuf[i] == 0xFF);
-        fsbuf[i] = 0;
-    }
-
-    /* clear the last byte */
-    if (i == SECTOR_SIZE) {
-        i = 0;
-        WR_SECT_SCHED(pin->i_dev, s, fsbuf);
-        RD_SECT_SCHED(pin->i_dev, ++s, fsbuf);
-    }
-    // assert((fsbuf[i] & mask) == mask);
-    fsbuf[i] &= (~0) << bits_left;
-    WR_SECT_SCHED(pin->i_dev, s, fsbuf);
+    free_extents(pin);
 
     /***************************/
     /* clear the i-node itself */
     /***************************/
-    pin->i_mode       = 0;
-    pin->i_size       = 0;
-    pin->i_start_sect = 0;
-    pin->i_nr_sects   = 0;
+    pin->i_mode = 0;
+    pin->i_size = 0;
     sync_inode(pin);
     /* release slot in inode_table[] */
     put_inode(pin);
@@ -1091,7 +1218,6 @@ static int do_unlink(MESSAGE *fs_msg) {
     /************************************************/
     /* set the inode-nr to 0 in the directory entry */
     /************************************************/
-    int dir_blk0_nr = dir_inode->i_start_sect;
     int nr_dir_blks = (dir_inode->i_size + SECTOR_SIZE) / SECTOR_SIZE;
     int nr_dir_entries =
         dir_inode->i_size / DIR_ENTRY_SIZE; /* including unused slots
@@ -1104,8 +1230,9 @@ static int do_unlink(MESSAGE *fs_msg) {
     int               flg      = 0;
     int               dir_size = 0;
 
-    for (i = 0; i < nr_dir_blks; i++) {
-        RD_SECT_SCHED(dir_inode->i_dev, dir_blk0_nr + i, fsbuf);
+    for (int i = 0; i < nr_dir_blks; i++) {
+        uint32_t dir_blk_nr = bmap(dir_inode, i, NULL);
+        RD_SECT_SCHED(dir_inode->i_dev, dir_blk_nr, fsbuf);
 
         pde = (struct dir_entry *)fsbuf;
         int j;
@@ -1115,7 +1242,7 @@ static int do_unlink(MESSAGE *fs_msg) {
             if (pde->inode_nr == inode_nr) {
                 /* pde->inode_nr = 0; */
                 memset(pde, 0, DIR_ENTRY_SIZE);
-                WR_SECT_SCHED(dir_inode->i_dev, dir_blk0_nr + i, fsbuf);
+                WR_SECT_SCHED(dir_inode->i_dev, dir_blk_nr, fsbuf);
                 flg = 1;
                 break;
             }
@@ -1182,9 +1309,8 @@ int real_read(int fd, void *buf, int count) {
     fs_msg.BUF     = buf;
     fs_msg.CNT     = count;
     fs_msg.source  = proc2pid(p_proc_current);
-    int total_rd   = do_rdwt(&fs_msg);
-    assert(total_rd == fs_msg.CNT);
-    return total_rd;
+    //! NOTE: the read stops at the end of the file
+    return do_rdwt(&fs_msg);
 }
 
 int real_write(int fd, const void *buf, int count) {
@@ -1194,9 +1320,8 @@ int real_write(int fd, const void *buf, int count) {
     fs_msg.BUF     = (void *)buf;
     fs_msg.CNT     = count;
     fs_msg.source  = proc2pid(p_proc_current);
-    int total_wr   = do_rdwt(&fs_msg);
-    assert(total_wr == fs_msg.CNT);
-    return total_wr;
+    //! NOTE: the write falls short once the disk is full
+    return do_rdwt(&fs_msg);
 }
 
 int real_unlink(const char *pathname) {
@@ -1215,3 +1340,40 @@ int real_lseek(int fd, int offset, int whence) {
     fs_msg.WHENCE  = whence;
     return do_lseek(&fs_msg);
 }
+
+int real_map_range(
+    int fd, int io_type, int pos, int size, int *dev, uint32_t *sector) {
+    file_desc_t  *file = p_proc_current->pcb.filp[fd];
+    struct inode *pin  = file->fd_node.fd_inode;
+    if (!(file->fd_mode & O_RDWR)) { return -1; }
+    if ((pin->i_mode & I_TYPE_MASK) != I_REGULAR) { return -1; }
+    if (pos < 0 || size <= 0) { return -1; }
+    if (pos % SECTOR_SIZE != 0 || size % SECTOR_SIZE != 0) { return -1; }
+
+    int bytes    = size;
+    int nr_sects = size >> SECTOR_SIZE_SHIFT;
+    if (io_type == DEV_READ) {
+        bytes    = min(pos + size, pin->i_size) - pos;
+        nr_sects = (bytes + SECTOR_SIZE - 1) >> SECTOR_SIZE_SHIFT;
+    } else if (!grow_inode(pin, (pos + size) >> SECTOR_SIZE_SHIFT)) {
+        return -1;
+    }
+    if (bytes <= 0) { return -1; }
+
+    //! NOTE: the range must not cross the extents of the file
+    int      run  = 0;
+    uint32_t sect = bmap(pin, pos >> SECTOR_SIZE_SHIFT, &run);
+    if (sect == 0 || run < nr_sects) { return -1; }
+
+    if (io_type == DEV_WRITE) {
+        //! NOTE: cached image of the file goes stale once written
+        imgcache_invalidate(pin->i_dev, pin->i_num);
+        if (pos + size > pin->i_size) {
+            pin->i_size = pos + size;
+            sync_inode(pin);
+        }
+    }
+    *dev    = pin->i_dev;
+    *sector = sect;
+    return bytes;
+}
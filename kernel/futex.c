@@ -0,0 +1,101 @@
+#include <unios/futex.h>
+#include <unios/syscall.h>
+#include <unios/proc.h>
+#include <unios/page.h>
+#include <unios/layout.h>
+#include <unios/schedule.h>
+#include <unios/waitqueue.h>
+#include <unios/interrupt.h>
+#include <arch/x86.h>
+#include <sys/futex.h>
+#include <sys/errno.h>
+#include <stdint.h>
+#include <list.h>
+
+//! NOTE: waiters of all the futexes that hash to the same bucket share its wait
+//! queue, and a wakeup picks those of the very key only
+static wait_queue_head_t futex_buckets[NR_FUTEX_BUCKETS];
+
+static wait_queue_head_t *futex_bucket(uint64_t key) {
+    //! the low 2 bits of a futex word are always zero
+    uint32_t hash = ((uint32_t)key >> 2 ^ (uint32_t)(key >> 32)) * 2654435761u;
+    return &futex_buckets[hash >> (32 - FUTEX_HASH_BITS)];
+}
+
+/*!
+ * \brief the key of a futex is its address within the address space, which is
+ * identified by the page directory shared by the threads
+ *
+ * \note the frame of the word is no key, since a fork makes it cow and the
+ * next write moves the word to another frame while someone may wait on it
+ */
+static bool futex_key_of(int *uaddr, uint64_t *key) {
+    uint32_t laddr = (uint32_t)uaddr;
+    if (laddr == 0 || laddr % sizeof(int) != 0) { return false; }
+    if (laddr >= KernelLinBase) { return false; }
+    //! NOTE: touch the word first so that a lazily mapped page is faulted in
+    (void)*(volatile int *)uaddr;
+    uint32_t cr3 = p_proc_current->pcb.cr3;
+    if (!pg_addr_pte_exist(cr3, laddr)) { return false; }
+    *key = (uint64_t)cr3 << 32 | laddr;
+    return true;
+}
+
+static int futex_wait(int *uaddr, uint64_t key, int val) {
+    wait_queue_head_t *wq    = futex_bucket(key);
+    pcb_t             *pcb   = &p_proc_current->pcb;
+    bool               sleep = false;
+    //! NOTE: the check of the word and the enqueue must be atomic to wakers,
+    //! otherwise a wakeup in between is lost
+    disable_int_begin();
+    if (*(volatile int *)uaddr == val) {
+        pcb->futex_key = key;
+        prepare_to_wait(wq);
+        sleep = true;
+    }
+    disable_int_end();
+    if (!sleep) { return -EAGAIN; }
+    sched();
+    finish_wait(wq);
+    pcb->futex_key = 0;
+    return 0;
+}
+
+static int futex_wake(uint64_t key, int nr_wake) {
+    wait_queue_head_t *wq    = futex_bucket(key);
+    int                total = 0;
+    disable_int_begin();
+    pcb_t *pcb  = NULL;
+    pcb_t *next = NULL;
+    list_for_each_entry_safe(pcb, next, &wq->head, wait_node) {
+        if (total == nr_wake) { break; }
+        if (pcb->futex_key != key) { continue; }
+        //! NOTE: leaving SLEEPING also detaches it from the wait queue
+        set_proc_stat(pcb, READY);
+        ++total;
+    }
+    disable_int_end();
+    return total;
+}
+
+int do_futex(int *uaddr, int op, int val) {
+    uint64_t key = 0;
+    if (!futex_key_of(uaddr, &key)) { return -EFAULT; }
+    switch (op) {
+        case FUTEX_WAIT: {
+            return futex_wait(uaddr, key, val);
+        } break;
+        case FUTEX_WAKE: {
+            return futex_wake(key, val);
+        } break;
+        default: {
+            return -EINVAL;
+        } break;
+    }
+}
+
+void init_futex() {
+    for (int i = 0; i < NR_FUTEX_BUCKETS; ++i) {
+        init_wait_queue_head(&futex_buckets[i]);
+    }
+}
@@ -3,6 +3,7 @@
 #include <unios/tracing.h>
 #include <unios/memory.h>
 #include <unios/font.h>
+#include <unios/pci.h>
 #include <arch/x86.h>
 #include <config.h>
 #include <unios/layout.h>
@@ -79,29 +80,21 @@ static bool bga_available() {
     return (id & 0xFFF0) == (BGA_ID0 & 0xFFF0);
 }
 
-static inline uint32_t pci_cfg_read32(
-    uint8_t bus, uint8_t dev, uint8_t func, uint8_t offset) {
-    uint32_t addr = 0x80000000u | (bus << 16) | (dev << 11)
-                    | (func << 8) | (offset & 0xfc);
-    outl(0xcf8, addr);
-    return inl(0xcfc);
-}
-
 static uintptr_t find_bochs_lfb_base() {
     const uint16_t vendor = 0x1234;
     const uint16_t device = 0x1111; // qemu stdvga/bochs-display
 
     for (uint8_t dev = 0; dev < 32; ++dev) {
-        uint32_t vdid = pci_cfg_read32(0, dev, 0, 0x00);
-        if (vdid == 0xffffffffu) { continue; }
+        uint32_t vdid = pci_cfg_read32(0, dev, 0, PCI_REG_ID);
+        if (vdid == PCI_INVALID_VDID) { continue; }
         if ((vdid & 0xffffu) != vendor) { continue; }
         if ((vdid >> 16) != device) { continue; }
 
-        uint32_t bar0 = pci_cfg_read32(0, dev, 0, 0x10);
+        uint32_t bar0 = pci_cfg_read32(0, dev, 0, PCI_REG_BAR0);
         if (bar0 & 0x1) { continue; } // io bar, skip
         uintptr_t base = bar0 & ~0xFu;
         if ((bar0 & 0x6) == 0x4) {
-            uint32_t bar1 = pci_cfg_read32(0, dev, 0, 0x14);
+            uint32_t bar1 = pci_cfg_read32(0, dev, 0, PCI_REG_BAR1);
             base |= ((uint64_t)bar1) << 32;
         }
         return base;
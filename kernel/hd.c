@@ -3,11 +3,16 @@
 #include <unios/proc.h>
 #include <unios/fs_const.h>
 #include <unios/hd.h>
+#include <unios/blkdev.h>
 #include <unios/layout.h>
 #include <unios/interrupt.h>
 #include <unios/kstate.h>
 #include <unios/schedule.h>
 #include <unios/tracing.h>
+#include <unios/timer.h>
+#include <unios/pci.h>
+#include <unios/page.h>
+#include <unios/smp.h>
 #include <arch/x86.h>
 #include <assert.h>
 #include <stdlib.h>
@@ -19,16 +24,21 @@
 
 struct part_ent PARTITION_ENTRY;
 
-static HDQueue      hdque;
-static volatile int hd_int_waiting_flag;
-static uint8_t      hd_status;
-static uint8_t      hdbuf[SECTOR_SIZE * 2];
-hd_info_t           hd_info[1];
-
-static void init_hd_queue(HDQueue *hdq);
-static void in_hd_queue(HDQueue *hdq, RWInfo *p);
-static int  out_hd_queue(HDQueue *hdq, RWInfo **p);
-static void hd_rdwt_real(RWInfo *p);
+static uint32_t          hd_lock;
+static volatile int      hd_int_waiting_flag;
+static uint8_t           hd_status;
+static uint8_t           hdbuf[SECTOR_SIZE * 2];
+static uint16_t          bm_base;       //<! io base of bm ide, 0 if none
+static prd_t            *prdt;          //<! one page, never crosses 64K
+static phyaddr_t         prdt_phy;
+static volatile bool     hd_dma_active; //<! the interrupt completes a dma
+static volatile bool     hd_dma_done;
+static uint8_t           hd_dma_status;
+static wait_queue_head_t hd_dma_wait;
+static phyaddr_t         hd_phy_limit;  //<! limit of the kernel space frames
+hd_info_t                hd_info[1];
+
+static void init_hd_dma();
 
 static void get_part_table(int drive, int sect_nr, struct part_ent *entry);
 static void partition(int device, int style);
@@ -62,8 +72,10 @@ void init_hd() {
     const int n = sizeof(hd_info) / sizeof(hd_info_t);
     for (int i = 0; i < n; i++) { memset(&hd_info[i], 0, sizeof(hd_info_t)); }
     hd_info[0].open_cnt = 0;
+    hd_lock             = 0;
+    get_phymem_bound(KernelSpace, NULL, &hd_phy_limit);
 
-    init_hd_queue(&hdque);
+    init_hd_dma();
 }
 
 void hd_open(int drive) {
@@ -86,166 +98,277 @@ void hd_close(int device) {
     hd_info[drive].open_cnt--;
 }
 
-void hd_rdwt(MESSAGE *p) {
-    static uint32_t lock = 0;
-    lock_or(&lock, sched);
-    int drive = DRV_OF_DEV(p->DEVICE);
+int hd_drive_of(int device) {
+    return DRV_OF_DEV(device);
+}
 
-    uint64_t pos = p->POSITION;
+uint32_t hd_abs_sector(int device, uint32_t sector) {
+    int drive  = DRV_OF_DEV(device);
+    int logidx = (device - MINOR_hd1a) % NR_SUB_PER_DRIVE;
+    return sector
+         + (device < MAX_PRIM ? hd_info[drive].primary[device].base
+                              : hd_info[drive].logical[logidx].base);
+}
 
-    // We only allow to R/W from a SECTOR boundary:
+/*!
+ * \brief move the data of a physical piece within one page through the data
+ * port
+ */
+static void hd_pio_piece(int io_type, phyaddr_t phy, int size) {
+    if (phy + size <= hd_phy_limit) {
+        if (io_type == DEV_READ) {
+            insw(REG_DATA, K_PHY2LIN(phy), size);
+        } else {
+            outsw(REG_DATA, K_PHY2LIN(phy), size);
+        }
+        return;
+    }
 
-    uint32_t sect_nr =
-        (uint32_t)(pos >> SECTOR_SIZE_SHIFT); // pos / SECTOR_SIZE
-    int logidx  = (p->DEVICE - MINOR_hd1a) % NR_SUB_PER_DRIVE;
-    sect_nr    += p->DEVICE < MAX_PRIM ? hd_info[drive].primary[p->DEVICE].base
-                                       : hd_info[drive].logical[logidx].base;
+    //! NOTE: user frames are out of the kernel space, access them through the
+    //! share window of the current page table, which must never be left mapped
+    //! across a schedule since the window is shared with the cow handler
+    disable_int_begin();
+    uint32_t   cr3   = rcr3();
+    uint32_t   laddr = SharePageBase;
+    pg_batch_t batch;
+    pg_batch_begin(&batch, cr3);
+    assert(!pg_addr_pte_exist(cr3, laddr));
+    bool ok = pg_batch_map(
+        &batch,
+        laddr,
+        pg_frame_phyaddr(phy),
+        PG_P | PG_U | PG_RWX,
+        PG_P | PG_S | PG_RWX);
+    assert(ok);
+    void *data = (void *)(laddr + pg_offset(phy));
+    if (io_type == DEV_READ) {
+        insw(REG_DATA, data, size);
+    } else {
+        outsw(REG_DATA, data, size);
+    }
+    pg_batch_unmap(&batch, laddr, false);
+    pg_batch_commit(&batch);
+    disable_int_end();
+}
+
+/*!
+ * \brief pio transfer of at most HD_MAX_SECTS_PER_CMD sectors by one command
+ *
+ * \note the data is moved between the data port and the frames in place, the
+ * drive raises one interrupt per drq block of multi_sects sectors
+ */
+static void hd_pio(
+    int              io_type,
+    int              drive,
+    uint32_t         sect_nr,
+    int              nr_sects,
+    const bio_vec_t *vecs) {
+    assert(nr_sects > 0 && nr_sects <= HD_MAX_SECTS_PER_CMD);
+    int  block    = max(hd_info[drive].multi_sects, 1);
+    bool multiple = block > 1;
 
     struct hd_cmd cmd;
     cmd.features = 0;
-    cmd.count    = (p->CNT + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    cmd.count    = nr_sects & 0xFF;
     cmd.lba_low  = sect_nr & 0xFF;
     cmd.lba_mid  = (sect_nr >> 8) & 0xFF;
     cmd.lba_high = (sect_nr >> 16) & 0xFF;
     cmd.device   = MAKE_DEVICE_REG(1, drive, (sect_nr >> 24) & 0xF);
-    cmd.command  = (p->type == DEV_READ) ? ATA_READ : ATA_WRITE;
+    if (io_type == DEV_READ) {
+        cmd.command = multiple ? ATA_READ_MULTIPLE : ATA_READ;
+    } else {
+        cmd.command = multiple ? ATA_WRITE_MULTIPLE : ATA_WRITE;
+    }
     hd_cmd_out(&cmd);
 
-    int   bytes_left = p->CNT;
-    void *la         = (void *)va2la(p->PROC_NR, p->BUF);
-
-    while (bytes_left) {
-        int bytes = min(SECTOR_SIZE, bytes_left);
-        if (p->type == DEV_READ) {
+    int vec_off = 0; //<! offset into the current vec
+    for (int i = 0; i < nr_sects; i += block) {
+        int end = min(i + block, nr_sects);
+        if (io_type == DEV_READ) {
             interrupt_wait();
-            insw(REG_DATA, hdbuf, SECTOR_SIZE);
-            memcpy(la, hdbuf, bytes);
-        } else {
-            if (!waitfor(STATUS_DRQ, STATUS_DRQ, HD_TIMEOUT)) {
-                abort("hd writing error.");
+        } else if (!waitfor(STATUS_DRQ, STATUS_DRQ, HD_TIMEOUT)) {
+            abort("hd writing error.");
+        }
+        for (int left = (end - i) * SECTOR_SIZE; left > 0;) {
+            phyaddr_t phy  = vecs->phyaddr + vec_off;
+            int       size = min(left, vecs->size - vec_off);
+            size           = min(size, NUM_4K - pg_offset(phy));
+            hd_pio_piece(io_type, phy, size);
+            left    -= size;
+            vec_off += size;
+            if (vec_off == vecs->size) {
+                ++vecs;
+                vec_off = 0;
             }
-
-            memcpy(hdbuf, la, bytes);
-            outsw(REG_DATA, hdbuf, SECTOR_SIZE);
-            interrupt_wait();
         }
-        bytes_left -= SECTOR_SIZE;
-        la         += SECTOR_SIZE;
+        if (io_type == DEV_WRITE) { interrupt_wait(); }
     }
-    release(&lock);
 }
 
-// added by xw, 18/8/26
-void hd_service() {
-    RWInfo *rwinfo;
-
-    while (1) {
-        // the hd queue is not empty when out_hd_queue return 1.
-        while (out_hd_queue(&hdque, &rwinfo)) {
-            hd_rdwt_real(rwinfo);
-            rwinfo->proc->pcb.stat = READY;
+static uint16_t find_bmide_base() {
+    for (uint8_t dev = 0; dev < PCI_NR_DEVS; ++dev) {
+        for (uint8_t func = 0; func < PCI_NR_FUNCS; ++func) {
+            uint32_t vdid = pci_cfg_read32(0, dev, func, PCI_REG_ID);
+            if (vdid == PCI_INVALID_VDID) { continue; }
+            uint32_t class = pci_cfg_read32(0, dev, func, PCI_REG_CLASS);
+            if ((class >> 16) != PCI_CLASS_IDE) { continue; }
+            if (((class >> 8) & PCI_PROGIF_BMIDE) == 0) { continue; }
+            uint32_t bar4 = pci_cfg_read32(0, dev, func, PCI_REG_BAR4);
+            if ((bar4 & 0x1) == 0) { continue; } // must be an io bar
+
+            //! NOTE: zeros written to the status half are ignored
+            uint32_t cmd = pci_cfg_read32(0, dev, func, PCI_REG_COMMAND);
+            cmd          = (cmd & 0xffff) | PCI_CMD_IO | PCI_CMD_MASTER;
+            pci_cfg_write32(0, dev, func, PCI_REG_COMMAND, cmd);
+            return bar4 & 0xfffc;
         }
-        yield();
     }
+    return 0;
 }
 
-static void hd_rdwt_real(RWInfo *p) {
-    int drive = DRV_OF_DEV(p->msg->DEVICE);
+static void init_hd_dma() {
+    hd_dma_active = false;
+    hd_dma_done   = false;
+    init_wait_queue_head(&hd_dma_wait);
+
+    bm_base  = find_bmide_base();
+    prdt_phy = bm_base == 0 ? 0 : kmalloc_phypage();
+    if (prdt_phy == 0) {
+        bm_base = 0;
+        kwarn("hd: no bus master ide, fall back to pio");
+        return;
+    }
+    prdt = K_PHY2LIN(prdt_phy);
+    kinfo("hd: bus master ide at io %#x", bm_base);
+}
 
-    uint64_t pos = p->msg->POSITION;
+/*!
+ * \brief fill the prd table with the physical segments
+ *
+ * \return false if the prd table overflows, then pio is used
+ */
+static bool hd_dma_prepare(const bio_vec_t *vecs, int nr_vecs) {
+    const int nr_prds = NUM_4K / sizeof(prd_t);
+    int       total   = 0;
+    for (int i = 0; i < nr_vecs; ++i) {
+        for (int off = 0; off < vecs[i].size;) {
+            phyaddr_t phy  = vecs[i].phyaddr + off;
+            int       size = min(vecs[i].size - off, 0x10000 - (phy & 0xffff));
+            off           += size;
+            if (total > 0) {
+                prd_t    *prev = &prdt[total - 1];
+                phyaddr_t end  = prev->phyaddr + prev->size;
+                if (end == phy && (end & 0xffff) != 0) {
+                    prev->size += size;
+                    continue;
+                }
+            }
+            if (total == nr_prds) { return false; }
+            prdt[total].phyaddr = phy;
+            prdt[total].size    = size & 0xffff;
+            prdt[total].flags   = 0;
+            ++total;
+        }
+    }
+    prdt[total - 1].flags = PRD_EOT;
+    return true;
+}
 
-    // We only allow to R/W from a SECTOR boundary:
+static void hd_dma_wait_done() {
+    //! NOTE: nothing else can be scheduled during the initialization
+    if (kstate_on_init) {
+        while (!hd_dma_done) {}
+        return;
+    }
+    while (true) {
+        prepare_to_wait(&hd_dma_wait);
+        if (hd_dma_done) { break; }
+        sched();
+    }
+    finish_wait(&hd_dma_wait);
+}
 
-    uint32_t sect_nr =
-        (uint32_t)(pos >> SECTOR_SIZE_SHIFT); // pos / SECTOR_SIZE
-    int logidx  = (p->msg->DEVICE - MINOR_hd1a) % NR_SUB_PER_DRIVE;
-    sect_nr    += p->msg->DEVICE < MAX_PRIM
-                    ? hd_info[drive].primary[p->msg->DEVICE].base
-                    : hd_info[drive].logical[logidx].base;
+/*!
+ * \brief dma transfer of at most HD_MAX_SECTS_PER_CMD sectors by one command
+ *
+ * \return false if not transferred, then pio is used instead
+ */
+static bool hd_dma(
+    int              io_type,
+    int              drive,
+    uint32_t         sect_nr,
+    int              nr_sects,
+    const bio_vec_t *vecs,
+    int              nr_vecs) {
+    if (bm_base == 0 || !hd_info[drive].dma) { return false; }
+    if (!hd_dma_prepare(vecs, nr_vecs)) { return false; }
+
+    uint8_t bm_cmd = io_type == DEV_READ ? BM_CMD_READ : 0;
+    outl(bm_base + BM_REG_PRDT, prdt_phy);
+    outb(bm_base + BM_REG_CMD, bm_cmd);
+    outb(bm_base + BM_REG_STATUS, BM_STATUS_ERR | BM_STATUS_INTR);
+    hd_dma_done   = false;
+    hd_dma_active = true;
 
     struct hd_cmd cmd;
     cmd.features = 0;
-    cmd.count    = (p->msg->CNT + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    cmd.count    = nr_sects & 0xFF;
     cmd.lba_low  = sect_nr & 0xFF;
     cmd.lba_mid  = (sect_nr >> 8) & 0xFF;
     cmd.lba_high = (sect_nr >> 16) & 0xFF;
     cmd.device   = MAKE_DEVICE_REG(1, drive, (sect_nr >> 24) & 0xF);
-    cmd.command  = (p->msg->type == DEV_READ) ? ATA_READ : ATA_WRITE;
+    cmd.command  = io_type == DEV_READ ? ATA_READ_DMA : ATA_WRITE_DMA;
     hd_cmd_out(&cmd);
-
-    int   bytes_left = p->msg->CNT;
-    void *la         = p->kbuf; // attention here!
-
-    while (bytes_left) {
-        int bytes = min(SECTOR_SIZE, bytes_left);
-        if (p->msg->type == DEV_READ) {
-            interrupt_wait();
-            insw(REG_DATA, hdbuf, SECTOR_SIZE);
-            memcpy(la, hdbuf, bytes);
-        } else {
-            if (!waitfor(STATUS_DRQ, STATUS_DRQ, HD_TIMEOUT)) {
-                abort("hd writing error.");
-            }
-            memcpy(hdbuf, la, bytes);
-            outsw(REG_DATA, hdbuf, SECTOR_SIZE);
-            interrupt_wait();
-        }
-        bytes_left -= SECTOR_SIZE;
-        la         += SECTOR_SIZE;
+    outb(bm_base + BM_REG_CMD, bm_cmd | BM_CMD_START);
+    hd_dma_wait_done();
+
+    if ((hd_dma_status & BM_STATUS_ERR) || (hd_status & STATUS_ERR)) {
+        //! NOTE: the sectors are then transferred again by pio
+        kwarn("hd: dma error, status %#x, fall back to pio", hd_status);
+        hd_info[drive].dma = false;
+        return false;
     }
+    return true;
 }
 
-void hd_rdwt_sched(MESSAGE *p) {
-    RWInfo rwinfo;
-    int    size = p->CNT;
-    void  *buffer;
-
-    buffer      = kmalloc(size);
-    rwinfo.msg  = p;
-    rwinfo.kbuf = buffer;
-    rwinfo.proc = p_proc_current;
-
-    if (p->type == DEV_READ) {
-        in_hd_queue(&hdque, &rwinfo);
-        p_proc_current->pcb.channel = &hdque;
-        p_proc_current->pcb.stat    = SLEEPING;
-        sched();
-        memcpy(p->BUF, buffer, p->CNT);
-    } else {
-        memcpy(buffer, p->BUF, p->CNT);
-        in_hd_queue(&hdque, &rwinfo);
-        p_proc_current->pcb.channel = &hdque;
-        p_proc_current->pcb.stat    = SLEEPING;
-        sched();
+void hd_rdwt_vecs(
+    int              io_type,
+    int              device,
+    uint32_t         sector,
+    int              nr_sects,
+    const bio_vec_t *vecs,
+    int              nr_vecs) {
+    int      drive   = DRV_OF_DEV(device);
+    uint32_t sect_nr = hd_abs_sector(device, sector);
+    lock_or(&hd_lock, sched);
+    if (!hd_dma(io_type, drive, sect_nr, nr_sects, vecs, nr_vecs)) {
+        hd_pio(io_type, drive, sect_nr, nr_sects, vecs);
     }
-
-    kfree(buffer);
-}
-
-void init_hd_queue(HDQueue *hdq) {
-    hdq->front = hdq->rear = NULL;
+    release(&hd_lock);
 }
 
-static void in_hd_queue(HDQueue *hdq, RWInfo *p) {
-    p->next = NULL;
-    if (hdq->rear == NULL) { // put in the first node
-        hdq->front = hdq->rear = p;
-    } else {
-        hdq->rear->next = p;
-        hdq->rear       = p;
+void hd_rdwt(MESSAGE *p) {
+    void    *la       = va2la(p->PROC_NR, p->BUF);
+    uint32_t sector   = (uint32_t)(p->POSITION >> SECTOR_SIZE_SHIFT);
+    int      nr_sects = p->CNT / SECTOR_SIZE;
+    int      tail     = p->CNT % SECTOR_SIZE;
+    if (nr_sects > 0) {
+        int error = blk_rdwt(p->type, p->DEVICE, sector, nr_sects, la);
+        assert(error == 0);
     }
-}
+    if (tail == 0) { return; }
 
-static int out_hd_queue(HDQueue *hdq, RWInfo **p) {
-    if (hdq->rear == NULL) return 0; // empty
-
-    *p = hdq->front;
-    if (hdq->front == hdq->rear) { // put out the last node
-        hdq->front = hdq->rear = NULL;
+    //! NOTE: only the partial tail sector is bounced
+    uint16_t buf[SECTOR_SIZE / 2];
+    la += nr_sects * SECTOR_SIZE;
+    if (p->type == DEV_READ) {
+        blk_rdwt(DEV_READ, p->DEVICE, sector + nr_sects, 1, buf);
+        memcpy(la, buf, tail);
     } else {
-        hdq->front = hdq->front->next;
+        memcpy(buf, la, tail);
+        memset((void *)buf + tail, 0, SECTOR_SIZE - tail);
+        blk_rdwt(DEV_WRITE, p->DEVICE, sector + nr_sects, 1, buf);
     }
-    return 1; // not empty
 }
 
 //~xw
@@ -472,6 +595,29 @@ static void hd_identify(int drive) {
     hd_info[drive].primary[0].base = 0;
     /* Total Nr of User Addressable Sectors */
     hd_info[drive].primary[0].size = ((int)hdinfo[61] << 16) + hdinfo[60];
+    /* Capabilities bit 8: DMA supported */
+    hd_info[drive].dma = bm_base != 0 && (hdinfo[49] & 0x0100);
+
+    //! NOTE: word 47 holds the max sectors per drq block of READ/WRITE
+    //! MULTIPLE, enable the multiple mode with it to save the interrupts
+    int max_multi = hdinfo[47] & 0xFF;
+    hd_info[drive].multi_sects = 1;
+    if (max_multi > 1) {
+        cmd.features = 0;
+        cmd.count    = max_multi;
+        cmd.lba_low  = 0;
+        cmd.lba_mid  = 0;
+        cmd.lba_high = 0;
+        cmd.device   = MAKE_DEVICE_REG(0, drive, 0);
+        cmd.command  = ATA_SET_MULTIPLE;
+        hd_cmd_out(&cmd);
+        interrupt_wait();
+        if ((hd_status & STATUS_ERR) == 0) {
+            hd_info[drive].multi_sects = max_multi;
+        }
+    }
+    kinfo(
+        "HD multiple mode: %d sectors per block", hd_info[drive].multi_sects);
 }
 
 /*****************************************************************************
@@ -553,7 +699,8 @@ static void hd_cmd_out(struct hd_cmd *cmd) {
  *
  *****************************************************************************/
 static void interrupt_wait() {
-    while (hd_int_waiting_flag) {}
+    //! NOTE: the irq is taken by the bsp, which needs the kernel lock for it
+    while (hd_int_waiting_flag) { smp_kernel_relax(); }
     hd_int_waiting_flag = 1;
 }
 
@@ -569,7 +716,11 @@ static void interrupt_wait() {
  *
  * @return One if sucess, zero if timeout.
  *****************************************************************************/
-static int waitfor(int mask, int val, int timeout) {
+static void waitfor_timeout(void *arg) {
+    *(volatile bool *)arg = true;
+}
+
+static int waitfor_ticks(int mask, int val, int timeout) {
     int t0 = do_get_ticks();
     while (true) {
         int t1 = do_get_ticks();
@@ -579,6 +730,24 @@ static int waitfor(int mask, int val, int timeout) {
     return 0;
 }
 
+static int waitfor(int mask, int val, int timeout) {
+    //! NOTE: the clock does not run the timers during init, but system_ticks
+    //! still advances
+    if (kstate_on_init) { return waitfor_ticks(mask, val, timeout); }
+    volatile bool expired = false;
+    ktimer_t      timer;
+    ktimer_init(&timer, waitfor_timeout, (void *)&expired);
+    ktimer_arm(&timer, sysclk_from_clock(timeout));
+    while (!expired) {
+        if ((inb(REG_STATUS) & mask) == val) {
+            ktimer_cancel(&timer);
+            return 1;
+        }
+        smp_kernel_relax();
+    }
+    return 0;
+}
+
 /*****************************************************************************
  *                                hd_handler
  *****************************************************************************/
@@ -595,6 +764,15 @@ static void hd_handler(int irq) {
      *   - writes to the Command Register.
      */
     hd_status = inb(REG_STATUS);
+    if (hd_dma_active) {
+        hd_dma_status = inb(bm_base + BM_REG_STATUS);
+        outb(bm_base + BM_REG_CMD, 0);
+        outb(bm_base + BM_REG_STATUS, BM_STATUS_ERR | BM_STATUS_INTR);
+        hd_dma_active = false;
+        hd_dma_done   = true;
+        wake_up_all(&hd_dma_wait);
+        return;
+    }
     inform_int();
 
     /* There is two stages - in kernel intializing or in process running.
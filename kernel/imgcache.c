@@ -0,0 +1,188 @@
+#include <unios/imgcache.h>
+#include <unios/memory.h>
+#include <unios/page.h>
+#include <unios/schedule.h>
+#include <unios/sync.h>
+#include <unios/assert.h>
+#include <stddef.h>
+#include <math.h>
+#include <list.h>
+
+//! a read-only PT_LOAD segment of an executable, keyed by (dev, ino) and the
+//! placement of the segment
+typedef struct imgcache_entry_s {
+    int              dev;
+    int              ino;
+    uint32_t         offset;   //<! file offset of the segment
+    uint32_t         va;       //<! laddr of the segment
+    uint32_t         filesz;   //<! bytes read from the file
+    uint32_t         memsz;    //<! bytes in memory, the rest is zero filled
+    int              nr_pages; //<! frames covering [va, va + memsz)
+    phyaddr_t       *frames;   //<! one reference of each is held by the cache
+    struct list_head node;     //<! link in `entry_list`, mru first
+} imgcache_entry_t;
+
+static struct list_head entry_list;
+static imgcache_stat_t  imgcache_stat;
+static uint32_t         imgcache_gen;
+static spinlock_t       imgcache_lock;
+
+static void imgcache_range(
+    const elf_proghdr_t *progh, uint32_t *p_base, uint32_t *p_limit) {
+    *p_base  = round_down(progh->va, NUM_4K);
+    *p_limit = round_up(progh->va + progh->memsz, NUM_4K);
+}
+
+static imgcache_entry_t *
+    imgcache_find(int dev, int ino, const elf_proghdr_t *progh) {
+    imgcache_entry_t *entry = NULL;
+    list_for_each_entry(entry, &entry_list, node) {
+        if (entry->dev != dev || entry->ino != ino) { continue; }
+        if (entry->offset != progh->offset || entry->va != progh->va) {
+            continue;
+        }
+        if (entry->filesz != progh->filesz || entry->memsz != progh->memsz) {
+            continue;
+        }
+        return entry;
+    }
+    return NULL;
+}
+
+static void imgcache_free_entry(imgcache_entry_t *entry) {
+    for (int i = 0; i < entry->nr_pages; ++i) {
+        free_phypage(entry->frames[i]);
+    }
+    kfree(entry->frames);
+    kfree(entry);
+}
+
+static void imgcache_unlink(imgcache_entry_t *entry) {
+    list_del(&entry->node);
+    --imgcache_stat.nr_entries;
+    imgcache_stat.nr_pages -= entry->nr_pages;
+}
+
+bool imgcache_map(int dev, int ino, const elf_proghdr_t *progh, uint32_t cr3) {
+    lock_or(&imgcache_lock, sched);
+    imgcache_entry_t *entry = imgcache_find(dev, ino, progh);
+    if (entry == NULL) {
+        ++imgcache_stat.nr_misses;
+        release(&imgcache_lock);
+        return false;
+    }
+    list_move(&entry->node, &entry_list);
+
+    uint32_t base  = 0;
+    uint32_t limit = 0;
+    imgcache_range(progh, &base, &limit);
+    uint32_t laddr = base;
+    bool     ok    = true;
+    for (int i = 0; i < entry->nr_pages; ++i, laddr += NUM_4K) {
+        ok = pg_map_laddr(
+            cr3,
+            laddr,
+            entry->frames[i],
+            PG_P | PG_U | PG_RWX,
+            PG_P | PG_U | PG_RX);
+        if (!ok) { break; }
+        ref_phypage(entry->frames[i]);
+    }
+    //! drop the references taken by the partially mapped part
+    if (!ok) { pg_unmap_laddr_range(cr3, base, laddr, true); }
+
+    if (ok) { ++imgcache_stat.nr_hits; }
+    release(&imgcache_lock);
+    return ok;
+}
+
+void imgcache_insert(
+    int dev, int ino, const elf_proghdr_t *progh, uint32_t cr3, uint32_t gen) {
+    uint32_t base  = 0;
+    uint32_t limit = 0;
+    imgcache_range(progh, &base, &limit);
+
+    imgcache_entry_t *entry = kmalloc(sizeof(imgcache_entry_t));
+    if (entry == NULL) { return; }
+    entry->nr_pages = (limit - base) / NUM_4K;
+    entry->frames   = kmalloc(entry->nr_pages * sizeof(phyaddr_t));
+    if (entry->frames == NULL) {
+        kfree(entry);
+        return;
+    }
+    entry->dev    = dev;
+    entry->ino    = ino;
+    entry->offset = progh->offset;
+    entry->va     = progh->va;
+    entry->filesz = progh->filesz;
+    entry->memsz  = progh->memsz;
+
+    uint32_t laddr = base;
+    for (int i = 0; i < entry->nr_pages; ++i, laddr += NUM_4K) {
+        assert(pg_addr_pte_exist(cr3, laddr));
+        entry->frames[i] = pg_frame_phyaddr(pg_laddr_phyaddr(cr3, laddr));
+        ref_phypage(entry->frames[i]);
+    }
+
+    lock_or(&imgcache_lock, sched);
+    //! NOTE: the file may be written while the segment is being read, or the
+    //! same segment may be cached by another exec in between
+    if (gen != imgcache_gen || imgcache_find(dev, ino, progh) != NULL) {
+        release(&imgcache_lock);
+        imgcache_free_entry(entry);
+        return;
+    }
+    imgcache_entry_t *victim = NULL;
+    if (imgcache_stat.nr_entries == IMGCACHE_MAX_ENTRIES) {
+        victim = list_last_entry(&entry_list, imgcache_entry_t, node);
+        imgcache_unlink(victim);
+    }
+    list_add(&entry->node, &entry_list);
+    ++imgcache_stat.nr_entries;
+    imgcache_stat.nr_pages += entry->nr_pages;
+    release(&imgcache_lock);
+
+    if (victim != NULL) { imgcache_free_entry(victim); }
+}
+
+void imgcache_invalidate(int dev, int ino) {
+    struct list_head dropped;
+    INIT_LIST_HEAD(&dropped);
+
+    lock_or(&imgcache_lock, sched);
+    ++imgcache_gen;
+    imgcache_entry_t *entry = NULL;
+    imgcache_entry_t *next  = NULL;
+    list_for_each_entry_safe(entry, next, &entry_list, node) {
+        if (entry->dev != dev || entry->ino != ino) { continue; }
+        imgcache_unlink(entry);
+        list_add(&entry->node, &dropped);
+    }
+    release(&imgcache_lock);
+
+    //! frames still mapped by running procs live on with their references
+    list_for_each_entry_safe(entry, next, &dropped, node) {
+        imgcache_free_entry(entry);
+    }
+}
+
+uint32_t imgcache_generation() {
+    return imgcache_gen;
+}
+
+void imgcache_get_stat(imgcache_stat_t *stat) {
+    assert(stat != NULL);
+    lock_or(&imgcache_lock, sched);
+    *stat = imgcache_stat;
+    release(&imgcache_lock);
+}
+
+void init_imgcache() {
+    INIT_LIST_HEAD(&entry_list);
+    imgcache_stat.nr_entries = 0;
+    imgcache_stat.nr_pages   = 0;
+    imgcache_stat.nr_hits    = 0;
+    imgcache_stat.nr_misses  = 0;
+    imgcache_gen             = 0;
+    imgcache_lock            = 0;
+}
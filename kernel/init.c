@@ -1,6 +1,7 @@
 #include <unios/tracing.h>
 #include <unios/hd.h>
 #include <unios/fs.h>
+#include <unios/schedule.h>
 #include <unios/tty.h>
 #include <config.h>
 #include <assert.h>
@@ -97,11 +98,11 @@ static void init_setup_envs() {
 }
 
 static void init_enable_preinited_procs() {
-    for (int i = 0; i < NR_PCBS; ++i) {
+    for (int i = 0; i < nr_pcbs; ++i) {
         process_t *proc = proc_table[i];
         if (proc == NULL) { continue; }
         if (proc->pcb.stat != PREINITED) { continue; }
-        proc->pcb.stat = READY;
+        set_proc_stat(&proc->pcb, READY);
     }
 }
 
@@ -150,8 +151,8 @@ void init() {
     init_untar_user_progs();
     init_enable_preinited_procs();
     while (true) {
+        tty_wait_request();
         init_handle_new_tty();
-        yield();
     }
     unreachable();
 }
@@ -1,6 +1,7 @@
 #include <unios/interrupt.h>
 #include <unios/tracing.h>
 #include <unios/proc.h>
+#include <unios/schedule.h>
 #include <arch/x86.h>
 
 irq_handler_t irq_table[NR_IRQS];
@@ -99,5 +100,5 @@ void exception_handler(int vec_no, int err_code, int eip, int cs, int eflags) {
         err_code,
         p_proc_current->pcb.pid);
 
-    p_proc_current->pcb.stat = KILLED;
+    set_proc_stat(&p_proc_current->pcb, KILLED);
 }
@@ -36,24 +36,21 @@ extern cstart
 extern kernel_main
 extern cherry_pick_next_ready_proc
 extern switch_cr3
+extern this_cpu
+extern smp_lock_kernel
 
 extern gdt_ptr
 extern idt_ptr
-extern p_proc_current
-extern tss
+extern smp_kernel_lock
 extern syscall_table
 extern cr3_ready
 extern p_proc_next
-extern kstate_reenter_cntr
 extern kstate_on_init
 
 [bits 32]
 
 [section .bss]
 
-StackSpace resb 2 * 1024
-StackTop:       ; used only as irq-stack in minios
-
 KernelStackSpace resb 2 * 1024
 KernelStackTop: ; used as stack of kernel itself
 
@@ -80,10 +77,9 @@ renew_env:
     call    switch_cr3
     mov     eax, [cr3_ready]
     mov     cr3, eax
-    mov     eax, [p_proc_current]
+    call    this_cpu
+    mov     eax, [eax + CPU_PROC]
     lldt    [eax + P_LDT_SEL]
-    lea     ebx, [eax + INIT_STACK_SIZE]
-    mov     dword [tss + TSS3_S_SP0], ebx
     ret
 
     global save_int
@@ -93,18 +89,20 @@ save_int:
     push    es      ;
     push    fs      ;
     push    gs      ; <--
-    cmp     dword [kstate_reenter_cntr], 0
-    jnz     instack ; already in the irq-stack
-    mov     ebx,  [p_proc_current]
-    mov     dword [ebx + ESP_SAVE_INT], esp
     mov     dx, ss
     mov     ds, dx
     mov     es, dx
     mov     fs, dx
     mov     dx, SELECTOR_VIDEO - 2
     mov     gs, dx
+    lock_kernel_on_entry 0
+    call    this_cpu
+    cmp     dword [eax + CPU_REENTER], 0
+    jnz     instack ; already in the cpu stack
+    mov     ebx,  [eax + CPU_PROC]
+    mov     dword [ebx + ESP_SAVE_INT], esp
     mov     esi, esp
-    mov     esp, StackTop
+    mov     esp, [eax + CPU_STACK_TOP]
     push    restart_int
     jmp     [esi + RETADR - P_STACKBASE]
 instack:
@@ -119,21 +117,25 @@ save_syscall:
     push    es      ;
     push    fs      ;
     push    gs      ; <--
-    mov     edx,  [p_proc_current]
-    mov     dword [edx + ESP_SAVE_SYSCALL], esp
     mov     dx, ss
     mov     ds, dx
     mov     es, dx
     mov     fs, dx
     mov     dx, SELECTOR_VIDEO - 2
     mov     gs, dx
+    lock_kernel_on_entry 0
+    call    this_cpu
+    mov     edx,  [eax + CPU_PROC]
+    mov     dword [edx + ESP_SAVE_SYSCALL], esp
     mov     esi, esp
+    mov     eax, [esi + EAXREG - P_STACKBASE] ; syscall number
     push    restart_syscall
     jmp     [esi + RETADR - P_STACKBASE]
 
     global restart_int
 restart_int:
-    mov     eax, [p_proc_current]
+    call    this_cpu
+    mov     eax, [eax + CPU_PROC]
     mov     esp, [eax + ESP_SAVE_INT]
     cmp     dword [kstate_on_init], 0
     jnz     restart_restore
@@ -142,25 +144,29 @@ restart_int:
 
     global restart_syscall
 restart_syscall:
-    mov     eax, [p_proc_current]
+    call    this_cpu
+    mov     eax, [eax + CPU_PROC]
     mov     esp, [eax + ESP_SAVE_SYSCALL]
     call    sched
     jmp     restart_restore
 
     global restart_restore
 restart_restore:
+    cli
     pop     gs
     pop     fs
     pop     es
     pop     ds
     popad
     add     esp, 4
+    unlock_kernel_on_exit
     iretd
 
     global restart_initial
 restart_initial:
     call    renew_env
-    mov     eax, [p_proc_current]
+    call    this_cpu
+    mov     eax, [eax + CPU_PROC]
     mov     esp, [eax + ESP_SAVE_INT]
     jmp     restart_restore
 
@@ -169,13 +175,20 @@ sched:
     pushfd
     pushad
     cli
-    mov     ebx,  [p_proc_current]
+    call    this_cpu
+    mov     ebx,  [eax + CPU_PROC]
+    test    ebx, ebx
+    jz      .pick   ; nothing to save on an ap entering the scheduler
     mov     dword [ebx + ESP_SAVE_CONTEXT], esp
+.pick:
+    ; NOTE: the context is saved, pick on the cpu stack so that the prev proc
+    ; is free to run on another cpu right after
+    mov     esp, [eax + CPU_STACK_TOP]
     call    cherry_pick_next_ready_proc
+    call    this_cpu
     mov     ebx,  [p_proc_next]
-    mov     dword [p_proc_current], ebx
+    mov     dword [eax + CPU_PROC], ebx
     call    renew_env
-    mov     ebx, [p_proc_current]
     mov     esp, [ebx + ESP_SAVE_CONTEXT]
     popad
     popfd
@@ -187,7 +200,21 @@ syscall_handler:
     sti
     call    [syscall_table + eax * 4]
     cli
-    mov     edx, [p_proc_current]
+    push    eax
+    call    this_cpu
+    mov     edx, [eax + CPU_PROC]
+    pop     eax
     mov     esi, [edx + ESP_SAVE_SYSCALL]
     mov     [esi + EAXREG - P_STACKBASE], eax
     ret
+
+    ; NOTE: an irq taken by the hlt returns to cpu_halt_ret, which is how the
+    ; entry & exit code tell an idle cpu
+    global cpu_halt
+cpu_halt:
+    sti
+    hlt
+    global cpu_halt_ret
+cpu_halt_ret:
+    cli
+    ret
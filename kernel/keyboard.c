@@ -6,14 +6,19 @@
 #include <unios/graphics.h>
 #include <unios/tracing.h>
 #include <unios/window.h>
+#include <unios/waitqueue.h>
+#include <unios/smp.h>
 #include <arch/x86.h>
 #include <sys/defs.h>
 #include <atomic.h>
+#include <stdlib.h>
 
 static KB_INPUT    kb_in;
 static MOUSE_INPUT mouse_in;
 static int         mouse_init;
 
+static wait_queue_head_t kb_wait_queue; //<! tty handler waiting for input
+
 static int shift_l;     //<! left shift state
 static int shift_r;     //<! right shift state
 static int alt_l;       //<! left alt state
@@ -101,8 +106,8 @@ static void set_mouse_leds() {
 static uint8_t get_byte_from_kb_buf() {
     uint8_t scan_code;
 
-    //! wait for a byte to arrive
-    while (kb_in.count <= 0) {}
+    //! wait for a byte to arrive, the irq is taken by the bsp only
+    while (kb_in.count <= 0) { smp_kernel_relax(); }
 
     disable_int_begin();
     scan_code = *(kb_in.p_tail);
@@ -123,6 +128,7 @@ void kb_handler(int irq) {
             kb_in.p_head = kb_in.buf;
         }
         kb_in.count++;
+        wake_up_all(&kb_wait_queue);
     }
 };
 
@@ -223,6 +229,7 @@ void init_mouse() {
 void init_keyboard() {
     kb_in.count  = 0;
     kb_in.p_head = kb_in.p_tail = kb_in.buf;
+    init_wait_queue_head(&kb_wait_queue);
 
     shift_l = shift_r = 0;
     alt_l = alt_r = 0;
@@ -243,6 +250,15 @@ void init_keyboard() {
     set_mouse_leds();
 }
 
+void keyboard_wait_input() {
+    while (true) {
+        prepare_to_wait(&kb_wait_queue);
+        if (kb_in.count > 0) { break; }
+        yield();
+    }
+    finish_wait(&kb_wait_queue);
+}
+
 void keyboard_read(tty_t* p_tty) {
     //! make or break
     bool make = false;
@@ -1,4 +1,5 @@
 #include <unios/khd.h>
+#include <math.h>
 
 void wait_disk(void) {
     while ((in_byte(REG_STATUS) & 0xC0) != 0x40);
@@ -6,9 +7,15 @@ void wait_disk(void) {
 
 // 读取一个扇区
 void read_sector_pio(uint32_t lba, void *buf) {
+    read_sectors_pio(lba, 1, buf);
+}
+
+// 一条命令读取连续的多个扇区, 至多 HD_MAX_SECTS_PER_CMD 个
+void read_sectors_pio(uint32_t lba, int nr_sects, void *buf) {
     wait_disk();
 
-    out_byte(REG_NSECTOR, 1);
+    // 扇区数 0 表示 256 个
+    out_byte(REG_NSECTOR, (uint8_t)(nr_sects & 0xFF));
     out_byte(REG_LBA_LOW,  (uint8_t)(lba & 0xFF));
     out_byte(REG_LBA_MID,  (uint8_t)((lba >> 8) & 0xFF));
     out_byte(REG_LBA_HIGH, (uint8_t)((lba >> 16) & 0xFF));
@@ -19,18 +26,21 @@ void read_sector_pio(uint32_t lba, void *buf) {
     // 发送读命令
     out_byte(REG_CMD, 0x20); // ATA_READ
 
-    wait_disk(); // 等待数据准备好
+    for (int i = 0; i < nr_sects; i++) {
+        wait_disk(); // 等待数据准备好
 
-    // 读取数据 (in_word 一次读2字节，循环256次 = 512字节)
-    port_read(REG_DATA, buf, 256);
+        // 读取数据 (in_word 一次读2字节，循环256次 = 512字节)
+        port_read(REG_DATA, (uint8_t *)buf + i * SECTOR_SIZE, 256);
+    }
 }
 
 // 批量读取函数
 void raw_read_font(uint32_t start_lba, uint32_t bytes, uint8_t *buffer) {
     uint32_t sectors = (bytes + SECTOR_SIZE - 1) / SECTOR_SIZE;
 
-    for (uint32_t i = 0; i < sectors; i++) {
-        // 逐个扇区读取，计算当前内存偏移
-        read_sector_pio(start_lba + i, buffer + (i * SECTOR_SIZE));
+    for (uint32_t i = 0; i < sectors; i += HD_MAX_SECTS_PER_CMD) {
+        // 每条命令读取尽可能多的扇区，计算当前内存偏移
+        int n = min(sectors - i, HD_MAX_SECTS_PER_CMD);
+        read_sectors_pio(start_lba + i, n, buffer + (i * SECTOR_SIZE));
     }
 }
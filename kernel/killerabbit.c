@@ -16,90 +16,69 @@
 #include <atomic.h>
 
 static int killerabbit_find_child_proc(uint32_t pid) {
-    pcb_t* fa_pcb = (pcb_t*)pid2proc(pid);
-    for (int i = 0; i < fa_pcb->tree_info.child_p_num; ++i) {
-        return fa_pcb->tree_info.child_process[i];
-    }
-    return -1;
+    pcb_t*            fa_pcb   = (pcb_t*)pid2proc(pid);
+    struct list_head* children = &fa_pcb->tree_info.children;
+    if (list_empty(children)) { return -1; }
+    return list_first_entry(children, pcb_t, tree_info.sibling)->pid;
 }
 
 static void transfer_child_proc(uint32_t src_pid, uint32_t dst_pid) {
     assert(src_pid != dst_pid);
     pcb_t* src_pcb = (pcb_t*)pid2proc(src_pid);
     pcb_t* dst_pcb = (pcb_t*)pid2proc(dst_pid);
-    for (int i = 0, j = dst_pcb->tree_info.child_p_num;
-         i < src_pcb->tree_info.child_p_num;
-         ++i, ++j) {
-        dst_pcb->tree_info.child_process[j] =
-            src_pcb->tree_info.child_process[i];
-        pcb_t* son_pcb = (pcb_t*)pid2proc(src_pcb->tree_info.child_process[i]);
+    pcb_t* son_pcb = NULL;
+    list_for_each_entry(
+        son_pcb, &src_pcb->tree_info.children, tree_info.sibling) {
         if (son_pcb->pid != p_proc_current->pcb.pid) {
             lock_or(&son_pcb->lock, sched);
-            son_pcb->stat = ZOMBIE;
+            set_proc_stat(son_pcb, ZOMBIE);
+            list_move_tail(
+                &son_pcb->tree_info.zombie, &dst_pcb->tree_info.zombies);
         }
         son_pcb->tree_info.ppid = dst_pid;
-        ++dst_pcb->tree_info.child_p_num;
         if (son_pcb->pid != p_proc_current->pcb.pid) {
             release(&son_pcb->lock);
         }
     }
-    src_pcb->tree_info.child_p_num = 0;
+    list_splice_tail_init(
+        &src_pcb->tree_info.children, &dst_pcb->tree_info.children);
 }
 
 static void killerabbit_handle_child_thread_proc(uint32_t pid) {
     //! NOTE:fixed, now recursive delete
-    pcb_t* pcb      = (pcb_t*)pid2proc(pid);
-    pcb_t* recy_pcb = (pcb_t*)pid2proc(NR_RECY_PROC);
-    for (int i = 0; i < pcb->tree_info.child_t_num; ++i) {
-        pcb_t*   child_pcb = (pcb_t*)pid2proc(pcb->tree_info.child_thread[i]);
-        uint32_t cr3       = ((pcb_t*)pid2proc(pid))->cr3;
-        uint32_t laddr     = child_pcb->memmap.stack_lin_limit;
-        uint32_t limit     = child_pcb->memmap.stack_lin_base;
-        while (laddr < limit) {
-            bool ok = pg_unmap_laddr(cr3, laddr, true);
-            assert(ok);
-            laddr = pg_frame_phyaddr(laddr) + NUM_4K;
-        }
-        for (int i = 0; i < child_pcb->tree_info.child_t_num; ++i) {
-            killerabbit_handle_child_thread_proc(
-                child_pcb->tree_info.child_thread[i]);
-        }
+    pcb_t* pcb       = (pcb_t*)pid2proc(pid);
+    pcb_t* recy_pcb  = (pcb_t*)pid2proc(NR_RECY_PROC);
+    pcb_t* child_pcb = NULL;
+    pcb_t* next_pcb  = NULL;
+    list_for_each_entry_safe(
+        child_pcb, next_pcb, &pcb->tree_info.threads, tree_info.sibling) {
+        //! NOTE: the thread may be running on another cpu, keep it from being
+        //! picked again and wait till it leaves before its stack goes away
+        set_proc_stat(child_pcb, KILLING);
+        sched_wait_off_cpu(child_pcb);
+        uint32_t cr3   = pcb->cr3;
+        uint32_t laddr = child_pcb->memmap.stack_lin_limit;
+        uint32_t limit = child_pcb->memmap.stack_lin_base;
+        bool     ok    = pg_unmap_laddr_range(cr3, laddr, limit, true);
+        assert(ok);
+        killerabbit_handle_child_thread_proc(child_pcb->pid);
         lock_or(&recy_pcb->lock, sched);
         transfer_child_proc(child_pcb->pid, NR_RECY_PROC);
         release(&recy_pcb->lock);
-        child_pcb->stat = IDLE;
+        list_del_init(&child_pcb->tree_info.sibling);
+        set_proc_stat(child_pcb, IDLE);
     }
-    pcb->tree_info.child_t_num = 0;
     return;
 }
 
 static void remove_killed_child(uint32_t ppid, uint32_t pid) {
-    pcb_t* fa_pcb  = (pcb_t*)pid2proc(ppid);
-    bool   cpyflg  = false;
-    bool   killflg = false;
-    for (int i = 0; i < fa_pcb->tree_info.child_p_num; ++i) {
-        pcb_t* exit_child =
-            (pcb_t*)pid2proc(fa_pcb->tree_info.child_process[i]);
-        assert(!(cpyflg && exit_child->pid == pid));
-        if (exit_child->pid == pid) { cpyflg = true; }
-        if (cpyflg && i < fa_pcb->tree_info.child_p_num - 1) {
-            fa_pcb->tree_info.child_process[i] =
-                fa_pcb->tree_info.child_process[i + 1];
-        }
-    }
-    for (int i = 0; i < fa_pcb->tree_info.child_k_num; ++i) {
-        //! case 0: forward didn't clean, no need to add
-        if (fa_pcb->tree_info.child_killed[i] == pid) { killflg = true; }
-    }
-    //! case 1: forward cleaned / doesn't have, just add
-    if (killflg == false) {
-        fa_pcb->tree_info.child_killed[fa_pcb->tree_info.child_k_num] = pid;
-        ++fa_pcb->tree_info.child_k_num;
-        killflg = true;
-    }
-    assert(cpyflg);
-    assert(killflg);
-    --fa_pcb->tree_info.child_p_num;
+    pcb_t* fa_pcb     = (pcb_t*)pid2proc(ppid);
+    pcb_t* kill_child = (pcb_t*)pid2proc(pid);
+    assert(kill_child->tree_info.ppid == ppid);
+    assert(!list_empty(&kill_child->tree_info.sibling));
+    list_del_init(&kill_child->tree_info.sibling);
+    list_del_init(&kill_child->tree_info.zombie);
+    add_killed_child(&fa_pcb->tree_info, pid);
     return;
 }
 
@@ -124,16 +103,13 @@ static bool killerabbit_kill_one(uint32_t kill_pid, uint32_t fa_pid) {
         //! case 1: father isn't recy so need to lock
         lock_or(&recy_pcb->lock, sched);
         transfer_child_proc(kill_pid, NR_RECY_PROC);
-        recy_pcb->stat = READY;
+        wake_up_all(&recy_pcb->wait_child);
         release(&recy_pcb->lock);
     }
     killerabbit_recycle_memory(kill_pid);
     disable_int_begin();
-    memset(kill_pcb, 0, sizeof(process_t));
-    kill_pcb->pid = -1;
-    assert(try_lock(&kill_pcb->lock));
-    kill_pcb->stat = IDLE;
-    fa_pcb->stat   = READY;
+    recycle_locked_pcb(kill_pcb);
+    wake_up_all(&fa_pcb->wait_child);
     disable_int_end();
     return true;
 }
@@ -150,7 +126,8 @@ int do_killerabbit(int pid) {
     int kill_pid = pid;
     if (kill_pid < NR_TASKS + NR_CONSOLES && kill_pid >= 0) { return -1; }
     if (kill_pid == p_proc_current->pcb.pid) { return -1; }
-    if (kill_pid >= NR_PCBS) { return -1; }
+    //! a thread must never tear down the address space it runs in
+    if (kill_pid == thread_leader(&p_proc_current->pcb)->pid) { return -1; }
     int    total_KIA = 0;
     pcb_t* kill_pcb  = NULL;
     pcb_t* fa_pcb    = NULL;
@@ -192,8 +169,9 @@ int do_killerabbit(int pid) {
                 if (fa_pcb->pid == p_proc_current->pcb.pid) { ok = true; }
                 if (ok) {
                     disable_int_begin();
-                    kill_pcb->stat = KILLING;
+                    set_proc_stat(kill_pcb, KILLING);
                     disable_int_end();
+                    sched_wait_off_cpu(kill_pcb);
                     ok = killerabbit_kill_one(
                         kill_pid, kill_pcb->tree_info.ppid);
                     assert(ok);
@@ -234,11 +212,8 @@ int do_killerabbit(int pid) {
     }
     killerabbit_recycle_memory(pid);
     disable_int_begin();
-    memset(kill_pcb, 0, sizeof(process_t));
-    kill_pcb->pid  = -1;
-    kill_pcb->lock = 0;
-    kill_pcb->stat = IDLE;
-    fa_pcb->stat   = READY;
+    recycle_locked_pcb(kill_pcb);
+    wake_up_all(&fa_pcb->wait_child);
     disable_int_end();
     release(&kill_pcb->lock);
     release(&fa_pcb->lock);
@@ -1,9 +1,18 @@
 #include <unios/vga.h>
 #include <unios/kstate.h>
 #include <unios/memory.h>
+#include <unios/page.h>
+#include <unios/slab.h>
+#include <unios/smp.h>
+#include <unios/futex.h>
+#include <unios/imgcache.h>
 #include <unios/clock.h>
 #include <unios/keyboard.h>
+#include <unios/tty.h>
 #include <unios/hd.h>
+#include <unios/bcache.h>
+#include <unios/blkdev.h>
+#include <unios/aio.h>
 #include <unios/schedule.h>
 #include <unios/vfs.h>
 #include <unios/fs.h>
@@ -26,8 +35,16 @@ void kernel_main() {
     kdebug("init kernel");
 
     init_memory();
+    init_kernel_page_table();
     kinfo("init memory done");
 
+    init_slab();
+    kinfo("init slab done");
+
+    init_smp();
+
+    init_imgcache();
+
     font_init();
     kinfo("init font done");
 
@@ -41,6 +58,9 @@ void kernel_main() {
 
     create_window(-50, -50, 150, 150, "Clipped", 0xFFFFFF00); // 黄色，只有右下角可见
 
+    init_sched();
+    init_proc_cache();
+    init_futex();
     process_t *proc = try_lock_free_pcb();
     assert(proc != NULL);
     bool ok = init_locked_pcb(proc, "init", init, RPL_TASK);
@@ -52,20 +72,23 @@ void kernel_main() {
             proc, task_table[i].name, task_table[i].entry_point, RPL_TASK);
         assert(ok);
         //! NOTE: mark as pre-inited, enable it in the `init` proc later
-        proc->pcb.stat = PREINITED;
+        set_proc_stat(&proc->pcb, PREINITED);
     }
     kinfo("init startup proc done");
 
     init_sysclk();
     init_keyboard();
+    init_tty();
     init_hd();
+    init_blkdev();
+    init_bcache();
+    init_aio();
     kinfo("init device done");
 
     vfs_setup_and_init();
     kinfo("init vfs done");
 
-    kstate_reenter_cntr = 0;
-    kstate_on_init      = false;
+    kstate_on_init = false;
     kinfo("init kernel done");
 
     p_proc_current = proc_table[0];
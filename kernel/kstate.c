@@ -1,4 +1,3 @@
 #include <unios/kstate.h>
 
 bool kstate_on_init;
-int  kstate_reenter_cntr;
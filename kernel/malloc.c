@@ -8,33 +8,28 @@
 #include <math.h>
 
 void *do_malloc(int size) {
-    pcb_t *pcb = &p_proc_current->pcb;
+    pcb_t *pcb = thread_leader(&p_proc_current->pcb);
 
     size_t real_size = size + sizeof(size_t);
     lock_or(&pcb->heap_lock, sched);
     void *ptr = mballoc_alloc(pcb->allocator, real_size);
+    if (ptr != NULL) {
+        pcb->memmap.heap_lin_limit =
+            max(pcb->memmap.heap_lin_limit, (uint32_t)(ptr + real_size));
+    }
     release(&pcb->heap_lock);
 
     if (ptr == NULL) { return NULL; }
-    bool need_refresh = !pg_addr_pte_exist(pcb->cr3, (uint32_t)ptr);
-    bool ok           = pg_map_laddr_range(
-        pcb->cr3,
-        (uint32_t)ptr,
-        (uint32_t)(ptr + real_size),
-        PG_P | PG_U | PG_RWX,
-        PG_P | PG_U | PG_RWX);
-    assert(ok);
-    if (need_refresh) { pg_refresh(); }
 
+    //! NOTE: nothing is mapped here, pages of the block are faulted in on the
+    //! first touch, so that untouched parts of a large block cost nothing
     *(size_t *)ptr = real_size;
-    pcb->memmap.heap_lin_limit =
-        max(pcb->memmap.heap_lin_limit, (uint32_t)(ptr + real_size));
 
     return ptr + sizeof(size_t);
 }
 
 void do_free(void *ptr) {
-    pcb_t *pcb = &p_proc_current->pcb;
+    pcb_t *pcb = thread_leader(&p_proc_current->pcb);
 
     void *real_ptr = ptr - sizeof(size_t);
     if (!pg_pde_exist(pcb->cr3, (uint32_t)real_ptr)) { return; }
@@ -46,3 +41,31 @@ void do_free(void *ptr) {
     int resp = mballoc_free(pcb->allocator, real_ptr, size);
     release(&pcb->heap_lock);
 }
+
+void *do_sbrk(int increment) {
+    pcb_t        *pcb    = thread_leader(&p_proc_current->pcb);
+    lin_memmap_t *memmap = &pcb->memmap;
+
+    lock_or(&pcb->heap_lock, sched);
+
+    uint32_t old_brk = memmap->brk_lin_limit;
+    int64_t  brk     = (int64_t)old_brk + increment;
+    if (brk < memmap->brk_lin_base || brk > BrkLinLimitMAX) {
+        release(&pcb->heap_lock);
+        return (void *)-1;
+    }
+    uint32_t new_brk = brk;
+
+    //! NOTE: pages are mapped in whole, so only the page-aligned ends matter,
+    //! and a growing break maps nothing until the new pages are touched
+    uint32_t old_end = round_up(old_brk, NUM_4K);
+    uint32_t new_end = round_up(new_brk, NUM_4K);
+    bool     ok      = true;
+    if (new_end < old_end) {
+        ok = pg_unmap_laddr_range(pcb->cr3, new_end, old_end, true);
+    }
+    if (ok) { memmap->brk_lin_limit = new_brk; }
+
+    release(&pcb->heap_lock);
+    return ok ? (void *)old_brk : (void *)-1;
+}
@@ -5,17 +5,58 @@
 #include <unios/schedule.h>
 #include <unios/tracing.h>
 #include <unios/host_device.h>
+#include <unios/regs.h>
+#include <arch/x86.h>
 #include <string.h>
 #include <stddef.h>
 #include <config.h>
 #include <math.h>
+#include <list.h>
 
 //! { kmem, kpage, upage, kernel space } ~ [ base, limit ]
 static phyaddr_t memblk_bounds[4][2];
 
-static memblk_allocator_t* kmem_allocator  = NULL;
-static memblk_allocator_t* kpage_allocator = NULL;
-static memblk_allocator_t* upage_allocator = NULL;
+//! binary buddy allocator over a page frame range, orders are counted in
+//! absolute pfn so that a block of order k is always aligned to 2^k pages
+typedef struct buddy_allocator_s {
+    size_t            base_pfn;
+    size_t            limit_pfn;
+    size_t            nr_free_pages;
+    spinlock_t        lock;
+    struct list_head  free_area[PHYPAGE_MAX_ORDER + 1];
+    size_t            nr_free_blocks[PHYPAGE_MAX_ORDER + 1];
+    struct list_head* links;    //<! per-frame list node, valid for free heads
+    uint8_t*          orders;   //<! per-frame order, valid for free heads
+    uint32_t*         free_map; //<! per-frame bit, set iff heads a free block
+} buddy_allocator_t;
+
+//! frame descriptors of kpage & upage, which are adjacent, indexed by pfn
+static phypage_t* phypages;
+static size_t     phypage_base_pfn;
+static size_t     phypage_limit_pfn;
+
+//! boundary-tag allocator over kmem, every block carries its size in both the
+//! head and the foot tag, and a free block additionally links into the bin of
+//! its size class, so a free block never needs any external metadata
+#define KMEM_ALIGN     8
+#define KMEM_TAG_SIZE  sizeof(size_t)
+#define KMEM_TAG_USED  0x1
+#define KMEM_MIN_BLOCK 16 //<! head tag + list node + foot tag
+#define KMEM_NR_BINS   16 //<! bin i holds blocks of size [2^(i+4), 2^(i+5))
+
+typedef struct kmem_block_s {
+    size_t           tag;
+    struct list_head node; //<! valid only if the block is free
+} kmem_block_t;
+
+static void*            kmem_base;
+static void*            kmem_limit;
+static size_t           kmem_free_size;
+static size_t           kmem_nr_free_blocks;
+static struct list_head kmem_bins[KMEM_NR_BINS];
+
+static buddy_allocator_t kpage_allocator;
+static buddy_allocator_t upage_allocator;
 
 static spinlock_t kmem_lock;
 
@@ -41,14 +82,6 @@ static size_t get_critical_memsize() {
     return (size_t)K_LIN2PHY(round_up(&end, NUM_4K));
 }
 
-void* unsafe_kmalloc(size_t size) {
-    static void* base = 0;
-    if (base == 0) { base = K_PHY2LIN(get_critical_memsize()); }
-    void* ptr  = base;
-    base      += size;
-    return ptr;
-}
-
 void mballoc_reset_unsafe(memblk_allocator_t* allocator) {
     assert(allocator != NULL);
     assert(allocator->memblk_base < allocator->memblk_limit);
@@ -88,6 +121,20 @@ void* mballoc_alloc(memblk_allocator_t* allocator, size_t size) {
     return addr;
 }
 
+static bool mballoc_grow(memblk_allocator_t* allocator) {
+    size_t    total_free_slots = allocator->total_free_slots * 2;
+    memblk_t* free_slots       = kmalloc(total_free_slots * sizeof(memblk_t));
+    if (free_slots == NULL) { return false; }
+    memcpy(
+        free_slots,
+        allocator->free_slots,
+        allocator->nr_frees * sizeof(memblk_t));
+    kfree(allocator->free_slots);
+    allocator->free_slots       = free_slots;
+    allocator->total_free_slots = total_free_slots;
+    return true;
+}
+
 int mballoc_free(memblk_allocator_t* allocator, void* addr, size_t size) {
     if (allocator == NULL) { return MBALLOC_INVALID; }
     if (size == 0) { return MBALLOC_INVALID; }
@@ -140,9 +187,9 @@ int mballoc_free(memblk_allocator_t* allocator, void* addr, size_t size) {
 
     if (merged > 0) { return MBALLOC_OK; }
 
-    //! no enough space to insert new free blk, failed to free
-    if (allocator->nr_frees >= allocator->total_free_slots) {
-        //! TODO: resolve memory leak issues
+    //! no enough space to insert new free blk, grow the slots first
+    if (allocator->nr_frees >= allocator->total_free_slots
+        && !mballoc_grow(allocator)) {
         return MBALLOC_NOSLOTS;
     }
 
@@ -155,14 +202,17 @@ int mballoc_free(memblk_allocator_t* allocator, void* addr, size_t size) {
     return MBALLOC_OK;
 }
 
-memblk_allocator_t* mballoc_create(
-    fn_malloc_t malloc, size_t total_free_slots, void* base, void* limit) {
+memblk_allocator_t*
+    mballoc_create(size_t total_free_slots, void* base, void* limit) {
     if (total_free_slots < 1) { return NULL; }
     if (base >= limit) { return NULL; }
-    size_t size =
-        sizeof(memblk_allocator_t) + total_free_slots * sizeof(memblk_t);
-    memblk_allocator_t* obj = malloc(size);
+    memblk_allocator_t* obj = kmalloc(sizeof(memblk_allocator_t));
     if (obj == NULL) { return NULL; }
+    obj->free_slots = kmalloc(total_free_slots * sizeof(memblk_t));
+    if (obj->free_slots == NULL) {
+        kfree(obj);
+        return NULL;
+    }
     obj->total_free_slots = total_free_slots;
     obj->memblk_base      = base;
     obj->memblk_limit     = limit;
@@ -170,79 +220,448 @@ memblk_allocator_t* mballoc_create(
     return obj;
 }
 
-memblk_allocator_t* mballoc_create_by(
-    memblk_allocator_t* allocator,
-    size_t              total_free_slots,
-    void*               base,
-    void*               limit) {
-    if (total_free_slots < 1) { return NULL; }
-    if (base >= limit) { return NULL; }
-    size_t size =
-        sizeof(memblk_allocator_t) + total_free_slots * sizeof(memblk_t);
-    memblk_allocator_t* obj = mballoc_alloc(allocator, size);
+memblk_allocator_t* mballoc_clone(memblk_allocator_t* allocator) {
+    assert(allocator != NULL);
+    memblk_allocator_t* obj = mballoc_create(
+        allocator->total_free_slots,
+        allocator->memblk_base,
+        allocator->memblk_limit);
     if (obj == NULL) { return NULL; }
-    obj->total_free_slots = total_free_slots;
-    obj->memblk_base      = base;
-    obj->memblk_limit     = limit;
-    mballoc_reset_unsafe(obj);
+    memcpy(
+        obj->free_slots,
+        allocator->free_slots,
+        allocator->nr_frees * sizeof(memblk_t));
+    obj->nr_frees = allocator->nr_frees;
     return obj;
 }
 
+void mballoc_destroy(memblk_allocator_t* allocator) {
+    if (allocator == NULL) { return; }
+    kfree(allocator->free_slots);
+    kfree(allocator);
+}
+
+static size_t kmem_block_size(kmem_block_t* blk) {
+    return blk->tag & ~KMEM_TAG_USED;
+}
+
+static bool kmem_block_used(kmem_block_t* blk) {
+    return blk->tag & KMEM_TAG_USED;
+}
+
+static size_t* kmem_block_foot(kmem_block_t* blk) {
+    return (void*)blk + kmem_block_size(blk) - KMEM_TAG_SIZE;
+}
+
+static void kmem_block_set(kmem_block_t* blk, size_t size, bool used) {
+    blk->tag              = size | (used ? KMEM_TAG_USED : 0);
+    *kmem_block_foot(blk) = blk->tag;
+}
+
+static int kmem_bin_index(size_t size) {
+    int index = 0;
+    size    >>= 5;
+    while (size > 0 && index < KMEM_NR_BINS - 1) {
+        size >>= 1;
+        ++index;
+    }
+    return index;
+}
+
+static void kmem_link(kmem_block_t* blk) {
+    size_t size = kmem_block_size(blk);
+    list_add(&blk->node, &kmem_bins[kmem_bin_index(size)]);
+    kmem_free_size += size;
+    ++kmem_nr_free_blocks;
+}
+
+static void kmem_unlink(kmem_block_t* blk) {
+    list_del(&blk->node);
+    kmem_free_size -= kmem_block_size(blk);
+    --kmem_nr_free_blocks;
+}
+
+static kmem_block_t* kmem_find_fit(size_t size) {
+    for (int i = kmem_bin_index(size); i < KMEM_NR_BINS; ++i) {
+        kmem_block_t* blk = NULL;
+        list_for_each_entry(blk, &kmem_bins[i], node) {
+            if (kmem_block_size(blk) >= size) { return blk; }
+        }
+    }
+    return NULL;
+}
+
+static void kmem_init(void* base, void* limit) {
+    base  = round_up(base, KMEM_ALIGN);
+    limit = round_down(limit, KMEM_ALIGN);
+    assert(limit - base >= KMEM_MIN_BLOCK + 2 * KMEM_TAG_SIZE);
+
+    for (int i = 0; i < KMEM_NR_BINS; ++i) { INIT_LIST_HEAD(&kmem_bins[i]); }
+    kmem_base           = base;
+    kmem_limit          = limit;
+    kmem_free_size      = 0;
+    kmem_nr_free_blocks = 0;
+
+    //! NOTE: the prologue foot & the epilogue head are tagged as used blocks
+    //! of size 0, so that coalescing never runs out of the kmem segment, and
+    //! payloads stay aligned to `KMEM_ALIGN`
+    *(size_t*)base                    = KMEM_TAG_USED;
+    *(size_t*)(limit - KMEM_TAG_SIZE) = KMEM_TAG_USED;
+
+    kmem_block_t* blk = base + KMEM_TAG_SIZE;
+    kmem_block_set(blk, limit - base - 2 * KMEM_TAG_SIZE, false);
+    kmem_link(blk);
+}
+
 void* kmalloc(size_t size) {
-    size_t real_size = size + sizeof(size_t);
+    size_t real_size = round_up(size + 2 * KMEM_TAG_SIZE, KMEM_ALIGN);
+    real_size        = max(real_size, (size_t)KMEM_MIN_BLOCK);
+
     lock_or(&kmem_lock, sched);
-    void* ptr = mballoc_alloc(kmem_allocator, real_size);
+    kmem_block_t* blk = kmem_find_fit(real_size);
+    if (blk == NULL) {
+        release(&kmem_lock);
+        return NULL;
+    }
+    kmem_unlink(blk);
+
+    //! split the block if the rest is still a valid free block
+    size_t rest = kmem_block_size(blk) - real_size;
+    if (rest >= KMEM_MIN_BLOCK) {
+        kmem_block_t* next = (void*)blk + real_size;
+        kmem_block_set(next, rest, false);
+        kmem_link(next);
+    } else {
+        real_size += rest;
+    }
+    kmem_block_set(blk, real_size, true);
     release(&kmem_lock);
-    if (ptr == NULL) { return NULL; }
-    *(size_t*)ptr = real_size;
-    return ptr + sizeof(size_t);
+
+    return (void*)blk + KMEM_TAG_SIZE;
 }
 
 void kfree(void* ptr) {
-    //! WARNING: the following explicit bound check is necessary, although the
-    //! `mballoc_free` also contains this logic, we still need to access memory
-    //! at `ptr` to retrive the memblk size, and that is exactly a potential
-    //! risky operation since `ptr` may be invalid
-    void* real_ptr = ptr - sizeof(size_t);
-    assert(
-        real_ptr >= kmem_allocator->memblk_base
-        && ptr < kmem_allocator->memblk_limit);
-
-    size_t size = *(size_t*)real_ptr;
+    kmem_block_t* blk = ptr - KMEM_TAG_SIZE;
+    assert((void*)blk > kmem_base && ptr < kmem_limit);
+    //! NOTE: mismatched tags imply a double free or an out-of-bound write
+    assert(kmem_block_used(blk));
+    assert(*kmem_block_foot(blk) == blk->tag);
+
     lock_or(&kmem_lock, sched);
-    int resp = mballoc_free(kmem_allocator, real_ptr, size);
+    size_t size = kmem_block_size(blk);
+
+    //! merge forward
+    kmem_block_t* next = (void*)blk + size;
+    if (!kmem_block_used(next)) {
+        kmem_unlink(next);
+        size += kmem_block_size(next);
+    }
+
+    //! merge backward
+    size_t prev_tag = *((size_t*)blk - 1);
+    if (!(prev_tag & KMEM_TAG_USED)) {
+        kmem_block_t* prev = (void*)blk - prev_tag;
+        kmem_unlink(prev);
+        size += kmem_block_size(prev);
+        blk   = prev;
+    }
+
+    kmem_block_set(blk, size, false);
+    kmem_link(blk);
     release(&kmem_lock);
+}
+
+void get_kmem_stat(kmem_stat_t* stat) {
+    assert(stat != NULL);
+    lock_or(&kmem_lock, sched);
+    stat->total          = kmem_limit - kmem_base;
+    stat->free           = kmem_free_size;
+    stat->nr_free_blocks = kmem_nr_free_blocks;
+    stat->largest_free   = 0;
+    for (int i = KMEM_NR_BINS - 1; i >= 0; --i) {
+        kmem_block_t* blk = NULL;
+        list_for_each_entry(blk, &kmem_bins[i], node) {
+            stat->largest_free = max(stat->largest_free, kmem_block_size(blk));
+        }
+        if (stat->largest_free > 0) { break; }
+    }
+    release(&kmem_lock);
+    //! external fragmentation, i.e. the part of free memory that can not be
+    //! served as a single block
+    stat->fragmentation =
+        stat->free == 0 ? 0 : 1000 - stat->largest_free * 1000 / stat->free;
+}
+
+static bool buddy_is_free_head(
+    buddy_allocator_t* allocator, size_t pfn, int order) {
+    if (pfn < allocator->base_pfn || pfn >= allocator->limit_pfn) {
+        return false;
+    }
+    size_t index = pfn - allocator->base_pfn;
+    if (!(allocator->free_map[index / 32] & (1u << (index % 32)))) {
+        return false;
+    }
+    return allocator->orders[index] == order;
+}
+
+static void buddy_push(buddy_allocator_t* allocator, size_t pfn, int order) {
+    size_t index                     = pfn - allocator->base_pfn;
+    allocator->orders[index]         = order;
+    allocator->free_map[index / 32] |= 1u << (index % 32);
+    list_add(&allocator->links[index], &allocator->free_area[order]);
+    ++allocator->nr_free_blocks[order];
+}
+
+static void buddy_remove(buddy_allocator_t* allocator, size_t pfn, int order) {
+    size_t index                     = pfn - allocator->base_pfn;
+    allocator->free_map[index / 32] &= ~(1u << (index % 32));
+    list_del(&allocator->links[index]);
+    --allocator->nr_free_blocks[order];
+}
+
+static void
+    buddy_init(buddy_allocator_t* allocator, phyaddr_t base, phyaddr_t limit) {
+    assert(base == pg_frame_phyaddr(base));
+    assert(limit == pg_frame_phyaddr(limit));
+    assert(base < limit);
+
+    size_t total_pages       = (limit - base) / NUM_4K;
+    size_t total_map_size    = idiv_ceil(total_pages, 32) * sizeof(uint32_t);
+    allocator->base_pfn      = base / NUM_4K;
+    allocator->limit_pfn     = limit / NUM_4K;
+    allocator->nr_free_pages = 0;
+    allocator->lock          = 0;
+
+    //! NOTE: metadata lives in kmem, which must be ready before this call
+    allocator->links    = kmalloc(total_pages * sizeof(struct list_head));
+    allocator->orders   = kmalloc(total_pages * sizeof(uint8_t));
+    allocator->free_map = kmalloc(total_map_size);
+    assert(allocator->links != NULL);
+    assert(allocator->orders != NULL);
+    assert(allocator->free_map != NULL);
+    memset(allocator->free_map, 0, total_map_size);
+
+    for (int order = 0; order <= PHYPAGE_MAX_ORDER; ++order) {
+        INIT_LIST_HEAD(&allocator->free_area[order]);
+        allocator->nr_free_blocks[order] = 0;
+    }
 
-    //! NOTE: we exactly not that care about memory leak :-)
-    assert(resp == MBALLOC_OK || resp == MBALLOC_NOSLOTS);
+    //! carve the range into the largest naturally aligned blocks
+    size_t pfn = allocator->base_pfn;
+    while (pfn < allocator->limit_pfn) {
+        int order = PHYPAGE_MAX_ORDER;
+        while (order > 0
+               && ((pfn & ((1u << order) - 1)) != 0
+                   || pfn + (1u << order) > allocator->limit_pfn)) {
+            --order;
+        }
+        buddy_push(allocator, pfn, order);
+        allocator->nr_free_pages += 1u << order;
+        pfn                      += 1u << order;
+    }
+}
+
+static phypage_t* phypage_of_pfn(size_t pfn) {
+    if (pfn < phypage_base_pfn || pfn >= phypage_limit_pfn) { return NULL; }
+    return &phypages[pfn - phypage_base_pfn];
+}
+
+static void phypage_init_block(size_t pfn, int order, int type) {
+    phypage_t* page = phypage_of_pfn(pfn);
+    for (int i = 0; i < (1 << order); ++i) {
+        page[i].refcount = 0;
+        page[i].type     = type;
+        page[i].flags    = 0;
+    }
+}
+
+static phyaddr_t
+    buddy_alloc(buddy_allocator_t* allocator, int order, int type) {
+    if (order < 0 || order > PHYPAGE_MAX_ORDER) { return 0; }
+
+    lock_or(&allocator->lock, sched);
+
+    int k = order;
+    while (k <= PHYPAGE_MAX_ORDER && list_empty(&allocator->free_area[k])) {
+        ++k;
+    }
+    if (k > PHYPAGE_MAX_ORDER) {
+        release(&allocator->lock);
+        return 0;
+    }
+
+    struct list_head* node  = allocator->free_area[k].next;
+    size_t            index = node - allocator->links;
+    size_t            pfn   = allocator->base_pfn + index;
+    buddy_remove(allocator, pfn, k);
+
+    //! split down, the upper half goes back to the free area of each order
+    while (k > order) {
+        --k;
+        buddy_push(allocator, pfn + (1u << k), k);
+    }
+
+    //! NOTE: only the head frame of a block counts the references
+    phypage_init_block(pfn, order, type);
+    phypage_of_pfn(pfn)->refcount  = 1;
+    allocator->nr_free_pages      -= 1u << order;
+    release(&allocator->lock);
+
+    return (phyaddr_t)(pfn * NUM_4K);
+}
+
+static void
+    buddy_free(buddy_allocator_t* allocator, phyaddr_t phyaddr, int order) {
+    assert(order >= 0 && order <= PHYPAGE_MAX_ORDER);
+    size_t pfn = phyaddr / NUM_4K;
+    assert((pfn & ((1u << order) - 1)) == 0);
+    assert(pfn >= allocator->base_pfn);
+    assert(pfn + (1u << order) <= allocator->limit_pfn);
+
+    lock_or(&allocator->lock, sched);
+
+    //! NOTE: a frame that still heads a free block is a double free
+    size_t index = pfn - allocator->base_pfn;
+    assert(!(allocator->free_map[index / 32] & (1u << (index % 32))));
+
+    //! NOTE: frames may be shared, e.g. by cow, only drop the last reference
+    phypage_t* page = phypage_of_pfn(pfn);
+    assert(page->refcount > 0);
+    if (--page->refcount > 0) {
+        release(&allocator->lock);
+        return;
+    }
+
+    phypage_init_block(pfn, order, PHYPAGE_FREE);
+    allocator->nr_free_pages += 1u << order;
+
+    //! merge with the buddy as long as it is a free block of the same order
+    while (order < PHYPAGE_MAX_ORDER) {
+        size_t buddy_pfn = pfn ^ (1u << order);
+        if (!buddy_is_free_head(allocator, buddy_pfn, order)) { break; }
+        buddy_remove(allocator, buddy_pfn, order);
+        pfn = min(pfn, buddy_pfn);
+        ++order;
+    }
+    buddy_push(allocator, pfn, order);
+
+    release(&allocator->lock);
+}
+
+static bool buddy_contains(buddy_allocator_t* allocator, phyaddr_t phyaddr) {
+    size_t pfn = phyaddr / NUM_4K;
+    return pfn >= allocator->base_pfn && pfn < allocator->limit_pfn;
+}
+
+static buddy_allocator_t* buddy_of(phyaddr_t phyaddr) {
+    if (buddy_contains(&kpage_allocator, phyaddr)) { return &kpage_allocator; }
+    if (buddy_contains(&upage_allocator, phyaddr)) { return &upage_allocator; }
+    return NULL;
+}
+
+phyaddr_t kmalloc_phypages(int order) {
+    return buddy_alloc(&kpage_allocator, order, PHYPAGE_KERNEL);
+}
 
-    //! TODO: deal with memory leak
+phyaddr_t malloc_phypages(int order) {
+    return buddy_alloc(&upage_allocator, order, PHYPAGE_USER);
+}
+
+void free_phypages(phyaddr_t phyaddr, int order) {
+    assert(phyaddr == pg_frame_phyaddr(phyaddr));
+    buddy_allocator_t* allocator = buddy_of(phyaddr);
+    if (allocator == NULL) { unreachable(); }
+    buddy_free(allocator, phyaddr, order);
+}
+
+void ref_phypage(phyaddr_t phyaddr) {
+    assert(phyaddr == pg_frame_phyaddr(phyaddr));
+    buddy_allocator_t* allocator = buddy_of(phyaddr);
+    assert(allocator != NULL);
+    phypage_t* page = phypage_of_pfn(phyaddr / NUM_4K);
+    lock_or(&allocator->lock, sched);
+    assert(page->refcount > 0);
+    assert(page->refcount != (uint16_t)-1);
+    ++page->refcount;
+    release(&allocator->lock);
+}
+
+int phypage_refcount(phyaddr_t phyaddr) {
+    phypage_t* page = phypage_of_pfn(phyaddr / NUM_4K);
+    return page == NULL ? 0 : page->refcount;
+}
+
+bool get_phypage_info(phyaddr_t phyaddr, phypage_t* info) {
+    phypage_t* page = phypage_of_pfn(phyaddr / NUM_4K);
+    if (page == NULL || info == NULL) { return false; }
+    *info = *page;
+    return true;
+}
+
+void set_phypage_type(phyaddr_t phyaddr, int type) {
+    assert(type > PHYPAGE_FREE && type < NR_PHYPAGE_TYPES);
+    buddy_allocator_t* allocator = buddy_of(phyaddr);
+    assert(allocator != NULL);
+    phypage_t* page = phypage_of_pfn(phyaddr / NUM_4K);
+    lock_or(&allocator->lock, sched);
+    assert(page->type != PHYPAGE_FREE);
+    page->type = type;
+    release(&allocator->lock);
+}
+
+void set_phypage_flags(phyaddr_t phyaddr, int flags, bool on) {
+    buddy_allocator_t* allocator = buddy_of(phyaddr);
+    assert(allocator != NULL);
+    phypage_t* page = phypage_of_pfn(phyaddr / NUM_4K);
+    lock_or(&allocator->lock, sched);
+    assert(page->type != PHYPAGE_FREE);
+    if (on) {
+        page->flags |= flags;
+    } else {
+        page->flags &= ~flags;
+    }
+    release(&allocator->lock);
+}
+
+void get_phypage_usage(phypage_stat_t* stat) {
+    assert(stat != NULL);
+    memset(stat, 0, sizeof(phypage_stat_t));
+    //! NOTE: a racy snapshot, only used for statistics
+    for (size_t i = 0; i < phypage_limit_pfn - phypage_base_pfn; ++i) {
+        phypage_t* page = &phypages[i];
+        ++stat->nr_pages[page->type];
+        if (page->refcount > 1) { ++stat->nr_shared; }
+        if (page->flags & PHYPAGE_COW) { ++stat->nr_cow; }
+        if (page->flags & PHYPAGE_PINNED) { ++stat->nr_pinned; }
+        if (page->flags & PHYPAGE_DIRTY) { ++stat->nr_dirty; }
+    }
 }
 
 phyaddr_t kmalloc_phypage() {
-    return (phyaddr_t)mballoc_alloc(kpage_allocator, NUM_4K);
+    return kmalloc_phypages(0);
 }
 
 phyaddr_t malloc_phypage() {
-    return (phyaddr_t)mballoc_alloc(upage_allocator, NUM_4K);
+    return malloc_phypages(0);
 }
 
 void free_phypage(phyaddr_t phyaddr) {
-    assert(phyaddr == pg_frame_phyaddr(phyaddr));
-    void* addr = (void*)phyaddr;
-    if (addr >= kpage_allocator->memblk_base
-        && addr + NUM_4K < kpage_allocator->memblk_limit) {
-        int resp = mballoc_free(kpage_allocator, addr, NUM_4K);
-        assert(resp == MBALLOC_OK);
-        return;
+    free_phypages(phyaddr, 0);
+}
+
+bool get_phypage_stat(int type, size_t* total, size_t* nr_free) {
+    buddy_allocator_t* allocator = NULL;
+    if (type == KernelPage) {
+        allocator = &kpage_allocator;
+    } else if (type == UserPage) {
+        allocator = &upage_allocator;
     }
-    if (addr >= upage_allocator->memblk_base
-        && addr + NUM_4K < upage_allocator->memblk_limit) {
-        int resp = mballoc_free(upage_allocator, addr, NUM_4K);
-        assert(resp == MBALLOC_OK);
-        return;
+    if (allocator == NULL) { return false; }
+    if (total != NULL) {
+        *total = allocator->limit_pfn - allocator->base_pfn;
     }
-    unreachable();
+    if (nr_free != NULL) { *nr_free = allocator->nr_free_pages; }
+    return true;
 }
 
 bool get_phymem_bound(int type, phyaddr_t* base, phyaddr_t* limit) {
@@ -269,11 +688,7 @@ void init_memory() {
     size_t total_crit = get_critical_memsize();
     kdebug("total critical memory: %.3f KB", total_crit * 1.0 / NUM_1K);
 
-    const int    kmem_slots = 1000;
-    const size_t kmem_alloc_size =
-        sizeof(memblk_allocator_t) + kmem_slots * sizeof(memblk_t);
-
-    //! layout: critical | kmem_allocator | kmem | kpage | upage
+    //! layout: critical | kmem | kpage | upage
 
     const ssize_t min_kmem_size  = 2 * NUM_1M;
     const ssize_t min_kpage_size = 2 * NUM_1M;
@@ -281,7 +696,7 @@ void init_memory() {
     const ssize_t min_free_mem =
         min_kmem_size + min_kpage_size + min_upage_size;
 
-    const ssize_t kmem_offset    = total_crit + kmem_alloc_size;
+    const ssize_t kmem_offset    = total_crit;
     const ssize_t total_free_mem = (ssize_t)total_mem - kmem_offset;
     if (total_free_mem < min_free_mem) {
         size_t min_req = idiv_ceil(min_free_mem + kmem_offset, NUM_1M);
@@ -321,33 +736,26 @@ void init_memory() {
         memblk_bounds[2][0],
         upagesize / NUM_4K);
 
-    //! NOTE: separate `kmem_allocator` itself from the kmem segment, so nothing
-    //! except a violent mem direct write could destroy kmem_allocator
-    kmem_allocator = mballoc_create(
-        unsafe_kmalloc,
-        kmem_slots,
-        K_PHY2LIN(memblk_bounds[0][0]),
-        K_PHY2LIN(memblk_bounds[0][1]));
-
-    //! NOTE: ok, now `unsafe_kmalloc` has finished its task and was completely
-    //! replaced by `kmem_allocator`, it should never be used since then,
-    //! neither should we free the memory allocated by it
-
-    //! NOTE: kpage_allocator & upage_allocator is expected always to allocate
-    //! and free page size, so the free slots should never excceed half of total
-    //! pages
-
-    kpage_allocator = mballoc_create_by(
-        kmem_allocator,
-        idiv_ceil(memblk_bounds[1][1] - memblk_bounds[1][0], NUM_4K * 2),
-        (void*)memblk_bounds[1][0],
-        (void*)memblk_bounds[1][1]);
-    assert(kpage_allocator != NULL);
-
-    upage_allocator = mballoc_create_by(
-        kmem_allocator,
-        idiv_ceil(memblk_bounds[2][1] - memblk_bounds[2][0], NUM_4K * 2),
-        (void*)memblk_bounds[2][0],
-        (void*)memblk_bounds[2][1]);
-    assert(upage_allocator != NULL);
+    kmem_init(K_PHY2LIN(memblk_bounds[0][0]), K_PHY2LIN(memblk_bounds[0][1]));
+
+    //! NOTE: kpage & upage are served by buddy allocators, whose per-frame
+    //! metadata is allocated from kmem, and so is the frame descriptor table
+    //! shared by both of them
+    phypage_base_pfn  = memblk_bounds[1][0] / NUM_4K;
+    phypage_limit_pfn = memblk_bounds[2][1] / NUM_4K;
+    size_t nr_frames  = phypage_limit_pfn - phypage_base_pfn;
+    phypages          = kmalloc(nr_frames * sizeof(phypage_t));
+    assert(phypages != NULL);
+    memset(phypages, 0, nr_frames * sizeof(phypage_t));
+    kdebug(
+        "phypage: %d frame descriptors, %d KB",
+        nr_frames,
+        nr_frames * sizeof(phypage_t) / NUM_1K);
+
+    buddy_init(&kpage_allocator, memblk_bounds[1][0], memblk_bounds[1][1]);
+    buddy_init(&upage_allocator, memblk_bounds[2][0], memblk_bounds[2][1]);
+
+    //! NOTE: honor read-only ptes in supervisor mode as well, otherwise writes
+    //! from the kernel to a cow page would silently go to the shared frame
+    lcr0(rcr0() | CR0_WP);
 }
@@ -4,9 +4,27 @@
 #include <unios/proc.h>
 #include <unios/kstate.h>
 #include <unios/memory.h>
+#include <unios/interrupt.h>
 #include <unios/tracing.h>
+#include <unios/smp.h>
 #include <arch/x86.h>
 #include <string.h>
+#include <math.h>
+
+//! NOTE: page tables of the kernel space are built once and linked into every
+//! page directory, so they are shared among all the processes and must never
+//! be freed along with a process
+static uint32_t kernel_pgdir;     //<! template page directory
+static uint32_t kernel_pde_base;  //<! index of the first shared pde
+static uint32_t kernel_pde_limit; //<! index past the last shared pde
+
+static bool pg_is_current(uint32_t cr3) {
+    return pg_frame_phyaddr(rcr3()) == pg_frame_phyaddr(cr3);
+}
+
+static bool pg_is_kernel_pde(uint32_t index) {
+    return index >= kernel_pde_base && index < kernel_pde_limit;
+}
 
 bool pg_free_page_table(uint32_t cr3) {
     assert(cr3 != 0);
@@ -24,30 +42,30 @@ bool pg_clear_page_table(uint32_t cr3, bool free) {
         uint32_t  pde     = *pde_ptr;
         //! case 0: pde not exist is also a good unmap
         if ((pde & PG_MASK_P) != PG_P) { continue; }
-        //! case 1: unmap the pde
+        //! case 1: shared kernel pte table, only unlink it
+        //! case 2: unmap the pde
         uint32_t pde_phyaddr = pg_frame_phyaddr(pde);
-        if (free) { free_phypage(pde_phyaddr); }
+        if (free && !pg_is_kernel_pde(i)) { free_phypage(pde_phyaddr); }
         *pde_ptr = 0;
     }
-    pg_refresh();
+    //! NOTE: tlb only caches the current address space
+    if (pg_is_current(cr3)) { pg_refresh(); }
     return true;
 }
 
+static bool pg_resolve_cow(uint32_t cr3, uint32_t laddr);
+
+static void pg_mark_table(phyaddr_t phyaddr) {
+    set_phypage_type(phyaddr, PHYPAGE_PGTABLE);
+    set_phypage_flags(phyaddr, PHYPAGE_PINNED, true);
+}
+
 bool pg_unmap_laddr(uint32_t cr3, uint32_t laddr, bool free) {
-    assert(cr3 != 0);
-    uint32_t pde = pg_pde(cr3, laddr);
-    //! case 0: pde not present is also a good unmap
-    if ((pde & PG_MASK_P) != PG_P) { return true; }
-    uint32_t *pte_ptr = pg_pte_ptr(pde, laddr);
-    uint32_t  pte     = *pte_ptr;
-    //! case 1: pte already not present
-    if ((pte & PG_MASK_P) != PG_P) { return true; }
-    uint32_t phyaddr = pg_frame_phyaddr(pte);
-    //! case 2: pte present, reset then
-    if (free) { free_phypage(phyaddr); }
-    *pte_ptr = 0;
-    pg_refresh();
-    return true;
+    pg_batch_t batch;
+    pg_batch_begin(&batch, cr3);
+    bool ok = pg_batch_unmap(&batch, laddr, free);
+    pg_batch_commit(&batch);
+    return ok;
 }
 
 bool pg_map_laddr(
@@ -66,12 +84,24 @@ bool pg_map_laddr(
     if ((*pde_ptr & PG_MASK_P) != PG_P) {
         uint32_t pde_phyaddr = (uint32_t)kmalloc_phypage();
         assert(pde_phyaddr == pg_frame_phyaddr(pde_phyaddr));
+        pg_mark_table(pde_phyaddr);
         memset(K_PHY2LIN(pde_phyaddr), 0, NUM_4K);
         *pde_ptr = pde_phyaddr | pde_attr;
     }
     uint32_t pde         = *pde_ptr;
     uint32_t old_pte     = pg_pte(pde, laddr);
     uint32_t old_phyaddr = pg_frame_phyaddr(old_pte);
+    //! NOTE: keeping the frame of a cow page while granting the write access
+    //! would write through to the other holders of the frame, so the cow is
+    //! broken ahead, and retried if the frame got shared again in between
+    bool want_rw = (pte_attr & PG_MASK_RW) == PG_RWX;
+    while (phyaddr == PG_INVALID && want_rw
+           && (old_pte & (PG_MASK_P | PG_MASK_COW)) == (PG_P | PG_COW)) {
+        assert(pg_is_current(cr3));
+        if (!pg_resolve_cow(cr3, laddr)) { return false; }
+        old_pte     = pg_pte(pde, laddr);
+        old_phyaddr = pg_frame_phyaddr(old_pte);
+    }
     if (phyaddr == PG_INVALID) {
         if ((old_pte & PG_MASK_P) != PG_P) {
             bool in_kernel = laddr >= KernelLinBase;
@@ -95,9 +125,10 @@ bool pg_map_laddr(
     if (old_phyaddr == phyaddr) {
         //! case 1: old present, with the same page, but different from attr
         //! TODO: attr overwrite policy
-    } else if (old_phyaddr != 0) {
-        //! case 2: old present, but with different phy page
-        //! TODO: release old phy page
+    } else if ((old_pte & PG_MASK_P) == PG_P) {
+        //! case 2: old present, but with different phy page, drop the
+        //! reference held by the old pte if the frame is managed
+        if (phypage_refcount(old_phyaddr) > 0) { free_phypage(old_phyaddr); }
     } else {
         //! case 3: old not present, just write
     }
@@ -108,13 +139,11 @@ bool pg_map_laddr(
 
 bool pg_unmap_laddr_range(
     uint32_t cr3, uint32_t laddr_base, uint32_t laddr_limit, bool free) {
-    laddr_base  = pg_frame_phyaddr(laddr_base);
-    laddr_limit = pg_frame_phyaddr(laddr_limit + 0xfff);
-    for (uint32_t laddr = laddr_base; laddr < laddr_limit; laddr += NUM_4K) {
-        bool ok = pg_unmap_laddr(cr3, laddr, free);
-        if (!ok) { return false; }
-    }
-    return true;
+    pg_batch_t batch;
+    pg_batch_begin(&batch, cr3);
+    bool ok = pg_batch_unmap_range(&batch, laddr_base, laddr_limit, free);
+    pg_batch_commit(&batch);
+    return ok;
 }
 
 bool pg_map_laddr_range(
@@ -136,17 +165,249 @@ void pg_refresh() {
     tlbflush();
 }
 
+void pg_batch_begin(pg_batch_t *batch, uint32_t cr3) {
+    assert(batch != NULL);
+    assert(cr3 != 0);
+    batch->cr3        = cr3;
+    batch->nr_pending = 0;
+}
+
+void pg_batch_invalidate(pg_batch_t *batch, uint32_t laddr) {
+    //! NOTE: once overflowed, the whole tlb is flushed at commit and there is
+    //! no need to record any more
+    if (batch->nr_pending > PG_BATCH_MAX) { return; }
+    if (batch->nr_pending < PG_BATCH_MAX) {
+        batch->pending[batch->nr_pending] = pg_frame_phyaddr(laddr);
+    }
+    ++batch->nr_pending;
+}
+
+bool pg_batch_map(
+    pg_batch_t *batch,
+    uint32_t    laddr,
+    uint32_t    phyaddr,
+    uint32_t    pde_attr,
+    uint32_t    pte_attr) {
+    //! NOTE: not present entries are never cached by tlb, only overwriting a
+    //! present one leaves a stale entry
+    bool stale = pg_addr_pte_exist(batch->cr3, laddr);
+    bool ok    = pg_map_laddr(batch->cr3, laddr, phyaddr, pde_attr, pte_attr);
+    if (ok && stale) { pg_batch_invalidate(batch, laddr); }
+    return ok;
+}
+
+bool pg_batch_unmap(pg_batch_t *batch, uint32_t laddr, bool free) {
+    uint32_t pde = pg_pde(batch->cr3, laddr);
+    //! case 0: pde not present is also a good unmap
+    if ((pde & PG_MASK_P) != PG_P) { return true; }
+    uint32_t *pte_ptr = pg_pte_ptr(pde, laddr);
+    uint32_t  pte     = *pte_ptr;
+    //! case 1: pte already not present
+    if ((pte & PG_MASK_P) != PG_P) { return true; }
+    uint32_t phyaddr = pg_frame_phyaddr(pte);
+    //! case 2: pte present, reset then
+    if (free) { free_phypage(phyaddr); }
+    *pte_ptr = 0;
+    pg_batch_invalidate(batch, laddr);
+    return true;
+}
+
+bool pg_batch_map_range(
+    pg_batch_t *batch,
+    uint32_t    laddr_base,
+    uint32_t    laddr_limit,
+    uint32_t    pde_attr,
+    uint32_t    pte_attr) {
+    laddr_base  = pg_frame_phyaddr(laddr_base);
+    laddr_limit = pg_frame_phyaddr(laddr_limit + 0xfff);
+    for (uint32_t laddr = laddr_base; laddr < laddr_limit; laddr += NUM_4K) {
+        bool ok = pg_batch_map(batch, laddr, PG_INVALID, pde_attr, pte_attr);
+        if (!ok) { return false; }
+    }
+    return true;
+}
+
+bool pg_batch_unmap_range(
+    pg_batch_t *batch, uint32_t laddr_base, uint32_t laddr_limit, bool free) {
+    laddr_base  = pg_frame_phyaddr(laddr_base);
+    laddr_limit = pg_frame_phyaddr(laddr_limit + 0xfff);
+    uint32_t laddr = laddr_base;
+    while (laddr < laddr_limit) {
+        //! skip the whole page table if not present
+        if (!pg_pde_exist(batch->cr3, laddr)) {
+            laddr = round_down(laddr, NUM_4M) + NUM_4M;
+            //! NOTE: wraps around at the top of the address space
+            if (laddr == 0) { break; }
+            continue;
+        }
+        bool ok = pg_batch_unmap(batch, laddr, free);
+        if (!ok) { return false; }
+        laddr += NUM_4K;
+    }
+    return true;
+}
+
+void pg_batch_commit(pg_batch_t *batch) {
+    //! NOTE: tlb only caches the current address space, entries of the others
+    //! are dropped on the next cr3 switch anyway, but the address space may be
+    //! current on the other cpus as well, where threads of it are running
+    if (batch->nr_pending > 0) { smp_tlb_shootdown(batch->cr3); }
+    if (batch->nr_pending > 0 && pg_is_current(batch->cr3)) {
+        if (batch->nr_pending > PG_BATCH_MAX) {
+            pg_refresh();
+        } else {
+            for (int i = 0; i < batch->nr_pending; ++i) {
+                invlpg(batch->pending[i]);
+            }
+        }
+    }
+    batch->nr_pending = 0;
+}
+
+static bool pg_in_range(uint32_t laddr, uint32_t base, uint32_t limit) {
+    return laddr >= base && laddr < limit;
+}
+
+static bool pg_resolve_cow(uint32_t cr3, uint32_t laddr) {
+    laddr = pg_frame_phyaddr(laddr);
+    if (!pg_addr_pte_exist(cr3, laddr)) { return false; }
+    uint32_t *pte_ptr = pg_pte_ptr(pg_pde(cr3, laddr), laddr);
+
+    //! NOTE: the private frame is allocated ahead since the allocator may
+    //! sleep, a fault that finds no frame when it turns out to need one is
+    //! simply retried
+    phyaddr_t new_phyaddr = 0;
+    bool      cow         = (*pte_ptr & PG_MASK_COW) == PG_COW;
+    if (cow && phypage_refcount(pg_frame_phyaddr(*pte_ptr)) > 1) {
+        new_phyaddr = malloc_phypage();
+        if (new_phyaddr == 0) { return false; }
+    }
+
+    uint32_t  attr      = PG_P | PG_U | PG_RWX;
+    phyaddr_t to_free   = 0;
+    bool      resolved  = true;
+    bool      used_copy = false;
+
+    //! NOTE: threads of the address space may fault on the page at the same
+    //! time while the share window is single, so the pte is checked again and
+    //! fixed up as a whole with the interrupts disabled
+    disable_int_begin();
+    uint32_t  pte     = *pte_ptr;
+    phyaddr_t phyaddr = pg_frame_phyaddr(pte);
+
+    pg_batch_t batch;
+    pg_batch_begin(&batch, cr3);
+
+    if ((pte & PG_MASK_COW) != PG_COW) {
+        //! broken by another thread in between, or not a cow page at all
+        resolved = (pte & PG_MASK_RW) == PG_RWX;
+    } else if (phypage_refcount(phyaddr) == 1) {
+        //! case 0: the last holder of the frame, simply take it over
+        set_phypage_flags(phyaddr, PHYPAGE_COW, false);
+        *pte_ptr = phyaddr | attr;
+        pg_batch_invalidate(&batch, laddr);
+    } else if (new_phyaddr != 0) {
+        //! case 1: still shared, copy to a private frame through the share
+        //! window since upage is out of the kernel space
+        uint32_t laddr_share = SharePageBase;
+        assert(!pg_addr_pte_exist(cr3, laddr_share));
+        resolved = pg_batch_map(
+            &batch, laddr_share, new_phyaddr, attr, PG_P | PG_S | PG_RWX);
+        if (resolved) {
+            memcpy((void *)laddr_share, (void *)laddr, NUM_4K);
+            pg_batch_unmap(&batch, laddr_share, false);
+            *pte_ptr = new_phyaddr | attr;
+            pg_batch_invalidate(&batch, laddr);
+            to_free   = phyaddr;
+            used_copy = true;
+        }
+    }
+    pg_batch_commit(&batch);
+    disable_int_end();
+
+    if (new_phyaddr != 0 && !used_copy) { free_phypage(new_phyaddr); }
+    if (to_free != 0) { free_phypage(to_free); }
+    return resolved;
+}
+
+static bool pg_resolve_fault(uint32_t err_code, uint32_t cr2) {
+    if (kstate_on_init) { return false; }
+    //! NOTE: the low bits of the error code are laid out the same as the pte,
+    //! i.e. P for protection violation and R/W for write access, and the
+    //! only resolvable violation is a write to a cow page
+    if ((err_code & PG_MASK_P) == PG_P) {
+        if ((err_code & PG_MASK_RW) != PG_RWX) { return false; }
+        return pg_resolve_cow(p_proc_current->pcb.cr3, cr2);
+    }
+
+    //! NOTE: threads share the heap & args of the leader, but each of them
+    //! has its own stack
+    pcb_t        *pcb    = &p_proc_current->pcb;
+    lin_memmap_t *memmap = &thread_leader(pcb)->memmap;
+    lin_memmap_t *stack  = &pcb->memmap;
+    uint32_t      laddr  = pg_frame_phyaddr(cr2);
+
+    //! NOTE: pages are handed out in whole, so round up the exact limits
+    uint32_t heap_limit = round_up(memmap->heap_lin_limit, NUM_4K);
+    uint32_t brk_limit  = round_up(memmap->brk_lin_limit, NUM_4K);
+
+    //! NOTE: stack grows down toward the child stack limit on demand
+    bool in_heap  = pg_in_range(cr2, memmap->heap_lin_base, heap_limit);
+    bool in_brk   = pg_in_range(cr2, memmap->brk_lin_base, brk_limit);
+    bool in_arg   = pg_in_range(
+        cr2, memmap->arg_lin_base, memmap->arg_lin_limit);
+    bool in_stack = pg_in_range(
+        cr2, stack->stack_child_limit, stack->stack_lin_base);
+    if (!(in_heap || in_brk || in_arg || in_stack)) { return false; }
+
+    //! already resolved by someone else in between
+    if (pg_addr_pte_exist(pcb->cr3, laddr)) { return true; }
+
+    //! NOTE: the frame is allocated ahead since the allocator may sleep
+    phyaddr_t phyaddr = malloc_phypage();
+    if (phyaddr == 0) { return false; }
+
+    //! NOTE: another thread of the address space must never see the page
+    //! before it is zeroed, so the check, the map and the zeroing are done as
+    //! a whole with the interrupts disabled
+    bool ok     = true;
+    bool mapped = false;
+    disable_int_begin();
+    if (!pg_addr_pte_exist(pcb->cr3, laddr)) {
+        ok = pg_map_laddr(
+            pcb->cr3,
+            laddr,
+            phyaddr,
+            PG_P | PG_U | PG_RWX,
+            PG_P | PG_U | PG_RWX);
+        //! NOTE: not present entries are never cached by tlb, so the new page
+        //! is accessible right away without a flush
+        if (ok) { memset((void *)laddr, 0, NUM_4K); }
+        mapped = ok;
+    }
+    disable_int_end();
+    if (!mapped) { free_phypage(phyaddr); }
+    if (!ok) { return false; }
+
+    if (in_stack) {
+        stack->stack_lin_limit = min(stack->stack_lin_limit, laddr);
+    }
+    return true;
+}
+
 void page_fault_handler(
     uint32_t vec_no,
     uint32_t err_code,
     uint32_t eip,
     uint32_t cs,
-    uint32_t eflags) {
+    uint32_t eflags,
+    uint32_t cr2) {
+    //! demand paging, resume the faulting instruction if resolved
+    if (pg_resolve_fault(err_code, cr2)) { return; }
+
     static uint32_t pfh_cntr = 0;
     uint32_t        id       = pfh_cntr++;
 
-    uint32_t cr2 = rcr2();
-
     kinfo(
         "[#PF.%d] trigger page fault %s",
         ++id,
@@ -201,9 +462,26 @@ bool pg_create_and_init(uint32_t *p_cr3) {
     //! non-zero
     if (cr3 == 0) { return false; }
     assert(cr3 == pg_frame_phyaddr(cr3));
+    pg_mark_table(cr3);
     memset(K_PHY2LIN(cr3), 0, NUM_4K);
-    bool should_rollback = false;
-    //! init kernel memory space
+    //! init kernel memory space by linking the shared pte tables
+    //! NOTE: a brand new page table is never cached, so no flush is needed
+    uint32_t *dst = K_PHY2LIN(cr3);
+    uint32_t *src = K_PHY2LIN(kernel_pgdir);
+    memcpy(
+        dst + kernel_pde_base,
+        src + kernel_pde_base,
+        (kernel_pde_limit - kernel_pde_base) * sizeof(uint32_t));
+    *p_cr3 = cr3;
+    return true;
+}
+
+void init_kernel_page_table() {
+    kernel_pgdir = kmalloc_phypage();
+    assert(kernel_pgdir != 0);
+    pg_mark_table(kernel_pgdir);
+    memset(K_PHY2LIN(kernel_pgdir), 0, NUM_4K);
+
     phyaddr_t phy_base  = 0;
     phyaddr_t phy_limit = 0;
     bool      ok        = get_phymem_bound(KernelSpace, &phy_base, &phy_limit);
@@ -211,25 +489,24 @@ bool pg_create_and_init(uint32_t *p_cr3) {
     uint32_t base    = (uint32_t)K_PHY2LIN(phy_base);
     uint32_t limit   = (uint32_t)K_PHY2LIN(phy_limit);
     uint32_t laddr   = base;
-    uint32_t phyaddr = 0;
+    uint32_t phyaddr = phy_base;
     while (laddr < limit) {
         bool ok = pg_map_laddr(
-            cr3, laddr, phyaddr, PG_P | PG_U | PG_RWX, PG_P | PG_S | PG_RWX);
-        if (!ok) {
-            should_rollback = true;
-            break;
-        }
+            kernel_pgdir,
+            laddr,
+            phyaddr,
+            PG_P | PG_U | PG_RWX,
+            PG_P | PG_S | PG_RWX);
+        assert(ok);
         laddr   += NUM_4K;
         phyaddr += NUM_4K;
     }
-    if (should_rollback) {
-        pg_unmap_laddr_range(cr3, base, limit, false);
-        return false;
-    } else {
-        pg_refresh();
-    }
-    *p_cr3 = cr3;
-    return true;
+
+    kernel_pde_base  = pg_pde_index(base);
+    kernel_pde_limit = pg_pde_index(limit - 1) + 1;
+    kinfo(
+        "kernel space shares %d pte tables",
+        kernel_pde_limit - kernel_pde_base);
 }
 
 #pragma GCC push_options
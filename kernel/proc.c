@@ -4,8 +4,11 @@
 #include <unios/tty.h>
 #include <unios/hd.h>
 #include <unios/scavenger.h>
+#include <unios/bcache.h>
+#include <unios/aio.h>
 #include <unios/schedule.h>
 #include <unios/graphics.h>
+#include <unios/apic.h>
 #include <unios/kstate.h>
 #include <unios/memory.h>
 #include <unios/layout.h>
@@ -13,14 +16,29 @@
 #include <unios/assert.h>
 #include <unios/page.h>
 #include <unios/window.h>
+#include <unios/slab.h>
+#include <unios/interrupt.h>
+#include <arch/x86.h>
 #include <string.h>
 #include <atomic.h>
+#include <math.h>
 
-tss_t      tss;
-process_t* p_proc_current;
-process_t* p_proc_next;
-process_t* proc_table[NR_PCBS];
-rwlock_t   proc_table_rwlock;
+process_t*  p_proc_next;
+process_t** proc_table;
+int         nr_pcbs;
+rwlock_t    proc_table_rwlock;
+
+static kmem_cache_t* proc_cache    = NULL;
+static kmem_cache_t* ph_info_cache = NULL;
+static kmem_cache_t* killed_cache  = NULL;
+
+//! bit i set iff slot i of proc_table is NULL or holds an IDLE pcb, a set bit
+//! is only a hint, the pcb is checked again under its lock
+static uint32_t* free_slots = NULL;
+
+//! pids are handed out in increasing order and never reused while alive
+static struct list_head pid_hash[NR_PID_BUCKETS];
+static int              next_pid = 0;
 
 #define TASK_ENTRY(handler) {handler, #handler}
 
@@ -28,49 +46,172 @@ task_t task_table[NR_TASKS] = {
     TASK_ENTRY(tty_handler),
     TASK_ENTRY(scavenger),
     TASK_ENTRY(window_manager_handler),
+    TASK_ENTRY(bcache_flusher),
 };
 
-process_t* try_lock_free_pcb() {
-    bool have_free_slot = false;
-    rwlock_wait_rd(&proc_table_rwlock);
-    for (int i = 0; i < NR_PCBS; ++i) {
-        if (proc_table[i] == NULL) {
-            have_free_slot = true;
-            continue;
-        }
-        pcb_t* pcb = &proc_table[i]->pcb;
-        if (!try_lock(&pcb->lock)) { continue; }
-        if (pcb->stat != IDLE) {
-            release(&pcb->lock);
-            continue;
-        }
-        rwlock_leave(&proc_table_rwlock);
-        return (process_t*)pcb;
+void init_proc_cache() {
+    proc_cache = kmem_cache_create("process_t", sizeof(process_t), 0, NULL);
+    assert(proc_cache != NULL);
+    ph_info_cache =
+        kmem_cache_create("ph_info_t", sizeof(ph_info_t), 0, NULL);
+    assert(ph_info_cache != NULL);
+    killed_cache =
+        kmem_cache_create("killed_child_t", sizeof(killed_child_t), 0, NULL);
+    assert(killed_cache != NULL);
+
+    proc_table = kmalloc(NR_PCBS * sizeof(process_t*));
+    free_slots = kmalloc(NR_PCBS / 32 * sizeof(uint32_t));
+    assert(proc_table != NULL && free_slots != NULL);
+    memset(proc_table, 0, NR_PCBS * sizeof(process_t*));
+    memset(free_slots, 0xff, NR_PCBS / 32 * sizeof(uint32_t));
+    nr_pcbs           = NR_PCBS;
+    proc_table_rwlock = 0;
+
+    for (int i = 0; i < NR_PID_BUCKETS; ++i) { INIT_LIST_HEAD(&pid_hash[i]); }
+    next_pid = 0;
+}
+
+static struct list_head* pid_bucket(int pid) {
+    return &pid_hash[pid & (NR_PID_BUCKETS - 1)];
+}
+
+static void set_slot_free(int slot, bool free) {
+    uint32_t mask = 1u << (slot % 32);
+    if (free) {
+        free_slots[slot / 32] |= mask;
+    } else {
+        free_slots[slot / 32] &= ~mask;
     }
-    rwlock_leave(&proc_table_rwlock);
-    if (!have_free_slot) { return NULL; }
+}
+
+static bool grow_proc_table() {
+    //! NOTE: the slot bounds the thread stack, see `thread_stack_base`
+    if (nr_pcbs >= NR_PCBS_MAX) { return false; }
+    int         new_nr    = min(nr_pcbs * 2, NR_PCBS_MAX);
+    process_t** new_table = kmalloc(new_nr * sizeof(process_t*));
+    uint32_t*   new_slots = kmalloc(new_nr / 32 * sizeof(uint32_t));
+    if (new_table == NULL || new_slots == NULL) {
+        if (new_table != NULL) { kfree(new_table); }
+        if (new_slots != NULL) { kfree(new_slots); }
+        return false;
+    }
+    memset(new_table, 0, new_nr * sizeof(process_t*));
+    memset(new_slots, 0xff, new_nr / 32 * sizeof(uint32_t));
+
+    //! NOTE: the table is also walked in irqs, swap it in at once
+    process_t** old_table = proc_table;
+    uint32_t*   old_slots = free_slots;
+    disable_int_begin();
+    memcpy(new_table, proc_table, nr_pcbs * sizeof(process_t*));
+    memcpy(new_slots, free_slots, nr_pcbs / 32 * sizeof(uint32_t));
+    proc_table = new_table;
+    free_slots = new_slots;
+    nr_pcbs    = new_nr;
+    disable_int_end();
+
+    kfree(old_table);
+    kfree(old_slots);
+    return true;
+}
+
+static process_t* try_lock_slot(int slot) {
+    process_t* proc = proc_table[slot];
+    if (proc == NULL) {
+        proc = kmem_cache_alloc(proc_cache);
+        if (proc == NULL) { return NULL; }
+        memset(proc, 0, sizeof(process_t));
+        acquire(&proc->pcb.lock);
+        proc->pcb.stat = IDLE;
+        proc->pcb.pid  = -1;
+        proc->pcb.slot = slot;
+        INIT_LIST_HEAD(&proc->pcb.rq_node);
+        INIT_LIST_HEAD(&proc->pcb.pid_node);
+        init_tree_lists(&proc->pcb.tree_info);
+        proc_table[slot] = proc;
+        return proc;
+    }
+    if (!try_lock(&proc->pcb.lock)) { return NULL; }
+    if (proc->pcb.stat != IDLE) {
+        //! stale hint, the pcb has been taken since
+        set_slot_free(slot, false);
+        release(&proc->pcb.lock);
+        return NULL;
+    }
+    return proc;
+}
+
+process_t* try_lock_free_pcb() {
+    //! NOTE: the slot stays marked free until a pid is bound to the pcb, so a
+    //! pcb given up before that is simply picked up again
     rwlock_wait_wr(&proc_table_rwlock);
     process_t* proc = NULL;
-    for (int i = 0; i < NR_PCBS; ++i) {
-        if (proc_table[i] == NULL) {
-            process_t* proc = kmalloc(sizeof(process_t));
-            assert(proc != NULL);
-            memset(proc, 0, sizeof(process_t));
-            acquire(&proc->pcb.lock);
-            proc->pcb.stat = IDLE;
-            proc_table[i]  = proc;
-            rwlock_leave(&proc_table_rwlock);
-            return proc;
+    for (int i = 0; i < nr_pcbs / 32 && proc == NULL; ++i) {
+        uint32_t bits = free_slots[i];
+        while (bits != 0 && proc == NULL) {
+            int slot  = i * 32 + __builtin_ctz(bits);
+            bits     &= bits - 1;
+            proc      = try_lock_slot(slot);
         }
     }
+    if (proc == NULL) {
+        int slot = nr_pcbs;
+        if (grow_proc_table()) { proc = try_lock_slot(slot); }
+    }
     rwlock_leave(&proc_table_rwlock);
-    return NULL;
+    return proc;
+}
+
+int pid_alloc(pcb_t* pcb) {
+    disable_int_begin();
+    list_del_init(&pcb->pid_node);
+    //! NOTE: skip the pids still alive once the counter wraps around
+    do {
+        if (next_pid < 0) { next_pid = 0; }
+        pcb->pid = next_pid++;
+    } while (pid2proc(pcb->pid) != NULL);
+    list_add_tail(&pcb->pid_node, pid_bucket(pcb->pid));
+    set_slot_free(pcb->slot, false);
+    disable_int_end();
+    return pcb->pid;
+}
+
+void pid_detach(pcb_t* pcb) {
+    disable_int_begin();
+    list_del_init(&pcb->pid_node);
+    set_slot_free(pcb->slot, true);
+    aio_orphan(pcb->pid);
+    disable_int_end();
+}
+
+void recycle_locked_pcb(pcb_t* pcb) {
+    assert(pcb->lock);
+    disable_int_begin();
+    //! NOTE: leave the run queue & the pid hash before the pcb is wiped
+    set_proc_stat(pcb, IDLE);
+    free_killed_children(&pcb->tree_info);
+    int slot = pcb->slot;
+    memset(pcb, 0, sizeof(process_t));
+    acquire(&pcb->lock);
+    pcb->pid  = -1;
+    pcb->slot = slot;
+    INIT_LIST_HEAD(&pcb->rq_node);
+    INIT_LIST_HEAD(&pcb->pid_node);
+    init_tree_lists(&pcb->tree_info);
+    disable_int_end();
+}
+
+ph_info_t* alloc_ph_info() {
+    return kmem_cache_alloc(ph_info_cache);
+}
+
+void free_ph_info(ph_info_t* ph_info) {
+    kmem_cache_free(ph_info_cache, ph_info);
 }
 
 ph_info_t* clone_ph_info(ph_info_t* src) {
     ph_info_t* dst = NULL;
     while (src != NULL) {
-        ph_info_t* node = kmalloc(sizeof(ph_info_t));
+        ph_info_t* node = alloc_ph_info();
         assert(node != NULL);
         node->base  = src->base;
         node->limit = src->limit;
@@ -89,18 +230,60 @@ ph_info_t* clone_ph_info(ph_info_t* src) {
     return dst;
 }
 
+void init_tree_lists(tree_info_t* info) {
+    INIT_LIST_HEAD(&info->children);
+    INIT_LIST_HEAD(&info->threads);
+    INIT_LIST_HEAD(&info->zombies);
+    INIT_LIST_HEAD(&info->killed);
+    INIT_LIST_HEAD(&info->sibling);
+    INIT_LIST_HEAD(&info->zombie);
+}
+
+void add_killed_child(tree_info_t* info, int pid) {
+    killed_child_t* killed = NULL;
+    list_for_each_entry(killed, &info->killed, node) {
+        //! already recorded and not waited for yet
+        if (killed->pid == pid) { return; }
+    }
+    killed = kmem_cache_alloc(killed_cache);
+    assert(killed != NULL);
+    killed->pid = pid;
+    list_add_tail(&killed->node, &info->killed);
+}
+
+int pop_killed_child(tree_info_t* info) {
+    if (list_empty(&info->killed)) { return -1; }
+    killed_child_t* killed =
+        list_first_entry(&info->killed, killed_child_t, node);
+    int pid = killed->pid;
+    list_del(&killed->node);
+    kmem_cache_free(killed_cache, killed);
+    return pid;
+}
+
+void free_killed_children(tree_info_t* info) {
+    while (pop_killed_child(info) != -1) {}
+}
+
 void do_yield() {
-    p_proc_current->pcb.live_ticks = 0;
     sched();
 }
 
+static void sleep_timeout(void* arg) {
+    set_proc_stat(arg, READY);
+}
+
 void do_sleep(int n) {
-    int ticks0                  = system_ticks;
-    p_proc_current->pcb.channel = &system_ticks;
-    while (system_ticks - ticks0 < n) {
-        p_proc_current->pcb.stat = SLEEPING;
-        sched();
-    }
+    if (n <= 0) { return; }
+    //! NOTE: the timer lives in the pcb and is cancelled once the proc leaves
+    //! SLEEPING, so a proc killed in its sleep never leaves a dangling timer
+    pcb_t* pcb = &p_proc_current->pcb;
+    disable_int_begin();
+    ktimer_init(&pcb->sleep_timer, sleep_timeout, pcb);
+    ktimer_arm(&pcb->sleep_timer, n);
+    set_proc_stat(pcb, SLEEPING);
+    disable_int_end();
+    sched();
 }
 
 int do_get_pid() {
@@ -111,16 +294,6 @@ int do_get_ppid() {
     return p_proc_current->pcb.tree_info.ppid;
 }
 
-void wakeup_exclusive(void* channel) {
-    for (int i = 0; i < NR_PCBS; ++i) {
-        process_t* proc = proc_table[i];
-        if (proc == NULL) { continue; }
-        if (proc->pcb.stat == SLEEPING && proc->pcb.channel == channel) {
-            proc->pcb.stat = READY;
-        }
-    }
-}
-
 int ldt_seg_linear(process_t* p, int idx) {
     descriptor_t* d = &p->pcb.ldts[idx];
     return d->base2 << 24 | d->base1 << 16 | d->base0;
@@ -128,7 +301,7 @@ int ldt_seg_linear(process_t* p, int idx) {
 
 void* va2la(int pid, void* va) {
     if (kstate_on_init) { return va; }
-    process_t* proc = proc_table[pid];
+    process_t* proc = pid2proc(pid);
     assert(proc != NULL);
     uint32_t seg_base = ldt_seg_linear(proc, INDEX_LDT_RW);
     uint32_t la       = seg_base + (uint32_t)va;
@@ -137,20 +310,42 @@ void* va2la(int pid, void* va) {
 
 process_t* pid2proc(int pid) {
     assert(pid >= 0);
-    return proc_table[pid];
+    struct list_head* head = pid_bucket(pid);
+    struct list_head* node = NULL;
+    process_t*        proc = NULL;
+    //! NOTE: the hash is updated with the interrupts disabled, a walker that
+    //! is preempted on a node being detached would never reach the head again
+    disable_int_begin();
+    list_for_each(node, head) {
+        pcb_t* pcb = list_entry(node, pcb_t, pid_node);
+        if (pcb->pid == pid) {
+            proc = (process_t*)pcb;
+            break;
+        }
+    }
+    disable_int_end();
+    return proc;
+}
+
+void load_ldt_desc(pcb_t* pcb) {
+    //! NOTE: all the pcbs share a single gdt slot, which is rewritten before
+    //! every lldt, so the number of pcbs is not bounded by the gdt
+    init_descriptor(
+        &gdt[INDEX_LDT_FIRST],
+        vir2phys(seg2phys(SELECTOR_KERNEL_DS), pcb->ldts),
+        LDT_SIZE * sizeof(descriptor_t) - 1,
+        DA_LDT);
+}
+
+pcb_t* thread_leader(pcb_t* pcb) {
+    //! NOTE: threads are always attached to the leader, see `do_thread_create`
+    if (pcb->tree_info.type != TYPE_THREAD) { return pcb; }
+    return (pcb_t*)pid2proc(pcb->tree_info.ppid);
 }
 
 int proc2pid(process_t* proc) {
     assert(proc != NULL);
-    rwlock_wait_rd(&proc_table_rwlock);
-    for (int i = 0; i < NR_PCBS; ++i) {
-        if (proc == proc_table[i]) {
-            rwlock_leave(&proc_table_rwlock);
-            return i;
-        }
-    }
-    rwlock_leave(&proc_table_rwlock);
-    unreachable();
+    return proc->pcb.pid;
 }
 
 bool init_locked_pcb(
@@ -163,33 +358,31 @@ bool init_locked_pcb(
     pcb_t*        pcb  = &proc->pcb;
     lin_memmap_t* mmap = &pcb->memmap;
 
-    //! FIXME: better pid & ldt sel assignment method
-    int index = proc2pid(proc);
-
     //! basic info
     strcpy(pcb->name, name);
-    pcb->exit_code  = 0;
-    pcb->pid        = index;
-    pcb->priority   = 4;
-    pcb->live_ticks = pcb->priority;
-
-    //! ldt selector
-    pcb->ldt_sel = SELECTOR_LDT_FIRST + (index << 3);
+    pcb->exit_code   = 0;
+    pcb->priority    = 4;
+    pcb->live_ticks  = pcb->priority;
+    pcb->sched_level = 0;
+    pcb->wait_queue  = NULL;
+    pcb->filp        = pcb->files;
+    init_wait_queue_head(&pcb->wait_child);
+    sched_fork(pcb, NULL);
+    pid_alloc(pcb);
+
+    //! ldt selector, see `load_ldt_desc`
+    pcb->ldt_sel = SELECTOR_LDT_FIRST;
     memcpy(&pcb->ldts[0], &gdt[SELECTOR_KERNEL_CS >> 3], sizeof(descriptor_t));
     memcpy(&pcb->ldts[1], &gdt[SELECTOR_KERNEL_DS >> 3], sizeof(descriptor_t));
     pcb->ldts[0].attr0 = DA_C | (rpl << 5);
     pcb->ldts[1].attr0 = DA_DRW | (rpl << 5);
-    init_descriptor(
-        &gdt[pcb->ldt_sel >> 3],
-        vir2phys(seg2phys(SELECTOR_KERNEL_DS), pcb->ldts),
-        LDT_SIZE * sizeof(descriptor_t) - 1,
-        DA_LDT);
 
     //! memory
     bool ok = pg_create_and_init(&pcb->cr3);
     if (!ok) { return false; }
 
     graphics_map_lfb(pcb->cr3);
+    lapic_map(pcb->cr3);
 
     phyaddr_t phy_base  = 0;
     phyaddr_t phy_limit = 0;
@@ -204,27 +397,23 @@ bool init_locked_pcb(
     mmap->arg_lin_base  = ArgLinBase;
     mmap->arg_lin_limit = ArgLinLimitMAX;
 
-    //! 3. stack, alloc 16 KB currently
-    //! TODO: adaptive stack allocation
+    //! 3. stack, faulted in on demand and grows toward the child limit
     mmap->stack_lin_base    = StackLinBase;
-    mmap->stack_lin_limit   = StackLinBase - 4 * NUM_4K;
-    mmap->stack_child_limit = StackLinLimitMAX;
-    ok                      = pg_map_laddr_range(
-        pcb->cr3,
-        mmap->stack_lin_limit,
-        mmap->stack_lin_base,
-        PG_P | PG_U | PG_RWX,
-        PG_P | PG_U | PG_RWX);
-    assert(ok);
+    mmap->stack_lin_limit   = StackLinBase;
+    mmap->stack_child_limit = StackChildLinBase;
 
     //! 4. heap, alloc dynamically
     mmap->heap_lin_base  = HeapLinBase;
     mmap->heap_lin_limit = HeapLinBase;
     //! TODO: better heap manager
     pcb->allocator = mballoc_create(
-        kmalloc, NUM_4K, (void*)mmap->heap_lin_base, (void*)HeapLinLimitMAX);
+        64, (void*)mmap->heap_lin_base, (void*)BrkLinBase);
     pcb->heap_lock = 0;
 
+    //! 5. program break, extended by sbrk
+    mmap->brk_lin_base  = BrkLinBase;
+    mmap->brk_lin_limit = BrkLinBase;
+
     //! user space context
     memset(&pcb->regs, 0, P_STACKTOP);
     pcb->regs.cs  = ((8 * 0) & SA_MASK_RPL & SA_MASK_TI) | SA_TIL | rpl;
@@ -259,16 +448,14 @@ bool init_locked_pcb(
     //! family tree
     pcb->tree_info.type = TYPE_PROCESS;
     //! FIXME: semantics of pid=-1 are unclear
-    pcb->tree_info.real_ppid   = -1;
-    pcb->tree_info.ppid        = -1;
-    pcb->tree_info.child_p_num = 0;
-    pcb->tree_info.child_t_num = 0;
-    pcb->tree_info.child_k_num = 0;
-    pcb->tree_info.text_hold   = true;
-    pcb->tree_info.data_hold   = true;
+    pcb->tree_info.real_ppid = -1;
+    pcb->tree_info.ppid      = -1;
+    pcb->tree_info.text_hold = true;
+    pcb->tree_info.data_hold = true;
+    init_tree_lists(&pcb->tree_info);
 
     //! done
-    pcb->stat = READY;
+    set_proc_stat(pcb, READY);
     release(&pcb->lock);
     return true;
 }
@@ -2,6 +2,8 @@
 #include <unios/interrupt.h>
 #include <unios/layout.h>
 #include <unios/proc.h>
+#include <unios/apic.h>
+#include <unios/smp.h>
 #include <sys/types.h>
 #include <string.h>
 
@@ -39,6 +41,17 @@ void init_descriptor(
     desc->base2        = (base >> 24) & 0xff;
 }
 
+void init_tss(tss_t* tss, int index) {
+    memset(tss, 0, sizeof(tss_t));
+    tss->ss0 = SELECTOR_KERNEL_DS;
+    init_descriptor(
+        &gdt[index],
+        vir2phys(seg2phys(SELECTOR_KERNEL_DS), tss),
+        sizeof(tss_t) - 1,
+        DA_386TSS);
+    tss->iobase = sizeof(tss_t);
+}
+
 void init_protect_mode() {
     init_interrupt_controller();
 
@@ -89,6 +102,14 @@ void init_protect_mode() {
     init_idt_desc(INT_VECTOR_IRQ8 + 6, DA_386IGate, hwint14, RPL_KERNEL);
     init_idt_desc(INT_VECTOR_IRQ8 + 7, DA_386IGate, hwint15, RPL_KERNEL);
 
+    init_idt_desc(
+        INT_VECTOR_LOCAL_TIMER, DA_386IGate, hwint_local_timer, RPL_KERNEL);
+    init_idt_desc(INT_VECTOR_RESCHED, DA_386IGate, hwint_resched, RPL_KERNEL);
+    init_idt_desc(
+        INT_VECTOR_TLB_FLUSH, DA_386IGate, hwint_tlb_flush, RPL_KERNEL);
+    init_idt_desc(
+        LAPIC_SPURIOUS_VECTOR, DA_386IGate, hwint_spurious, RPL_KERNEL);
+
     init_idt_desc(INT_VECTOR_SYSCALL, DA_386IGate, syscall_handler, RPL_USER);
 
     init_descriptor(
@@ -97,12 +118,6 @@ void init_protect_mode() {
         0x0ffff,
         DA_DRW | DA_DPL3);
 
-    memset(&tss, 0, sizeof(tss));
-    tss.ss0 = SELECTOR_KERNEL_DS;
-    init_descriptor(
-        &gdt[INDEX_TSS],
-        vir2phys(seg2phys(SELECTOR_KERNEL_DS), &tss),
-        sizeof(tss) - 1,
-        DA_386TSS);
-    tss.iobase = sizeof(tss);
+    //! NOTE: the tss is loaded right after, see `_start`
+    init_tss(&cpus[CPU_BSP].tss, INDEX_TSS);
 }
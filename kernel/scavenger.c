@@ -1,12 +1,15 @@
 #include <unios/scavenger.h>
 #include <unios/page.h>
+#include <unios/schedule.h>
 #include <unios/assert.h>
 #include <unios/tracing.h>
 #include <stdlib.h>
 #include <stddef.h>
+#include <math.h>
 
-void recycle_memory_part(phyaddr_t cr3, void* base, void* limit) {
-    bool ok = pg_unmap_laddr_range(cr3, (uint32_t)base, (uint32_t)limit, true);
+void recycle_memory_part(pg_batch_t* batch, void* base, void* limit) {
+    bool ok =
+        pg_batch_unmap_range(batch, (uint32_t)base, (uint32_t)limit, true);
     assert(ok);
 }
 
@@ -24,49 +27,66 @@ void recycle_proc_memory(process_t* proc) {
     ph_info_t*    ph_ptr = memmap->ph_info;
     phyaddr_t     cr3    = pcb->cr3;
 
+    //! NOTE: the whole teardown shares a single batch, and since cr3 is never
+    //! the current one here, no tlb flush is issued at all
+    pg_batch_t batch;
+    pg_batch_begin(&batch, cr3);
+
     while (ph_ptr != NULL) {
-        recycle_memory_part(cr3, (void*)ph_ptr->base, (void*)ph_ptr->limit);
+        recycle_memory_part(
+            &batch, (void*)ph_ptr->base, (void*)ph_ptr->limit);
         ph_info_t* old_ph_ptr = ph_ptr;
         ph_ptr                = ph_ptr->next;
-        kfree(old_ph_ptr);
+        free_ph_info(old_ph_ptr);
     }
     memmap->ph_info = NULL;
 
     recycle_memory_part(
-        cr3, (void*)memmap->heap_lin_base, (void*)memmap->heap_lin_limit);
+        &batch, (void*)memmap->heap_lin_base, (void*)memmap->heap_lin_limit);
     recycle_memory_part(
-        cr3, (void*)memmap->arg_lin_base, (void*)memmap->arg_lin_limit);
+        &batch,
+        (void*)memmap->brk_lin_base,
+        (void*)round_up(memmap->brk_lin_limit, NUM_4K));
     recycle_memory_part(
-        cr3, (void*)memmap->stack_lin_limit, (void*)memmap->stack_lin_base);
-
-    //! NOTE: phypages of kernel memory is stable and shared, not from any
-    //! allocator, under no circumstances can they be released
-    bool ok = pg_unmap_laddr_range(
-        cr3, memmap->kernel_lin_base, memmap->kernel_lin_limit, false);
-    assert(ok);
+        &batch, (void*)memmap->arg_lin_base, (void*)memmap->arg_lin_limit);
+    recycle_memory_part(
+        &batch,
+        (void*)memmap->stack_lin_limit,
+        (void*)memmap->stack_lin_base);
+    pg_batch_commit(&batch);
 
-    ok = pg_clear_page_table(pcb->cr3, true);
+    //! NOTE: pte tables of kernel memory are shared among all the processes,
+    //! pg_clear_page_table only unlinks them, under no circumstances can they
+    //! be released or modified here
+    bool ok = pg_clear_page_table(pcb->cr3, true);
     assert(ok);
     ok = pg_free_page_table(pcb->cr3);
     assert(ok);
 
-    kfree(pcb->allocator);
+    mballoc_destroy(pcb->allocator);
     pcb->allocator = NULL;
 }
 
+static void scavenger_wait_orphans() {
+    //! NOTE: orphans are transferred as children of the scavenger, see
+    //! `transfer_child_proc`
+    wait_queue_head_t* wq = &p_proc_current->pcb.wait_child;
+    prepare_to_wait(wq);
+    yield();
+    finish_wait(wq);
+}
+
 void scavenger() {
     while (true) {
         int number = killerabbit(-1);
         if (number == 0) {
-            p_proc_current->pcb.stat = SLEEPING;
-            yield();
+            scavenger_wait_orphans();
         } else if (number > 0) {
             kinfo("---killed orphan! number = [%d]---", number);
         } else {
-            for (int i = 0; i < p_proc_current->pcb.tree_info.child_p_num;
-                 ++i) {
-                pcb_t* pcb = (pcb_t*)pid2proc(
-                    p_proc_current->pcb.tree_info.child_process[i]);
+            tree_info_t* info = &p_proc_current->pcb.tree_info;
+            pcb_t*       pcb  = NULL;
+            list_for_each_entry(pcb, &info->children, tree_info.sibling) {
                 kinfo(
                     "------ kill error pid:[%d] state:[%d] (0: I, 1: R, 2: S, "
                     "3: K, 4: Z, 5: "
@@ -74,8 +94,7 @@ void scavenger() {
                     proc2pid((process_t*)pcb),
                     pcb->stat);
             }
-            p_proc_current->pcb.stat = SLEEPING;
-            yield();
+            scavenger_wait_orphans();
         }
     }
 }
@@ -1,33 +1,377 @@
 #include <unios/schedule.h>
 #include <unios/proc.h>
+#include <unios/waitqueue.h>
+#include <unios/timer.h>
+#include <unios/clock.h>
+#include <unios/interrupt.h>
+#include <unios/kstate.h>
+#include <unios/smp.h>
+#include <unios/page.h>
+#include <unios/apic.h>
+#include <unios/graphics.h>
 #include <unios/assert.h>
+#include <arch/x86.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <list.h>
+
+//! NOTE: level 0 is the top priority, a proc starts at the level given by its
+//! creator, sinks one level each time it uses up the allotment of its level,
+//! and rises one level each time it is waken up from sleeping, so that io-bound
+//! & interactive procs stay on top of cpu-bound ones
+
+//! NOTE: every cpu owns a run queue, and a proc always belongs to the run queue
+//! of `pcb.cpu`, all the queues are touched with the kernel lock held and
+//! interrupts disabled only
+typedef struct runqueue_s {
+    struct list_head queues[NR_SCHED_LEVELS];
+    uint32_t         ready_bitmap; //<! bit i set iff queues[i] not empty
+    bool             active;       //<! whether the cpu runs the scheduler
+    bool             idle;         //<! whether the cpu is in the idle loop
+    sched_stat_t     stat;
+} runqueue_t;
+
+static runqueue_t        runqueues[NR_CPUS];
+static int               last_boost_ticks;
+static uint32_t          idle_cr3;   //<! page table of the idle cpus
+static wait_queue_head_t off_cpu_wq; //<! see `sched_wait_off_cpu`
 
 phyaddr_t cr3_ready;
 
+static int sched_quantum(pcb_t *pcb) {
+    return pcb->priority << pcb->sched_level;
+}
+
+static runqueue_t *rq_of(pcb_t *pcb) {
+    return &runqueues[pcb->cpu];
+}
+
+static void rq_add(pcb_t *pcb) {
+    runqueue_t *rq = rq_of(pcb);
+    list_add_tail(&pcb->rq_node, &rq->queues[pcb->sched_level]);
+    rq->ready_bitmap |= 1u << pcb->sched_level;
+    ++rq->stat.nr_ready;
+    //! an idle cpu halts till the next interrupt, wake it up for the new one
+    if (rq->idle && pcb->cpu != smp_cpu_id()) { smp_send_resched(pcb->cpu); }
+}
+
+static void rq_del(pcb_t *pcb) {
+    runqueue_t *rq = rq_of(pcb);
+    list_del_init(&pcb->rq_node);
+    if (list_empty(&rq->queues[pcb->sched_level])) {
+        rq->ready_bitmap &= ~(1u << pcb->sched_level);
+    }
+    --rq->stat.nr_ready;
+}
+
+static void rq_migrate(pcb_t *pcb, int cpu) {
+    if (pcb->cpu == cpu) { return; }
+    bool queued = pcb->stat == READY;
+    if (queued) { rq_del(pcb); }
+    pcb->cpu = cpu;
+    if (queued) { rq_add(pcb); }
+    ++runqueues[cpu].stat.nr_migrations;
+}
+
+static bool sched_is_task(pcb_t *pcb) {
+    //! NOTE: kernel tasks and the procs not exec-ed yet run at RPL_TASK, they
+    //! stay on the cpu they are created on, i.e. the bsp for the most
+    return (pcb->regs.cs & SA_RPL3) != RPL_USER;
+}
+
+static int sched_running_cpu(pcb_t *pcb) {
+    for (int i = 0; i < nr_cpus; ++i) {
+        if (cpus[i].proc != NULL && &cpus[i].proc->pcb == pcb) { return i; }
+    }
+    return -1;
+}
+
+static bool sched_cpu_valid(int cpu) {
+    return cpu >= 0 && cpu < nr_cpus && runqueues[cpu].active;
+}
+
+static int sched_idlest_cpu() {
+    int idlest = -1;
+    for (int i = 0; i < nr_cpus; ++i) {
+        if (!runqueues[i].active) { continue; }
+        if (idlest == -1
+            || runqueues[i].stat.nr_ready < runqueues[idlest].stat.nr_ready) {
+            idlest = i;
+        }
+    }
+    return idlest;
+}
+
+static bool sched_steal(int cpu) {
+    //! find the busiest cpu that has something to spare
+    int busiest = -1;
+    int nr_max  = 1;
+    for (int i = 0; i < nr_cpus; ++i) {
+        if (i == cpu || !runqueues[i].active) { continue; }
+        if (runqueues[i].stat.nr_ready > nr_max) {
+            busiest = i;
+            nr_max  = runqueues[i].stat.nr_ready;
+        }
+    }
+    if (busiest == -1) { return false; }
+
+    //! take half of its procs, the top levels first
+    runqueue_t *src      = &runqueues[busiest];
+    int         nr_steal = nr_max / 2;
+    int         nr_taken = 0;
+    for (int i = 0; i < NR_SCHED_LEVELS && nr_taken < nr_steal; ++i) {
+        pcb_t *pcb  = NULL;
+        pcb_t *next = NULL;
+        list_for_each_entry_safe(pcb, next, &src->queues[i], rq_node) {
+            if (nr_taken == nr_steal) { break; }
+            //! the running, the pinned procs and the tasks stay where they are
+            if (sched_running_cpu(pcb) != -1) { continue; }
+            if (pcb->cpu_affinity != SCHED_CPU_ANY) { continue; }
+            if (sched_is_task(pcb)) { continue; }
+            rq_migrate(pcb, cpu);
+            ++nr_taken;
+        }
+    }
+    if (nr_taken > 0) { ++runqueues[cpu].stat.nr_steals; }
+    return nr_taken > 0;
+}
+
+static void sched_move_level(pcb_t *pcb, int level) {
+    if (pcb->sched_level == level) { return; }
+    bool queued = pcb->stat == READY;
+    if (queued) { rq_del(pcb); }
+    pcb->sched_level = level;
+    if (queued) { rq_add(pcb); }
+}
+
+static void sched_boost() {
+    //! NOTE: lift all the procs periodically, otherwise cpu-bound procs at the
+    //! bottom may starve
+    for (int i = 0; i < nr_pcbs; ++i) {
+        process_t *proc = proc_table[i];
+        if (proc == NULL || proc->pcb.stat == IDLE) { continue; }
+        sched_move_level(&proc->pcb, 0);
+    }
+}
+
+void set_proc_stat(pcb_t *pcb, int stat) {
+    disable_int_begin();
+    int old_stat = pcb->stat;
+    if (old_stat == SLEEPING && stat != SLEEPING) {
+        wait_queue_detach(pcb);
+        ktimer_cancel(&pcb->sleep_timer);
+    }
+    if (old_stat == READY && stat != READY) {
+        rq_del(pcb);
+    } else if (old_stat != READY && stat == READY) {
+        if (old_stat == SLEEPING && pcb->sched_level > 0) {
+            --pcb->sched_level;
+        }
+        pcb->live_ticks = sched_quantum(pcb);
+        rq_add(pcb);
+    }
+    pcb->stat = stat;
+    //! NOTE: an idle pcb is dead, drop its pid and give the slot back
+    if (stat == IDLE) { pid_detach(pcb); }
+    disable_int_end();
+}
+
+void sched_tick() {
+    //! the cpu is idle
+    if (p_proc_current == NULL) { return; }
+    pcb_t *pcb = &p_proc_current->pcb;
+    if (pcb->stat != READY) { return; }
+    if (--pcb->live_ticks <= 0) {
+        if (pcb->sched_level + 1 < NR_SCHED_LEVELS) {
+            sched_move_level(pcb, pcb->sched_level + 1);
+        }
+        pcb->live_ticks = sched_quantum(pcb);
+    }
+    if (system_ticks - last_boost_ticks >= SCHED_BOOST_TICKS) {
+        sched_boost();
+        last_boost_ticks = system_ticks;
+    }
+}
+
 void switch_cr3() {
-    cr3_ready = p_proc_current->pcb.cr3;
+    cpu_t *cpu = this_cpu();
+    cr3_ready  = p_proc_current->pcb.cr3;
+    cpu->cr3   = cr3_ready;
+    //! NOTE: the kernel stack of a proc is the top of its pcb
+    cpu->tss.esp0 = (uint32_t)(p_proc_current + 1);
+    load_ldt_desc(&p_proc_current->pcb);
+}
+
+static void sched_drop_cr3(cpu_t *cpu) {
+    //! NOTE: the prev proc may exit and free its page table on another cpu once
+    //! the kernel lock is given out, so it never stays loaded
+    if (cpu->cr3 == idle_cr3) { return; }
+    cpu->cr3 = idle_cr3;
+    lcr3(idle_cr3);
+}
+
+static bool sched_others_idle(int cpu) {
+    for (int i = 0; i < nr_cpus; ++i) {
+        if (i == cpu || !runqueues[i].active) { continue; }
+        if (!runqueues[i].idle) { return false; }
+    }
+    return true;
+}
+
+static pcb_t *sched_pick(int cpu) {
+    //! NOTE: a proc may be migrated while running elsewhere, skip it
+    runqueue_t *rq     = &runqueues[cpu];
+    uint32_t    bitmap = rq->ready_bitmap;
+    while (bitmap != 0) {
+        int    level = __builtin_ctz(bitmap);
+        pcb_t *pcb   = NULL;
+        list_for_each_entry(pcb, &rq->queues[level], rq_node) {
+            if (sched_running_cpu(pcb) == -1) { return pcb; }
+        }
+        bitmap &= ~(1u << level);
+    }
+    return NULL;
+}
+
+static void sched_idle(int cpu) {
+    //! NOTE: the idle loop runs on the cpu stack with interrupts disabled, mark
+    //! it as in kernel so that irqs taken by the hlt return right here instead
+    //! of scheduling again
+    cpu_t      *self = &cpus[cpu];
+    runqueue_t *rq   = &runqueues[cpu];
+    ++self->reenter;
+    rq->idle = true;
+    sched_drop_cr3(self);
+    while (sched_pick(cpu) == NULL && !sched_steal(cpu)) {
+        //! NOTE: the periodic tick drives the timers of all the cpus, it may
+        //! only be stopped while nothing runs anywhere
+        bool tickless = cpu == CPU_BSP && sched_others_idle(cpu);
+        if (tickless) {
+            sysclk_enter_idle(timer_ticks_until_next(SCHED_MAX_IDLE_TICKS));
+        }
+        smp_unlock_kernel();
+        cpu_halt();
+        smp_lock_kernel();
+        if (tickless) { sysclk_leave_idle(); }
+        if (cpu == CPU_BSP) { timer_tick(); }
+    }
+    rq->idle = false;
+    --self->reenter;
 }
 
 void cherry_pick_next_ready_proc() {
-    //! NOTE: proc2pid does unexpected lock check, we do not need it here
-    int index = -1;
-    for (int i = 0; i < NR_PCBS; ++i) {
-        if (p_proc_current == proc_table[i]) { index = i; }
+    cpu_t      *self = this_cpu();
+    int         cpu  = self - cpus;
+    runqueue_t *rq   = &runqueues[cpu];
+    pcb_t      *prev = self->proc == NULL ? NULL : &self->proc->pcb;
+    //! NOTE: the context of the prev proc is saved and the cpu stack is in use
+    //! now, so the cpu runs nothing till the next one is picked
+    self->proc = NULL;
+    //! NOTE: a running proc stays in the run queue, rotate it to the tail of its
+    //! level so that procs of the same level take turns on every sched
+    if (prev != NULL && prev->stat == READY) {
+        list_move_tail(&prev->rq_node, &rq_of(prev)->queues[prev->sched_level]);
+    } else if (prev != NULL) {
+        wake_up_all(&off_cpu_wq);
     }
-    assert(index != -1);
+    //! NOTE: a proc waiting for the others, e.g. through `lock_or`, may sched
+    //! again and again on this cpu, let the waiting cpus in between
+    if (smp_kernel_contended()) {
+        sched_drop_cr3(self);
+        smp_kernel_relax();
+    }
+    pcb_t *next = sched_pick(cpu);
+    while (next == NULL) {
+        if (!sched_steal(cpu)) { sched_idle(cpu); }
+        next = sched_pick(cpu);
+    }
+    if (next != prev) { ++rq->stat.nr_switches; }
+    p_proc_next = (process_t *)next;
+}
+
+void sched_wait_off_cpu(pcb_t *pcb) {
+    assert(pcb->stat != READY);
+    assert(pcb != &p_proc_current->pcb);
     while (true) {
-        index           = (index + 1) % NR_PCBS;
-        process_t *proc = proc_table[index];
-        if (proc == NULL) { continue; }
-        if (proc->pcb.stat == READY && proc->pcb.live_ticks > 0) {
-            p_proc_next = proc;
-            break;
-        }
-        if (proc != p_proc_current) { continue; }
-        for (int i = 0; i < NR_PCBS; ++i) {
-            if (proc_table[i] == NULL) { continue; }
-            proc_table[i]->pcb.live_ticks = proc_table[i]->pcb.priority;
+        prepare_to_wait(&off_cpu_wq);
+        int cpu = sched_running_cpu(pcb);
+        if (cpu == -1) { break; }
+        smp_send_resched(cpu);
+        sched();
+    }
+    finish_wait(&off_cpu_wq);
+}
+
+void sched_start_ap() {
+    disable_int();
+    runqueues[smp_cpu_id()].active = true;
+    sched();
+    unreachable();
+}
+
+void sched_fork(pcb_t *child, pcb_t *parent) {
+    child->cpu_affinity = parent == NULL ? SCHED_CPU_ANY : parent->cpu_affinity;
+    if (child->cpu_affinity != SCHED_CPU_ANY) {
+        child->cpu = child->cpu_affinity;
+        return;
+    }
+    int cpu = parent == NULL ? smp_cpu_id() : parent->cpu;
+    if (parent == NULL || sched_is_task(child)) {
+        child->cpu = cpu;
+        return;
+    }
+    int idlest = sched_idlest_cpu();
+    if (runqueues[cpu].stat.nr_ready
+        > runqueues[idlest].stat.nr_ready + SCHED_IMBALANCE) {
+        cpu = idlest;
+    }
+    child->cpu = cpu;
+}
+
+int do_sched_setaffinity(int pid, int cpu) {
+    if (cpu != SCHED_CPU_ANY && !sched_cpu_valid(cpu)) { return -1; }
+    if (pid < 0) { return -1; }
+    int retval = -1;
+    disable_int_begin();
+    process_t *proc = pid2proc(pid);
+    if (proc != NULL && proc->pcb.stat != IDLE) {
+        proc->pcb.cpu_affinity = cpu;
+        if (cpu != SCHED_CPU_ANY) { rq_migrate(&proc->pcb, cpu); }
+        retval = 0;
+    }
+    disable_int_end();
+    return retval;
+}
+
+int do_sched_getstat(int cpu, sched_stat_t *stat) {
+    if (cpu < 0 || cpu >= nr_cpus || stat == NULL) { return -1; }
+    disable_int_begin();
+    *stat        = runqueues[cpu].stat;
+    stat->active = runqueues[cpu].active;
+    disable_int_end();
+    return 0;
+}
+
+void init_sched() {
+    for (int i = 0; i < NR_CPUS; ++i) {
+        runqueue_t *rq = &runqueues[i];
+        for (int j = 0; j < NR_SCHED_LEVELS; ++j) {
+            INIT_LIST_HEAD(&rq->queues[j]);
         }
+        rq->ready_bitmap = 0;
+        rq->active       = false;
+        rq->idle         = false;
+        memset(&rq->stat, 0, sizeof(sched_stat_t));
     }
+    //! NOTE: the idle page table maps nothing but the kernel space and the
+    //! devices touched by the irqs
+    bool ok = pg_create_and_init(&idle_cr3);
+    assert(ok);
+    graphics_map_lfb(idle_cr3);
+    lapic_map(idle_cr3);
+    init_wait_queue_head(&off_cpu_wq);
+    //! NOTE: the aps join once they take the kernel lock, see `smp_ap_main`
+    runqueues[smp_cpu_id()].active = true;
+    last_boost_ticks               = 0;
 }
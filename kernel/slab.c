@@ -0,0 +1,279 @@
+#include <unios/slab.h>
+#include <unios/memory.h>
+#include <unios/layout.h>
+#include <unios/schedule.h>
+#include <unios/sync.h>
+#include <unios/assert.h>
+#include <unios/tracing.h>
+#include <string.h>
+#include <math.h>
+#include <list.h>
+
+//! empty slabs kept by a cache before they are given back to kpage
+#define SLAB_MAX_FREE 1
+
+struct kmem_cache_s {
+    const char       *name;
+    size_t            slot_size;     //<! object size plus optional free link
+    size_t            link_offset;   //<! where the free link is in a slot
+    int               slab_order;    //<! each slab takes 2^order pages
+    size_t            objs_per_slab; //<! object slots in a single slab
+    size_t            first_offset;  //<! offset of the first slot in a slab
+    size_t            nr_free_slabs; //<! length of `slabs_free`
+    fn_ctor_t         ctor;
+    spinlock_t        lock;
+    struct list_head  slabs_full;
+    struct list_head  slabs_partial;
+    struct list_head  slabs_free;
+    struct list_head  node; //<! link in `cache_list`
+    kmem_cache_stat_t stat;
+};
+
+//! NOTE: a slab header always lives at the start of the slab, and since the
+//! slab is naturally aligned to its size by the buddy allocator, the owning
+//! slab of an object can be found by simply rounding down its address
+typedef struct slab_s {
+    kmem_cache_t    *cache;
+    struct list_head node;
+    void            *free_list;
+    size_t           nr_active;
+} slab_t;
+
+static kmem_cache_t     cache_cache;
+static struct list_head cache_list;
+static spinlock_t       cache_list_lock;
+
+static void **slab_link(kmem_cache_t *cache, void *obj) {
+    return (void **)(obj + cache->link_offset);
+}
+
+static slab_t *slab_of(kmem_cache_t *cache, void *obj) {
+    return (slab_t *)round_down(obj, cache->stat.slab_size);
+}
+
+static bool kmem_cache_setup(
+    kmem_cache_t *cache,
+    const char   *name,
+    size_t        size,
+    size_t        align,
+    fn_ctor_t     ctor) {
+    if (size == 0) { return false; }
+    if (align == 0) { align = sizeof(void *); }
+    if ((align & (align - 1)) != 0) { return false; }
+
+    size_t obj_size = round_up(max(size, sizeof(void *)), align);
+
+    //! NOTE: a constructed object should keep its state while it is free, so
+    //! the free link is placed right after the object if ctor is provided
+    size_t link_offset  = 0;
+    size_t slot_size    = obj_size;
+    size_t first_offset = round_up(sizeof(slab_t), align);
+    if (ctor != NULL) {
+        link_offset = obj_size;
+        slot_size   = round_up(obj_size + sizeof(void *), align);
+    }
+
+    //! take the smallest order that wastes no more than 1/8 of the slab
+    int order = 0;
+    for (; order < SLAB_MAX_ORDER; ++order) {
+        size_t slab_size = NUM_4K << order;
+        if (first_offset + slot_size > slab_size) { continue; }
+        size_t waste = (slab_size - first_offset) % slot_size + first_offset;
+        if (waste * 8 <= slab_size) { break; }
+    }
+    size_t slab_size = NUM_4K << order;
+    if (first_offset + slot_size > slab_size) { return false; }
+
+    memset(cache, 0, sizeof(kmem_cache_t));
+    cache->name           = name;
+    cache->slot_size      = slot_size;
+    cache->link_offset    = link_offset;
+    cache->slab_order     = order;
+    cache->objs_per_slab  = (slab_size - first_offset) / slot_size;
+    cache->first_offset   = first_offset;
+    cache->ctor           = ctor;
+    cache->stat.obj_size  = obj_size;
+    cache->stat.slab_size = slab_size;
+    INIT_LIST_HEAD(&cache->slabs_full);
+    INIT_LIST_HEAD(&cache->slabs_partial);
+    INIT_LIST_HEAD(&cache->slabs_free);
+    INIT_LIST_HEAD(&cache->node);
+    return true;
+}
+
+static slab_t *slab_create(kmem_cache_t *cache) {
+    phyaddr_t phyaddr = kmalloc_phypages(cache->slab_order);
+    if (phyaddr == 0) { return NULL; }
+
+    for (int i = 0; i < (1 << cache->slab_order); ++i) {
+        set_phypage_type(phyaddr + i * NUM_4K, PHYPAGE_SLAB);
+    }
+
+    slab_t *slab    = K_PHY2LIN(phyaddr);
+    slab->cache     = cache;
+    slab->nr_active = 0;
+    INIT_LIST_HEAD(&slab->node);
+
+    //! build the free list in address order
+    void  *obj  = (void *)slab + cache->first_offset;
+    void **tail = &slab->free_list;
+    for (int i = 0; i < cache->objs_per_slab; ++i) {
+        if (cache->ctor != NULL) { cache->ctor(obj); }
+        *tail  = obj;
+        tail   = slab_link(cache, obj);
+        obj   += cache->slot_size;
+    }
+    *tail = NULL;
+
+    ++cache->stat.nr_slabs;
+    cache->stat.nr_objs += cache->objs_per_slab;
+    return slab;
+}
+
+static void slab_destroy(kmem_cache_t *cache, slab_t *slab) {
+    assert(slab->nr_active == 0);
+    --cache->stat.nr_slabs;
+    cache->stat.nr_objs -= cache->objs_per_slab;
+    free_phypages(K_LIN2PHY(slab), cache->slab_order);
+}
+
+kmem_cache_t *kmem_cache_create(
+    const char *name, size_t size, size_t align, fn_ctor_t ctor) {
+    kmem_cache_t *cache = kmem_cache_alloc(&cache_cache);
+    if (cache == NULL) { return NULL; }
+    if (!kmem_cache_setup(cache, name, size, align, ctor)) {
+        kmem_cache_free(&cache_cache, cache);
+        return NULL;
+    }
+    lock_or(&cache_list_lock, sched);
+    list_add_tail(&cache->node, &cache_list);
+    release(&cache_list_lock);
+    return cache;
+}
+
+void kmem_cache_destroy(kmem_cache_t *cache) {
+    assert(cache != NULL && cache != &cache_cache);
+
+    lock_or(&cache_list_lock, sched);
+    list_del(&cache->node);
+    release(&cache_list_lock);
+
+    lock_or(&cache->lock, sched);
+    //! NOTE: objects still in use would be left dangling
+    assert(cache->stat.nr_active == 0);
+    assert(list_empty(&cache->slabs_full));
+    assert(list_empty(&cache->slabs_partial));
+    slab_t *slab = NULL;
+    slab_t *next = NULL;
+    list_for_each_entry_safe(slab, next, &cache->slabs_free, node) {
+        list_del(&slab->node);
+        slab_destroy(cache, slab);
+    }
+    release(&cache->lock);
+
+    kmem_cache_free(&cache_cache, cache);
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache) {
+    assert(cache != NULL);
+    lock_or(&cache->lock, sched);
+
+    slab_t *slab = NULL;
+    if (!list_empty(&cache->slabs_partial)) {
+        slab = list_first_entry(&cache->slabs_partial, slab_t, node);
+    } else if (!list_empty(&cache->slabs_free)) {
+        slab = list_first_entry(&cache->slabs_free, slab_t, node);
+        list_move(&slab->node, &cache->slabs_partial);
+        --cache->nr_free_slabs;
+    } else {
+        slab = slab_create(cache);
+        if (slab == NULL) {
+            release(&cache->lock);
+            return NULL;
+        }
+        list_add(&slab->node, &cache->slabs_partial);
+    }
+
+    void *obj       = slab->free_list;
+    slab->free_list = *slab_link(cache, obj);
+    ++slab->nr_active;
+    if (slab->nr_active == cache->objs_per_slab) {
+        list_move(&slab->node, &cache->slabs_full);
+    }
+
+    ++cache->stat.nr_active;
+    ++cache->stat.nr_allocs;
+    release(&cache->lock);
+
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *obj) {
+    if (obj == NULL) { return; }
+    assert(cache != NULL);
+
+    slab_t *slab = slab_of(cache, obj);
+    assert(slab->cache == cache);
+    assert((obj - (void *)slab - cache->first_offset) % cache->slot_size == 0);
+
+    lock_or(&cache->lock, sched);
+    assert(slab->nr_active > 0);
+
+    bool was_full          = slab->nr_active == cache->objs_per_slab;
+    *slab_link(cache, obj) = slab->free_list;
+    slab->free_list        = obj;
+    --slab->nr_active;
+
+    if (slab->nr_active == 0) {
+        list_del(&slab->node);
+        if (cache->nr_free_slabs < SLAB_MAX_FREE) {
+            list_add(&slab->node, &cache->slabs_free);
+            ++cache->nr_free_slabs;
+        } else {
+            slab_destroy(cache, slab);
+        }
+    } else if (was_full) {
+        list_move(&slab->node, &cache->slabs_partial);
+    }
+
+    --cache->stat.nr_active;
+    ++cache->stat.nr_frees;
+    release(&cache->lock);
+}
+
+bool kmem_cache_get_stat(kmem_cache_t *cache, kmem_cache_stat_t *stat) {
+    if (cache == NULL || stat == NULL) { return false; }
+    lock_or(&cache->lock, sched);
+    *stat = cache->stat;
+    release(&cache->lock);
+    return true;
+}
+
+void kmem_cache_report() {
+    lock_or(&cache_list_lock, sched);
+    kmem_cache_t *cache = NULL;
+    list_for_each_entry(cache, &cache_list, node) {
+        kmem_cache_stat_t stat;
+        kmem_cache_get_stat(cache, &stat);
+        kinfo(
+            "slab %s: obj %d bytes, %d/%d active, %d slabs of %d KB, %d "
+            "allocs, %d frees",
+            cache->name,
+            stat.obj_size,
+            stat.nr_active,
+            stat.nr_objs,
+            stat.nr_slabs,
+            stat.slab_size / NUM_1K,
+            stat.nr_allocs,
+            stat.nr_frees);
+    }
+    release(&cache_list_lock);
+}
+
+void init_slab() {
+    INIT_LIST_HEAD(&cache_list);
+    bool ok = kmem_cache_setup(
+        &cache_cache, "kmem_cache", sizeof(kmem_cache_t), 0, NULL);
+    assert(ok);
+    list_add_tail(&cache_cache.node, &cache_list);
+}
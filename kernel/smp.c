@@ -0,0 +1,396 @@
+#include <unios/smp.h>
+#include <unios/apic.h>
+#include <unios/clock.h>
+#include <unios/memory.h>
+#include <unios/page.h>
+#include <unios/layout.h>
+#include <unios/protect.h>
+#include <unios/interrupt.h>
+#include <unios/schedule.h>
+#include <unios/assert.h>
+#include <unios/tracing.h>
+#include <arch/x86.h>
+#include <sys/defs.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic.h>
+
+//! NOTE: ref Intel MultiProcessor Specification v1.4 Chapter 4
+
+//! floating pointer structure, 16-byte aligned
+typedef struct mp_fptr_s {
+    char     signature[4]; //<! "_MP_"
+    uint32_t config;       //<! phy addr of the config table
+    uint8_t  length;       //<! in 16 bytes
+    uint8_t  revision;
+    uint8_t  checksum;
+    uint8_t  type;         //<! default config type, 0 if config is present
+    uint8_t  features[4];
+} __attribute__((packed)) mp_fptr_t;
+
+//! config table header
+typedef struct mp_conf_s {
+    char     signature[4]; //<! "PCMP"
+    uint16_t length;       //<! base table length, including the header
+    uint8_t  revision;
+    uint8_t  checksum;
+    char     oem_id[8];
+    char     product_id[12];
+    uint32_t oem_table;
+    uint16_t oem_length;
+    uint16_t nr_entries;
+    uint32_t lapic_addr; //<! phy addr of the local apic
+    uint16_t ext_length;
+    uint8_t  ext_checksum;
+    uint8_t  reserved;
+} __attribute__((packed)) mp_conf_t;
+
+typedef struct mp_proc_s {
+    uint8_t  type; //<! MP_PROC
+    uint8_t  apic_id;
+    uint8_t  apic_version;
+    uint8_t  flags; //<! MP_PROC_*
+    uint32_t signature;
+    uint32_t features;
+    uint32_t reserved[2];
+} __attribute__((packed)) mp_proc_t;
+
+typedef struct mp_ioapic_s {
+    uint8_t  type; //<! MP_IOAPIC
+    uint8_t  apic_id;
+    uint8_t  version;
+    uint8_t  flags;
+    uint32_t addr; //<! phy addr of the io apic
+} __attribute__((packed)) mp_ioapic_t;
+
+enum {
+    MP_PROC   = 0,
+    MP_BUS    = 1,
+    MP_IOAPIC = 2,
+    MP_IOINTR = 3,
+    MP_LINTR  = 4,
+};
+
+#define MP_PROC_ENABLED 0x01
+#define MP_PROC_BSP     0x02
+#define MP_ENTRY_SIZE   8 //<! size of all the entries but MP_PROC
+
+#define BDA_EBDA_SEG 0x40e //<! segment of the ebda
+#define BDA_BASE_MEM 0x413 //<! size of the base memory in KB
+#define BIOS_ROM_PHY 0xf0000
+
+extern char     ap_trampoline_start[];
+extern char     ap_trampoline_end[];
+extern uint32_t ap_boot_cr3;
+extern uint32_t ap_boot_stack;
+
+cpu_t cpus[NR_CPUS];
+int   nr_cpus;
+
+//! NOTE: the bsp runs the kernel from the very beginning, so it owns the lock
+volatile uint32_t   smp_kernel_lock    = 1;
+static volatile int smp_kernel_waiters = 0;
+
+static phyaddr_t lapic_phy  = 0;
+static phyaddr_t ioapic_phy = 0;
+
+static bool mp_checksum(void *addr, size_t len) {
+    uint8_t sum = 0;
+    for (int i = 0; i < len; ++i) { sum += ((uint8_t *)addr)[i]; }
+    return sum == 0;
+}
+
+static mp_fptr_t *mp_search(phyaddr_t base, size_t len) {
+    void *addr  = K_PHY2LIN(base);
+    void *limit = addr + len;
+    for (; addr + sizeof(mp_fptr_t) <= limit; addr += 16) {
+        mp_fptr_t *fptr = addr;
+        if (memcmp(fptr->signature, "_MP_", 4) != 0) { continue; }
+        if (!mp_checksum(fptr, fptr->length * 16)) { continue; }
+        return fptr;
+    }
+    return NULL;
+}
+
+static mp_fptr_t *mp_find() {
+    mp_fptr_t *fptr = NULL;
+    //! 1. the first 1 KB of the ebda
+    uint16_t ebda_seg = *(uint16_t *)K_PHY2LIN(BDA_EBDA_SEG);
+    if (ebda_seg != 0) { fptr = mp_search((phyaddr_t)ebda_seg << 4, NUM_1K); }
+    //! 2. the last 1 KB of the base memory
+    if (fptr == NULL) {
+        uint16_t base_kb = *(uint16_t *)K_PHY2LIN(BDA_BASE_MEM);
+        fptr             = mp_search((base_kb - 1) * NUM_1K, NUM_1K);
+    }
+    //! 3. the bios rom
+    if (fptr == NULL) { fptr = mp_search(BIOS_ROM_PHY, 0x10000); }
+    return fptr;
+}
+
+static mp_conf_t *mp_config(mp_fptr_t *fptr) {
+    //! NOTE: default configs have no table and are too old to care about
+    if (fptr->config == 0 || fptr->type != 0) { return NULL; }
+
+    //! NOTE: the table is accessed through the kernel space mapping, that
+    //! covers the low memory where bioses put it
+    phyaddr_t phy_limit = 0;
+    get_phymem_bound(KernelSpace, NULL, &phy_limit);
+    if (fptr->config + sizeof(mp_conf_t) > phy_limit) { return NULL; }
+
+    mp_conf_t *conf = K_PHY2LIN(fptr->config);
+    if (memcmp(conf->signature, "PCMP", 4) != 0) { return NULL; }
+    if (fptr->config + conf->length > phy_limit) { return NULL; }
+    if (!mp_checksum(conf, conf->length)) { return NULL; }
+    return conf;
+}
+
+static bool mp_parse() {
+    mp_fptr_t *fptr = mp_find();
+    if (fptr == NULL) { return false; }
+    mp_conf_t *conf = mp_config(fptr);
+    if (conf == NULL) { return false; }
+
+    lapic_phy   = conf->lapic_addr;
+    void *entry = conf + 1;
+    void *limit = (void *)conf + conf->length;
+    while (entry < limit) {
+        switch (*(uint8_t *)entry) {
+            case MP_PROC: {
+                mp_proc_t *proc  = entry;
+                entry           += sizeof(mp_proc_t);
+                if ((proc->flags & MP_PROC_ENABLED) == 0) { break; }
+                if (nr_cpus == NR_CPUS) {
+                    kwarn("smp: cpu %d is ignored", proc->apic_id);
+                    break;
+                }
+                cpus[nr_cpus++].apic_id = proc->apic_id;
+            } break;
+            case MP_IOAPIC: {
+                mp_ioapic_t *ioapic = entry;
+                //! NOTE: only the first io apic is recorded
+                if (ioapic_phy == 0) { ioapic_phy = ioapic->addr; }
+                entry += MP_ENTRY_SIZE;
+            } break;
+            case MP_BUS:
+            case MP_IOINTR:
+            case MP_LINTR: {
+                entry += MP_ENTRY_SIZE;
+            } break;
+            default: {
+                kwarn("smp: unknown mp entry %d", *(uint8_t *)entry);
+                return nr_cpus > 0;
+            } break;
+        }
+    }
+    return nr_cpus > 0;
+}
+
+static uint32_t *ap_trampoline_var(uint32_t *var) {
+    //! NOTE: the trampoline runs from its copy, so are the vars of it
+    size_t offset = (void *)var - (void *)ap_trampoline_start;
+    return K_PHY2LIN(AP_TRAMPOLINE_BASE + offset);
+}
+
+static bool smp_prepare_ap_boot() {
+    //! NOTE: the ap enables paging in the identity mapped trampoline before it
+    //! jumps to the kernel, so a dedicated page table that maps the low 4 MB
+    //! both as it is and as the kernel space is made for the boot path
+    uint32_t cr3 = 0;
+    if (!pg_create_and_init(&cr3)) { return false; }
+    *pg_pde_ptr(cr3, 0) = pg_pde(cr3, KernelLinBase);
+    lapic_map(cr3);
+
+    size_t size = ap_trampoline_end - ap_trampoline_start;
+    memcpy(K_PHY2LIN(AP_TRAMPOLINE_BASE), ap_trampoline_start, size);
+    *ap_trampoline_var(&ap_boot_cr3) = cr3;
+    return true;
+}
+
+static int smp_tss_index(cpu_t *cpu) {
+    int id = cpu - cpus;
+    return id == CPU_BSP ? INDEX_TSS : INDEX_TSS_AP_FIRST + id - 1;
+}
+
+static cpu_t *smp_find_cpu(uint8_t apic_id) {
+    for (int i = 0; i < nr_cpus; ++i) {
+        if (cpus[i].apic_id == apic_id) { return &cpus[i]; }
+    }
+    return NULL;
+}
+
+static bool smp_alloc_stack(cpu_t *cpu) {
+    void *stack = kmalloc(CPU_STACK_SIZE);
+    if (stack == NULL) { return false; }
+    cpu->stack     = stack;
+    cpu->stack_top = stack + CPU_STACK_SIZE;
+    return true;
+}
+
+static bool smp_boot_ap(cpu_t *cpu) {
+    if (!smp_alloc_stack(cpu)) { return false; }
+    init_tss(&cpu->tss, smp_tss_index(cpu));
+    *ap_trampoline_var(&ap_boot_stack) = (uint32_t)cpu->stack_top;
+
+    lapic_start_ap(cpu->apic_id, AP_TRAMPOLINE_BASE);
+    //! wait for at most 100 ms
+    for (int i = 0; i < 100 && !cpu->online; ++i) { sysclk_delay_us(1000); }
+    return cpu->online;
+}
+
+cpu_t *this_cpu() {
+    uint16_t selector = rtr();
+    if (selector == 0 || selector == SELECTOR_TSS) { return &cpus[CPU_BSP]; }
+    return &cpus[(selector >> 3) - INDEX_TSS_AP_FIRST + 1];
+}
+
+int smp_cpu_id() {
+    return this_cpu() - cpus;
+}
+
+int smp_nr_online() {
+    int total = 0;
+    for (int i = 0; i < nr_cpus; ++i) {
+        if (cpus[i].online) { ++total; }
+    }
+    return total;
+}
+
+static void smp_tlb_flush_local(cpu_t *cpu) {
+    if (!cpu->tlb_flush) { return; }
+    tlbflush();
+    cpu->tlb_flush = false;
+}
+
+void smp_lock_kernel() {
+    cpu_t *cpu = this_cpu();
+    if (xchg(&smp_kernel_lock, 1) == 0) { return; }
+    fetch_add((void *)&smp_kernel_waiters, 1);
+    do {
+        //! NOTE: the lock holder may wait for the tlb of this cpu flushed, see
+        //! `smp_tlb_shootdown`, and this cpu never takes the ipi while waiting
+        while (smp_kernel_lock != 0) {
+            smp_tlb_flush_local(cpu);
+            cpu_relax();
+        }
+    } while (xchg(&smp_kernel_lock, 1) != 0);
+    fetch_sub((void *)&smp_kernel_waiters, 1);
+}
+
+void smp_unlock_kernel() {
+    xchg(&smp_kernel_lock, 0);
+}
+
+bool smp_kernel_contended() {
+    return smp_kernel_waiters > 0;
+}
+
+void smp_kernel_relax() {
+    if (!smp_kernel_contended()) { return; }
+    disable_int_begin();
+    smp_unlock_kernel();
+    //! NOTE: wait till one of the waiters takes the lock, or this cpu may
+    //! simply take it back
+    while (smp_kernel_lock == 0 && smp_kernel_contended()) { cpu_relax(); }
+    smp_lock_kernel();
+    disable_int_end();
+}
+
+void smp_tlb_shootdown(uint32_t cr3) {
+    if (nr_cpus <= 1) { return; }
+    cpu_t *self = this_cpu();
+    cr3         = pg_frame_phyaddr(cr3);
+    for (int i = 0; i < nr_cpus; ++i) {
+        cpu_t *cpu = &cpus[i];
+        if (cpu == self || !cpu->online) { continue; }
+        if (pg_frame_phyaddr(cpu->cr3) != cr3) { continue; }
+        cpu->tlb_flush = true;
+        lapic_send_ipi(cpu->apic_id, INT_VECTOR_TLB_FLUSH);
+    }
+    for (int i = 0; i < nr_cpus; ++i) {
+        while (cpus[i].tlb_flush) { cpu_relax(); }
+    }
+}
+
+void smp_send_resched(int cpu) {
+    lapic_send_ipi(cpus[cpu].apic_id, INT_VECTOR_RESCHED);
+}
+
+void smp_local_timer_handler() {
+    lapic_eoi();
+    sched_tick();
+}
+
+void smp_resched_handler() {
+    //! NOTE: the cpu schedules again on the way out, see `restart_int`
+    lapic_eoi();
+}
+
+void smp_tlb_flush_handler() {
+    //! NOTE: the flag may have been served while waiting for the kernel lock,
+    //! and the ipi taken later is then for nothing
+    smp_tlb_flush_local(this_cpu());
+    lapic_eoi();
+}
+
+void smp_ap_main() {
+    lapic_init();
+    cpu_t *cpu = smp_find_cpu(lapic_id());
+    if (cpu == NULL) { return; }
+    ltr(smp_tss_index(cpu) << 3);
+    cpu->online = true;
+    //! NOTE: the bsp holds the kernel lock through the whole init, so the ap
+    //! joins the scheduler once the first proc runs in the user space
+    smp_lock_kernel();
+    lapic_start_timer(INT_VECTOR_LOCAL_TIMER, SYSCLK_FREQ_HZ);
+    sched_start_ap();
+}
+
+void init_smp() {
+    //! NOTE: the tss of the bsp is in use, see `init_protect_mode`, so only
+    //! the discovered cpus are reset here
+    nr_cpus    = 0;
+    lapic_phy  = 0;
+    ioapic_phy = 0;
+
+    if (!mp_parse()) {
+        nr_cpus = 0;
+        kinfo("smp: no mp table, run as uniprocessor");
+    } else {
+        lapic_setup(lapic_phy);
+    }
+
+    //! NOTE: the bsp always takes the slot CPU_BSP, see `this_cpu`
+    cpu_t *bsp = smp_find_cpu(lapic_id());
+    if (bsp == NULL) {
+        //! NOTE: the bsp itself is always there even if the tables lie
+        nr_cpus               = 1;
+        cpus[CPU_BSP].apic_id = lapic_id();
+    } else if (bsp != &cpus[CPU_BSP]) {
+        bsp->apic_id          = cpus[CPU_BSP].apic_id;
+        cpus[CPU_BSP].apic_id = lapic_id();
+    }
+    bsp         = &cpus[CPU_BSP];
+    bsp->online = true;
+    bool ok     = smp_alloc_stack(bsp);
+    assert(ok);
+    if (nr_cpus == 1) { return; }
+
+    if (!smp_prepare_ap_boot()) {
+        kwarn("smp: low memory, aps are not started");
+        return;
+    }
+    lapic_enable_bsp();
+    lapic_calibrate_timer();
+    for (int i = 0; i < nr_cpus; ++i) {
+        cpu_t *cpu = &cpus[i];
+        if (cpu == bsp) { continue; }
+        if (!smp_boot_ap(cpu)) { kwarn("smp: cpu %d is down", cpu->apic_id); }
+    }
+
+    kinfo(
+        "smp: %d/%d cpus online, lapic at 0x%x, ioapic at 0x%x",
+        smp_nr_online(),
+        nr_cpus,
+        lapic_phy,
+        ioapic_phy);
+}
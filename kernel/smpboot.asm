@@ -0,0 +1,91 @@
+; AP Startup
+;
+; the sipi starts an ap in real mode at AP_TRAMPOLINE_BASE, where init_smp
+; copies the code between ap_trampoline_start and ap_trampoline_end, so the
+; trampoline must address itself through AP_REL only, and the vars inside it
+; are patched in the copy rather than here
+;
+; 1. switch to protect mode with a temporary flat gdt
+; 2. enable paging with ap_boot_cr3, which maps the low memory both as it is
+;    and as the kernel space
+; 3. jump to the kernel space and load the gdt & idt of the kernel
+
+%include "sconst.inc"
+
+extern gdt_ptr
+extern idt_ptr
+extern smp_ap_main
+
+; NOTE: keep in sync with AP_TRAMPOLINE_BASE in unios/smp.h
+AP_TRAMPOLINE_BASE equ 0x7000
+
+%define AP_REL(x) (AP_TRAMPOLINE_BASE + (x) - ap_trampoline_start)
+
+[section .text]
+
+[bits 16]
+    global ap_trampoline_start
+ap_trampoline_start:
+    cli
+    xor     ax, ax
+    mov     ds, ax
+    o32 lgdt [AP_REL(ap_boot_gdt_ptr)]
+    mov     eax, cr0
+    or      eax, 1
+    mov     cr0, eax
+    jmp     dword SELECTOR_KERNEL_CS:AP_REL(ap_protect_mode)
+
+[bits 32]
+ap_protect_mode:
+    mov     ax, SELECTOR_KERNEL_DS
+    mov     ds, ax
+    mov     es, ax
+    mov     fs, ax
+    mov     ss, ax
+    mov     eax, [AP_REL(ap_boot_cr3)]
+    mov     cr3, eax
+    mov     eax, cr0
+    or      eax, 0x80000000
+    mov     cr0, eax
+    mov     esp, [AP_REL(ap_boot_stack)]
+    mov     eax, ap_kernel_entry
+    jmp     eax
+
+    align 8
+ap_boot_gdt:
+    dq      0x0000000000000000
+    dq      0x00cf9a000000ffff  ; flat code, the same selector as the kernel
+    dq      0x00cf92000000ffff  ; flat data, the same selector as the kernel
+ap_boot_gdt_ptr:
+    dw      3 * 8 - 1
+    dd      AP_REL(ap_boot_gdt)
+
+    global ap_boot_cr3
+ap_boot_cr3:
+    dd      0
+    global ap_boot_stack
+ap_boot_stack:
+    dd      0
+
+    global ap_trampoline_end
+ap_trampoline_end:
+
+ap_kernel_entry:
+    lgdt    [gdt_ptr]
+    lidt    [idt_ptr]
+    jmp     SELECTOR_KERNEL_CS:.reload
+.reload:
+    mov     ax, SELECTOR_KERNEL_DS
+    mov     ds, ax
+    mov     es, ax
+    mov     fs, ax
+    mov     ss, ax
+    mov     ax, SELECTOR_VIDEO - 2
+    mov     gs, ax
+    ; NOTE: smp_ap_main loads the tss of the cpu and never returns but for an
+    ; unknown cpu
+    call    smp_ap_main
+.park:
+    cli
+    hlt
+    jmp     .park
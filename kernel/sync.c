@@ -2,6 +2,8 @@
 #include <unios/memory.h>
 #include <unios/schedule.h>
 #include <unios/assert.h>
+#include <unios/waitqueue.h>
+#include <unios/smp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <atomic.h>
@@ -11,22 +13,24 @@
 
 enum krnl_obj_status {
     FLAG_USED = 0x80000000,
-    FLAG_LOCK = 0x40000000,
     FLAG_BUSY = 0x20000000,
 };
 
 typedef struct krnl_obj_s {
-    uint32_t id;
-    int      user_id;
-    int      status;
-    void    *func;
+    uint32_t          id;
+    int               user_id;
+    int               status;
+    void             *func;
+    int               locked;
+    wait_queue_head_t wait; //<! procs waiting for the lock
 } krnl_obj_t;
 
-//! NOTE: only support spin lock currently
+//! NOTE: only support sleeping lock currently
 static krnl_obj_t krnl_obj_table[NR_KRNL_OBJS];
 
 static handle_t krnlobj_lookup(int user_id) {
     for (int i = 0; i < NR_KRNL_OBJS; ++i) {
+        if ((krnl_obj_table[i].status & FLAG_USED) == 0) { continue; }
         if (krnl_obj_table[i].user_id == user_id) {
             return (handle_t)krnl_obj_table[i].id;
         }
@@ -50,6 +54,8 @@ static handle_t krnlobj_create(int user_id) {
     krnl_obj_table[index].id      = index;
     krnl_obj_table[index].func    = kmalloc(sizeof(uint32_t));
     krnl_obj_table[index].user_id = user_id;
+    krnl_obj_table[index].locked  = 0;
+    init_wait_queue_head(&krnl_obj_table[index].wait);
     return (handle_t)krnl_obj_table[index].id;
 }
 
@@ -65,49 +71,38 @@ static void krnlobj_destroy(handle_t handle) {
         if (old == FLAG_USED) { break; }
     }
 
+    //! NOTE: waiters find the object gone once they are up
+    wake_up_all(&krnl_obj_table[id].wait);
     kfree(krnl_obj_table[id].func);
     krnl_obj_table[id].user_id = 0;
     old = compare_exchange_strong(&krnl_obj_table[id].status, FLAG_BUSY, 0);
     assert(old == FLAG_BUSY);
 }
 
-static void krnlobj_lock(int user_id) {
+static krnl_obj_t *krnlobj_find(int user_id) {
     uint32_t id = (uint32_t)krnlobj_lookup(user_id);
-    assert(id >= 0 && id < NR_KRNL_OBJS);
+    return id < NR_KRNL_OBJS ? &krnl_obj_table[id] : NULL;
+}
 
-    int old = 0;
+static void krnlobj_lock(int user_id) {
+    //! NOTE: lock on an absent object is a no-op, so that the users need no
+    //! extra lookup request before every lock & unlock
+    krnl_obj_t *obj = krnlobj_find(user_id);
+    if (obj == NULL) { return; }
     while (true) {
-        old = compare_exchange_strong(
-            &krnl_obj_table[id].status, FLAG_USED, FLAG_USED | FLAG_BUSY);
-        assert(old & FLAG_USED);
-        if (old == FLAG_USED) { break; }
-    }
-
-    while (compare_exchange_strong(
-               &krnl_obj_table[id].status,
-               FLAG_USED | FLAG_BUSY,
-               FLAG_USED | FLAG_BUSY | FLAG_LOCK)
-           != (FLAG_USED | FLAG_BUSY)) {
+        prepare_to_wait(&obj->wait);
+        if (try_lock(&obj->locked)) { break; }
+        if ((obj->status & FLAG_USED) == 0) { break; }
         sched();
     }
+    finish_wait(&obj->wait);
 }
 
 static void krnlobj_unlock(int user_id) {
-    uint32_t id = (uint32_t)krnlobj_lookup(user_id);
-    assert(id >= 0 && id < NR_KRNL_OBJS);
-    int old = 0;
-    while (true) {
-        old = compare_exchange_strong(
-            &krnl_obj_table[id].status,
-            FLAG_USED | FLAG_BUSY | FLAG_LOCK,
-            FLAG_USED);
-        assert(old & FLAG_USED);
-        if (old != (FLAG_USED | FLAG_BUSY | FLAG_LOCK)) {
-            sched();
-        } else {
-            break;
-        }
-    }
+    krnl_obj_t *obj = krnlobj_find(user_id);
+    if (obj == NULL) { return; }
+    release(&obj->locked);
+    wake_up_one(&obj->wait);
 }
 
 int do_krnlobj_request(int req, void *arg) {
@@ -138,12 +133,13 @@ int do_krnlobj_request(int req, void *arg) {
 
 void rwlock_wait_rd(rwlock_t *lock) {
     assert(lock != NULL);
-    while (!rwlock_try_lock_rd(lock)) {}
+    //! NOTE: the holder may be another cpu waiting for the kernel lock
+    while (!rwlock_try_lock_rd(lock)) { smp_kernel_relax(); }
 }
 
 void rwlock_wait_wr(rwlock_t *lock) {
     assert(lock != NULL);
-    while (!rwlock_try_lock_wr(lock)) {}
+    while (!rwlock_try_lock_wr(lock)) { smp_kernel_relax(); }
 }
 
 void rwlock_wait_rd_or(rwlock_t *lock, void (*callback)()) {
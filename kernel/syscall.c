@@ -76,6 +76,42 @@ static uint32_t sys_wait() {
     return do_wait(SYSCALL_ARGS1(int *));
 }
 
+static uint32_t sys_thread_create() {
+    return do_thread_create(SYSCALL_ARGS3(void *, void *, void *));
+}
+
+static uint32_t sys_thread_join() {
+    return do_thread_join(SYSCALL_ARGS2(int, int *));
+}
+
+static uint32_t sys_sched_setaffinity() {
+    return do_sched_setaffinity(SYSCALL_ARGS2(int, int));
+}
+
+static uint32_t sys_sched_getstat() {
+    return do_sched_getstat(SYSCALL_ARGS2(int, sched_stat_t *));
+}
+
+static uint32_t sys_futex() {
+    return do_futex(SYSCALL_ARGS3(int *, int, int));
+}
+
+static uint32_t sys_sync() {
+    return do_sync();
+}
+
+static uint32_t sys_bcache_getstat() {
+    return do_bcache_getstat(SYSCALL_ARGS1(bcache_stat_t *));
+}
+
+static uint32_t sys_aio_submit() {
+    return do_aio_submit(SYSCALL_ARGS5(int, int, void *, int, int));
+}
+
+static uint32_t sys_aio_wait() {
+    return do_aio_wait(SYSCALL_ARGS1(int));
+}
+
 static uint32_t sys_get_pid() {
     return do_get_pid();
 }
@@ -103,6 +139,10 @@ static uint32_t sys_free(void *ptr) {
     return 0;
 }
 
+static uint32_t sys_sbrk() {
+    return (uint32_t)do_sbrk(SYSCALL_ARGS1(int));
+}
+
 static uint32_t sys_open() {
     return do_open(SYSCALL_ARGS2(const char *, int));
 }
@@ -181,4 +221,14 @@ syscall_t syscall_table[NR_SYSCALLS] = {
     SYSCALL_ENTRY(killerabbit),
     SYSCALL_ENTRY(environ),
     SYSCALL_ENTRY(krnlobj_request),
+    SYSCALL_ENTRY(sbrk),
+    SYSCALL_ENTRY(thread_create),
+    SYSCALL_ENTRY(thread_join),
+    SYSCALL_ENTRY(sched_setaffinity),
+    SYSCALL_ENTRY(sched_getstat),
+    SYSCALL_ENTRY(futex),
+    SYSCALL_ENTRY(sync),
+    SYSCALL_ENTRY(bcache_getstat),
+    SYSCALL_ENTRY(aio_submit),
+    SYSCALL_ENTRY(aio_wait),
 };
@@ -0,0 +1,175 @@
+#include <unios/syscall.h>
+#include <unios/proc.h>
+#include <unios/page.h>
+#include <unios/layout.h>
+#include <unios/assert.h>
+#include <unios/schedule.h>
+#include <unios/protect.h>
+#include <unios/tracing.h>
+#include <unios/interrupt.h>
+#include <arch/x86.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic.h>
+
+static uint32_t thread_stack_base(int slot) {
+    //! NOTE: slot is unique among live pcbs, so is the stack slot, and unlike
+    //! the pid it is bounded by NR_PCBS_MAX
+    return StackChildLinBase - slot * StackThreadSizeMAX;
+}
+
+static bool thread_setup_stack(pcb_t* th, void* func, void* arg) {
+    lin_memmap_t* memmap = &th->memmap;
+    memmap->stack_lin_base    = thread_stack_base(th->slot);
+    memmap->stack_child_limit = memmap->stack_lin_base - StackThreadSizeMAX;
+    memmap->stack_lin_limit   = memmap->stack_lin_base - NUM_4K;
+
+    //! NOTE: the creator faults in pages of its own stack only, so map the top
+    //! page of the new stack here to place the args of the entry
+    uint32_t laddr = memmap->stack_lin_limit;
+    bool     ok    = pg_map_laddr(
+        th->cr3, laddr, PG_INVALID, PG_P | PG_U | PG_RWX, PG_P | PG_U | PG_RWX);
+    if (!ok) { return false; }
+    memset((void*)laddr, 0, NUM_4K);
+
+    //! represent: entry(func, arg) called with a null retaddr
+    uint32_t* stack = (uint32_t*)memmap->stack_lin_base;
+    stack[-1]       = (uint32_t)arg;
+    stack[-2]       = (uint32_t)func;
+    stack[-3]       = 0;
+    th->regs.esp    = (uint32_t)&stack[-3];
+    return true;
+}
+
+static void thread_pcb_clone(process_t* p_thread, pcb_t* leader, void* entry) {
+    pcb_t* fa = &p_proc_current->pcb;
+    pcb_t* th = &p_thread->pcb;
+
+    uint32_t* th_frame = (void*)(p_thread + 1) - P_STACKTOP;
+    uint32_t* fa_frame = (void*)(p_proc_current + 1) - P_STACKTOP;
+
+    //! shared part
+    th->regs        = fa->regs;
+    th->memmap      = leader->memmap;
+    th->live_ticks  = fa->live_ticks;
+    th->priority    = fa->priority;
+    th->sched_level = fa->sched_level;
+    th->cr3         = leader->cr3;
+    th->allocator   = leader->allocator;
+    th->filp        = leader->filp;
+    strcpy(th->name, fa->name);
+    memcpy(th->ldts, fa->ldts, sizeof(fa->ldts));
+    memcpy(th_frame, fa_frame, P_STACKTOP);
+    sched_fork(th, fa);
+
+    //! unique part
+    th->exit_code  = 0;
+    th->heap_lock  = 0;
+    th->wait_queue = NULL;
+    init_wait_queue_head(&th->wait_child);
+    //! NOTE: elf parts are owned and recycled by the leader
+    th->memmap.ph_info = NULL;
+
+    pid_alloc(th);
+    th->ldt_sel = SELECTOR_LDT_FIRST;
+
+    th->regs.eip = (uint32_t)entry;
+    th->regs.eax = 0;
+
+    //! NOTE: the thread starts at its entry in the ring of the creator, see
+    //! `fork_pcb_clone` for more details
+    th->esp_save_int     = (void*)th_frame;
+    th->esp_save_syscall = (void*)th_frame;
+    th->esp_save_context = (void*)(th_frame - 10);
+    memset(th->esp_save_context, 0, sizeof(uint32_t) * 10);
+    th_frame[-1] = (uint32_t)restart_restore;
+    th_frame[-2] = th_frame[NR_EFLAGSREG];
+}
+
+static void thread_update_tree_info(pcb_t* th, pcb_t* leader) {
+    //! NOTE: threads created by threads are attached to the leader as well, so
+    //! that the group never depends on the lifetime of any non-leader thread
+    init_tree_lists(&th->tree_info);
+    list_add_tail(&th->tree_info.sibling, &leader->tree_info.threads);
+
+    th->tree_info.type      = TYPE_THREAD;
+    th->tree_info.real_ppid = p_proc_current->pcb.pid;
+    th->tree_info.ppid      = leader->pid;
+    th->tree_info.text_hold = false;
+    th->tree_info.data_hold = false;
+}
+
+static pcb_t* thread_find_child(pcb_t* leader, int tid) {
+    pcb_t* th = (pcb_t*)pid2proc(tid);
+    if (th == NULL || th->tree_info.type != TYPE_THREAD) { return NULL; }
+    if (th->tree_info.ppid != leader->pid) { return NULL; }
+    return th;
+}
+
+int do_thread_create(void* entry, void* func, void* arg) {
+    pcb_t* leader = thread_leader(&p_proc_current->pcb);
+    lock_or(&leader->lock, sched);
+    process_t* th = try_lock_free_pcb();
+    if (th == NULL) {
+        kwarn("thread %d: pcb res is not available", leader->pid);
+        release(&leader->lock);
+        return -1;
+    }
+
+    thread_pcb_clone(th, leader, entry);
+
+    bool ok = false;
+    disable_int_begin();
+    ok = thread_setup_stack(&th->pcb, func, arg);
+    disable_int_end();
+    if (!ok) {
+        kwarn("thread %d: low memory", leader->pid);
+        recycle_locked_pcb(&th->pcb);
+        release(&th->pcb.lock);
+        release(&leader->lock);
+        return -1;
+    }
+
+    uint32_t* frame  = (void*)(th + 1) - P_STACKTOP;
+    frame[NR_EIPREG] = th->pcb.regs.eip;
+    frame[NR_ESPREG] = th->pcb.regs.esp;
+    frame[NR_EAXREG] = th->pcb.regs.eax;
+    thread_update_tree_info(&th->pcb, leader);
+
+    set_proc_stat(&th->pcb, READY);
+
+    release(&th->pcb.lock);
+    release(&leader->lock);
+    return th->pcb.pid;
+}
+
+int do_thread_join(int tid, int* retval) {
+    pcb_t* self   = &p_proc_current->pcb;
+    pcb_t* leader = thread_leader(self);
+    if (tid == self->pid) { return -1; }
+    while (true) {
+        lock_or(&leader->lock, sched);
+        pcb_t* th = thread_find_child(leader, tid);
+        if (th == NULL) {
+            release(&leader->lock);
+            return -1;
+        }
+        if (th->stat != ZOMBIE) {
+            //! NOTE: exiting threads take the lock of the leader before the
+            //! wakeup, so the wakeup can never be lost in between
+            prepare_to_wait(&leader->wait_child);
+            release(&leader->lock);
+            sched();
+            finish_wait(&leader->wait_child);
+            continue;
+        }
+        lock_or(&th->lock, sched);
+        list_del_init(&th->tree_info.sibling);
+        if (retval != NULL) { *retval = th->exit_code; }
+        //! NOTE: nothing else to recycle, the stack has been dropped on exit
+        recycle_locked_pcb(th);
+        release(&th->lock);
+        release(&leader->lock);
+        return tid;
+    }
+}
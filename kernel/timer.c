@@ -0,0 +1,157 @@
+#include <unios/timer.h>
+#include <unios/clock.h>
+#include <unios/interrupt.h>
+#include <arch/x86.h>
+#include <stddef.h>
+#include <math.h>
+
+#define TIMER_ROOT_MASK  (TIMER_ROOT_SIZE - 1)
+#define TIMER_LEVEL_MASK (TIMER_LEVEL_SIZE - 1)
+
+static struct list_head timer_root[TIMER_ROOT_SIZE];
+static struct list_head timer_levels[NR_TIMER_LEVELS][TIMER_LEVEL_SIZE];
+static uint32_t         timer_ticks; //<! next tick to be processed
+
+static int timer_level_shift(int level) {
+    return TIMER_ROOT_BITS + level * TIMER_LEVEL_BITS;
+}
+
+static int timer_level_index(int level, uint32_t ticks) {
+    return (ticks >> timer_level_shift(level)) & TIMER_LEVEL_MASK;
+}
+
+static void timer_enqueue(ktimer_t *timer) {
+    uint32_t delta = timer->expires - timer_ticks;
+    if ((int32_t)delta < 0) {
+        //! already due, fire it on the next tick
+        timer->expires = timer_ticks;
+        delta          = 0;
+    } else if (delta > TIMER_MAX_TICKS) {
+        timer->expires = timer_ticks + TIMER_MAX_TICKS;
+        delta          = TIMER_MAX_TICKS;
+    }
+    struct list_head *slot = NULL;
+    if (delta < TIMER_ROOT_SIZE) {
+        slot = &timer_root[timer->expires & TIMER_ROOT_MASK];
+    } else {
+        int level = 0;
+        while (delta >> timer_level_shift(level + 1) != 0) { ++level; }
+        slot = &timer_levels[level][timer_level_index(level, timer->expires)];
+    }
+    list_add_tail(&timer->node, slot);
+    timer->pending = true;
+}
+
+static void timer_cascade(int level, int index) {
+    //! NOTE: timers in the slot are now due within the range of the lower
+    //! level, re-enqueue them to find their new slots
+    struct list_head  work;
+    struct list_head *slot = &timer_levels[level][index];
+    list_replace_init(slot, &work);
+    while (!list_empty(&work)) {
+        ktimer_t *timer = list_first_entry(&work, ktimer_t, node);
+        list_del(&timer->node);
+        timer_enqueue(timer);
+    }
+}
+
+void ktimer_init(ktimer_t *timer, fn_timer_t func, void *arg) {
+    INIT_LIST_HEAD(&timer->node);
+    timer->expires = 0;
+    timer->period  = 0;
+    timer->func    = func;
+    timer->arg     = arg;
+    timer->pending = false;
+}
+
+static void ktimer_arm_with(ktimer_t *timer, uint32_t ticks, uint32_t period) {
+    disable_int_begin();
+    if (timer->pending) { list_del_init(&timer->node); }
+    timer->expires = (uint32_t)system_ticks + ticks;
+    timer->period  = period;
+    timer_enqueue(timer);
+    disable_int_end();
+}
+
+void ktimer_arm(ktimer_t *timer, uint32_t ticks) {
+    ktimer_arm_with(timer, ticks, 0);
+}
+
+void ktimer_arm_periodic(ktimer_t *timer, uint32_t period) {
+    ktimer_arm_with(timer, period, period);
+}
+
+bool ktimer_cancel(ktimer_t *timer) {
+    bool pending = false;
+    disable_int_begin();
+    pending = timer->pending;
+    if (pending) {
+        list_del_init(&timer->node);
+        timer->pending = false;
+    }
+    disable_int_end();
+    return pending;
+}
+
+bool ktimer_pending(const ktimer_t *timer) {
+    return timer->pending;
+}
+
+void timer_tick() {
+    //! NOTE: the clock handler runs with the interrupts enabled, and the
+    //! handlers of the nested ones may arm or cancel timers in between
+    disable_int_begin();
+    while ((int32_t)((uint32_t)system_ticks - timer_ticks) >= 0) {
+        int index = timer_ticks & TIMER_ROOT_MASK;
+        //! cascade the upper levels once the level below wraps
+        for (int level = 0; level < NR_TIMER_LEVELS; ++level) {
+            if (level == 0 && index != 0) { break; }
+            int upper = timer_level_index(level, timer_ticks);
+            timer_cascade(level, upper);
+            if (upper != 0) { break; }
+        }
+        ++timer_ticks;
+
+        struct list_head work;
+        list_replace_init(&timer_root[index], &work);
+        while (!list_empty(&work)) {
+            ktimer_t *timer = list_first_entry(&work, ktimer_t, node);
+            list_del_init(&timer->node);
+            timer->pending = false;
+            if (timer->period != 0) {
+                timer->expires += timer->period;
+                timer_enqueue(timer);
+            }
+            timer->func(timer->arg);
+        }
+    }
+    disable_int_end();
+}
+
+uint32_t timer_ticks_until_next(uint32_t limit) {
+    int32_t base = (int32_t)(timer_ticks - (uint32_t)system_ticks);
+    if (base <= 0) { return 0; }
+    //! NOTE: the upper levels are cascaded once the root wraps, so the scan is
+    //! bounded by the next wrap besides the limit
+    uint32_t bound = (TIMER_ROOT_SIZE - (timer_ticks & TIMER_ROOT_MASK))
+                   & TIMER_ROOT_MASK;
+    uint32_t offset = 0;
+    while (offset < bound && base + offset < limit) {
+        int index = (timer_ticks + offset) & TIMER_ROOT_MASK;
+        if (!list_empty(&timer_root[index])) { break; }
+        ++offset;
+    }
+    return min(base + offset, limit);
+}
+
+void init_timer() {
+    for (int i = 0; i < TIMER_ROOT_SIZE; ++i) {
+        INIT_LIST_HEAD(&timer_root[i]);
+    }
+    for (int i = 0; i < NR_TIMER_LEVELS; ++i) {
+        for (int j = 0; j < TIMER_LEVEL_SIZE; ++j) {
+            INIT_LIST_HEAD(&timer_levels[i][j]);
+        }
+    }
+    timer_ticks = system_ticks;
+}
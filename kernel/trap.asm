@@ -1,9 +1,15 @@
 %include "sconst.inc"
 
-extern kstate_reenter_cntr
 extern irq_table
 extern save_int
 extern sched
+extern this_cpu
+extern smp_lock_kernel
+extern smp_kernel_lock
+extern cpu_halt_ret
+extern smp_local_timer_handler
+extern smp_resched_handler
+extern smp_tlb_flush_handler
 
 extern exception_handler
 extern page_fault_handler
@@ -23,13 +29,20 @@ save_exception:
     mov     fs, dx
     mov     dx, SELECTOR_VIDEO - 2
     mov     gs, dx
+    lock_kernel_on_entry 4
     mov     esi, esp
     push    restart_exception
     jmp     [esi + RETADR - P_STACKBASE]
 
     global restart_exception
 restart_exception:
+    ; NOTE: an exception nested in an irq runs on the cpu stack, which is never
+    ; switched away from
+    call    this_cpu
+    cmp     dword [eax + CPU_REENTER], 0
+    jnz     .restore
     call    sched
+.restore:
     pop     gs
     pop     fs
     pop     es
@@ -37,6 +50,7 @@ restart_exception:
     popad
     ; clear retaddr and error code in stack
     add     esp, 4 * 2
+    unlock_kernel_on_exit
     iretd
 
 ; impl_hwint_master <irq-name>, <irq-id>
@@ -45,7 +59,8 @@ restart_exception:
     align 16
 %1:
     call    save_int                    ; save context
-    inc     dword [kstate_reenter_cntr] ; mark as entering kernel
+    call    this_cpu                    ; mark as entering kernel -->
+    inc     dword [eax + CPU_REENTER]   ; <--
     in      al, INT_M_CTLMASK           ; mask current int -->
     or      al, (1 << %2)               ;
     out     INT_M_CTLMASK, al           ; <--
@@ -56,7 +71,8 @@ restart_exception:
     call    [irq_table + 4 * %2]        ;
     pop     ecx                         ; <--
     cli
-    dec     dword [kstate_reenter_cntr]
+    call    this_cpu
+    dec     dword [eax + CPU_REENTER]
     in      al, INT_M_CTLMASK           ; unmask current int -->
     and     al, ~(1 << %2)              ;
     out     INT_M_CTLMASK, al           ; <--
@@ -69,7 +85,8 @@ restart_exception:
     align 16
 %1:
     call    save_int                    ; save context
-    inc     dword [kstate_reenter_cntr] ; mark as entering kernel
+    call    this_cpu                    ; mark as entering kernel -->
+    inc     dword [eax + CPU_REENTER]   ; <--
     in      al, INT_S_CTLMASK           ; mask current int -->
     or      al, (1 << (%2 - 8))         ;
     out     INT_S_CTLMASK, al           ; <--
@@ -82,13 +99,31 @@ restart_exception:
     call    [irq_table + 4 * %2]        ;
     pop     ecx                         ; <--
     cli
-    dec     dword [kstate_reenter_cntr]
+    call    this_cpu
+    dec     dword [eax + CPU_REENTER]
     in      al, INT_S_CTLMASK           ; unmask current int -->
     and     al, ~(1 << (%2 - 8))        ;
     out     INT_S_CTLMASK, al           ; <--
     ret
 %endmacro
 
+; impl_hwint_local <irq-name>, <handler>
+; NOTE: irqs raised by the local apic, the handler sends the EOI itself
+%macro impl_hwint_local 2
+    global %1
+    align 16
+%1:
+    call    save_int                    ; save context
+    call    this_cpu                    ; mark as entering kernel -->
+    inc     dword [eax + CPU_REENTER]   ; <--
+    sti                                 ; enable respond to new int
+    call    %2                          ; run int handler
+    cli
+    call    this_cpu
+    dec     dword [eax + CPU_REENTER]
+    ret
+%endmacro
+
 ; impl_exception_no_errcode <exception-name>, <vec-no>, <handler>
 %macro impl_exception_no_errcode 3
     global %1
@@ -138,6 +173,35 @@ restart_exception:
     ret                             ; returned to 'restart_exception' procedure
 %endmacro
 
+; impl_exception_page_fault <exception-name>, <vec-no>, <handler>
+; NOTE: the same as impl_exception_errcode, except that cr2 is passed as the
+; extra argument, since it must be read before interrupts are enabled, or a
+; nested page fault may overwrite it
+%macro impl_exception_page_fault 3
+    global %1
+%1:
+    call    save_exception          ; save registers and some other things.
+    mov     esi, esp                ; esp points to pushed address of restart_exception at present
+    add     esi, 4 * 17             ; we use esi to help to fetch arguments of exception handler from the stack.
+                                    ; 17 is calculated by: 4+8+retaddr+errcode+eip+cs+eflag=17
+    mov     eax, cr2                ; fault laddr
+    push    eax
+    mov     eax, [esi]              ; saved eflags
+    push    eax
+    mov     eax, [esi - 4]          ; saved cs
+    push    eax
+    mov     eax, [esi - 4 * 2]      ; saved eip
+    push    eax
+    mov     eax, [esi - 4 * 3]      ; saved err code
+    push    eax
+    push    %2                      ; vector_no
+    sti
+    call    %3
+    cli
+    add     esp, 4 * 6              ; clear arguments of exception handler in stack
+    ret                             ; returned to 'restart_exception' procedure
+%endmacro
+
 impl_hwint_master hwint00, 0  ; interrupt routine for irq 0 (the clock)
 impl_hwint_master hwint01, 1  ; interrupt routine for irq 1 (keyboard)
 impl_hwint_master hwint02, 2  ; interrupt routine for irq 2 (cascade)
@@ -155,6 +219,32 @@ impl_hwint_slave  hwint13, 13 ; interrupt routine for irq 13 (fpu exception)
 impl_hwint_slave  hwint14, 14 ; interrupt routine for irq 14 (AT winchester)
 impl_hwint_slave  hwint15, 15 ; interrupt routine for irq 15
 
+impl_hwint_local hwint_local_timer, smp_local_timer_handler ; local apic timer
+impl_hwint_local hwint_resched,     smp_resched_handler     ; resched ipi
+
+; NOTE: the tlb flush ipi may hit a cpu spinning for the kernel lock, so it
+; neither takes the lock nor schedules
+    global hwint_tlb_flush
+    align 16
+hwint_tlb_flush:
+    pushad
+    push    ds
+    push    es
+    mov     dx, ss
+    mov     ds, dx
+    mov     es, dx
+    call    smp_tlb_flush_handler
+    pop     es
+    pop     ds
+    popad
+    iretd
+
+; NOTE: no EOI is sent for a spurious irq
+    global hwint_spurious
+    align 16
+hwint_spurious:
+    iretd
+
 impl_exception_no_errcode division_error,           0,  exception_handler   ; division error, fault, #DE, no error code
 impl_exception_no_errcode debug_exception,          1,  exception_handler   ; debug exception, fault/trap, #DB, no error code
 impl_exception_no_errcode nmi,                      2,  exception_handler   ; non-maskable interrupt, int, \, no error code
@@ -169,5 +259,5 @@ impl_exception_errcode    invalid_tss,              10, exception_handler   ; in
 impl_exception_errcode    segment_not_present,      11, exception_handler   ; segment not present, fault, #NP, error code
 impl_exception_errcode    stack_seg_exception,      12, exception_handler   ; stack-segment fault, fault, #SS, error code
 impl_exception_errcode    general_protection,       13, exception_handler   ; general protection fault, fault, #PF, error code
-impl_exception_errcode    page_fault,               14, page_fault_handler  ; page fault, fault, #PF, error code
+impl_exception_page_fault page_fault,               14, page_fault_handler  ; page fault, fault, #PF, error code
 impl_exception_no_errcode floating_point_exception, 16, exception_handler   ; floating-point exception, fault, #MF, no error code
@@ -5,6 +5,8 @@
 #include <unios/keyboard.h>
 #include <unios/console.h>
 #include <unios/tracing.h>
+#include <unios/waitqueue.h>
+#include <unios/schedule.h>
 #include <arch/x86.h>
 #include <sys/defs.h>
 #include <assert.h>
@@ -15,7 +17,9 @@
 
 tty_t *tty_table[NR_CONSOLES];
 
-static volatile int tty_wait_nr;
+static volatile int      tty_wait_nr;
+static volatile bool     tty_wait_served; //<! request taken by init proc
+static wait_queue_head_t tty_wait_queue;
 
 static void tty_init(tty_t *tty) {
     //! TODO: move part of struct to user space
@@ -26,6 +30,7 @@ static void tty_init(tty_t *tty) {
     tty->cnt_wr    = 0;
     tty->ibuf_rd   = tty->ibuf_next;
     tty->cnt_rd    = 0;
+    init_wait_queue_head(&tty->rd_wait);
 
     console_t *con = kmalloc(sizeof(console_t));
     assert(con != NULL);
@@ -149,7 +154,12 @@ int tty_read(tty_t *tty, char *buf, int len) {
 
     while (total_rd < len) {
         if (tty->cnt_rd == 0) { tty->status |= TTY_WAIT_ENTER; }
-        while (tty->status & TTY_WAIT_ENTER) {}
+        while (true) {
+            prepare_to_wait(&tty->rd_wait);
+            if (!(tty->status & TTY_WAIT_ENTER)) { break; }
+            sched();
+        }
+        finish_wait(&tty->rd_wait);
         while (tty->cnt_rd > 0) {
             bool ok = tty_rdbuf_next(tty, &code);
             assert(ok);
@@ -173,6 +183,7 @@ void tty_keyboard_proc(tty_t *tty, uint32_t key) {
     if (raw_code == ENTER) {
         tty_put_key(tty, '\n');
         tty->status &= ~TTY_WAIT_ENTER;
+        wake_up_all(&tty->rd_wait);
     } else if (raw_code == BACKSPACE) {
         tty_put_key(tty, '\b');
     } else if (raw_code == UP) {
@@ -248,18 +259,36 @@ static void tty_dev_write(tty_t *tty) {
 void tty_wait_shell(int index) {
     int nr = index + 1;
     assert(tty_wait_nr == 0);
-    tty_wait_nr = nr;
-    while (tty_wait_nr == nr) { yield(); }
+    tty_wait_served = false;
+    tty_wait_nr     = nr;
+    wake_up_all(&tty_wait_queue);
+    while (true) {
+        prepare_to_wait(&tty_wait_queue);
+        if (tty_wait_nr != nr) { break; }
+        yield();
+    }
+    finish_wait(&tty_wait_queue);
     kdebug("tty %d shell done", index);
 }
 
+void tty_wait_request() {
+    while (true) {
+        prepare_to_wait(&tty_wait_queue);
+        if (tty_wait_nr != 0 && !tty_wait_served) { break; }
+        yield();
+    }
+    finish_wait(&tty_wait_queue);
+}
+
 int tty_wait_for() {
     int nr_tty = tty_wait_nr - 1;
+    if (nr_tty != -1) { tty_wait_served = true; }
     return nr_tty;
 }
 
 void tty_notify_shell() {
     tty_wait_nr = 0;
+    wake_up_all(&tty_wait_queue);
 }
 
 bool tty_select(int index) {
@@ -307,6 +336,12 @@ void tty_handler() {
             }
             if (times > 0) { ++done; }
         }
-        if (done == 0) { yield(); }
+        if (done == 0) { keyboard_wait_input(); }
     }
 }
+
+void init_tty() {
+    tty_wait_nr     = 0;
+    tty_wait_served = false;
+    init_wait_queue_head(&tty_wait_queue);
+}
@@ -247,6 +247,16 @@ int do_vwrite(int fd, const void *buf, int count) {
     return count;
 }
 
+int vfs_map_range(
+    int fd, int io_type, int pos, int size, int *dev, uint32_t *sector) {
+    if (fd < 0 || fd >= NR_FILES) { return -1; }
+    file_desc_t *file = p_proc_current->pcb.filp[fd];
+    if (file == NULL) { return -1; }
+    //! NOTE: only orange fs lays a file out on the contiguous sectors
+    if (&vfs_table[file->dev_index] != &ORANGE_VFS) { return -1; }
+    return real_map_range(fd, io_type, pos, size, dev, sector);
+}
+
 int do_vunlink(const char *path) {
     const char *relpath = NULL;
     int         index   = get_vfs_index_and_relpath(path, &relpath);
@@ -13,40 +13,18 @@
 #include <atomic.h>
 #include <string.h>
 
-static pcb_t* try_get_zombie_child(uint32_t pid) {
-    pcb_t* pcb = (pcb_t*)pid2proc(pid);
-    for (int i = 0; i < pcb->tree_info.child_p_num; ++i) {
-        pcb_t* exit_child = (pcb_t*)pid2proc(pcb->tree_info.child_process[i]);
-        if (exit_child->stat == ZOMBIE) { return exit_child; }
-    }
-    return NULL;
-}
-
-static int try_remove_killed_child(uint32_t pid) {
-    pcb_t* pcb = (pcb_t*)pid2proc(pid);
-    if (pcb->tree_info.child_k_num == 0) { return -1; }
-    for (int i = pcb->tree_info.child_k_num - 1; i >= 0; --i) {
-        --pcb->tree_info.child_k_num;
-        return (int)pcb->tree_info.child_killed[i];
-    }
-    unreachable();
+static pcb_t* try_get_zombie_child(pcb_t* pcb) {
+    //! NOTE: children are linked to the zombie list once they exit, see
+    //! `do_exit` & `transfer_child_proc`
+    struct list_head* zombies = &pcb->tree_info.zombies;
+    if (list_empty(zombies)) { return NULL; }
+    return list_first_entry(zombies, pcb_t, tree_info.zombie);
 }
 
-static void remove_zombie_child(uint32_t pid) {
-    pcb_t* pcb    = &p_proc_current->pcb;
-    bool   cpyflg = false;
-    for (int i = 0; i < pcb->tree_info.child_p_num; ++i) {
-        pcb_t* exit_child = (pcb_t*)pid2proc(pcb->tree_info.child_process[i]);
-        assert(!(cpyflg && exit_child->pid == pid));
-        if (exit_child->pid == pid) { cpyflg = true; }
-        if (cpyflg && i < pcb->tree_info.child_p_num - 1) {
-            pcb->tree_info.child_process[i] =
-                pcb->tree_info.child_process[i + 1];
-        }
-    }
-    assert(cpyflg);
-    --pcb->tree_info.child_p_num;
-    return;
+static void remove_zombie_child(pcb_t* exit_child) {
+    assert(exit_child->tree_info.ppid == p_proc_current->pcb.pid);
+    list_del_init(&exit_child->tree_info.sibling);
+    list_del_init(&exit_child->tree_info.zombie);
 }
 
 static void wait_recycle_memory(uint32_t recy_pid) {
@@ -60,43 +38,34 @@ int do_wait(int* wstatus) {
     pcb_t* fa_pcb = &p_proc_current->pcb;
     while (true) {
         lock_or(&fa_pcb->lock, sched);
-        if (fa_pcb->tree_info.child_p_num == 0
-            && fa_pcb->tree_info.child_k_num == 0) {
+        if (list_empty(&fa_pcb->tree_info.children)
+            && list_empty(&fa_pcb->tree_info.killed)) {
             if (wstatus != NULL) { *wstatus = 0; }
             release(&fa_pcb->lock);
             return -1;
         }
-        pcb_t* exit_pcb = try_get_zombie_child(fa_pcb->pid);
+        pcb_t* exit_pcb = try_get_zombie_child(fa_pcb);
         if (exit_pcb == NULL) {
-            int pid = try_remove_killed_child(fa_pcb->pid);
+            int pid = pop_killed_child(&fa_pcb->tree_info);
             if (pid != -1) {
                 release(&fa_pcb->lock);
                 return pid;
             }
-            disable_int_begin();
-            fa_pcb->stat = SLEEPING;
-            disable_int_end();
+            //! NOTE: exiting children take the lock before the wakeup, so the
+            //! wakeup can never be lost in between
+            prepare_to_wait(&fa_pcb->wait_child);
             release(&fa_pcb->lock);
             sched();
+            finish_wait(&fa_pcb->wait_child);
             continue;
         }
         lock_or(&exit_pcb->lock, sched);
-        remove_zombie_child(exit_pcb->pid);
+        remove_zombie_child(exit_pcb);
         if (wstatus != NULL) { *wstatus = exit_pcb->exit_code; }
-        //! FIXME: no thread release here
+        //! NOTE: threads of the child have been released on its exit
         wait_recycle_memory(exit_pcb->pid);
         int pid = exit_pcb->pid;
-        //! FIXME: lock also release here
-        disable_int_begin();
-        memset(exit_pcb, 0, sizeof(process_t));
-        assert(!exit_pcb->tree_info.child_k_num);
-        assert(!exit_pcb->tree_info.child_p_num);
-        assert(!exit_pcb->tree_info.child_t_num);
-        assert(!exit_pcb->tree_info.ppid);
-        assert(!exit_pcb->tree_info.real_ppid);
-        exit_pcb->pid  = -1;
-        exit_pcb->stat = IDLE;
-        disable_int_end();
+        recycle_locked_pcb(exit_pcb);
         release(&exit_pcb->lock);
         release(&fa_pcb->lock);
         return pid;
@@ -0,0 +1,65 @@
+#include <unios/waitqueue.h>
+#include <unios/schedule.h>
+#include <unios/interrupt.h>
+#include <unios/proc.h>
+#include <unios/assert.h>
+#include <arch/x86.h>
+#include <stddef.h>
+
+void init_wait_queue_head(wait_queue_head_t *wq) {
+    INIT_LIST_HEAD(&wq->head);
+}
+
+void wait_queue_detach(pcb_t *pcb) {
+    disable_int_begin();
+    if (pcb->wait_queue != NULL) {
+        list_del_init(&pcb->wait_node);
+        pcb->wait_queue = NULL;
+    }
+    disable_int_end();
+}
+
+void prepare_to_wait(wait_queue_head_t *wq) {
+    pcb_t *pcb = &p_proc_current->pcb;
+    disable_int_begin();
+    if (pcb->wait_queue != wq) {
+        wait_queue_detach(pcb);
+        list_add_tail(&pcb->wait_node, &wq->head);
+        pcb->wait_queue = wq;
+    }
+    set_proc_stat(pcb, SLEEPING);
+    disable_int_end();
+}
+
+void finish_wait(wait_queue_head_t *wq) {
+    pcb_t *pcb = &p_proc_current->pcb;
+    disable_int_begin();
+    //! NOTE: leaving SLEEPING also detaches it from the wait queue
+    if (pcb->stat == SLEEPING) { set_proc_stat(pcb, READY); }
+    assert(pcb->wait_queue == NULL);
+    disable_int_end();
+}
+
+bool wake_up_one(wait_queue_head_t *wq) {
+    bool woken = false;
+    disable_int_begin();
+    if (!list_empty(&wq->head)) {
+        pcb_t *pcb = list_first_entry(&wq->head, pcb_t, wait_node);
+        set_proc_stat(pcb, READY);
+        woken = true;
+    }
+    disable_int_end();
+    return woken;
+}
+
+int wake_up_all(wait_queue_head_t *wq) {
+    int total = 0;
+    disable_int_begin();
+    while (!list_empty(&wq->head)) {
+        pcb_t *pcb = list_first_entry(&wq->head, pcb_t, wait_node);
+        set_proc_stat(pcb, READY);
+        ++total;
+    }
+    disable_int_end();
+    return total;
+}
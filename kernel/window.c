@@ -1,6 +1,9 @@
 #include <unios/window.h>
 #include <unios/clock.h>
+#include <unios/timer.h>
+#include <unios/waitqueue.h>
 #include <unios/memory.h>
+#include <unios/slab.h>
 #include <unios/assert.h>
 #include <unios/tracing.h>
 #include <lib/string.h>
@@ -14,6 +17,7 @@
 #define ENABLE_INTERRUPTS()  __asm__ volatile("sti")
 #define DRAG_THRESHOLD 8
 #define RESIZE_BORDER 6
+#define REFRESH_INTERVAL_TICKS 10
 
 enum {
     RESIZE_NONE   = 0,
@@ -28,8 +32,12 @@ static int drag_start_mx = 0;
 static int drag_start_my = 0;
 static bool is_drag_active = false;
 
+static kmem_cache_t* window_cache = NULL;
 static window_t* root_window = NULL;
 static int win_id_counter = 0;
+// 刷新节流: 定时器挂起期间不刷新
+static ktimer_t refresh_timer;
+static wait_queue_head_t wm_wait_queue; // 窗口管理任务在此等待事件
 
 static window_t* drag_window = NULL; // 当前正在拖拽的窗口
 static int drag_off_x = 0;           // 鼠标点击位置相对于窗口左上角的偏移
@@ -124,13 +132,23 @@ void window_invalidate_rect(window_t* win, int x, int y, int w, int h) {
     if (!g_has_dirty) {
         g_dirty_rect = new_rect;
         g_has_dirty = true;
+        wake_up_all(&wm_wait_queue);
     } else {
         g_dirty_rect = rect_union(g_dirty_rect, new_rect);
     }
 }
 
+static void refresh_timer_expired(void* arg) {
+    wake_up_all(&wm_wait_queue);
+}
+
+static bool window_manager_has_work() {
+    return g_mouse_event_pending
+        || (g_has_dirty && !ktimer_pending(&refresh_timer));
+}
+
 void window_manager_handler(void) {
-    int last_refresh_tick = 0;
+    ktimer_init(&refresh_timer, refresh_timer_expired, NULL);
     while (true) {
 
         if (g_mouse_event_pending) {
@@ -289,23 +307,27 @@ void window_manager_handler(void) {
             g_mouse_last_y = y;
         }
 
-        if (g_has_dirty) {
-            int current_tick = system_ticks;
-            if (current_tick - last_refresh_tick >= 10) {
-                window_manager_refresh();
-                last_refresh_tick = current_tick;
-            }
+        if (g_has_dirty && !ktimer_pending(&refresh_timer)) {
+            window_manager_refresh();
+            ktimer_arm(&refresh_timer, REFRESH_INTERVAL_TICKS);
         }
 
-        yield();
+        // 没有鼠标事件且无需刷新时睡眠，由鼠标、脏区域或刷新定时器唤醒
+        prepare_to_wait(&wm_wait_queue);
+        if (!window_manager_has_work()) { yield(); }
+        finish_wait(&wm_wait_queue);
     }
 }
 
 void init_window_manager() {
+    init_wait_queue_head(&wm_wait_queue);
     const graphics_mode_t *mode = graphics_current_mode();
     if (!mode) return;
 
-    root_window = kmalloc(sizeof(window_t));
+    window_cache = kmem_cache_create("window_t", sizeof(window_t), 0, NULL);
+    assert(window_cache != NULL);
+
+    root_window = kmem_cache_alloc(window_cache);
     memset(root_window, 0, sizeof(window_t));
 
     root_window->id = win_id_counter++;
@@ -326,7 +348,7 @@ void init_window_manager() {
 window_t* create_window(int x, int y, int w, int h, const char* title, uint32_t bg_color) {
     if (!root_window) return NULL;
 
-    window_t* win = kmalloc(sizeof(window_t));
+    window_t* win = kmem_cache_alloc(window_cache);
     if (!win) return NULL;
     memset(win, 0, sizeof(window_t));
 
@@ -385,7 +407,7 @@ void destroy_window(window_t* win) {
         kfree(win->surface.pixels);
         win->surface.pixels = NULL;
     }
-    kfree(win);
+    kmem_cache_free(window_cache, win);
 }
 
 void window_fill(window_t* win, uint32_t color) {
@@ -620,6 +642,7 @@ void window_manager_on_mouse(int x, int y, int buttons) {
     g_cmd_y = y;
     g_cmd_buttons = buttons;
     g_mouse_event_pending = true;
+    wake_up_all(&wm_wait_queue);
 }
 
 static bool window_recreate_surface(window_t* win, int new_w, int new_h) {
@@ -0,0 +1,173 @@
+#include <unios/layout.h>
+#include <malloc.h>
+#include <assert.h>
+#include <atomic.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+//! NOTE: all states of the allocator live in the data segment of the image,
+//! that is per process, however kernel tasks share the kernel image, so they
+//! must never allocate through this allocator
+
+#define HEAP_ALIGN      8
+#define HEAP_MAGIC      0x4d4c4300  //<! "\0CLM", low byte is the size class
+#define HEAP_LARGE      0xff        //<! size class of large blocks
+#define HEAP_CHUNK_SIZE (64 * 1024) //<! min bytes to move the break by
+#define HEAP_SPLIT_MIN  64          //<! min payload to split a large block
+
+typedef struct heap_block_s {
+    uint32_t tag;  //<! magic | size class
+    uint32_t size; //<! payload size
+} heap_block_t;
+
+static const uint32_t size_classes[] = {
+    16,
+    32,
+    48,
+    64,
+    96,
+    128,
+    192,
+    256,
+    384,
+    512,
+    768,
+    1024,
+    1536,
+    2048,
+    3072,
+    4096,
+};
+
+#define NR_SIZE_CLASSES (sizeof(size_classes) / sizeof(size_classes[0]))
+
+//! free payloads are linked through their first word
+static void *free_lists[NR_SIZE_CLASSES];
+static void *large_free_list;
+
+//! range carved from the program break but not yet handed out
+static void *bump_base;
+static void *bump_limit;
+
+static int heap_lock;
+
+static int size_class_of(uint32_t size) {
+    for (int i = 0; i < NR_SIZE_CLASSES; ++i) {
+        if (size <= size_classes[i]) { return i; }
+    }
+    return HEAP_LARGE;
+}
+
+static void *heap_carve(int cls, uint32_t size) {
+    uint32_t total = sizeof(heap_block_t) + size;
+    if (bump_limit - bump_base < total) {
+        uint32_t want = round_up(total + HEAP_ALIGN, HEAP_CHUNK_SIZE);
+        void    *base = sbrk(want);
+        if (base == (void *)-1) { return NULL; }
+        //! NOTE: the rest of the old range is dropped if the break has been
+        //! moved by someone else in between
+        if (base != bump_limit) { bump_base = round_up(base, HEAP_ALIGN); }
+        bump_limit = base + want;
+    }
+    heap_block_t *blk = bump_base;
+    bump_base        += total;
+    blk->tag          = HEAP_MAGIC | cls;
+    blk->size         = size;
+    return blk + 1;
+}
+
+static void heap_put_large(void *ptr) {
+    //! the list is kept in address order, so that a block is merged with its
+    //! free neighbours on both sides
+    void **pp   = &large_free_list;
+    void  *prev = NULL;
+    while (*pp != NULL && *pp < ptr) {
+        prev = *pp;
+        pp   = (void **)*pp;
+    }
+    heap_block_t *blk  = (heap_block_t *)ptr - 1;
+    void         *next = *pp;
+    if (next != NULL && ptr + blk->size == (heap_block_t *)next - 1) {
+        blk->size += sizeof(heap_block_t) + ((heap_block_t *)next - 1)->size;
+        next       = *(void **)next;
+    }
+    heap_block_t *prev_blk = prev != NULL ? (heap_block_t *)prev - 1 : NULL;
+    if (prev_blk != NULL && prev + prev_blk->size == (void *)blk) {
+        prev_blk->size += sizeof(heap_block_t) + blk->size;
+        *(void **)prev  = next;
+    } else {
+        *(void **)ptr = next;
+        *pp           = ptr;
+    }
+}
+
+static void *heap_take_large(uint32_t size) {
+    //! first fit, the rest of a block is split out if it is worth it
+    void **pp = &large_free_list;
+    while (*pp != NULL) {
+        heap_block_t *blk = (heap_block_t *)*pp - 1;
+        if (blk->size < size) {
+            pp = (void **)*pp;
+            continue;
+        }
+        void *ptr = *pp;
+        *pp       = *(void **)ptr;
+        if (blk->size - size >= sizeof(heap_block_t) + HEAP_SPLIT_MIN) {
+            //! the rest takes over the place of the block in the list
+            heap_block_t *rest   = ptr + size;
+            rest->tag            = HEAP_MAGIC | HEAP_LARGE;
+            rest->size           = blk->size - size - sizeof(heap_block_t);
+            blk->size            = size;
+            *(void **)(rest + 1) = *pp;
+            *pp                  = rest + 1;
+        }
+        return ptr;
+    }
+    return heap_carve(HEAP_LARGE, size);
+}
+
+void *malloc(int size) {
+    if (size <= 0) { return NULL; }
+
+    int   cls = size_class_of(size);
+    void *ptr = NULL;
+
+    lock_or(&heap_lock, yield);
+    if (cls == HEAP_LARGE) {
+        ptr = heap_take_large(round_up(size, HEAP_ALIGN));
+    } else if (free_lists[cls] != NULL) {
+        ptr             = free_lists[cls];
+        free_lists[cls] = *(void **)ptr;
+    } else {
+        ptr = heap_carve(cls, size_classes[cls]);
+    }
+    release(&heap_lock);
+
+    return ptr;
+}
+
+void free(void *ptr) {
+    if (ptr == NULL) { return; }
+
+    //! NOTE: blocks below the program break come from the kernel managed heap
+    if ((uintptr_t)ptr < BrkLinBase) {
+        free_syscall(ptr);
+        return;
+    }
+
+    heap_block_t *blk = (heap_block_t *)ptr - 1;
+    assert((blk->tag & ~0xff) == HEAP_MAGIC);
+    int cls = blk->tag & 0xff;
+
+    lock_or(&heap_lock, yield);
+    if (cls == HEAP_LARGE) {
+        heap_put_large(ptr);
+    } else {
+        assert(cls < NR_SIZE_CLASSES);
+        *(void **)ptr   = free_lists[cls];
+        free_lists[cls] = ptr;
+    }
+    release(&heap_lock);
+}
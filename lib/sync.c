@@ -0,0 +1,91 @@
+#include <sys/sync.h>
+#include <sys/futex.h>
+#include <atomic.h>
+#include <limits.h>
+#include <stdbool.h>
+
+//! NOTE: ref Ulrich Drepper, Futexes Are Tricky, mutex take 2
+
+static int load(int *ptr) {
+    return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+}
+
+void mutex_init(mutex_t *mutex) {
+    mutex->state = 0;
+}
+
+static void mutex_lock_contended(mutex_t *mutex) {
+    //! NOTE: the lock is always taken as contended on the slow path, since
+    //! there is no telling whether any other waiter is still asleep
+    while (exchange(&mutex->state, 2) != 0) {
+        futex(&mutex->state, FUTEX_WAIT, 2);
+    }
+}
+
+void mutex_lock(mutex_t *mutex) {
+    if (compare_exchange_strong(&mutex->state, 0, 1) == 0) { return; }
+    mutex_lock_contended(mutex);
+}
+
+bool mutex_trylock(mutex_t *mutex) {
+    return compare_exchange_strong(&mutex->state, 0, 1) == 0;
+}
+
+void mutex_unlock(mutex_t *mutex) {
+    if (exchange(&mutex->state, 0) == 2) {
+        futex(&mutex->state, FUTEX_WAKE, 1);
+    }
+}
+
+void cond_init(cond_t *cond) {
+    cond->seq = 0;
+}
+
+void cond_wait(cond_t *cond, mutex_t *mutex) {
+    //! NOTE: a signal after the unlock bumps the seq, so the wait below returns
+    //! at once rather than missing it
+    int seq = load(&cond->seq);
+    mutex_unlock(mutex);
+    futex(&cond->seq, FUTEX_WAIT, seq);
+    mutex_lock_contended(mutex);
+}
+
+void cond_signal(cond_t *cond) {
+    fetch_add(&cond->seq, 1);
+    futex(&cond->seq, FUTEX_WAKE, 1);
+}
+
+void cond_broadcast(cond_t *cond) {
+    fetch_add(&cond->seq, 1);
+    futex(&cond->seq, FUTEX_WAKE, INT_MAX);
+}
+
+void sem_init(sem_t *sem, int value) {
+    sem->count      = value;
+    sem->nr_waiters = 0;
+}
+
+bool sem_trywait(sem_t *sem) {
+    int count = load(&sem->count);
+    while (count > 0) {
+        int old = compare_exchange_strong(&sem->count, count, count - 1);
+        if (old == count) { return true; }
+        count = old;
+    }
+    return false;
+}
+
+void sem_wait(sem_t *sem) {
+    while (!sem_trywait(sem)) {
+        //! NOTE: the post in between raises the count, and the wait returns
+        //! at once since the count is no longer 0
+        fetch_add(&sem->nr_waiters, 1);
+        futex(&sem->count, FUTEX_WAIT, 0);
+        fetch_sub(&sem->nr_waiters, 1);
+    }
+}
+
+void sem_post(sem_t *sem) {
+    fetch_add(&sem->count, 1);
+    if (load(&sem->nr_waiters) > 0) { futex(&sem->count, FUTEX_WAKE, 1); }
+}
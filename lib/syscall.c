@@ -2,6 +2,10 @@
 #include <unios/environ.h>
 #include <unios/sync.h>
 #include <sys/types.h>
+#include <sys/sched.h>
+#include <sys/futex.h>
+#include <sys/bcache.h>
+#include <sys/aio.h>
 #include <compiler.h>
 #include <stdint.h>
 #include <stddef.h>
@@ -130,14 +134,63 @@ void sleep(int n) {
     syscall1(NR_sleep, n);
 }
 
-void *malloc(int size) {
+static void thread_start(int (*func)(void *), void *arg) {
+    //! NOTE: exit in a thread only terminates the thread itself
+    exit(func(arg));
+}
+
+int thread_create(int (*func)(void *), void *arg) {
+    return syscall3(
+        NR_thread_create,
+        (uint32_t)thread_start,
+        (uint32_t)func,
+        (uint32_t)arg);
+}
+
+int thread_join(int tid, int *retval) {
+    return syscall2(NR_thread_join, tid, (uint32_t)retval);
+}
+
+int sched_setaffinity(int pid, int cpu) {
+    return syscall2(NR_sched_setaffinity, pid, cpu);
+}
+
+int sched_getstat(int cpu, sched_stat_t *stat) {
+    return syscall2(NR_sched_getstat, cpu, (uint32_t)stat);
+}
+
+int futex(int *uaddr, int op, int val) {
+    return syscall3(NR_futex, (uint32_t)uaddr, op, val);
+}
+
+int sync() {
+    return syscall0(NR_sync);
+}
+
+int bcache_getstat(bcache_stat_t *stat) {
+    return syscall1(NR_bcache_getstat, (uint32_t)stat);
+}
+
+int aio_submit(int op, int fd, void *buf, int size, int pos) {
+    return syscall5(NR_aio_submit, op, fd, (uint32_t)buf, size, pos);
+}
+
+int aio_wait(int id) {
+    return syscall1(NR_aio_wait, id);
+}
+
+void *malloc_syscall(int size) {
     return size <= 0 ? NULL : (void *)syscall1(NR_malloc, size);
 }
 
-void free(void *ptr) {
+void free_syscall(void *ptr) {
     syscall1(NR_free, (uint32_t)ptr);
 }
 
+void *sbrk(int increment) {
+    return (void *)syscall1(NR_sbrk, increment);
+}
+
 int open(const char *path, int flags) {
     return syscall2(NR_open, (uint32_t)path, flags);
 }
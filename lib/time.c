@@ -6,6 +6,10 @@ clock_t clock_from_sysclk(int ticks) {
     return ticks * 1000 / SYSCLK_FREQ_HZ;
 }
 
+int sysclk_from_clock(clock_t ms) {
+    return ms * SYSCLK_FREQ_HZ / 1000;
+}
+
 clock_t clock() {
     return clock_from_sysclk(get_ticks());
 }
@@ -2,6 +2,7 @@
 # [out] QEMU path to qemu-system-? executable
 # [in] QEMU_DISPLAY qemu display graphics
 # [in] QEMU_MEMORY physical memory conf, in MB
+# [in] QEMU_SMP number of vcpus
 # [out] QEMU_FLAGS options for qemu-system-?
 
 QEMU_ARCH ?= i386
@@ -9,11 +10,13 @@ QEMU      ?= qemu-system-$(QEMU_ARCH)
 
 QEMU_DISPLAY ?=
 QEMU_MEMORY  ?= 128
+QEMU_SMP     ?= 1
 
 QEMU_FLAGS ?=
 QEMU_FLAGS += -boot order=c
 QEMU_FLAGS += -serial file:$(OBJDIR)serial-$(shell date +%Y%m%d%H%M).log
 QEMU_FLAGS += -m $(QEMU_MEMORY)m
+QEMU_FLAGS += -smp $(QEMU_SMP)
 
 QEMU_FLAGS += -vga std
 
@@ -0,0 +1,38 @@
+#include <sys/bcache.h>
+#include <stdio.h>
+#include <string.h>
+
+static void usage() {
+    printf("usage: bcstat [-sync]\n");
+}
+
+static void report() {
+    bcache_stat_t stat;
+    if (bcache_getstat(&stat) != 0) {
+        printf("bcstat: failed to get the stat\n");
+        return;
+    }
+    int lookups = stat.hits + stat.misses;
+    printf(
+        "bcache: %d bufs, %d dirty, %d hits, %d misses, %d%% hit rate\n",
+        stat.nr_bufs,
+        stat.nr_dirty,
+        stat.hits,
+        stat.misses,
+        lookups == 0 ? 0 : stat.hits * 100 / lookups);
+    printf(
+        "bcache: %d evictions, %d writebacks\n",
+        stat.evictions,
+        stat.writebacks);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 2 && strcmp(argv[1], "-sync") == 0) {
+        sync();
+    } else if (argc != 1) {
+        usage();
+        return 1;
+    }
+    report();
+    return 0;
+}
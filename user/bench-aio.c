@@ -0,0 +1,96 @@
+#include <sys/aio.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+#define CHUNK_SIZE  4096
+#define NR_INFLIGHT 4
+#define MAX_SIZE    (256 * 1024)
+
+//! NOTE: the disk moves words, keep the buffers even aligned
+static int sync_buf[MAX_SIZE / sizeof(int)];
+static int aio_buf[MAX_SIZE / sizeof(int)];
+
+static void usage() {
+    printf("usage: bench-aio <file>\n");
+}
+
+static void report(const char *name, int bytes, clock_t elapsed) {
+    int ms = max(elapsed, 1);
+    printf(
+        "%s: %d bytes in %d ms, %d KB/s\n",
+        name,
+        bytes,
+        elapsed,
+        bytes / ms * 1000 / 1024);
+}
+
+static int read_sync(int fd, int size) {
+    char *buf   = (char *)sync_buf;
+    int   total = 0;
+    lseek(fd, 0, SEEK_SET);
+    while (total < size) {
+        int n = read(fd, buf + total, min(CHUNK_SIZE, size - total));
+        if (n <= 0) { break; }
+        total += n;
+    }
+    return total;
+}
+
+static int read_async(int fd, int size) {
+    char *buf   = (char *)aio_buf;
+    int   total = 0;
+    for (int pos = 0; pos < size; pos += CHUNK_SIZE * NR_INFLIGHT) {
+        int ids[NR_INFLIGHT];
+        int nr_ids = 0;
+        //! keep several chunks in flight so that the elevator can merge them
+        for (int i = 0; i < NR_INFLIGHT; ++i) {
+            int off = pos + i * CHUNK_SIZE;
+            if (off >= size) { break; }
+            int id = aio_submit(AIO_READ, fd, buf + off, CHUNK_SIZE, off);
+            if (id < 0) { break; }
+            ids[nr_ids++] = id;
+        }
+        if (nr_ids == 0) { break; }
+        for (int i = 0; i < nr_ids; ++i) {
+            int n = aio_wait(ids[i]);
+            if (n > 0) { total += n; }
+        }
+    }
+    return total;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        usage();
+        return 1;
+    }
+    int fd = open(argv[1], O_RDWR);
+    if (fd == -1) {
+        printf("bench-aio: failed to open %s\n", argv[1]);
+        return 1;
+    }
+
+    int size = min(lseek(fd, 0, SEEK_END), MAX_SIZE);
+    size     = size / CHUNK_SIZE * CHUNK_SIZE;
+    if (size <= 0) {
+        printf("bench-aio: %s is smaller than %d bytes\n", argv[1], CHUNK_SIZE);
+        close(fd);
+        return 1;
+    }
+
+    clock_t start     = clock();
+    int     sync_size = read_sync(fd, size);
+    report("read", sync_size, clock() - start);
+
+    start        = clock();
+    int aio_size = read_async(fd, size);
+    report("aio x4", aio_size, clock() - start);
+
+    if (aio_size != sync_size || memcmp(sync_buf, aio_buf, sync_size) != 0) {
+        printf("bench-aio: data mismatch\n");
+    }
+    close(fd);
+    return 0;
+}
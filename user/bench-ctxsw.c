@@ -0,0 +1,39 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <math.h>
+
+#define NR_ROUNDS 20000
+
+static clock_t yield_rounds(int rounds) {
+    clock_t start = clock();
+    for (int i = 0; i < rounds; ++i) { yield(); }
+    return clock() - start;
+}
+
+static void report(const char *name, int nr_switches, clock_t elapsed) {
+    int total_us = max(elapsed, 1) * 1000;
+    printf(
+        "%s: %d switches in %d ms, %d.%03d us/switch\n",
+        name,
+        nr_switches,
+        elapsed,
+        total_us / nr_switches,
+        total_us % nr_switches * 1000 / nr_switches);
+}
+
+int main(int argc, char *argv[]) {
+    //! yield with no peer of the same level, mostly the cost of the syscall
+    report("yield-alone", NR_ROUNDS, yield_rounds(NR_ROUNDS));
+
+    //! two procs yield to each other, every yield is a context switch
+    int pid = fork();
+    if (pid == 0) {
+        yield_rounds(NR_ROUNDS);
+        exit(0);
+    }
+    clock_t elapsed = yield_rounds(NR_ROUNDS);
+    wait(NULL);
+    report("yield-pingpong", NR_ROUNDS * 2, elapsed);
+    return 0;
+}
@@ -0,0 +1,48 @@
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+#include <math.h>
+
+#define NR_ROUNDS 20000
+#define NR_LIVE   64
+
+typedef void *(*fn_alloc_t)(int);
+typedef void (*fn_dealloc_t)(void *);
+
+static void bench(const char *name, fn_alloc_t alloc, fn_dealloc_t dealloc) {
+    void *live[NR_LIVE] = {};
+    int   total_ops     = 0;
+
+    clock_t start = clock();
+    for (int i = 0; i < NR_ROUNDS; ++i) {
+        int slot = i % NR_LIVE;
+        if (live[slot] != NULL) {
+            dealloc(live[slot]);
+            ++total_ops;
+        }
+        //! mostly small objects with a few odd sizes mixed in
+        live[slot] = alloc(8 + (i * 37) % 500);
+        assert(live[slot] != NULL);
+        ++total_ops;
+    }
+    for (int i = 0; i < NR_LIVE; ++i) {
+        dealloc(live[i]);
+        ++total_ops;
+    }
+    clock_t elapsed = max(clock() - start, 1);
+
+    printf(
+        "%s: %d ops in %d ms, %d ops/s\n",
+        name,
+        total_ops,
+        elapsed,
+        total_ops * 1000 / elapsed);
+}
+
+int main(int argc, char *argv[]) {
+    bench("malloc", malloc, free);
+    bench("malloc_syscall", malloc_syscall, free_syscall);
+    return 0;
+}
@@ -0,0 +1,113 @@
+#include <sys/sync.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <math.h>
+
+#define NR_ROUNDS  100000
+#define NR_THREADS 4
+#define NR_ITEMS   1000
+
+static const int bench_lock_uid = 0x6d757478;
+
+static mutex_t mutex   = MUTEX_INITIALIZER;
+static int     counter = 0;
+
+static sem_t   items;
+static mutex_t queue_lock = MUTEX_INITIALIZER;
+static cond_t  queue_cond = COND_INITIALIZER;
+static int     queue_size = 0;
+
+static void report(const char *name, int rounds, clock_t elapsed) {
+    int total_us = max(elapsed, 1) * 1000;
+    printf(
+        "%s: %d rounds in %d ms, %d.%03d us/round\n",
+        name,
+        rounds,
+        elapsed,
+        total_us / rounds,
+        total_us % rounds * 1000 / rounds);
+}
+
+static clock_t uncontended_krnlobj(int rounds) {
+    krnlobj_create(bench_lock_uid);
+    clock_t start = clock();
+    for (int i = 0; i < rounds; ++i) {
+        krnlobj_lock(bench_lock_uid);
+        ++counter;
+        krnlobj_unlock(bench_lock_uid);
+    }
+    clock_t elapsed = clock() - start;
+    krnlobj_destroy(krnlobj_lookup(bench_lock_uid));
+    return elapsed;
+}
+
+static clock_t uncontended_mutex(int rounds) {
+    clock_t start = clock();
+    for (int i = 0; i < rounds; ++i) {
+        mutex_lock(&mutex);
+        ++counter;
+        mutex_unlock(&mutex);
+    }
+    return clock() - start;
+}
+
+static int contender(void *arg) {
+    int rounds = (int)arg;
+    for (int i = 0; i < rounds; ++i) {
+        mutex_lock(&mutex);
+        ++counter;
+        mutex_unlock(&mutex);
+    }
+    return 0;
+}
+
+static clock_t contended_mutex(int rounds) {
+    int tids[NR_THREADS];
+    counter       = 0;
+    clock_t start = clock();
+    for (int i = 0; i < NR_THREADS; ++i) {
+        tids[i] = thread_create(contender, (void *)(rounds / NR_THREADS));
+    }
+    for (int i = 0; i < NR_THREADS; ++i) { thread_join(tids[i], NULL); }
+    clock_t elapsed = clock() - start;
+    if (counter != rounds / NR_THREADS * NR_THREADS) {
+        printf("mutex: lost updates, counter %d\n", counter);
+    }
+    return elapsed;
+}
+
+static int producer(void *arg) {
+    for (int i = 0; i < NR_ITEMS; ++i) {
+        mutex_lock(&queue_lock);
+        ++queue_size;
+        cond_signal(&queue_cond);
+        mutex_unlock(&queue_lock);
+        sem_post(&items);
+    }
+    return 0;
+}
+
+static clock_t producer_consumer() {
+    sem_init(&items, 0);
+    queue_size    = 0;
+    clock_t start = clock();
+    int     tid   = thread_create(producer, NULL);
+    for (int i = 0; i < NR_ITEMS; ++i) {
+        sem_wait(&items);
+        mutex_lock(&queue_lock);
+        while (queue_size == 0) { cond_wait(&queue_cond, &queue_lock); }
+        --queue_size;
+        mutex_unlock(&queue_lock);
+    }
+    thread_join(tid, NULL);
+    return clock() - start;
+}
+
+int main(int argc, char *argv[]) {
+    report("krnlobj", NR_ROUNDS, uncontended_krnlobj(NR_ROUNDS));
+    report("mutex", NR_ROUNDS, uncontended_mutex(NR_ROUNDS));
+    report("mutex x4", NR_ROUNDS, contended_mutex(NR_ROUNDS));
+    report("sem+cond", NR_ITEMS, producer_consumer());
+    return 0;
+}
@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+#define NR_ROUNDS  64
+#define HEAP_BYTES (4 * 1024 * 1024)
+
+static int worker(void *arg) {
+    return (int)arg;
+}
+
+static clock_t fork_rounds(int rounds) {
+    clock_t start = clock();
+    for (int i = 0; i < rounds; ++i) {
+        int pid = fork();
+        if (pid == 0) { exit(worker((void *)i)); }
+        wait(NULL);
+    }
+    return clock() - start;
+}
+
+static clock_t thread_rounds(int rounds) {
+    clock_t start = clock();
+    for (int i = 0; i < rounds; ++i) {
+        int tid    = thread_create(worker, (void *)i);
+        int retval = -1;
+        thread_join(tid, &retval);
+        if (retval != i) { printf("thread %d: bad retval %d\n", tid, retval); }
+    }
+    return clock() - start;
+}
+
+static void report(const char *name, int rounds, clock_t elapsed) {
+    int total_us = max(elapsed, 1) * 1000;
+    printf(
+        "%s: %d spawns in %d ms, %d.%03d us/spawn\n",
+        name,
+        rounds,
+        elapsed,
+        total_us / rounds,
+        total_us % rounds * 1000 / rounds);
+}
+
+int main(int argc, char *argv[]) {
+    //! touch some heap so that fork has a real address space to clone
+    char *heap = malloc(HEAP_BYTES);
+    memset(heap, 0, HEAP_BYTES);
+    report("fork+wait", NR_ROUNDS, fork_rounds(NR_ROUNDS));
+    report("thread+join", NR_ROUNDS, thread_rounds(NR_ROUNDS));
+    free(heap);
+    return 0;
+}
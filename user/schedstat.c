@@ -0,0 +1,59 @@
+#include <sys/sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+static void usage() {
+    printf("usage: schedstat [-pin <pid> <cpu>]\n");
+}
+
+static bool parse_int(const char *s, int *value) {
+    int sign = 1;
+    if (*s == '-') {
+        sign = -1;
+        ++s;
+    }
+    if (*s == '\0') { return false; }
+    int result = 0;
+    for (; *s != '\0'; ++s) {
+        if (!isdigit(*s)) { return false; }
+        result = result * 10 + (*s - '0');
+    }
+    *value = sign * result;
+    return true;
+}
+
+static void report() {
+    sched_stat_t stat;
+    for (int cpu = 0; sched_getstat(cpu, &stat) == 0; ++cpu) {
+        printf(
+            "cpu%d: %s, %d ready, %d switches, %d migrations, %d steals\n",
+            cpu,
+            stat.active ? "active" : "parked",
+            stat.nr_ready,
+            stat.nr_switches,
+            stat.nr_migrations,
+            stat.nr_steals);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 4 && strcmp(argv[1], "-pin") == 0) {
+        int pid = 0;
+        int cpu = 0;
+        if (!parse_int(argv[2], &pid) || !parse_int(argv[3], &cpu)) {
+            usage();
+            return 1;
+        }
+        if (sched_setaffinity(pid, cpu) != 0) {
+            printf("schedstat: failed to pin %d to cpu%d\n", pid, cpu);
+            return 1;
+        }
+    } else if (argc != 1) {
+        usage();
+        return 1;
+    }
+    report();
+    return 0;
+}
@@ -13,16 +13,6 @@ const int screen_lock_uid = 0xcafebabe;
         }                                                        \
     } while (0)
 
-#define begin_exclusive_screen()                                 \
-    do {                                                         \
-        if (krnlobj_lookup(screen_lock_uid) != INVALID_HANDLE) { \
-            krnlobj_lock(screen_lock_uid);                       \
-        }                                                        \
-    } while (0)
-
-#define end_exclusive_screen()                                   \
-    do {                                                         \
-        if (krnlobj_lookup(screen_lock_uid) != INVALID_HANDLE) { \
-            krnlobj_unlock(screen_lock_uid);                     \
-        }                                                        \
-    } while (0)
+//! NOTE: lock & unlock are no-op if the screen lock is not created
+#define begin_exclusive_screen() krnlobj_lock(screen_lock_uid)
+#define end_exclusive_screen()   krnlobj_unlock(screen_lock_uid)
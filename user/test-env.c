@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+
+//! NOTE: the env page is shared copy-on-write after fork, an update in the
+//! child must never show through in the parent
+
+static bool env_equal(char *const *envp, char *const *expected) {
+    while (*expected != NULL) {
+        if (*envp == NULL || strcmp(*envp, *expected) != 0) { return false; }
+        ++envp;
+        ++expected;
+    }
+    return *envp == NULL;
+}
+
+static bool check_env(char *const *expected) {
+    char *const *envp = getenv();
+    if (envp == NULL) { return false; }
+    bool ok = env_equal(envp, expected);
+    free((void *)envp);
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    char *const parent_env[3] = {"WHO=parent", "ANSWER=42", NULL};
+    char *const child_env[2]  = {"WHO=child-with-a-longer-value", NULL};
+
+    if (!putenv(parent_env) || !check_env(parent_env)) {
+        printf("test-env: failed to set up the parent env\n");
+        return 1;
+    }
+
+    int pid = fork();
+    if (pid == 0) {
+        bool ok = putenv(child_env) && check_env(child_env);
+        exit(ok ? 0 : 1);
+    }
+    if (pid < 0) {
+        printf("test-env: fork failed\n");
+        return 1;
+    }
+
+    int status = -1;
+    wait(&status);
+    if (status != 0) {
+        printf("test-env: child failed to update its env\n");
+        return 1;
+    }
+    if (!check_env(parent_env)) {
+        printf("test-env: parent env changed by the child\n");
+        return 1;
+    }
+
+    printf("test-env: passed\n");
+    return 0;
+}